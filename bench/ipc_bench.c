@@ -0,0 +1,667 @@
+/**
+ * @file ipc_bench.c
+ *
+ * @brief Multi-process benchmark driver for the IPC appender.
+ *
+ * Forks N producer processes with M threads each. Every thread logs a fixed
+ * number of messages through an IPC appender category and measures how long
+ * each call takes, i.e. the cost of appender_ipc_append() as seen by the
+ * application. Every message carries its CLOCK_MONOTONIC send time, and the
+ * driver itself tails the output file to measure enqueue-to-disk latency.
+ *
+ * Latencies are collected in log-linear histograms (32 sub-buckets per power
+ * of two, i.e. ~3% resolution) in shared memory, so no sample is lost and the
+ * producers never contend on them while logging.
+ *
+ * Usage: ipc_bench [-p procs] [-t threads] [-n messages] [-s size|min:max]
+ *                  [-o options] [-l layout] [-d dir] [-N name] [-c] [-v]
+ *
+ *  -p  producer processes (1)
+ *  -t  threads per process (1)
+ *  -n  messages per thread (100000)
+ *  -s  message size in bytes, or a min:max range for variable sizes (64)
+ *  -o  appender options, e.g. "transport=shm,queue_depth=10" (none)
+ *  -l  layout of the output file (basic)
+ *  -d  directory of the output file (/tmp)
+ *  -N  appender name, also names the output file (ipcbench)
+ *  -c  print one CSV line instead of the report (see -H for the header)
+ *  -v  keep the appender's stderr output
+ *
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <log4c.h>
+
+#include "log4c_appender_ipc.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define HIST_SUB_BITS   5
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS    (64 * HIST_SUB)
+
+static const size_t MAX_MESSAGE_SIZE = 64 * 1024;
+static const int TAIL_IDLE_TIMEOUT_MS = 5000;   // give up on lines that never come
+static const useconds_t TAIL_POLL_US  = 100;
+
+static const char* const CSV_HEADER =
+    "procs,threads,messages,min_size,max_size,options,"
+    "msgs_per_s,bytes_per_s,append_p50_ns,append_p99_ns,append_p999_ns,append_max_ns,"
+    "e2e_p50_us,e2e_p99_us,e2e_p999_us,e2e_max_us,lines_lost";
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __bench_hist
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+typedef struct __bench_hist bench_hist_t;
+
+struct __bench_conf
+{
+    int procs;
+    int threads;
+    long messages;          // per thread
+    size_t minSize;
+    size_t maxSize;
+    const char* options;
+    const char* layout;
+    const char* dir;
+    const char* name;
+    int bCsv;
+    int bVerbose;
+};
+
+typedef struct __bench_conf bench_conf_t;
+
+// shared by the driver and all producers
+struct __bench_shared
+{
+    atomic_int ready;                   // threads waiting for the start signal
+    atomic_int go;
+    atomic_ullong startNs;              // first message sent
+    atomic_ullong endNs;                // last message sent
+    atomic_ullong bytes;
+    pthread_mutex_t histLock;           // process-shared
+    bench_hist_t append;
+};
+
+typedef struct __bench_shared bench_shared_t;
+
+struct __bench_thread
+{
+    const bench_conf_t* conf;
+    bench_shared_t* shared;
+    log4c_category_t* category;
+    int proc;
+    int thread;
+};
+
+typedef struct __bench_thread bench_thread_t;
+
+struct __bench_reaper
+{
+    int procs;
+    int failed;             // producers that didn't exit cleanly
+    atomic_int* bFinished;
+};
+
+typedef struct __bench_reaper bench_reaper_t;
+
+/*******************************************************************************
+ * @brief Tokenizer the appender expects from the application
+ * @param str - string to split in place
+ * @param delim - delimiter characters
+ * @param tokens - [out]
+ * @param num - [in] capacity of tokens, [out] number of tokens found
+ * @return number of tokens found
+ */
+int split_tokens(char* str, const char* delim, char** tokens, int* num)
+{
+    int capacity = *num;
+    char* savePtr = NULL;
+
+    *num = 0;
+
+    for (char* token = strtok_r(str, delim, &savePtr);
+         token != NULL && *num < capacity;
+         token = strtok_r(NULL, delim, &savePtr))
+    {
+        tokens[(*num)++] = token;
+    }
+
+    return *num;
+}
+
+/*******************************************************************************
+ * @brief CLOCK_MONOTONIC time, the same for all processes
+ * @return nanoseconds
+ */
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*******************************************************************************
+ * @brief Histogram bucket of a value
+ * @param value
+ * @return bucket index
+ */
+static int hist_bucket(uint64_t value)
+{
+    if (value < HIST_SUB)
+    {
+        return (int)value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS;
+
+    return (shift + 1) * HIST_SUB + (int)((value >> shift) - HIST_SUB);
+}
+
+/*******************************************************************************
+ * @brief Lowest value falling into a bucket
+ * @param bucket
+ * @return value
+ */
+static uint64_t hist_value(int bucket)
+{
+    if (bucket < HIST_SUB)
+    {
+        return bucket;
+    }
+
+    int shift = bucket / HIST_SUB - 1;
+
+    return (uint64_t)(bucket % HIST_SUB + HIST_SUB) << shift;
+}
+
+static void hist_add(bench_hist_t* hist, uint64_t value)
+{
+    hist->counts[hist_bucket(value)]++;
+    hist->total++;
+
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+}
+
+static void hist_merge(bench_hist_t* into, const bench_hist_t* from)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        into->counts[i] += from->counts[i];
+    }
+
+    into->total += from->total;
+
+    if (from->max > into->max)
+    {
+        into->max = from->max;
+    }
+}
+
+/*******************************************************************************
+ * @brief Value below which the given fraction of samples falls
+ * @param hist
+ * @param fraction - e.g. 0.99
+ * @return value, 0 if there are no samples
+ */
+static uint64_t hist_percentile(const bench_hist_t* hist, double fraction)
+{
+    uint64_t rank = (uint64_t)(fraction * hist->total);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += hist->counts[i];
+
+        if (seen > rank)
+        {
+            return hist_value(i);
+        }
+    }
+
+    return hist->max;
+}
+
+/*******************************************************************************
+ * @brief Producer thread: log, measuring every call
+ * @param param - bench_thread_t
+ * @return NULL
+ */
+static void* producer(void* param)
+{
+    bench_thread_t* self = (bench_thread_t*) param;
+    const bench_conf_t* conf = self->conf;
+    bench_shared_t* shared = self->shared;
+
+    bench_hist_t* hist = (bench_hist_t*) calloc(1, sizeof(bench_hist_t));
+    char* payload = (char*) malloc(conf->maxSize + 1);
+
+    if (NULL == hist || NULL == payload)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    memset(payload, 'x', conf->maxSize);
+    payload[conf->maxSize] = '\0';
+
+    unsigned seed = (unsigned)(self->proc * 7919 + self->thread);
+    uint64_t bytes = 0;
+
+    atomic_fetch_add(&shared->ready, 1);
+
+    while (!atomic_load(&shared->go))
+    {
+        sched_yield();
+    }
+
+    uint64_t start = now_ns();
+    uint64_t expected = 0;
+
+    // first message of the run
+    atomic_compare_exchange_strong(&shared->startNs, &expected, start);
+
+    for (long i = 0; i < conf->messages; i++)
+    {
+        size_t size = conf->minSize;
+
+        if (conf->maxSize > conf->minSize)
+        {
+            size += rand_r(&seed) % (conf->maxSize - conf->minSize + 1);
+        }
+
+        // "@<send time> <padding>", the driver parses the time back
+        char stamp[32];
+        uint64_t before = now_ns();
+        int prefix = snprintf(stamp, sizeof(stamp), "@%llu ", (unsigned long long)before);
+        int pad = size > (size_t)prefix ? (int)(size - prefix) : 0;
+
+        log4c_category_log(self->category, LOG4C_PRIORITY_INFO, "%s%.*s", stamp, pad, payload);
+
+        hist_add(hist, now_ns() - before);
+        bytes += prefix + pad;
+    }
+
+    uint64_t end = now_ns();
+    uint64_t last = atomic_load(&shared->endNs);
+
+    while (end > last && !atomic_compare_exchange_weak(&shared->endNs, &last, end))
+    {
+    }
+
+    atomic_fetch_add(&shared->bytes, bytes);
+
+    pthread_mutex_lock(&shared->histLock);
+    hist_merge(&shared->append, hist);
+    pthread_mutex_unlock(&shared->histLock);
+
+    free(payload);
+    free(hist);
+
+    return NULL;
+}
+
+/*******************************************************************************
+ * @brief Producer process
+ * @param conf
+ * @param shared
+ * @param proc - index of the process
+ * @return exit code
+ */
+static int producer_process(const bench_conf_t* conf, bench_shared_t* shared, int proc)
+{
+    if (!conf->bVerbose && NULL == freopen("/dev/null", "w", stderr))
+    {
+        return 1;
+    }
+
+    char appenderName[1024];
+    snprintf(appenderName, sizeof(appenderName), "%s;%s;%s.log;%s%s%s",
+             conf->name, conf->dir, conf->name, conf->layout,
+             *conf->options ? ";" : "", conf->options);
+
+    log4c_init();
+    log4c_appender_type_set(&log4c_appender_type_appender_ipc);
+    log4c_layout_type_set(&log4c_layout_type_raw);
+
+    log4c_appender_t* appender = log4c_appender_get(appenderName);
+    log4c_appender_set_type(appender, &log4c_appender_type_appender_ipc);
+
+    log4c_category_t* category = log4c_category_get("bench");
+    log4c_category_set_priority(category, LOG4C_PRIORITY_TRACE);
+    log4c_category_set_appender(category, appender);
+
+    // opens the appender (and runs the election) outside of the measurement
+    log4c_category_log(category, LOG4C_PRIORITY_INFO, "warmup");
+
+    pthread_t* threads = (pthread_t*) calloc(conf->threads, sizeof(pthread_t));
+    bench_thread_t* params = (bench_thread_t*) calloc(conf->threads, sizeof(bench_thread_t));
+
+    for (int i = 0; i < conf->threads; i++)
+    {
+        params[i].conf     = conf;
+        params[i].shared   = shared;
+        params[i].category = category;
+        params[i].proc     = proc;
+        params[i].thread   = i;
+
+        if (0 != pthread_create(&threads[i], NULL, producer, &params[i]))
+        {
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < conf->threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    log4c_fini();
+
+    free(params);
+    free(threads);
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Follow the output file and measure enqueue-to-disk latency
+ *
+ * Lines are seen once the pump has written them, so this is the latency up
+ * to the page cache; polling adds up to TAIL_POLL_US to every sample.
+ *
+ * @param path - output file
+ * @param expected - number of benchmark lines to wait for
+ * @param hist - [out] latencies in microseconds
+ * @param bFinished - set once all producers have exited
+ * @return number of benchmark lines seen
+ */
+static long tail_output(const char* path, long expected, bench_hist_t* hist, atomic_int* bFinished)
+{
+    size_t size = 2 * MAX_MESSAGE_SIZE;
+    char* buffer = (char*) malloc(size);
+    size_t used = 0;
+    long seen = 0;
+    int fd = -1;
+    uint64_t idleSince = now_ns();
+
+    while (seen < expected)
+    {
+        if (-1 == fd)
+        {
+            fd = open(path, O_RDONLY);
+        }
+
+        ssize_t bytes = (-1 == fd) ? 0 : read(fd, buffer + used, size - used - 1);
+
+        if (bytes <= 0)
+        {
+            if (atomic_load(bFinished) && now_ns() - idleSince > TAIL_IDLE_TIMEOUT_MS * 1000000ULL)
+            {
+                break;
+            }
+
+            usleep(TAIL_POLL_US);
+            continue;
+        }
+
+        uint64_t now = now_ns();
+        idleSince = now;
+        used += bytes;
+        buffer[used] = '\0';
+
+        char* line = buffer;
+        char* eol;
+
+        while (NULL != (eol = memchr(line, '\n', buffer + used - line)))
+        {
+            char* mark = memchr(line, '@', eol - line);
+
+            if (mark)
+            {
+                uint64_t sent = strtoull(mark + 1, NULL, 10);
+
+                hist_add(hist, now > sent ? (now - sent) / 1000 : 0);
+                seen++;
+            }
+
+            line = eol + 1;
+        }
+
+        // keep the incomplete line
+        used = buffer + used - line;
+        memmove(buffer, line, used);
+
+        if (used == size - 1)
+        {
+            used = 0;   // not a benchmark line
+        }
+    }
+
+    if (-1 != fd)
+    {
+        close(fd);
+    }
+
+    free(buffer);
+
+    return seen;
+}
+
+/*******************************************************************************
+ * @brief Wait for all producers to exit
+ * @param param - bench_reaper_t
+ * @return NULL
+ */
+static void* reap_producers(void* param)
+{
+    bench_reaper_t* reaper = (bench_reaper_t*) param;
+    int status;
+
+    for (int i = 0; i < reaper->procs; i++)
+    {
+        if (-1 != wait(&status) && (!WIFEXITED(status) || 0 != WEXITSTATUS(status)))
+        {
+            reaper->failed++;
+        }
+    }
+
+    atomic_store(reaper->bFinished, 1);
+
+    return NULL;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-p procs] [-t threads] [-n messages] [-s size|min:max]\n"
+            "          [-o options] [-l layout] [-d dir] [-N name] [-c] [-H] [-v]\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+    bench_conf_t conf;
+    conf.procs    = 1;
+    conf.threads  = 1;
+    conf.messages = 100000;
+    conf.minSize  = 64;
+    conf.maxSize  = 64;
+    conf.options  = "";
+    conf.layout   = "basic";
+    conf.dir      = "/tmp";
+    conf.name     = "ipcbench";
+    conf.bCsv     = 0;
+    conf.bVerbose = 0;
+
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "p:t:n:s:o:l:d:N:cHvh")))
+    {
+        switch (opt)
+        {
+        case 'p': conf.procs    = atoi(optarg); break;
+        case 't': conf.threads  = atoi(optarg); break;
+        case 'n': conf.messages = atol(optarg); break;
+        case 'o': conf.options  = optarg;       break;
+        case 'l': conf.layout   = optarg;       break;
+        case 'd': conf.dir      = optarg;       break;
+        case 'N': conf.name     = optarg;       break;
+        case 'c': conf.bCsv     = 1;            break;
+        case 'v': conf.bVerbose = 1;            break;
+        case 'H': printf("%s\n", CSV_HEADER);   return 0;
+
+        case 's':
+        {
+            char* colon = strchr(optarg, ':');
+            conf.minSize = strtoul(optarg, NULL, 10);
+            conf.maxSize = colon ? strtoul(colon + 1, NULL, 10) : conf.minSize;
+            break;
+        }
+
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // the prefix alone takes up to 22 bytes
+    if (conf.procs <= 0 || conf.threads <= 0 || conf.messages <= 0
+        || conf.minSize < 24 || conf.maxSize < conf.minSize || conf.maxSize > MAX_MESSAGE_SIZE)
+    {
+        usage(argv[0]);
+        fprintf(stderr, "sizes must be within 24..%zu\n", MAX_MESSAGE_SIZE);
+        return 1;
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.log", conf.dir, conf.name);
+    unlink(path);
+
+    bench_shared_t* shared = (bench_shared_t*) mmap(NULL, sizeof(bench_shared_t), PROT_READ | PROT_WRITE,
+                                                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == shared)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shared->histLock, &attr);
+
+    for (int i = 0; i < conf.procs; i++)
+    {
+        pid_t pid = fork();
+
+        if (0 == pid)
+        {
+            _exit(producer_process(&conf, shared, i));
+        }
+
+        if (-1 == pid)
+        {
+            perror("fork");
+            return 1;
+        }
+    }
+
+    // reap the producers from a thread so tailing starts right away
+    atomic_int bFinished = 0;
+    bench_reaper_t reaper = { conf.procs, 0, &bFinished };
+    pthread_t reaperThread;
+
+    if (0 != pthread_create(&reaperThread, NULL, reap_producers, &reaper))
+    {
+        perror("pthread_create");
+        return 1;
+    }
+
+    // everybody is set up, start at once
+    while (atomic_load(&shared->ready) < conf.procs * conf.threads && !atomic_load(&bFinished))
+    {
+        usleep(1000);
+    }
+
+    atomic_store(&shared->go, 1);
+
+    // the driver follows the file while the producers run
+    bench_hist_t* e2e = (bench_hist_t*) calloc(1, sizeof(bench_hist_t));
+    long expected = (long)conf.procs * conf.threads * conf.messages;
+    long seen = 0;
+
+    seen = tail_output(path, expected, e2e, &bFinished);
+
+    pthread_join(reaperThread, NULL);
+
+    uint64_t elapsedNs = shared->endNs - shared->startNs;
+    double seconds = elapsedNs / 1e9;
+    double msgsPerS = seconds > 0 ? expected / seconds : 0;
+    double bytesPerS = seconds > 0 ? shared->bytes / seconds : 0;
+    bench_hist_t* append = &shared->append;
+
+    if (conf.bCsv)
+    {
+        printf("%d,%d,%ld,%zu,%zu,\"%s\",%.0f,%.0f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%ld\n",
+               conf.procs, conf.threads, conf.messages, conf.minSize, conf.maxSize, conf.options,
+               msgsPerS, bytesPerS,
+               (unsigned long long) hist_percentile(append, 0.50),
+               (unsigned long long) hist_percentile(append, 0.99),
+               (unsigned long long) hist_percentile(append, 0.999),
+               (unsigned long long) append->max,
+               (unsigned long long) hist_percentile(e2e, 0.50),
+               (unsigned long long) hist_percentile(e2e, 0.99),
+               (unsigned long long) hist_percentile(e2e, 0.999),
+               (unsigned long long) e2e->max,
+               expected - seen);
+    }
+    else
+    {
+        printf("producers:   %d processes x %d threads, %ld messages each, %zu..%zu bytes\n",
+               conf.procs, conf.threads, conf.messages, conf.minSize, conf.maxSize);
+        printf("options:     %s\n", *conf.options ? conf.options : "(defaults)");
+        printf("throughput:  %.0f msgs/s, %.1f MB/s over %.3f s\n", msgsPerS, bytesPerS / (1 << 20), seconds);
+        printf("append:      p50 %llu ns, p99 %llu ns, p999 %llu ns, max %llu ns\n",
+               (unsigned long long) hist_percentile(append, 0.50),
+               (unsigned long long) hist_percentile(append, 0.99),
+               (unsigned long long) hist_percentile(append, 0.999),
+               (unsigned long long) append->max);
+        printf("to disk:     p50 %llu us, p99 %llu us, p999 %llu us, max %llu us\n",
+               (unsigned long long) hist_percentile(e2e, 0.50),
+               (unsigned long long) hist_percentile(e2e, 0.99),
+               (unsigned long long) hist_percentile(e2e, 0.999),
+               (unsigned long long) e2e->max);
+        printf("lines:       %ld of %ld written\n", seen, expected);
+    }
+
+    free(e2e);
+    munmap(shared, sizeof(bench_shared_t));
+
+    return (reaper.failed > 0 || seen < expected) ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Sweep producer count, message size and queue depth, one CSV line per run.
+#
+# usage: sweep.sh [path/to/ipc_bench] [extra appender options]
+#
+# Environment: PROCS, SIZES, DEPTHS, THREADS and MESSAGES override the grids,
+# e.g. PROCS="1 8" SIZES="64 32:1024" DEPTHS="10" ./sweep.sh
+#
+# Queue depths above fs.mqueue.msg_max (10 by default) need CAP_SYS_RESOURCE
+# or a raised limit: sysctl fs.mqueue.msg_max=1024
+
+BENCH=${1:-./ipc_bench}
+EXTRA=${2:+,$2}
+
+PROCS=${PROCS:-"1 2 4 8"}
+SIZES=${SIZES:-"64 256 900 32:900"}
+DEPTHS=${DEPTHS:-"10"}
+THREADS=${THREADS:-1}
+MESSAGES=${MESSAGES:-20000}
+
+"$BENCH" -H
+
+for depth in $DEPTHS; do
+    for procs in $PROCS; do
+        for size in $SIZES; do
+            "$BENCH" -c -p "$procs" -t "$THREADS" -n "$MESSAGES" -s "$size" \
+                     -o "queue_depth=$depth$EXTRA" || echo "# failed: procs=$procs size=$size depth=$depth" >&2
+        done
+    done
+done
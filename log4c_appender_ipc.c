@@ -1,55 +1,535 @@
 #include <fcntl.h>
-#include <semaphore.h>
 #include <errno.h>
 #include <unistd.h>
+#include <signal.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
 #include <time.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <mqueue.h>
 #include <log4c/appender.h>
 #include <log4c/category.h>
+#include <log4c/layout.h>
+#include <log4c/priority.h>
 #include "log4c/appender_type_stream2.h"
-#include <log4c/rollingpolicy.h>
 
 #include "log4c_appender_ipc.h"
+#include "log4c_appender_ipc_ring.h"
+#include "log4c_appender_ipc_binlog.h"
+#include "log4c_appender_ipc_filter.h"
+#include "log4c_appender_ipc_fmt.h"
+#include "log4c_appender_ipc_gzip.h"
+#include "log4c_appender_ipc_lease.h"
+#include "log4c_appender_ipc_loop.h"
+#include "log4c_appender_ipc_reasm.h"
+#include "log4c_appender_ipc_roll.h"
+#include "log4c_appender_ipc_segment.h"
+#include "log4c_appender_ipc_sink.h"
+#include "log4c_appender_ipc_sock.h"
+#include "log4c_appender_ipc_spill.h"
+#include "log4c_appender_ipc_stats.h"
+#include "log4c_appender_ipc_trace.h"
+#include "log4c_appender_ipc_writer.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // CONSTANTS
-const int PING_PONG_TIMEOUT_S   = 1;
-const int THREAD_SLACKNESS_MS   = 100;
-const int SEM_GUARD_TIMEOUT_S   = 4;
+const int MASTER_STARTUP_TIMEOUT_MS = 4000;
+const int MAX_ELECTION_ROUNDS   = 3;
 const int MAX_MSG_SIZE          = 1024;
+const int PUMP_IDLE_WAIT_MS     = 100;
+const int DEFAULT_QUEUE_DEPTH   = 10;       // fs.mqueue.msg_max of unprivileged processes
+const size_t DEFAULT_RING_SIZE  = 1024 * 1024;
+const size_t RING_SIZE_MIN      = 64 * 1024;        // of the ring and of a spill journal
+const size_t RING_SIZE_MAX      = 1024 * 1024 * 1024;
+const int DEFAULT_BATCH_SIZE    = 256;
+const int DEFAULT_LINGER_MS     = 0;
+const int MAX_IOV_PER_WRITE     = 1024;     // IOV_MAX on Linux
+const int DEFAULT_COALESCE_MS   = 0;        // coalescing is off by default
+const size_t MAX_RING_FRAME     = 4096;
+const size_t MAX_SOCKET_MESSAGE = 4096;     // larger messages are fragmented
+const size_t DEFAULT_SOCKET_BUFFER = 1024 * 1024;
+const int SOCKET_RETRY_MS       = 100;      // between attempts to connect while no master listens
+#define FRAGMENTS_PER_SEND  16                  // fragments of a message handed over at once
+const size_t DEFAULT_MAX_MESSAGE = 64 * 1024;  // larger records are truncated
+const size_t REASSEMBLY_MEMORY  = 4 * 1024 * 1024;  // master's buffers for fragmented messages
+const size_t EVENT_TEXT_SIZE    = 64 * 1024;    // formatted lines per batch, grows on demand
+const size_t EVENT_FORMAT_SLACK = 512;      // room for the layout's own decoration
+const size_t DEFERRED_MSG_SIZE  = 16 * 1024;    // max message rendered from a deferred record
+const int MAX_KNOWN_FORMATS     = 16384;    // master forgets formats of dead processes beyond this
+#define FORMAT_CACHE_SIZE   1024            // formats a process can log with deferred rendering
+#define KNOWN_FORMAT_BUCKETS 1024
+const int DEFAULT_SEND_TIMEOUT_MS = 100;
+const int DEFAULT_DROP_REPORT_S = 10;
+const int MAX_EVICTIONS_PER_SEND = 4;
+#define EVICT_MAX_HELD      4               // more urgent messages set aside to reach an older one
+const int SHED_RING_PERCENT     = 75;       // ring fill above which the low lane is shed
+const int MAX_SHARDS            = 64;
+const size_t DEFAULT_WRITE_BUFFER = 1024 * 1024;
+const int WRITE_BUFFERS         = 4;        // buffers of the asynchronous writer in flight at once
+const size_t DEFAULT_SEGMENT_SIZE = 64 * 1024 * 1024;
+const int DEFAULT_GZIP_LEVEL    = 6;
+const size_t DEFAULT_GZIP_FRAME = 1024 * 1024;  // bytes of text per independent gzip member
+const int DEFAULT_GZIP_FLUSH_MS = 1000;
+const size_t DEFAULT_INDEX_INTERVAL = 64 * 1024;   // bytes of binary records per index entry
+const int MAX_ROLL_SUFFIX       = 1000;     // files rolled within the same second
+const int DEFAULT_FSYNC_MS      = 1000;
+const int DEFAULT_SYNC_TIMEOUT_MS = 5000;  // above the default fsync_ms
+const long SYNC_RETRY_NS        = 1000000;  // retry of a sync request on a full non-blocking queue
+const size_t DEFAULT_SPILL_SIZE = 16 * 1024 * 1024;
+const int SPILL_SCAN_MS         = 200;      // how often the master looks for new spill journals
+const int SPILL_HOLD_MS         = 500;      // max time spilled messages wait for an idle transport
+const int SPILL_BATCHES_PER_CALL = 4;       // merging yields to the transport after this many
+const size_t DEFAULT_SINK_BUFFER = 4 * 1024 * 1024;
+const int SINK_CLOSE_TIMEOUT_MS = 2000;    // a stalled sink is left behind after this
 
-const char* const GUARD_SUFFIX   = "guard";
+#define MAX_DROP_SOURCES 64
+#define MAX_GONE_PIDS 64                    // processes whose formats wait to be forgotten
+#define MAX_SINKS IPC_STATS_MAX_SINKS       // each has its counters in the statistics
+#define SOCKET_RECEIVE_MAX 64               // messages taken from the socket per call
+#define MAX_SYNC_TICKETS 64                 // sync requests acknowledged at once, as many as the lease holds
+#define DROPS_CATEGORY "appender_ipc"       // source of the drop markers
 
-// control flow message to check availability of master instance appender
-const char* const PING_MESSAGE  = "ASJ#HAP@WSOEI&FUH3%WR098UW3F$A38SR!FUG[I%DPHWO=ISHD1GO5D|7FO9IS454HF[A254HFY[8WEA";
-const char* const PONG_MESSAGE  = "ZvgPJ18ggAeqcb3DwZ3LU4Yu0LNciWpDXqgijAGp3S07F82C9Zgfss0CgYEVsXOHG40O2037ih2U8y9Vg";
+const char* const OPTIONS_DELIM  = ",";
 
-// <name>;<path>;<base_filename>;<layout>
-static const int NUM_OF_NAME_TOKENS = 4;
+// <name>;<path>;<base_filename>;<layout>[;<options>]
+// where options are comma separated "key=value" pairs, e.g. "transport=shm"
+static const int NUM_OF_NAME_TOKENS     = 4;
+static const int MAX_NUM_OF_NAME_TOKENS = 5;
 
-#define LOG(FMT, ...) do { \
-    fprintf(stderr, "[%d] %s (%d): ", getpid(), __PRETTY_FUNCTION__, __LINE__); \
-    fprintf(stderr, FMT, ##__VA_ARGS__); \
-    fprintf(stderr, "\n"); \
-}while(0)
-#define ERROR_LOG(FMT, ...)    LOG(FMT, ##__VA_ARGS__)
-#define INFO_LOG(FMT, ...)     LOG(FMT, ##__VA_ARGS__)
+// see log4c_appender_ipc_trace.h; DEBUG_LOG is for the hot path only
+#define ERROR_LOG(FMT, ...)    IPC_TRACE_ERROR_LOG(FMT, ##__VA_ARGS__)
+#define INFO_LOG(FMT, ...)     IPC_TRACE_INFO_LOG(FMT, ##__VA_ARGS__)
+#define DEBUG_LOG(FMT, ...)    IPC_TRACE_DEBUG_LOG(FMT, ##__VA_ARGS__)
 
 ////////////////////////////////////////////////////////////////////////////////
 // DATA TYPES
+enum __appender_ipc_transport
+{
+    IPC_TRANSPORT_MQUEUE = 0,   // one mq_send per message, always available
+    IPC_TRANSPORT_SHM,          // shared-memory ring created by the master
+    IPC_TRANSPORT_SOCKET,       // Unix-domain socket of the master, see log4c_appender_ipc_sock.h
+};
+
+typedef enum __appender_ipc_transport appender_ipc_transport_t;
+
+// who drains the message queue of a master
+enum __appender_ipc_pump
+{
+    IPC_PUMP_SHARED = 0,        // the epoll loop shared by all masters of the process
+    IPC_PUMP_THREAD,            // a thread of its own; always so for the ring and the socket
+};
+
+typedef enum __appender_ipc_pump appender_ipc_pump_t;
+
+// how records are spread over the shards
+enum __appender_ipc_shard_by
+{
+    IPC_SHARD_BY_CATEGORY = 0,  // lines of a category stay in one file, in order
+    IPC_SHARD_BY_PID,           // lines of a process stay in one file, in order
+};
+
+typedef enum __appender_ipc_shard_by appender_ipc_shard_by_t;
+
+// how the master writes the file
+enum __appender_ipc_output
+{
+    IPC_OUTPUT_STREAM = 0,      // writev() from the pump thread
+    IPC_OUTPUT_URING,           // asynchronous writer with io_uring, or a thread if unavailable
+    IPC_OUTPUT_THREAD,          // asynchronous writer with a thread
+    IPC_OUTPUT_MMAP,            // memcpy() into preallocated mapped segments
+    IPC_OUTPUT_GZIP,            // compressed by a thread, in independent gzip frames
+};
+
+typedef enum __appender_ipc_output appender_ipc_output_t;
+
+// what the master writes to the file
+enum __appender_ipc_file_format
+{
+    IPC_FILE_TEXT = 0,          // lines
+    IPC_FILE_BINARY,            // records with a sparse index, see log4c_appender_ipc_binlog.h
+};
+
+typedef enum __appender_ipc_file_format appender_ipc_file_format_t;
+
+// when the master flushes the file to the disk
+enum __appender_ipc_durability
+{
+    IPC_DURABILITY_NONE = 0,    // whenever the kernel writes it back
+    IPC_DURABILITY_PERIODIC,    // fdatasync() every fsync_ms; sync requests wait for the next one
+    IPC_DURABILITY_GROUP,       // one fdatasync() for all sync requests pending after a batch
+};
+
+typedef enum __appender_ipc_durability appender_ipc_durability_t;
+
+// what appending does when the transport is full
+enum __appender_ipc_overflow
+{
+    IPC_OVERFLOW_BLOCK = 0,     // wait for room, however long it takes
+    IPC_OVERFLOW_TIMEOUT,       // wait at most send_timeout_ms, then drop
+    IPC_OVERFLOW_DROP_NEWEST,   // drop the message being appended
+    IPC_OVERFLOW_DROP_OLDEST,   // evict the oldest queued message (mqueue only)
+    IPC_OVERFLOW_SPILL,         // append to the spill journal of the process
+};
+
+typedef enum __appender_ipc_overflow appender_ipc_overflow_t;
+
+// what clients ship for every appended event
+enum __appender_ipc_record
+{
+    IPC_RECORD_TEXT = 0,        // message rendered by the client's layout
+    IPC_RECORD_BINARY,          // appender_ipc_event_t, formatted by the master
+};
+
+typedef enum __appender_ipc_record appender_ipc_record_t;
+
+// where duplicates and sources over the rate limit are held back
+enum __appender_ipc_filter_on
+{
+    IPC_FILTER_ON_MASTER = 0,   // as the pump collects binary events
+    IPC_FILTER_ON_CLIENT,       // before sending, saves the transport too
+};
+
+typedef enum __appender_ipc_filter_on appender_ipc_filter_on_t;
+
+// secondary output of the master, see log4c_appender_ipc_sink.h
+struct __appender_ipc_sink_conf
+{
+    ipc_sink_kind_t kind;
+    char target[256];
+};
+
+typedef struct __appender_ipc_sink_conf appender_ipc_sink_conf_t;
+
+// Lanes by severity; the lane is the message queue priority, so the pump
+// takes urgent messages ahead of the backlog of the other lanes
+enum __appender_ipc_lane
+{
+    IPC_LANE_LOW = 0,           // shed first when the transport is overloaded
+    IPC_LANE_NORMAL,
+    IPC_LANE_URGENT,            // skips staging; through the queue in shm mode
+};
+
+typedef enum __appender_ipc_lane appender_ipc_lane_t;
+
+// why the pump thread is asked to stop
+enum __appender_ipc_pump_stop
+{
+    PUMP_RUNNING = 0,
+    PUMP_HAND_OVER,             // another instance takes over what is left
+    PUMP_DRAIN,                 // the last instance: write out everything
+};
+
+// settings parsed from the optional 5th token of the appender name
+struct __appender_ipc_conf
+{
+    appender_ipc_transport_t transport;
+    appender_ipc_pump_t pump;
+    int shards;         // output files, each with its own transport and pump
+    appender_ipc_shard_by_t shardBy;
+    appender_ipc_output_t output;
+    size_t writeBuffer; // bytes per buffer of the asynchronous writer
+    size_t segmentSize; // bytes per mapped segment of the output file
+    int gzipLevel;      // zlib level of writer=gzip
+    size_t gzipFrame;   // bytes of text per frame of writer=gzip
+    int gzipFlushMs;    // max age of a frame of writer=gzip
+    appender_ipc_file_format_t fileFormat;
+    size_t indexInterval;   // bytes of binary records between two index entries
+    unsigned long long rollSize;    // roll the file when it gets this big, 0 for never
+    int rollInterval;   // roll the file every this many seconds of local time, 0 for never
+    int bCompress;      // gzip rolled files
+    appender_ipc_sink_conf_t sinks[MAX_SINKS];
+    int numSinks;
+    size_t sinkBuffer;  // bytes every sink may fall behind by
+    appender_ipc_durability_t durability;
+    int fsyncMs;        // period of durability=periodic
+    int syncPriority;   // appending this severe or more waits until it's durable
+    int syncTimeoutMs;  // max wait of such a record
+    size_t ringSize;
+    size_t socketBuffer;    // bytes a process may have in flight in the socket
+    int queueDepth;     // max messages in the message queue
+    int batchSize;      // max messages written by the pump at once
+    int lingerMs;       // max time the pump waits for a batch to fill up
+    int coalesceMs;     // max time a record waits in the staging buffer
+    appender_ipc_overflow_t overflow;
+    int sendTimeoutMs;
+    size_t spillSize;   // data size of the spill journal of a process
+    int dropReportS;    // how often the master reports dropped messages
+    appender_ipc_record_t record;
+    int minPriority;    // master drops binary events less severe than this
+    ipc_filter_conf_t filter;   // duplicates and rate limits, see log4c_appender_ipc_filter.h
+    appender_ipc_filter_on_t filterOn;
+    int urgentPriority; // this severe or more takes the urgent lane
+    int shedPriority;   // this severe or less takes the low lane
+    size_t maxMessage;  // max transport message after reassembly
+    int traceSignal;    // dumps the trace rings, 0 for none
+};
+
+typedef struct __appender_ipc_conf appender_ipc_conf_t;
+
+// Messages starting with a zero byte are frames built by the appender itself
+// (rendered text never does); anything else is a single rendered message.
+enum __appender_ipc_frame_kind
+{
+    IPC_FRAME_BATCH = 1,    // 'count' records, each prefixed by its length
+    IPC_FRAME_DROPS,        // appender_ipc_drops_t: messages lost by a process
+    IPC_FRAME_EVENTS,       // 'count' binary events, see appender_ipc_event_t
+    IPC_FRAME_FORMAT,       // appender_ipc_format_def_t: format string of deferred records
+    IPC_FRAME_DEFERRED,     // 'count' deferred records, see appender_ipc_deferred_t
+    IPC_FRAME_FRAGMENT,     // appender_ipc_fragment_t: piece of a message too large to send at once
+    IPC_FRAME_SYNC,         // appender_ipc_sync_t: a producer waits for what it sent before to be durable
+};
+
+struct __appender_ipc_frame
+{
+    uint8_t zero;
+    uint8_t kind;
+    uint16_t count;
+};
+
+typedef struct __appender_ipc_frame appender_ipc_frame_t;
+typedef uint16_t appender_ipc_reclen_t;
+
+struct __appender_ipc_drops
+{
+    int32_t pid;
+    uint32_t count;
+};
+
+typedef struct __appender_ipc_drops appender_ipc_drops_t;
+
+// Sync request: the master announces the ticket through the lease once
+// everything received before it is on the disk.
+struct __appender_ipc_sync
+{
+    uint32_t ticket;
+};
+
+typedef struct __appender_ipc_sync appender_ipc_sync_t;
+
+// Fragment header, followed by the next piece of the message. Fragments of a
+// message are sent in order by one thread; 'count' of the frame is the number
+// of records on the first fragment and 0 on the others, so evicting a
+// fragment counts the records once. See log4c_appender_ipc_reasm.h.
+struct __appender_ipc_fragment
+{
+    int32_t pid;
+    int32_t tid;
+    uint32_t msgId;         // per thread
+    uint32_t total;         // length of the whole message
+    uint32_t offset;        // position of this piece
+    uint32_t lane;          // fragments of different lanes interleave
+};
+
+typedef struct __appender_ipc_fragment appender_ipc_fragment_t;
+
+// Binary event record: the header is followed by the NUL-terminated category
+// name and the NUL-terminated message, so the master uses both in place.
+struct __appender_ipc_event
+{
+    uint64_t timestamp;     // microseconds since the epoch
+    int32_t pid;
+    int32_t tid;
+    uint16_t priority;      // LOG4C_PRIORITY_*
+    uint16_t categoryLen;   // including the terminating NUL
+    uint32_t msgLen;        // including the terminating NUL
+};
+
+typedef struct __appender_ipc_event appender_ipc_event_t;
+
+// Deferred record: the header is followed by the NUL-terminated category name
+// and the arguments packed by ipc_fmt_pack() for the format 'formatId'.
+struct __appender_ipc_deferred
+{
+    uint64_t timestamp;     // microseconds since the epoch
+    int32_t pid;
+    int32_t tid;
+    uint16_t priority;
+    uint16_t categoryLen;   // including the terminating NUL
+    uint32_t formatId;
+    uint32_t argsLen;
+};
+
+typedef struct __appender_ipc_deferred appender_ipc_deferred_t;
+
+// Format definition, followed by the NUL-terminated format string. Sent once
+// per format and process, before the first record using it.
+struct __appender_ipc_format_def
+{
+    int32_t pid;
+    uint32_t formatId;
+};
+
+typedef struct __appender_ipc_format_def appender_ipc_format_def_t;
+
+// client side: formats seen by this process, keyed by the format pointer
+struct __appender_ipc_format
+{
+    _Atomic(const char*) format;
+    int numArgs;                        // -1 if the caller has to render it
+    uint8_t types[IPC_FMT_MAX_ARGS];
+    atomic_int definedFor;              // pid the master knows it for
+    atomic_uint definedGen;             // lease generation of that master
+    atomic_uint definedLanes;           // bit per lane the definition was sent in
+};
+
+typedef struct __appender_ipc_format appender_ipc_format_t;
+
+// master side: format strings defined by the clients
+struct __appender_ipc_known_format
+{
+    struct __appender_ipc_known_format* next;
+    int32_t pid;
+    uint32_t formatId;
+    char format[];
+};
+
+typedef struct __appender_ipc_known_format appender_ipc_known_format_t;
+
+// messages drained by the pump thread and not written yet
+struct __appender_ipc_batch
+{
+    struct iovec* iov;
+    int iovCount;
+    int iovCapacity;
+    int count;          // transport messages, each may carry several records
+    int capacity;
+    char* arena;        // storage for messages received from the mqueue or the socket
+    size_t slotSize;    // of every message in the arena
+    char* text;         // lines formatted from binary events
+    size_t textUsed;
+    size_t textCapacity;
+    char* scratch;      // message rendered from a deferred record
+};
+
+typedef struct __appender_ipc_batch appender_ipc_batch_t;
+
+struct __appender_ipc_udata;
+
+// per-thread buffer packing several records into one frame
+struct __appender_ipc_stage
+{
+    pthread_mutex_t lock;
+    struct __appender_ipc_udata* owner;
+    struct __appender_ipc_stage* next;
+    struct timespec firstAt;    // CLOCK_MONOTONIC time of the oldest record
+    uint8_t kind;               // IPC_FRAME_BATCH or IPC_FRAME_EVENTS
+    appender_ipc_lane_t lane;
+    int count;
+    size_t used;
+    size_t capacity;
+    char buffer[];
+};
+
+typedef struct __appender_ipc_stage appender_ipc_stage_t;
+
+// outputs of a rolled file, closed on the roll thread
+struct __appender_ipc_rolled
+{
+    FILE* fp;
+    ipc_writer_t* writer;
+    ipc_segment_t* segment;
+    ipc_gzip_t* gzip;
+};
+
+typedef struct __appender_ipc_rolled appender_ipc_rolled_t;
+
+// spill journal of a process, as seen by the master
+struct __appender_ipc_spill_source
+{
+    struct __appender_ipc_spill_source* next;
+    ipc_spill_t* journal;
+    int bTaken;                 // messages taken into the merge batch
+    char path[];
+};
+
+typedef struct __appender_ipc_spill_source appender_ipc_spill_source_t;
+
 struct __appender_ipc_udata
 {
     pthread_t pumpThread;
+    ipc_loop_source_t* pumpSource;      // the master's queue in the shared loop
+    appender_ipc_batch_t pumpBatch;     // batch lingering between loop calls
+    struct timespec pumpDeadline;
+    int bPumpUrgent;
+    pthread_t watchdogThread;   // clients wait in it to take over
     mqd_t mqueueServer;
     mqd_t mqueueClient;
+    mqd_t mqueueEvict;          // drop-oldest policy steals messages through it
+    ipc_ring_t* ring;
+    ipc_sock_server_t* sockServer;  // master side of the socket, NULL if clients can't connect
+    ipc_sock_t* sock;           // connection of this process, NULL without the socket transport
+    atomic_uint sockEpoch;      // bumped by every attempt to connect
+    atomic_int bSockUp;         // connected to the master of sockGen
+    atomic_llong sockRetryAt;   // CLOCK_MONOTONIC ms of the next attempt while down
+    pid_t sockPid;              // process and master the connection was made for
+    uint32_t sockGen;
+    pthread_mutex_t sockLock;
+    int32_t gonePids[MAX_GONE_PIDS];   // hung up, formats forgotten once the queue is empty
+    int numGonePids;
+    ipc_lease_t* lease;
+    ipc_stats_t* stats;         // NULL if the segment can't be mapped
+    atomic_int pumpStop;        // PUMP_RUNNING or why to stop
+    appender_ipc_conf_t conf;
     log4c_category_t* rollingFileCategory;
     log4c_appender_t* rollingFileAppender;
+    const log4c_layout_t* eventLayout;     // formats binary events on the master
+    int outFd;
+    ipc_writer_t* writer;       // NULL => the pump writes outFd itself
+    ipc_segment_t* segment;     // or copies into the mapped file
+    ipc_gzip_t* gzip;           // or hands the lines over for compressing
+    ipc_binlog_index_t* index;  // of a binary file, NULL if none
+    ipc_sink_t* sinks[MAX_SINKS];   // get a copy of every line, NULL if they can't be set up
+    unsigned long long fileSize;    // bytes in the output file, pump thread only
+    unsigned long long rollFrom;    // fileSize roll_size counts from, moved on by a failed roll
+    time_t rollAt;              // next rolling by time, 0 for none
+    int bRolling;               // uses the roll thread
+    int bDirty;                 // written since the last fdatasync(), pump thread only
+    int bWriteFailed;           // a write failed since the last commit, pump thread only
+    struct timespec nextSync;   // CLOCK_MONOTONIC time of the next periodic fdatasync()
+    uint32_t syncTickets[MAX_SYNC_TICKETS]; // sync tickets received since the last commit
+    int numSyncTickets;
+    int numSyncReady;           // leading tickets everything before which is written
+    pthread_key_t stageKey;
+    pthread_mutex_t stageLock;
+    pthread_cond_t stageCond;
+    appender_ipc_stage_t* stages;
+    pthread_t flushThread;
+    int flushStop;
+    atomic_ulong droppedTotal;
+    atomic_ulong droppedPending;    // not reported to the master yet
+    appender_ipc_drops_t dropSources[MAX_DROP_SOURCES];     // pump thread only
+    struct timespec lastDropReport;
+    appender_ipc_format_t* formats;     // FORMAT_CACHE_SIZE entries
+    pthread_mutex_t formatLock;
+    appender_ipc_known_format_t* knownFormats[KNOWN_FORMAT_BUCKETS];   // pump thread only
+    int numKnownFormats;
+    ipc_reasm_t* reasm;         // pump thread only
+    ipc_filter_t* pumpFilter;   // pump thread only, NULL unless filter_on=master
+    ipc_filter_t* filter;       // of this process, NULL unless filter_on=client
+    _Atomic(ipc_spill_t*) spill;    // journal of this process, NULL until it spills
+    pid_t spillPid;             // process that last opened the journal, under spillLock
+    pthread_mutex_t spillLock;
+    appender_ipc_spill_source_t* spillSources;  // pump thread only
+    appender_ipc_batch_t spillBatch;
+    struct timespec spillScanAt;    // CLOCK_MONOTONIC time of the next scan for journals
     char queueName[256];
-    char queueNameHandShake[256];
+    char leaseName[256];
+    char statsName[256];
+    char ringName[256];
+    char sockName[256];         // the lease generation of the master is appended
+    char baseName[256];         // name of the stream2 appender and category
+    char filePath[512];
+    struct __appender_ipc_udata** shards;  // with shards=N the appender only routes to these
+    int numShards;
 };
 
 typedef struct __appender_ipc_udata appender_ipc_udata_t;
@@ -57,433 +537,6610 @@ typedef struct __appender_ipc_udata appender_ipc_udata_t;
 ////////////////////////////////////////////////////////////////////////////////
 // FORWARD DECLARATIONIS
 appender_ipc_udata_t *appender_ipc_make_udata();
+int split_tokens(char* str, const char* delim, char** tokens, int* num);     // provided by the application
+static pid_t current_pid();
+static int current_tid();
+static int filter_message(appender_ipc_udata_t* pUserData, int priority, const char* category,
+                          const void* key, size_t keyLen, uintptr_t tag, const char* text);
+static void filter_report(appender_ipc_udata_t* pUserData, uint64_t nowMs);
+int pump_write_batch(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch);
+int pump_flush_batch(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch);
+int pump_output(appender_ipc_udata_t* pUserData, const struct iovec* iov, int count);
+void pump_fan_out(appender_ipc_udata_t* pUserData, const struct iovec* iov, int count);
+void pump_roll_if_due(appender_ipc_udata_t* pUserData);
+int pump_spills_pending(appender_ipc_udata_t* pUserData);
+void pump_collect_frame(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch,
+                        const char* buffer, size_t len);
 
 /*******************************************************************************
- * @brief Open or create semaphore by its name
- * @param base_name - base name used for name construction
- * @param suffix - suffix used for name construction
- * @param init_val - initial value
- * @return
+ * @brief Open the descriptors used to send into the message queue
+ *
+ * Drop and spill policies must never block, so their descriptor is non-blocking;
+ * drop-oldest also needs a reading end to evict messages through.
+ *
+ * @param pUserData
+ * @return 0 upon success, -1 otherwise
+ */
+int open_client_queue(appender_ipc_udata_t* pUserData)
+{
+    int flags = O_WRONLY;
+
+    if (IPC_OVERFLOW_DROP_NEWEST == pUserData->conf.overflow
+        || IPC_OVERFLOW_DROP_OLDEST == pUserData->conf.overflow
+        || IPC_OVERFLOW_SPILL == pUserData->conf.overflow)
+    {
+        flags |= O_NONBLOCK;
+    }
+
+    pUserData->mqueueEvict = -1;
+
+    if (-1 == (pUserData->mqueueClient = mq_open(pUserData->queueName, flags)))
+    {
+        return -1;
+    }
+
+    if (IPC_OVERFLOW_DROP_OLDEST == pUserData->conf.overflow
+        && -1 == (pUserData->mqueueEvict = mq_open(pUserData->queueName, O_RDONLY | O_NONBLOCK)))
+    {
+        // can still drop the newest instead
+        ERROR_LOG("mq_open() failed (evict): %s, %s\n", pUserData->queueName, strerror(errno));
+        pUserData->conf.overflow = IPC_OVERFLOW_DROP_NEWEST;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Pick the layout rendering messages of this process
+ *
+ * Binary events are formatted by the master instance, so clients only need
+ * the raw message and skip the real layout altogether.
+ *
+ * @param appender - appender being opened
+ * @param conf - parsed settings
+ * @param layoutName - layout from the appender name
  */
-sem_t* open_semaphore(const char* base_name, const char* suffix, unsigned int init_val)
+void set_client_layout(log4c_appender_t* appender, const appender_ipc_conf_t* conf, const char* layoutName)
 {
-    char sem_name[256];
-    sprintf(sem_name, "/%s_%s", base_name, suffix);
+    if (IPC_RECORD_BINARY == conf->record)
+    {
+        log4c_layout_t* rawLayout = log4c_layout_get("raw_layout");
+        log4c_layout_set_type(rawLayout, log4c_layout_type_get("raw"));
+        log4c_appender_set_layout(appender, rawLayout);
+    }
+    else
+    {
+        log4c_appender_set_layout(appender, log4c_layout_get(layoutName));
+    }
+}
+
+/*******************************************************************************
+ * @brief Parse a decimal integer, nothing may follow it
+ * @param value
+ * @param number - [out]
+ * @return 0 upon success, -1 if it's not an int
+ */
+int parse_int(const char* value, int* number)
+{
+    char* end = NULL;
+
+    errno = 0;
+    long result = strtol(value, &end, 10);
+
+    if (end == value || *end != '\0' || ERANGE == errno || result < INT_MIN || result > INT_MAX)
+    {
+        return -1;
+    }
+
+    *number = (int) result;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Parse a size in bytes with an optional "k", "m" or "g" suffix
+ * @param value
+ * @param size - [out]
+ * @return 0 upon success, -1 if it's not a size
+ */
+int parse_size(const char* value, unsigned long long* size)
+{
+    char* end = NULL;
+    int shift = 0;
+
+    // strtoull() takes a sign and wraps a negative value around
+    if (!isdigit((unsigned char) value[0]))
+    {
+        return -1;
+    }
+
+    errno = 0;
+    *size = strtoull(value, &end, 10);
+
+    if (ERANGE == errno)
+    {
+        return -1;
+    }
+
+    if (*end == 'k' || *end == 'K')
+    {
+        shift = 10;
+        end++;
+    }
+    else if (*end == 'm' || *end == 'M')
+    {
+        shift = 20;
+        end++;
+    }
+    else if (*end == 'g' || *end == 'G')
+    {
+        shift = 30;
+        end++;
+    }
+
+    if (*end != '\0' || *size > (ULLONG_MAX >> shift))
+    {
+        return -1;
+    }
+
+    *size <<= shift;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Parse appender options ("key=value" pairs separated by commas)
+ * @param options - options token of the appender name, modified in place
+ * @param conf - [out] parsed settings, must be filled with defaults beforehand
+ * @return 0 upon success, -1 otherwise
+ */
+int parse_options(char* options, appender_ipc_conf_t* conf)
+{
+    char* savePtr = NULL;
+
+    for (char* option = strtok_r(options, OPTIONS_DELIM, &savePtr);
+         option != NULL;
+         option = strtok_r(NULL, OPTIONS_DELIM, &savePtr))
+    {
+        char* value = strchr(option, '=');
+
+        if (NULL == value)
+        {
+            ERROR_LOG("Option without value: %s\n", option);
+            return -1;
+        }
+
+        *value++ = '\0';
+
+        if (0 == strcmp(option, "transport"))
+        {
+            if (0 == strcmp(value, "mq"))
+            {
+                conf->transport = IPC_TRANSPORT_MQUEUE;
+            }
+            else if (0 == strcmp(value, "shm"))
+            {
+                conf->transport = IPC_TRANSPORT_SHM;
+            }
+            else if (0 == strcmp(value, "socket"))
+            {
+                conf->transport = IPC_TRANSPORT_SOCKET;
+            }
+            else
+            {
+                ERROR_LOG("Unknown transport: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "pump"))
+        {
+            if (0 == strcmp(value, "shared"))
+            {
+                conf->pump = IPC_PUMP_SHARED;
+            }
+            else if (0 == strcmp(value, "thread"))
+            {
+                conf->pump = IPC_PUMP_THREAD;
+            }
+            else
+            {
+                ERROR_LOG("Unknown pump: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "writer"))
+        {
+            if (0 == strcmp(value, "stream"))
+            {
+                conf->output = IPC_OUTPUT_STREAM;
+            }
+            else if (0 == strcmp(value, "uring"))
+            {
+                conf->output = IPC_OUTPUT_URING;
+            }
+            else if (0 == strcmp(value, "thread"))
+            {
+                conf->output = IPC_OUTPUT_THREAD;
+            }
+            else if (0 == strcmp(value, "mmap"))
+            {
+                conf->output = IPC_OUTPUT_MMAP;
+            }
+            else if (0 == strcmp(value, "gzip"))
+            {
+                conf->output = IPC_OUTPUT_GZIP;
+            }
+            else
+            {
+                ERROR_LOG("Unknown writer: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "write_buffer"))
+        {
+            unsigned long long size = 0;
+
+            if (-1 == parse_size(value, &size) || size < 4096 || size > (1ULL << 30))
+            {
+                ERROR_LOG("Invalid write buffer size: %s\n", value);
+                return -1;
+            }
+
+            conf->writeBuffer = size;
+        }
+        else if (0 == strcmp(option, "segment_size"))
+        {
+            unsigned long long size = 0;
+
+            // mapped in whole pages
+            if (-1 == parse_size(value, &size) || 0 == size || 0 != size % sysconf(_SC_PAGESIZE))
+            {
+                ERROR_LOG("Invalid segment size: %s\n", value);
+                return -1;
+            }
+
+            conf->segmentSize = size;
+        }
+        else if (0 == strcmp(option, "gzip_level"))
+        {
+            if (-1 == parse_int(value, &conf->gzipLevel) || conf->gzipLevel < 1 || conf->gzipLevel > 9)
+            {
+                ERROR_LOG("Invalid gzip level: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "gzip_frame"))
+        {
+            unsigned long long size = 0;
+
+            // the length of a frame is stored in 32 bits
+            if (-1 == parse_size(value, &size) || size < 4096 || size > (1ULL << 30))
+            {
+                ERROR_LOG("Invalid gzip frame size: %s\n", value);
+                return -1;
+            }
+
+            conf->gzipFrame = size;
+        }
+        else if (0 == strcmp(option, "gzip_flush_ms"))
+        {
+            if (-1 == parse_int(value, &conf->gzipFlushMs) || conf->gzipFlushMs <= 0)
+            {
+                ERROR_LOG("Invalid gzip flush period: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "file_format"))
+        {
+            if (0 == strcmp(value, "text"))
+            {
+                conf->fileFormat = IPC_FILE_TEXT;
+            }
+            else if (0 == strcmp(value, "binary"))
+            {
+                conf->fileFormat = IPC_FILE_BINARY;
+            }
+            else
+            {
+                ERROR_LOG("Unknown file format: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "index_interval"))
+        {
+            unsigned long long size = 0;
+
+            if (-1 == parse_size(value, &size) || size < 1024 || size > (1ULL << 30))
+            {
+                ERROR_LOG("Invalid index interval: %s\n", value);
+                return -1;
+            }
+
+            conf->indexInterval = size;
+        }
+        else if (0 == strcmp(option, "roll_size"))
+        {
+            // 0 turns it off
+            if (-1 == parse_size(value, &conf->rollSize))
+            {
+                ERROR_LOG("Invalid rolling size: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "roll_interval"))
+        {
+            if (0 == strcmp(value, "hourly"))
+            {
+                conf->rollInterval = 3600;
+            }
+            else if (0 == strcmp(value, "daily"))
+            {
+                conf->rollInterval = 86400;
+            }
+            else if (-1 == parse_int(value, &conf->rollInterval) || conf->rollInterval < 0)
+            {
+                ERROR_LOG("Invalid rolling interval: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "compress"))
+        {
+            if (0 == strcmp(value, "gzip"))
+            {
+                conf->bCompress = 1;
+            }
+            else if (0 == strcmp(value, "none"))
+            {
+                conf->bCompress = 0;
+            }
+            else
+            {
+                ERROR_LOG("Unknown compression: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "sink"))
+        {
+            appender_ipc_sink_conf_t* sink = &conf->sinks[conf->numSinks];
+            char* target = strchr(value, ':');
+
+            if (conf->numSinks >= MAX_SINKS)
+            {
+                ERROR_LOG("Too many sinks: %s\n", value);
+                return -1;
+            }
+
+            if (NULL == target || '\0' == target[1] || strlen(target + 1) >= sizeof(sink->target))
+            {
+                ERROR_LOG("Invalid sink: %s\n", value);
+                return -1;
+            }
+
+            *target++ = '\0';
+
+            if (0 == strcmp(value, "file"))
+            {
+                sink->kind = IPC_SINK_FILE;
+            }
+            else if (0 == strcmp(value, "syslog"))
+            {
+                sink->kind = IPC_SINK_SYSLOG;
+            }
+            else
+            {
+                ERROR_LOG("Unknown sink: %s\n", value);
+                return -1;
+            }
+
+            snprintf(sink->target, sizeof(sink->target), "%s", target);
+            conf->numSinks++;
+        }
+        else if (0 == strcmp(option, "sink_buffer"))
+        {
+            unsigned long long size = 0;
+
+            if (-1 == parse_size(value, &size) || size < 64 * 1024 || size > (1ULL << 30))
+            {
+                ERROR_LOG("Invalid sink buffer: %s\n", value);
+                return -1;
+            }
+
+            conf->sinkBuffer = size;
+        }
+        else if (0 == strcmp(option, "durability"))
+        {
+            if (0 == strcmp(value, "none"))
+            {
+                conf->durability = IPC_DURABILITY_NONE;
+            }
+            else if (0 == strcmp(value, "periodic"))
+            {
+                conf->durability = IPC_DURABILITY_PERIODIC;
+            }
+            else if (0 == strcmp(value, "group"))
+            {
+                conf->durability = IPC_DURABILITY_GROUP;
+            }
+            else
+            {
+                ERROR_LOG("Unknown durability: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "fsync_ms"))
+        {
+            if (-1 == parse_int(value, &conf->fsyncMs) || conf->fsyncMs <= 0)
+            {
+                ERROR_LOG("Invalid fsync period: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "sync_priority"))
+        {
+            // "none" makes no record wait
+            if (0 == strcmp(value, "none"))
+            {
+                conf->syncPriority = -1;
+            }
+            else if (LOG4C_PRIORITY_UNKNOWN == (conf->syncPriority = log4c_priority_to_int(value)))
+            {
+                ERROR_LOG("Unknown priority: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "sync_timeout_ms"))
+        {
+            if (-1 == parse_int(value, &conf->syncTimeoutMs) || conf->syncTimeoutMs < 0)
+            {
+                ERROR_LOG("Invalid sync timeout: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "ring_size"))
+        {
+            unsigned long long size = 0;
+
+            if (-1 == parse_size(value, &size) || size < RING_SIZE_MIN || size > RING_SIZE_MAX)
+            {
+                ERROR_LOG("Invalid ring size: %s\n", value);
+                return -1;
+            }
+
+            conf->ringSize = size;
+        }
+        else if (0 == strcmp(option, "socket_buffer"))
+        {
+            unsigned long long size = 0;
+
+            if (-1 == parse_size(value, &size) || size < MAX_SOCKET_MESSAGE || size > INT32_MAX)
+            {
+                ERROR_LOG("Invalid socket buffer: %s\n", value);
+                return -1;
+            }
+
+            conf->socketBuffer = size;
+        }
+        else if (0 == strcmp(option, "spill_size"))
+        {
+            unsigned long long size = 0;
+
+            if (-1 == parse_size(value, &size) || size < RING_SIZE_MIN || size > RING_SIZE_MAX)
+            {
+                ERROR_LOG("Invalid spill size: %s\n", value);
+                return -1;
+            }
+
+            conf->spillSize = size;
+        }
+        else if (0 == strcmp(option, "max_message"))
+        {
+            unsigned long long size = 0;
+
+            // fragments carry the length in 32 bits
+            if (-1 == parse_size(value, &size) || size < (unsigned long long)MAX_MSG_SIZE || size > UINT32_MAX)
+            {
+                ERROR_LOG("Invalid max message size: %s\n", value);
+                return -1;
+            }
+
+            conf->maxMessage = size;
+        }
+        else if (0 == strcmp(option, "queue_depth"))
+        {
+            if (-1 == parse_int(value, &conf->queueDepth) || conf->queueDepth <= 0)
+            {
+                ERROR_LOG("Invalid queue depth: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "shards"))
+        {
+            if (-1 == parse_int(value, &conf->shards) || conf->shards <= 0 || conf->shards > MAX_SHARDS)
+            {
+                ERROR_LOG("Invalid number of shards: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "shard_by"))
+        {
+            if (0 == strcmp(value, "category"))
+            {
+                conf->shardBy = IPC_SHARD_BY_CATEGORY;
+            }
+            else if (0 == strcmp(value, "pid"))
+            {
+                conf->shardBy = IPC_SHARD_BY_PID;
+            }
+            else
+            {
+                ERROR_LOG("Unknown shard key: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "batch"))
+        {
+            if (-1 == parse_int(value, &conf->batchSize) || conf->batchSize <= 0)
+            {
+                ERROR_LOG("Invalid batch size: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "coalesce_ms"))
+        {
+            if (-1 == parse_int(value, &conf->coalesceMs) || conf->coalesceMs < 0)
+            {
+                ERROR_LOG("Invalid coalescing time: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "overflow"))
+        {
+            if (0 == strcmp(value, "block"))
+            {
+                conf->overflow = IPC_OVERFLOW_BLOCK;
+            }
+            else if (0 == strcmp(value, "timeout"))
+            {
+                conf->overflow = IPC_OVERFLOW_TIMEOUT;
+            }
+            else if (0 == strcmp(value, "drop_newest"))
+            {
+                conf->overflow = IPC_OVERFLOW_DROP_NEWEST;
+            }
+            else if (0 == strcmp(value, "drop_oldest"))
+            {
+                conf->overflow = IPC_OVERFLOW_DROP_OLDEST;
+            }
+            else if (0 == strcmp(value, "spill"))
+            {
+                conf->overflow = IPC_OVERFLOW_SPILL;
+            }
+            else
+            {
+                ERROR_LOG("Unknown overflow policy: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "send_timeout_ms"))
+        {
+            if (-1 == parse_int(value, &conf->sendTimeoutMs) || conf->sendTimeoutMs < 0)
+            {
+                ERROR_LOG("Invalid send timeout: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "drop_report_s"))
+        {
+            if (-1 == parse_int(value, &conf->dropReportS) || conf->dropReportS <= 0)
+            {
+                ERROR_LOG("Invalid drop report interval: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "record"))
+        {
+            if (0 == strcmp(value, "text"))
+            {
+                conf->record = IPC_RECORD_TEXT;
+            }
+            else if (0 == strcmp(value, "binary"))
+            {
+                conf->record = IPC_RECORD_BINARY;
+            }
+            else
+            {
+                ERROR_LOG("Unknown record format: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "min_priority"))
+        {
+            conf->minPriority = log4c_priority_to_int(value);
+
+            if (LOG4C_PRIORITY_UNKNOWN == conf->minPriority)
+            {
+                ERROR_LOG("Unknown priority: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "dedup_ms"))
+        {
+            if (-1 == parse_int(value, &conf->filter.dedupMs) || conf->filter.dedupMs < 0)
+            {
+                ERROR_LOG("Invalid duplicate window: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "rate_limit") || 0 == strcmp(option, "rate_burst"))
+        {
+            int lines = 0;
+
+            if (-1 == parse_int(value, &lines) || lines < 0 || ('b' == option[5] && 0 == lines))
+            {
+                ERROR_LOG("Invalid %s: %s\n", option, value);
+                return -1;
+            }
+
+            if ('b' == option[5])
+            {
+                conf->filter.burst = lines;
+            }
+            else
+            {
+                conf->filter.rate = lines;
+            }
+        }
+        else if (0 == strcmp(option, "rate_by"))
+        {
+            if (0 == strcmp(value, "pid"))
+            {
+                conf->filter.bByCategory = 0;
+            }
+            else if (0 == strcmp(value, "category"))
+            {
+                conf->filter.bByCategory = 1;
+            }
+            else
+            {
+                ERROR_LOG("Unknown rate limit key: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "filter_on"))
+        {
+            if (0 == strcmp(value, "master"))
+            {
+                conf->filterOn = IPC_FILTER_ON_MASTER;
+            }
+            else if (0 == strcmp(value, "client"))
+            {
+                conf->filterOn = IPC_FILTER_ON_CLIENT;
+            }
+            else
+            {
+                ERROR_LOG("Unknown filter side: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "urgent_priority") || 0 == strcmp(option, "shed_priority"))
+        {
+            int bUrgent = ('u' == option[0]);
+            int priority = log4c_priority_to_int(value);
+
+            // "none" puts no priority into the lane
+            if (0 == strcmp(value, "none"))
+            {
+                priority = bUrgent ? -1 : LOG4C_PRIORITY_UNKNOWN;
+            }
+            else if (LOG4C_PRIORITY_UNKNOWN == priority)
+            {
+                ERROR_LOG("Unknown priority: %s\n", value);
+                return -1;
+            }
+
+            if (bUrgent)
+            {
+                conf->urgentPriority = priority;
+            }
+            else
+            {
+                conf->shedPriority = priority;
+            }
+        }
+        else if (0 == strcmp(option, "linger_ms"))
+        {
+            if (-1 == parse_int(value, &conf->lingerMs) || conf->lingerMs < 0)
+            {
+                ERROR_LOG("Invalid linger time: %s\n", value);
+                return -1;
+            }
+        }
+        else if (0 == strcmp(option, "trace_signal"))
+        {
+            if (0 == strcmp(value, "usr1"))
+            {
+                conf->traceSignal = SIGUSR1;
+            }
+            else if (0 == strcmp(value, "usr2"))
+            {
+                conf->traceSignal = SIGUSR2;
+            }
+            else if (-1 == parse_int(value, &conf->traceSignal))
+            {
+                conf->traceSignal = 0;
+            }
+
+            if (conf->traceSignal <= 0 || conf->traceSignal >= NSIG
+                || SIGKILL == conf->traceSignal || SIGSTOP == conf->traceSignal)
+            {
+                ERROR_LOG("Invalid trace signal: %s\n", value);
+                return -1;
+            }
+        }
+        else
+        {
+            ERROR_LOG("Unknown option: %s\n", option);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Find out which instance is the master, becoming it if there is none
+ *
+ * The master holds a lock on the control block for its whole life, see
+ * log4c_appender_ipc_lease.h. If it dies while we wait for it, the lock is
+ * free again and the election is repeated.
+ *
+ * @param pUserData
+ * @return 0 if we are the master now,
+ *         1 if another instance is the master and it's ready
+ *        -1 if function fails
+ */
+int elect_master(appender_ipc_udata_t* pUserData)
+{
+    if (NULL == (pUserData->lease = ipc_lease_open(pUserData->leaseName)))
+    {
+        return -1;
+    }
+
+    for (int round = 0; round < MAX_ELECTION_ROUNDS; round++)
+    {
+        int acquired = ipc_lease_acquire(pUserData->lease);
+
+        if (1 == acquired)
+        {
+            return 0;
+        }
+
+        if (-1 == acquired)
+        {
+            break;
+        }
+
+        int ready = ipc_lease_wait_master(pUserData->lease, MASTER_STARTUP_TIMEOUT_MS);
+
+        if (1 == ready)
+        {
+            return 1;
+        }
+
+        if (-1 == ready)
+        {
+            ERROR_LOG("Master instance didn't get ready in %d ms\n", MASTER_STARTUP_TIMEOUT_MS);
+            break;
+        }
+    }
+
+    ipc_lease_close(pUserData->lease);
+    pUserData->lease = NULL;
+
+    return -1;
+}
+
+/*******************************************************************************
+ * @brief Allocate the batch used by the pump thread
+ * @param batch - batch to initialize
+ * @param capacity - max number of messages per batch
+ * @param slotSize - storage per received message, 0 if they are used in place
+ * @return 0 upon success, -1 otherwise
+ */
+int pump_batch_init(appender_ipc_batch_t* batch, int capacity, size_t slotSize)
+{
+    memset(batch, 0, sizeof(*batch));
+
+    batch->capacity    = capacity;
+    batch->iovCapacity = capacity;
+    batch->iov         = (struct iovec*) calloc(capacity, sizeof(struct iovec));
+    batch->slotSize    = slotSize;
+
+    if (slotSize > 0)
+    {
+        batch->arena = (char*) malloc((size_t)capacity * slotSize);
+    }
+
+    batch->textCapacity = EVENT_TEXT_SIZE;
+    batch->text         = (char*) malloc(batch->textCapacity);
+    batch->scratch      = (char*) malloc(DEFERRED_MSG_SIZE);
+
+    if (NULL == batch->iov || (slotSize > 0 && NULL == batch->arena) || NULL == batch->text || NULL == batch->scratch)
+    {
+        free(batch->iov);
+        free(batch->arena);
+        free(batch->text);
+        free(batch->scratch);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Release the memory of the batch
+ * @param batch
+ */
+void pump_batch_free(appender_ipc_batch_t* batch)
+{
+    free(batch->iov);
+    free(batch->arena);
+    free(batch->text);
+    free(batch->scratch);
+    memset(batch, 0, sizeof(*batch));
+}
+
+/*******************************************************************************
+ * @brief Storage for the next message received from the message queue or the socket
+ * @param batch
+ * @return buffer of slotSize bytes, at least MAX_MSG_SIZE
+ */
+char* pump_batch_slot(appender_ipc_batch_t* batch)
+{
+    return batch->arena + (size_t)batch->count * batch->slotSize;
+}
+
+/*******************************************************************************
+ * @brief Queue one line for writing
+ * @param batch
+ * @param data - line, must stay valid until the batch is flushed
+ * @param len - line length
+ * @return 0 upon success, -1 otherwise
+ */
+int pump_batch_add(appender_ipc_batch_t* batch, const char* data, size_t len)
+{
+    if (batch->iovCount == batch->iovCapacity)
+    {
+        // frames carry many records, so there may be more lines than messages
+        struct iovec* iov = (struct iovec*) realloc(batch->iov, 2 * batch->iovCapacity * sizeof(struct iovec));
+
+        if (NULL == iov)
+        {
+            ERROR_LOG("realloc() failed, record dropped\n");
+            return -1;
+        }
+
+        batch->iov = iov;
+        batch->iovCapacity *= 2;
+    }
+
+    batch->iov[batch->iovCount].iov_base = (void*) data;
+    batch->iov[batch->iovCount].iov_len  = len;
+    batch->iovCount++;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Remember messages lost by a producer until the next drop report
+ * @param pUserData
+ * @param drops - report received from the producer
+ */
+void pump_account_drops(appender_ipc_udata_t* pUserData, const appender_ipc_drops_t* drops)
+{
+    appender_ipc_drops_t* slot = NULL;
+
+    // the producer may already have a slot after one that was freed
+    for (int i = 0; i < MAX_DROP_SOURCES && NULL == slot; i++)
+    {
+        if (pUserData->dropSources[i].pid == drops->pid && pUserData->dropSources[i].count > 0)
+        {
+            slot = &pUserData->dropSources[i];
+        }
+    }
+
+    for (int i = 0; i < MAX_DROP_SOURCES && NULL == slot; i++)
+    {
+        if (0 == pUserData->dropSources[i].count)
+        {
+            slot = &pUserData->dropSources[i];
+        }
+    }
+
+    // too many sources at once: the last slot counts the rest together
+    if (NULL == slot)
+    {
+        slot = &pUserData->dropSources[MAX_DROP_SOURCES - 1];
+        slot->pid = -1;
+    }
+    else
+    {
+        slot->pid = drops->pid;
+    }
+
+    slot->count += drops->count;
+
+    if (pUserData->stats)
+    {
+        atomic_fetch_add_explicit(&ipc_stats_shared(pUserData->stats)->master.dropsReported, drops->count,
+                                  memory_order_relaxed);
+    }
+}
+
+/*******************************************************************************
+ * @brief Check if some drops still wait to be reported
+ * @param pUserData
+ * @return 1 if there are pending drops, 0 otherwise
+ */
+int pump_drops_pending(appender_ipc_udata_t* pUserData)
+{
+    for (int i = 0; i < MAX_DROP_SOURCES; i++)
+    {
+        if (pUserData->dropSources[i].count > 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Write "N messages dropped" markers, at most once per drop_report_s
+ * @param pUserData
+ * @param bForce - 1 to ignore the interval, e.g. when the pump stops
+ */
+void pump_report_drops(appender_ipc_udata_t* pUserData, int bForce)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if ((!bForce && now.tv_sec - pUserData->lastDropReport.tv_sec < pUserData->conf.dropReportS)
+        || !pump_drops_pending(pUserData))
+    {
+        return;
+    }
+
+    pUserData->lastDropReport = now;
+
+    char stamp[32];
+    time_t wallClock = time(NULL);
+    struct tm tmNow;
+    strftime(stamp, sizeof(stamp), "%Y%m%d %H:%M:%S", localtime_r(&wallClock, &tmNow));
+
+    for (int i = 0; i < MAX_DROP_SOURCES; i++)
+    {
+        appender_ipc_drops_t* slot = &pUserData->dropSources[i];
+
+        if (0 == slot->count)
+        {
+            continue;
+        }
+
+        char prefix[64] = "";
+        char marker[128];
+        char record[sizeof(marker) + sizeof(ipc_binlog_record_t) + sizeof(DROPS_CATEGORY)];
+        int len;
+
+        // a binary record carries the time and the source itself
+        if (IPC_FILE_TEXT == pUserData->conf.fileFormat)
+        {
+            snprintf(prefix, sizeof(prefix), "%s " DROPS_CATEGORY ": ", stamp);
+        }
+
+        if (slot->pid > 0)
+        {
+            len = snprintf(marker, sizeof(marker), "%s%u messages dropped by process %d\n",
+                           prefix, slot->count, slot->pid);
+        }
+        else
+        {
+            len = snprintf(marker, sizeof(marker), "%s%u messages dropped by other processes\n",
+                           prefix, slot->count);
+        }
+
+        struct iovec iov = { marker, (size_t) len };
+
+        if (IPC_FILE_BINARY == pUserData->conf.fileFormat)
+        {
+            iov.iov_base = record;
+            iov.iov_len  = ipc_binlog_encode(record, (uint64_t) wallClock * 1000000, LOG4C_PRIORITY_WARN,
+                                             slot->pid > 0 ? slot->pid : 0, 0, DROPS_CATEGORY,
+                                             sizeof(DROPS_CATEGORY) - 1, marker, len);
+        }
+
+        pump_fan_out(pUserData, &iov, 1);
+
+        if (pUserData->writer || pUserData->segment || pUserData->gzip)
+        {
+            if (-1 == pump_output(pUserData, &iov, 1))
+            {
+                ERROR_LOG("write failed: %s\n", strerror(errno));
+                pUserData->bWriteFailed = 1;
+            }
+        }
+        else
+        {
+            if (iov.iov_len != (size_t) write(pUserData->outFd, iov.iov_base, iov.iov_len))
+            {
+                ERROR_LOG("write() failed: %s\n", strerror(errno));
+                pUserData->bWriteFailed = 1;
+            }
+            else
+            {
+                // only what is in the file
+                if (pUserData->index)
+                {
+                    ipc_binlog_index_add(pUserData->index, pUserData->fileSize, &iov, 1);
+                }
+
+                pUserData->fileSize += iov.iov_len;
+                pUserData->bDirty = 1;
+            }
+        }
+
+        slot->pid   = 0;
+        slot->count = 0;
+    }
+}
+
+/*******************************************************************************
+ * @brief Room in the text storage of the batch
+ *
+ * The batch is written out first if the storage is running low.
+ *
+ * @param pUserData
+ * @param batch
+ * @param needed - bytes
+ * @return start of the free room, NULL if it can't be had
+ */
+char* pump_batch_text(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch, size_t needed)
+{
+    if (batch->textCapacity - batch->textUsed < needed)
+    {
+        pump_write_batch(pUserData, batch);
+    }
+
+    // nothing refers to the text storage after the write => safe to grow it
+    if (batch->textCapacity < needed)
+    {
+        char* text = (char*) realloc(batch->text, needed);
+
+        if (NULL == text)
+        {
+            ERROR_LOG("realloc() failed, record dropped\n");
+            return NULL;
+        }
+
+        batch->text         = text;
+        batch->textCapacity = needed;
+    }
+
+    return batch->text + batch->textUsed;
+}
+
+/*******************************************************************************
+ * @brief Queue one record of a binary file
+ * @param pUserData
+ * @param batch
+ * @param timestamp - microseconds since the epoch
+ * @param priority
+ * @param pid
+ * @param tid
+ * @param category - may be NULL
+ * @param categoryLen
+ * @param msg
+ * @param msgLen
+ */
+void pump_collect_record(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch, uint64_t timestamp,
+                         int priority, int32_t pid, int32_t tid, const char* category, size_t categoryLen,
+                         const char* msg, size_t msgLen)
+{
+    char* record = pump_batch_text(pUserData, batch, ipc_binlog_record_size(categoryLen, msgLen));
+
+    if (NULL == record)
+    {
+        return;
+    }
+
+    size_t len = ipc_binlog_encode(record, timestamp, priority, pid, tid, category, categoryLen, msg, msgLen);
+
+    // one entry per record: the index relies on it
+    batch->textUsed += len;
+    pump_batch_add(batch, record, len);
+}
+
+/*******************************************************************************
+ * @brief Queue one line rendered by a client
+ *
+ * A binary file gets it as a record stamped with the time it's received at.
+ *
+ * @param pUserData
+ * @param batch
+ * @param data - line, must stay valid until the batch is flushed
+ * @param len - line length
+ */
+void pump_collect_line(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch, const char* data, size_t len)
+{
+    if (IPC_FILE_BINARY != pUserData->conf.fileFormat)
+    {
+        pump_batch_add(batch, data, len);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    pump_collect_record(pUserData, batch, (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000,
+                        LOG4C_PRIORITY_UNKNOWN, 0, 0, NULL, 0, data, len);
+}
+
+/*******************************************************************************
+ * @brief Format one binary event with the layout of the master instance
+ *
+ * The line goes to the text storage of the batch, which is written out first
+ * if it's running low. A binary file takes the event as it is instead.
+ *
+ * @param pUserData
+ * @param batch
+ * @param event - decoded event header
+ * @param category - category name, null-terminated
+ * @param msg - message, null-terminated
+ */
+void pump_format_event(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch,
+                       const appender_ipc_event_t* event, const char* category, const char* msg)
+{
+    if (IPC_FILE_BINARY == pUserData->conf.fileFormat)
+    {
+        pump_collect_record(pUserData, batch, event->timestamp, event->priority, event->pid, event->tid,
+                            category, strlen(category), msg, strlen(msg));
+        return;
+    }
+
+    size_t needed = event->msgLen + EVENT_FORMAT_SLACK;
+    char* line = pump_batch_text(pUserData, batch, needed);
+
+    if (NULL == line)
+    {
+        return;
+    }
+
+    log4c_logging_event_t loggingEvent;
+    memset(&loggingEvent, 0, sizeof(loggingEvent));
+    loggingEvent.evt_category = category;
+    loggingEvent.evt_priority = event->priority;
+    loggingEvent.evt_msg      = msg;
+    loggingEvent.evt_timestamp.tv_sec  = event->timestamp / 1000000;
+    loggingEvent.evt_timestamp.tv_usec = event->timestamp % 1000000;
+    loggingEvent.evt_buffer.buf_data    = line;
+    loggingEvent.evt_buffer.buf_size    = batch->textCapacity - batch->textUsed;
+    loggingEvent.evt_buffer.buf_maxsize = loggingEvent.evt_buffer.buf_size;
+
+    const char* formatted = pUserData->eventLayout
+                          ? log4c_layout_format(pUserData->eventLayout, &loggingEvent)
+                          : msg;
+
+    if (NULL == formatted)
+    {
+        return;
+    }
+
+    size_t lineLen = strnlen(formatted, loggingEvent.evt_buffer.buf_size - 1);
+
+    // layouts with their own storage (e.g. raw) don't use the event buffer
+    if (formatted != line)
+    {
+        memmove(line, formatted, lineLen);
+    }
+
+    batch->textUsed += lineLen;
+    pump_batch_add(batch, line, lineLen);
+}
+
+/*******************************************************************************
+ * @brief CLOCK_MONOTONIC time the filter counts in
+ * @return milliseconds
+ */
+uint64_t filter_now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*******************************************************************************
+ * @brief Message, category and priority a summary of the filter is logged with
+ * @param summary
+ * @param msg - [out]
+ * @param size - of msg
+ * @param pCategory - [out]
+ * @return priority
+ */
+int filter_summary_event(const ipc_filter_summary_t* summary, char* msg, size_t size, const char** pCategory)
+{
+    *pCategory = summary->category[0] ? summary->category : DROPS_CATEGORY;
+
+    if (IPC_FILTER_REPEATED == summary->verdict)
+    {
+        snprintf(msg, size, "message repeated %u more times: %s", summary->count, summary->text);
+        return summary->priority;
+    }
+
+    if (summary->category[0])
+    {
+        snprintf(msg, size, "%u messages over the rate limit", summary->count);
+    }
+    else
+    {
+        snprintf(msg, size, "%u messages of process %d over the rate limit", summary->count, summary->pid);
+    }
+
+    return LOG4C_PRIORITY_WARN;
+}
+
+/*******************************************************************************
+ * @brief Queue the summaries of the filter that are due
+ * @param pUserData
+ * @param batch
+ * @param nowMs - CLOCK_MONOTONIC milliseconds, IPC_FILTER_FLUSH for all of them
+ * @return number of summaries queued
+ */
+int pump_collect_summaries(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch, uint64_t nowMs)
+{
+    ipc_filter_summary_t summary;
+    int count = 0;
+
+    while (ipc_filter_next_report(pUserData->pumpFilter, nowMs, &summary))
+    {
+        char msg[IPC_FILTER_TEXT + 64];
+        const char* category;
+        struct timespec wallClock;
+        clock_gettime(CLOCK_REALTIME, &wallClock);
+
+        appender_ipc_event_t event;
+        event.priority    = filter_summary_event(&summary, msg, sizeof(msg), &category);
+        event.timestamp   = (uint64_t) wallClock.tv_sec * 1000000 + wallClock.tv_nsec / 1000;
+        event.pid         = summary.pid;
+        event.tid         = 0;
+        event.categoryLen = strlen(category) + 1;
+        event.msgLen      = strlen(msg) + 1;
+
+        pump_format_event(pUserData, batch, &event, category, msg);
+        count++;
+    }
+
+    return count;
+}
+
+/*******************************************************************************
+ * @brief Write the summaries of the filter that are due, e.g. while idle
+ * @param pUserData
+ * @param batch - lines already in it are written along
+ * @param bForce - 1 for all of them, e.g. when the pump stops
+ */
+void pump_report_filtered(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch, int bForce)
+{
+    if (pUserData->pumpFilter
+        && pump_collect_summaries(pUserData, batch, bForce ? IPC_FILTER_FLUSH : filter_now_ms()) > 0)
+    {
+        pump_flush_batch(pUserData, batch);
+    }
+}
+
+/*******************************************************************************
+ * @brief Collect one binary event
+ *
+ * Events less severe than min_priority are dropped here, then duplicates and
+ * sources over the rate limit are held back by the filter.
+ *
+ * @param pUserData
+ * @param batch
+ * @param event - decoded event header
+ * @param category - category name, null-terminated
+ * @param msg - message, null-terminated
+ */
+void pump_collect_event(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch,
+                        const appender_ipc_event_t* event, const char* category, const char* msg)
+{
+    if ((int)event->priority > pUserData->conf.minPriority)
+    {
+        return;
+    }
+
+    if (pUserData->pumpFilter)
+    {
+        size_t msgLen = strlen(msg);
+        uint64_t nowMs = filter_now_ms();
+
+        ipc_filter_record_t rec;
+        rec.pid         = event->pid;
+        rec.priority    = event->priority;
+        rec.category    = category;
+        rec.categoryLen = strlen(category);
+        rec.key         = msg;
+        rec.keyLen      = msgLen;
+        rec.tag         = 0;
+        rec.text        = msg;
+        rec.textLen     = msgLen;
+
+        ipc_filter_verdict_t verdict = ipc_filter_check(pUserData->pumpFilter, nowMs, &rec);
+
+        // summaries it made due come first
+        pump_collect_summaries(pUserData, batch, nowMs);
+
+        if (IPC_FILTER_PASS != verdict)
+        {
+            if (pUserData->stats)
+            {
+                ipc_stats_master_t* master = &ipc_stats_shared(pUserData->stats)->master;
+
+                atomic_fetch_add_explicit(IPC_FILTER_REPEATED == verdict ? &master->repeated : &master->limited, 1,
+                                          memory_order_relaxed);
+            }
+
+            return;
+        }
+    }
+
+    pump_format_event(pUserData, batch, event, category, msg);
+}
+
+/*******************************************************************************
+ * @brief Bucket of the master's format dictionary
+ * @param pid - process the format belongs to
+ * @param formatId - id assigned by that process
+ * @return bucket index
+ */
+static unsigned known_format_bucket(int32_t pid, uint32_t formatId)
+{
+    return ((uint32_t)pid * 2654435761u ^ formatId) % KNOWN_FORMAT_BUCKETS;
+}
+
+/*******************************************************************************
+ * @brief Look up a format string defined by a client
+ * @param pUserData
+ * @param pid - client process
+ * @param formatId - id assigned by the client
+ * @return format, NULL if unknown
+ */
+const appender_ipc_known_format_t* pump_find_format(appender_ipc_udata_t* pUserData, int32_t pid, uint32_t formatId)
+{
+    for (appender_ipc_known_format_t* known = pUserData->knownFormats[known_format_bucket(pid, formatId)];
+         known; known = known->next)
+    {
+        if (known->pid == pid && known->formatId == formatId)
+        {
+            return known;
+        }
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+ * @brief Drop formats of processes that are gone (or all of them)
+ * @param pUserData
+ * @param bAll - 1 to drop every format, e.g. when the pump stops
+ */
+void pump_forget_formats(appender_ipc_udata_t* pUserData, int bAll)
+{
+    for (int i = 0; i < KNOWN_FORMAT_BUCKETS; i++)
+    {
+        appender_ipc_known_format_t** pp = &pUserData->knownFormats[i];
+
+        while (*pp)
+        {
+            appender_ipc_known_format_t* known = *pp;
+
+            if (bAll || (-1 == kill(known->pid, 0) && ESRCH == errno))
+            {
+                *pp = known->next;
+                free(known);
+                pUserData->numKnownFormats--;
+            }
+            else
+            {
+                pp = &known->next;
+            }
+        }
+    }
+}
+
+/*******************************************************************************
+ * @brief Drop the formats of one process
+ * @param pUserData
+ * @param pid
+ */
+void pump_forget_process(appender_ipc_udata_t* pUserData, int32_t pid)
+{
+    for (int i = 0; i < KNOWN_FORMAT_BUCKETS; i++)
+    {
+        appender_ipc_known_format_t** pp = &pUserData->knownFormats[i];
+
+        while (*pp)
+        {
+            appender_ipc_known_format_t* known = *pp;
+
+            if (known->pid == pid)
+            {
+                *pp = known->next;
+                free(known);
+                pUserData->numKnownFormats--;
+            }
+            else
+            {
+                pp = &known->next;
+            }
+        }
+    }
+}
+
+/*******************************************************************************
+ * @brief Drop the formats of the processes that hung up the socket
+ *
+ * Called once the message queue is found empty: records a process sent
+ * through it before going away are collected by then.
+ *
+ * @param pUserData
+ */
+void pump_forget_gone(appender_ipc_udata_t* pUserData)
+{
+    for (int i = 0; i < pUserData->numGonePids; i++)
+    {
+        pump_forget_process(pUserData, pUserData->gonePids[i]);
+    }
+
+    pUserData->numGonePids = 0;
+}
+
+/*******************************************************************************
+ * @brief A connection to the socket hung up
+ * @param context - user data
+ * @param pid - process that made the connection
+ */
+void pump_client_gone(void* context, pid_t pid)
+{
+    appender_ipc_udata_t* pUserData = (appender_ipc_udata_t*) context;
+
+    if (MAX_GONE_PIDS == pUserData->numGonePids)
+    {
+        pump_forget_gone(pUserData);
+    }
+
+    pUserData->gonePids[pUserData->numGonePids++] = pid;
+}
+
+/*******************************************************************************
+ * @brief Remember a format string sent by a client
+ * @param pUserData
+ * @param def - definition header
+ * @param format - format string, null-terminated
+ */
+void pump_define_format(appender_ipc_udata_t* pUserData, const appender_ipc_format_def_t* def, const char* format)
+{
+    unsigned bucket = known_format_bucket(def->pid, def->formatId);
+
+    // a recycled pid may bring a different format under the same id
+    for (appender_ipc_known_format_t** pp = &pUserData->knownFormats[bucket]; *pp; pp = &(*pp)->next)
+    {
+        if ((*pp)->pid == def->pid && (*pp)->formatId == def->formatId)
+        {
+            appender_ipc_known_format_t* stale = *pp;
+            *pp = stale->next;
+            free(stale);
+            pUserData->numKnownFormats--;
+            break;
+        }
+    }
+
+    if (pUserData->numKnownFormats >= MAX_KNOWN_FORMATS)
+    {
+        pump_forget_formats(pUserData, 0);
+    }
+
+    size_t len = strlen(format);
+    appender_ipc_known_format_t* known = (appender_ipc_known_format_t*) malloc(sizeof(*known) + len + 1);
+
+    if (NULL == known)
+    {
+        ERROR_LOG("malloc() failed, format of process %d dropped\n", def->pid);
+        return;
+    }
+
+    known->pid      = def->pid;
+    known->formatId = def->formatId;
+    memcpy(known->format, format, len + 1);
+
+    known->next = pUserData->knownFormats[bucket];
+    pUserData->knownFormats[bucket] = known;
+    pUserData->numKnownFormats++;
+}
+
+/*******************************************************************************
+ * @brief Render a deferred record and format it like a binary event
+ * @param pUserData
+ * @param batch
+ * @param deferred - decoded record header
+ * @param category - category name, null-terminated
+ * @param args - packed arguments
+ */
+void pump_collect_deferred(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch,
+                           const appender_ipc_deferred_t* deferred, const char* category, const char* args)
+{
+    if ((int)deferred->priority > pUserData->conf.minPriority)
+    {
+        return;
+    }
+
+    const appender_ipc_known_format_t* known = pump_find_format(pUserData, deferred->pid, deferred->formatId);
+    int len = -1;
+
+    if (known)
+    {
+        len = ipc_fmt_render(known->format, args, deferred->argsLen, batch->scratch, DEFERRED_MSG_SIZE);
+    }
+
+    // keep the line, it still has the time, level and origin
+    if (-1 == len)
+    {
+        len = snprintf(batch->scratch, DEFERRED_MSG_SIZE, "appender_ipc: %s format %u of process %d",
+                       known ? "arguments don't match" : "unknown", deferred->formatId, deferred->pid);
+    }
+
+    appender_ipc_event_t event;
+    event.timestamp   = deferred->timestamp;
+    event.pid         = deferred->pid;
+    event.tid         = deferred->tid;
+    event.priority    = deferred->priority;
+    event.categoryLen = deferred->categoryLen;
+    event.msgLen      = len + 1;
+
+    pump_collect_event(pUserData, batch, &event, category, batch->scratch);
+}
+
+/*******************************************************************************
+ * @brief Report a fragmented message given up by the reassembly as dropped
+ * @param context - user data
+ * @param pid - producer of the message
+ */
+void pump_fragment_lost(void* context, int32_t pid)
+{
+    appender_ipc_drops_t drops;
+    drops.pid   = pid;
+    drops.count = 1;
+
+    pump_account_drops((appender_ipc_udata_t*) context, &drops);
+}
+
+/*******************************************************************************
+ * @brief Add a fragment to its message, collect the message once complete
+ * @param pUserData
+ * @param batch
+ * @param buffer - fragment frame
+ * @param len - frame length
+ */
+void pump_collect_fragment(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch,
+                           const char* buffer, size_t len)
+{
+    appender_ipc_fragment_t fragment;
+    size_t offset = sizeof(appender_ipc_frame_t) + sizeof(fragment);
+
+    if (len < offset)
+    {
+        ERROR_LOG("Truncated frame\n");
+        return;
+    }
+
+    memcpy(&fragment, buffer + sizeof(appender_ipc_frame_t), sizeof(fragment));
+
+    if (NULL == pUserData->reasm)
+    {
+        return;
+    }
+
+    const char* message = NULL;
+    int result = ipc_reasm_add(pUserData->reasm, fragment.pid, fragment.tid, fragment.lane, fragment.msgId, fragment.total,
+                               fragment.offset, buffer + offset, len - offset, &message);
+
+    if (-1 == result && ENOBUFS == errno)
+    {
+        // complete messages hold all the memory: write them out and retry
+        pump_write_batch(pUserData, batch);
+        ipc_reasm_recycle(pUserData->reasm);
+
+        result = ipc_reasm_add(pUserData->reasm, fragment.pid, fragment.tid, fragment.lane, fragment.msgId, fragment.total,
+                               fragment.offset, buffer + offset, len - offset, &message);
+    }
+
+    if (1 != result)
+    {
+        return;
+    }
+
+    // the buffer stays valid until the batch is flushed
+    if (fragment.total >= sizeof(appender_ipc_frame_t) && '\0' == message[0])
+    {
+        pump_collect_frame(pUserData, batch, message, fragment.total);
+    }
+    else
+    {
+        pump_collect_line(pUserData, batch, message, fragment.total);
+    }
+}
+
+/*******************************************************************************
+ * @brief Everything sent before the first tickets is in the batch or written
+ * @param pUserData
+ * @param numTickets - tickets received when the transports were last polled
+ */
+void pump_sync_ready(appender_ipc_udata_t* pUserData, int numTickets)
+{
+    if (numTickets > pUserData->numSyncReady)
+    {
+        pUserData->numSyncReady = numTickets;
+    }
+}
+
+/*******************************************************************************
+ * @brief A producer asks for what it sent before the ticket to be made durable
+ *
+ * The message queue hands the request (sent in the low lane) out after every
+ * message sent before it. With the ring or the socket, an urgent message may
+ * still wait in the queue, so the pump first polls both transports until they
+ * are empty.
+ *
+ * @param pUserData
+ * @param ticket
+ */
+void pump_sync_seen(appender_ipc_udata_t* pUserData, uint32_t ticket)
+{
+    // each ticket is acknowledged on its own: a higher one doesn't mean the
+    // requests of the lower ones came
+    if (MAX_SYNC_TICKETS == pUserData->numSyncTickets)
+    {
+        // the lease can't hold more, the oldest request times out
+        ERROR_LOG("Too many sync requests, dropping ticket %u\n", pUserData->syncTickets[0]);
+        memmove(pUserData->syncTickets, pUserData->syncTickets + 1,
+                (MAX_SYNC_TICKETS - 1) * sizeof(pUserData->syncTickets[0]));
+        pUserData->numSyncTickets--;
+        pUserData->numSyncReady -= (pUserData->numSyncReady > 0);
+    }
+
+    pUserData->syncTickets[pUserData->numSyncTickets++] = ticket;
+
+    if (NULL == pUserData->ring && NULL == pUserData->sockServer)
+    {
+        pump_sync_ready(pUserData, pUserData->numSyncTickets);
+    }
+}
+
+/*******************************************************************************
+ * @brief Unpack a frame built by the appender
+ * @param pUserData
+ * @param batch
+ * @param buffer - frame, must stay valid until the batch is flushed
+ * @param len - frame length
+ */
+void pump_collect_frame(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch,
+                        const char* buffer, size_t len)
+{
+    appender_ipc_frame_t frame;
+    memcpy(&frame, buffer, sizeof(frame));
+
+    if (IPC_FRAME_DROPS == frame.kind && len >= sizeof(frame) + sizeof(appender_ipc_drops_t))
+    {
+        appender_ipc_drops_t drops;
+        memcpy(&drops, buffer + sizeof(frame), sizeof(drops));
+        pump_account_drops(pUserData, &drops);
+        return;
+    }
+
+    if (IPC_FRAME_SYNC == frame.kind && len >= sizeof(frame) + sizeof(appender_ipc_sync_t))
+    {
+        appender_ipc_sync_t sync;
+        memcpy(&sync, buffer + sizeof(frame), sizeof(sync));
+        pump_sync_seen(pUserData, sync.ticket);
+        return;
+    }
+
+    if (IPC_FRAME_FRAGMENT == frame.kind)
+    {
+        pump_collect_fragment(pUserData, batch, buffer, len);
+        return;
+    }
+
+    const char* pos = buffer + sizeof(frame);
+    const char* end = buffer + len;
+
+    if (IPC_FRAME_FORMAT == frame.kind)
+    {
+        appender_ipc_format_def_t def;
+
+        if (pos + sizeof(def) >= end || '\0' != end[-1])
+        {
+            ERROR_LOG("Malformed format definition\n");
+            return;
+        }
+
+        memcpy(&def, pos, sizeof(def));
+        pump_define_format(pUserData, &def, pos + sizeof(def));
+        return;
+    }
+
+    if (IPC_FRAME_DEFERRED == frame.kind)
+    {
+        for (int i = 0; i < frame.count; i++)
+        {
+            appender_ipc_deferred_t deferred;
+
+            if (pos + sizeof(deferred) > end)
+            {
+                ERROR_LOG("Truncated frame\n");
+                return;
+            }
+
+            memcpy(&deferred, pos, sizeof(deferred));
+            pos += sizeof(deferred);
+
+            if (pos + deferred.categoryLen + deferred.argsLen > end
+                || 0 == deferred.categoryLen || '\0' != pos[deferred.categoryLen - 1])
+            {
+                ERROR_LOG("Malformed deferred record\n");
+                return;
+            }
+
+            pump_collect_deferred(pUserData, batch, &deferred, pos, pos + deferred.categoryLen);
+            pos += deferred.categoryLen + deferred.argsLen;
+        }
+
+        return;
+    }
+
+    if (IPC_FRAME_EVENTS == frame.kind)
+    {
+        for (int i = 0; i < frame.count; i++)
+        {
+            appender_ipc_event_t event;
+
+            if (pos + sizeof(event) > end)
+            {
+                ERROR_LOG("Truncated frame\n");
+                return;
+            }
+
+            memcpy(&event, pos, sizeof(event));
+            pos += sizeof(event);
+
+            if (pos + event.categoryLen + event.msgLen > end
+                || 0 == event.categoryLen || 0 == event.msgLen
+                || '\0' != pos[event.categoryLen - 1] || '\0' != pos[event.categoryLen + event.msgLen - 1])
+            {
+                ERROR_LOG("Malformed event\n");
+                return;
+            }
+
+            pump_collect_event(pUserData, batch, &event, pos, pos + event.categoryLen);
+            pos += event.categoryLen + event.msgLen;
+        }
+
+        return;
+    }
+
+    if (IPC_FRAME_BATCH != frame.kind)
+    {
+        ERROR_LOG("Unknown frame kind: %d\n", frame.kind);
+        return;
+    }
+
+    for (int i = 0; i < frame.count; i++)
+    {
+        appender_ipc_reclen_t recLen;
+
+        if (pos + sizeof(recLen) > end)
+        {
+            ERROR_LOG("Truncated frame\n");
+            return;
+        }
+
+        memcpy(&recLen, pos, sizeof(recLen));
+        pos += sizeof(recLen);
+
+        if (pos + recLen > end)
+        {
+            ERROR_LOG("Truncated frame\n");
+            return;
+        }
+
+        pump_collect_line(pUserData, batch, pos, recLen);
+        pos += recLen;
+    }
+}
+
+/*******************************************************************************
+ * @brief Add one received message to the batch
+ *
+ * Service messages are handled right away and never reach the file.
+ *
+ * @param pUserData
+ * @param batch
+ * @param buffer - message body, not necessarily null-terminated;
+ *                 must stay valid until the batch is flushed
+ * @param len - message length
+ */
+void pump_collect_message(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch,
+                          const char* buffer, size_t len)
+{
+    DEBUG_LOG("Received (PUMP_THREAD): %.*s\n", (int)len, buffer);
+
+    if (len >= sizeof(appender_ipc_frame_t) && '\0' == buffer[0])
+    {
+        pump_collect_frame(pUserData, batch, buffer, len);
+    }
+    else if (len > 0)
+    {
+        pump_collect_line(pUserData, batch, buffer, len);
+    }
+
+    batch->count++;
+}
+
+/*******************************************************************************
+ * @brief Start a binary file if it's empty, and open its index
+ *
+ * A file without an index is still valid, the index is only a shortcut.
+ *
+ * @param pUserData - fileSize is the size of the file
+ */
+void output_open_binary(appender_ipc_udata_t* pUserData)
+{
+    struct stat st;
+
+    // before a mapping or a writer takes the file over
+    if (0 == fstat(pUserData->outFd, &st) && 0 == st.st_size)
+    {
+        if (IPC_BINLOG_MAGIC_SIZE != write(pUserData->outFd, IPC_BINLOG_MAGIC, IPC_BINLOG_MAGIC_SIZE))
+        {
+            ERROR_LOG("write() failed: %s\n", strerror(errno));
+        }
+        else
+        {
+            pUserData->fileSize += IPC_BINLOG_MAGIC_SIZE;
+        }
+    }
+
+    if (NULL == (pUserData->index = ipc_binlog_index_open(pUserData->filePath, pUserData->fileSize,
+                                                          pUserData->conf.indexInterval)))
+    {
+        ERROR_LOG("ipc_binlog_index_open() failed, writing without an index: %s\n", pUserData->filePath);
+    }
+}
+
+/*******************************************************************************
+ * @brief Open the output file, and the writer or the mapping the settings ask for
+ *
+ * The pump can still write the file itself if the writer or the mapping
+ * can't be set up.
+ *
+ * @param pUserData
+ * @return 0 upon success, -1 if the file can't be opened
+ */
+int output_open(appender_ipc_udata_t* pUserData)
+{
+    FILE* fp = fopen(pUserData->filePath, "a");
+
+    if (NULL == fp)
+    {
+        ERROR_LOG("fopen() failed: %s, %s\n", pUserData->filePath, strerror(errno));
+        return -1;
+    }
+
+    // plain lines can't go after compressed ones, there is no falling back
+    if (IPC_OUTPUT_GZIP == pUserData->conf.output
+        && NULL == (pUserData->gzip = ipc_gzip_create(pUserData->filePath, pUserData->conf.gzipLevel,
+                                                      pUserData->conf.gzipFrame, pUserData->conf.gzipFlushMs,
+                                                      pUserData->conf.writeBuffer, WRITE_BUFFERS)))
+    {
+        ERROR_LOG("ipc_gzip_create() failed: %s\n", pUserData->filePath);
+        fclose(fp);
+        return -1;
+    }
+
+    // stream2 keeps owning the FILE, the pump writes its batches
+    // straight to the descriptor (the stream is unbuffered anyway)
+    log4c_stream2_set_fp(pUserData->rollingFileAppender, fp);
+    pUserData->outFd = fileno(fp);
+
+    if (IPC_FILE_BINARY == pUserData->conf.fileFormat)
+    {
+        output_open_binary(pUserData);
+    }
+
+    if (IPC_OUTPUT_MMAP == pUserData->conf.output)
+    {
+        // the pump can still write the file itself
+        if (NULL == (pUserData->segment = ipc_segment_open(pUserData->filePath, pUserData->conf.segmentSize)))
+        {
+            ERROR_LOG("ipc_segment_open() failed, writing synchronously: %s\n", pUserData->filePath);
+        }
+    }
+    else if (IPC_OUTPUT_GZIP == pUserData->conf.output)
+    {
+        INFO_LOG("Writing %s compressed, level %d\n", pUserData->filePath, pUserData->conf.gzipLevel);
+    }
+    else if (IPC_OUTPUT_STREAM != pUserData->conf.output)
+    {
+        ipc_writer_mode_t mode = (IPC_OUTPUT_URING == pUserData->conf.output) ? IPC_WRITER_URING : IPC_WRITER_THREAD;
+
+        // the pump can still write the file itself
+        if (NULL == (pUserData->writer = ipc_writer_create(pUserData->filePath, mode, pUserData->conf.writeBuffer,
+                                                           WRITE_BUFFERS)))
+        {
+            ERROR_LOG("ipc_writer_create() failed, writing synchronously: %s\n", pUserData->filePath);
+        }
+        else
+        {
+            INFO_LOG("Writing %s with %s\n", pUserData->filePath,
+                     ipc_writer_uses_uring(pUserData->writer) ? "io_uring" : "a writer thread");
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Set the sinks up; the master writes without those that can't be
+ *
+ * A sink whose target isn't there yet is set up anyway, it keeps retrying.
+ *
+ * @param pUserData
+ */
+void output_open_sinks(appender_ipc_udata_t* pUserData)
+{
+    ipc_stats_shared_t* shared = pUserData->stats ? ipc_stats_shared(pUserData->stats) : NULL;
+    int bBinary = (IPC_FILE_BINARY == pUserData->conf.fileFormat);
+
+    for (int i = 0; i < MAX_SINKS; i++)
+    {
+        const appender_ipc_sink_conf_t* sink = &pUserData->conf.sinks[i];
+        ipc_stats_sink_t* stats = shared ? &shared->sinks[i] : NULL;
+
+        // slots of sinks no longer configured keep their counters, not their name
+        if (i >= pUserData->conf.numSinks)
+        {
+            if (stats)
+            {
+                stats->name[0] = '\0';
+            }
+
+            continue;
+        }
+
+        if (stats)
+        {
+            snprintf(stats->name, sizeof(stats->name), "%s:%s",
+                     IPC_SINK_FILE == sink->kind ? "file" : "syslog", sink->target);
+        }
+
+        // a binary copy starts with the magic like the output file
+        if (NULL == (pUserData->sinks[i] = ipc_sink_open(sink->kind, sink->target, pUserData->conf.sinkBuffer,
+                                                         bBinary ? IPC_BINLOG_MAGIC : NULL,
+                                                         bBinary ? IPC_BINLOG_MAGIC_SIZE : 0, stats)))
+        {
+            ERROR_LOG("ipc_sink_open() failed, writing without it: %s\n", sink->target);
+        }
+    }
+}
+
+/*******************************************************************************
+ * @brief Close the sinks once they have written what they hold
+ * @param pUserData
+ */
+void output_close_sinks(appender_ipc_udata_t* pUserData)
+{
+    for (int i = 0; i < MAX_SINKS; i++)
+    {
+        ipc_sink_close(pUserData->sinks[i], SINK_CLOSE_TIMEOUT_MS);
+        pUserData->sinks[i] = NULL;
+    }
+}
+
+/*******************************************************************************
+ * @brief Copy lines to every sink; a sink that is behind drops them itself
+ * @param pUserData
+ * @param iov - lines
+ * @param count
+ */
+void pump_fan_out(appender_ipc_udata_t* pUserData, const struct iovec* iov, int count)
+{
+    for (int i = 0; i < pUserData->conf.numSinks; i++)
+    {
+        if (pUserData->sinks[i])
+        {
+            ipc_sink_writev(pUserData->sinks[i], iov, count);
+        }
+    }
+}
+
+/*******************************************************************************
+ * @brief Close the outputs of a rolled file; runs on the roll thread
+ * @param handle - appender_ipc_rolled_t, freed
+ */
+static void roll_close_output(void* handle)
+{
+    appender_ipc_rolled_t* rolled = (appender_ipc_rolled_t*) handle;
+
+    // waits for the writes in flight
+    ipc_writer_destroy(rolled->writer);
+    ipc_segment_close(rolled->segment);
+    ipc_gzip_destroy(rolled->gzip);
+
+    if (rolled->fp)
+    {
+        fclose(rolled->fp);
+    }
+
+    free(rolled);
+}
+
+/*******************************************************************************
+ * @brief Next rolling by time: the next multiple of the interval in local
+ *        time, so that "daily" rolls at midnight
+ * @param interval - seconds, 0 for none
+ * @param now
+ * @return time, 0 for none
+ */
+static time_t roll_next_time(int interval, time_t now)
+{
+    if (interval <= 0)
+    {
+        return 0;
+    }
+
+    struct tm tmNow;
+    localtime_r(&now, &tmNow);
+
+    time_t local = now + tmNow.tm_gmtoff;
+
+    return (local / interval + 1) * interval - tmNow.tm_gmtoff;
+}
+
+/*******************************************************************************
+ * @brief Name of a rolled file: the time of rolling goes after the file
+ *        name, e.g. "log.txt.20260101-000000", with a counter if it's taken
+ * @param out - [out]
+ * @param size - size of out
+ * @param filePath - output file
+ * @param now - time of rolling
+ * @return 0 upon success, -1 if there is no free name
+ */
+static int roll_file_path(char* out, size_t size, const char* filePath, time_t now)
+{
+    char stamp[16];
+    struct tm tmNow;
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r(&now, &tmNow));
+
+    for (int i = 0; i < MAX_ROLL_SUFFIX; i++)
+    {
+        char gzPath[1024];
+
+        if (0 == i)
+        {
+            snprintf(out, size, "%s.%s", filePath, stamp);
+        }
+        else
+        {
+            snprintf(out, size, "%s.%s-%d", filePath, stamp, i);
+        }
+
+        // neither the file nor its archive may exist
+        snprintf(gzPath, sizeof(gzPath), "%s.gz", out);
+
+        if (-1 == access(out, F_OK) && -1 == access(gzPath, F_OK))
+        {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*******************************************************************************
+ * @brief Absolute time the given number of milliseconds from now
+ * @param clockId - clock the time is measured with
+ * @param ms
+ * @param at - [out]
+ */
+void time_after_ms(clockid_t clockId, int ms, struct timespec* at)
+{
+    clock_gettime(clockId, at);
+
+    at->tv_sec  += ms / 1000;
+    at->tv_nsec += (long)(ms % 1000) * 1000000L;
+
+    if (at->tv_nsec >= 1000000000L)
+    {
+        at->tv_sec++;
+        at->tv_nsec -= 1000000000L;
+    }
+}
+
+/*******************************************************************************
+ * @brief Flush the output file to the disk
+ *
+ * The asynchronous writer finishes its writes first and the compressor
+ * writes out the frame it's building; the mapped segments are flushed
+ * together with the file.
+ *
+ * @param pUserData
+ * @return 0 upon success, -1 otherwise
+ */
+int pump_sync_output(appender_ipc_udata_t* pUserData)
+{
+    ipc_stats_master_t* stats = pUserData->stats ? &ipc_stats_shared(pUserData->stats)->master : NULL;
+    struct timespec start;
+    int result;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (pUserData->writer)
+    {
+        result = ipc_writer_sync(pUserData->writer);
+    }
+    else if (pUserData->segment)
+    {
+        result = ipc_segment_sync(pUserData->segment);
+    }
+    else if (pUserData->gzip)
+    {
+        result = ipc_gzip_sync(pUserData->gzip);
+    }
+    else if (-1 == (result = fdatasync(pUserData->outFd)))
+    {
+        ERROR_LOG("fdatasync() failed: %s\n", strerror(errno));
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (stats)
+    {
+        ipc_stats_sample(stats->fsyncHist, ((end.tv_sec - start.tv_sec) * 1000000000LL
+                                            + end.tv_nsec - start.tv_nsec) / 1000);
+    }
+
+    if (0 == result)
+    {
+        pUserData->bDirty = 0;
+    }
+    else
+    {
+        // a later fdatasync() may succeed without the pages that failed
+        pUserData->bWriteFailed = 1;
+    }
+
+    // also after a failure, so a broken disk isn't retried after every batch
+    time_after_ms(CLOCK_MONOTONIC, pUserData->conf.fsyncMs, &pUserData->nextSync);
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Flush the entries of the directory a file is in to the disk
+ * @param filePath
+ */
+static void sync_directory(const char* filePath)
+{
+    char dir[512];
+    const char* slash = strrchr(filePath, '/');
+
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - filePath) + 1 : 1, slash ? filePath : ".");
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (-1 == fd || -1 == fsync(fd))
+    {
+        ERROR_LOG("Can't sync directory %s: %s\n", dir, strerror(errno));
+    }
+
+    if (-1 != fd)
+    {
+        close(fd);
+    }
+}
+
+/*******************************************************************************
+ * @brief Roll the output file over to a new one
+ *
+ * Only the rename() and opening the new file happen on the pump thread;
+ * the old outputs are closed (waiting for the writes in flight) and the
+ * file compressed by the roll thread. If the new file can't be opened, the
+ * old one gets its name back and stays in use.
+ *
+ * @param pUserData
+ */
+void pump_roll(appender_ipc_udata_t* pUserData)
+{
+    char rolledPath[sizeof(pUserData->filePath) + 32];
+    time_t now = time(NULL);
+
+    // whatever happens, the next attempt is one interval or roll_size later;
+    // the size stays until there is a new file, the index counts on it
+    pUserData->rollFrom = pUserData->fileSize;
+    pUserData->rollAt   = roll_next_time(pUserData->conf.rollInterval, now);
+
+    appender_ipc_rolled_t* rolled = (appender_ipc_rolled_t*) malloc(sizeof(appender_ipc_rolled_t));
+
+    if (NULL == rolled || -1 == roll_file_path(rolledPath, sizeof(rolledPath), pUserData->filePath, now))
+    {
+        ERROR_LOG("Can't roll %s\n", pUserData->filePath);
+        free(rolled);
+        return;
+    }
+
+    // acknowledged requests may cover lines of the old file
+    if (IPC_DURABILITY_NONE != pUserData->conf.durability && pUserData->bDirty)
+    {
+        pump_sync_output(pUserData);
+    }
+
+    if (-1 == rename(pUserData->filePath, rolledPath))
+    {
+        ERROR_LOG("rename() failed: %s, %s\n", pUserData->filePath, strerror(errno));
+        free(rolled);
+        return;
+    }
+
+    int outFd = pUserData->outFd;
+    ipc_binlog_index_t* index = pUserData->index;
+    char indexPath[sizeof(pUserData->filePath) + 8];
+    char rolledIndexPath[sizeof(rolledPath) + 8];
+
+    // the index follows its file (it's never compressed)
+    int bIndexRenamed = index
+                     && 0 == ipc_binlog_index_path(indexPath, sizeof(indexPath), pUserData->filePath)
+                     && 0 == ipc_binlog_index_path(rolledIndexPath, sizeof(rolledIndexPath), rolledPath)
+                     && 0 == rename(indexPath, rolledIndexPath);
+
+    rolled->fp      = log4c_stream2_get_fp(pUserData->rollingFileAppender);
+    rolled->writer  = pUserData->writer;
+    rolled->segment = pUserData->segment;
+    rolled->gzip    = pUserData->gzip;
+
+    unsigned long long fileSize = pUserData->fileSize;
+
+    pUserData->writer   = NULL;
+    pUserData->segment  = NULL;
+    pUserData->gzip     = NULL;
+    pUserData->index    = NULL;
+    pUserData->fileSize = 0;
+
+    if (-1 == output_open(pUserData))
+    {
+        if (-1 == rename(rolledPath, pUserData->filePath))
+        {
+            ERROR_LOG("rename() failed: %s, %s\n", rolledPath, strerror(errno));
+        }
+        else if (bIndexRenamed && -1 == rename(rolledIndexPath, indexPath))
+        {
+            ERROR_LOG("rename() failed: %s, %s\n", rolledIndexPath, strerror(errno));
+        }
+
+        pUserData->outFd   = outFd;
+        pUserData->writer  = rolled->writer;
+        pUserData->segment = rolled->segment;
+        pUserData->gzip    = rolled->gzip;
+        pUserData->index   = index;
+        pUserData->fileSize = fileSize;
+        free(rolled);
+        return;
+    }
+
+    pUserData->rollFrom = 0;
+
+    // entries are written by the pump right away, nothing is in flight
+    ipc_binlog_index_close(index);
+
+    INFO_LOG("Rolled %s over to %s\n", pUserData->filePath, rolledPath);
+
+    // the new name and the new file must survive a crash as well
+    if (IPC_DURABILITY_NONE != pUserData->conf.durability)
+    {
+        sync_directory(pUserData->filePath);
+    }
+
+    // a compressed file is gzip already
+    ipc_roll_submit(rolledPath, roll_close_output, rolled, pUserData->conf.bCompress && NULL == rolled->gzip,
+                    IPC_DURABILITY_NONE != pUserData->conf.durability);
+}
+
+/*******************************************************************************
+ * @brief Roll the output file if it's big or old enough
+ * @param pUserData
+ */
+void pump_roll_if_due(appender_ipc_udata_t* pUserData)
+{
+    if (pUserData->bRolling
+        && ((pUserData->conf.rollSize && pUserData->fileSize - pUserData->rollFrom >= pUserData->conf.rollSize)
+            || (pUserData->rollAt && time(NULL) >= pUserData->rollAt)))
+    {
+        pump_roll(pUserData);
+    }
+}
+
+/*******************************************************************************
+ * @brief Copy lines to the asynchronous writer, into the mapped file or to the compressor
+ * @param pUserData
+ * @param iov - lines
+ * @param count
+ * @return 0 upon success, -1 if a write has failed
+ */
+int pump_output(appender_ipc_udata_t* pUserData, const struct iovec* iov, int count)
+{
+    unsigned long long offset = pUserData->fileSize;
+    int result;
+
+    for (int i = 0; i < count; i++)
+    {
+        pUserData->fileSize += iov[i].iov_len;
+    }
+
+    pUserData->bDirty = 1;
+
+    if (pUserData->segment)
+    {
+        result = ipc_segment_writev(pUserData->segment, iov, count);
+    }
+    else if (pUserData->gzip)
+    {
+        result = ipc_gzip_writev(pUserData->gzip, iov, count);
+    }
+    else
+    {
+        // the last buffer fills up over several batches, see pump_output_idle()
+        result = ipc_writer_writev(pUserData->writer, iov, count);
+    }
+
+    // the index is a hint: lines that may not have made it are left out
+    if (0 == result && pUserData->index)
+    {
+        ipc_binlog_index_add(pUserData->index, offset, iov, count);
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Send the partly filled buffer of the asynchronous writer on its way
+ *        once the transport is empty, before the pump waits for more
+ * @param pUserData
+ */
+void pump_output_idle(appender_ipc_udata_t* pUserData)
+{
+    if (pUserData->writer && -1 == ipc_writer_flush(pUserData->writer))
+    {
+        ERROR_LOG("write failed: %s\n", strerror(errno));
+        pUserData->bWriteFailed = 1;
+    }
+}
+
+/*******************************************************************************
+ * @brief Hand all collected lines to the asynchronous writer, the mapping or the compressor
+ *
+ * The lines are copied, so the batch can be reused right away; the pump
+ * waits only if every buffer of the writer is still being written.
+ *
+ * @param pUserData
+ * @param batch
+ * @return 0 upon success, -1 if a write has failed
+ */
+int pump_write_async(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    ipc_stats_master_t* stats = pUserData->stats ? &ipc_stats_shared(pUserData->stats)->master : NULL;
+    struct timespec start;
+
+    if (stats)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+
+    int result = pump_output(pUserData, batch->iov, batch->iovCount);
+
+    if (-1 == result)
+    {
+        ERROR_LOG("write failed: %s\n", strerror(errno));
+        pUserData->bWriteFailed = 1;
+    }
+
+    if (stats)
+    {
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        size_t bytes = 0;
+
+        for (int i = 0; i < batch->iovCount; i++)
+        {
+            bytes += batch->iov[i].iov_len;
+        }
+
+        ipc_stats_sample(stats->writeHist, ((end.tv_sec - start.tv_sec) * 1000000000LL
+                                            + end.tv_nsec - start.tv_nsec) / 1000);
+        atomic_fetch_add_explicit(&stats->lines, batch->iovCount, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->writes, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->bytes, bytes, memory_order_relaxed);
+    }
+
+    batch->iovCount = 0;
+    batch->textUsed = 0;
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Write all collected lines to the file
+ *
+ * One writev() per batch instead of one write() per message. Partial writes
+ * are resumed, so the file never gets a truncated line.
+ *
+ * Received messages stay in the batch, so this can be called in the middle of
+ * a frame to make room for more formatted lines.
+ *
+ * @param pUserData
+ * @param batch
+ * @return 0 upon success, -1 otherwise
+ */
+int pump_write_batch(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    struct iovec* iov = batch->iov;
+    int count = batch->iovCount;
+    int result = 0;
+    ipc_stats_master_t* stats = pUserData->stats ? &ipc_stats_shared(pUserData->stats)->master : NULL;
+
+    // copied before the writes below move through the batch
+    pump_fan_out(pUserData, iov, count);
+
+    if (pUserData->writer || pUserData->segment || pUserData->gzip)
+    {
+        result = pump_write_async(pUserData, batch);
+        pump_roll_if_due(pUserData);
+
+        return result;
+    }
+
+    DEBUG_LOG("writev(%d messages)\n", count);
+
+    // indexed once written; a line written in parts gets its entry back in between
+    unsigned long long offset = pUserData->fileSize;
+    struct iovec* partial = NULL;
+    struct iovec partialOrig;
+
+    if (stats)
+    {
+        atomic_fetch_add_explicit(&stats->lines, count, memory_order_relaxed);
+    }
+
+    while (count > 0)
+    {
+        struct timespec start;
+
+        if (stats)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
+
+        ssize_t written = writev(pUserData->outFd, iov, count < MAX_IOV_PER_WRITE ? count : MAX_IOV_PER_WRITE);
+
+        if (stats)
+        {
+            struct timespec end;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            ipc_stats_sample(stats->writeHist, ((end.tv_sec - start.tv_sec) * 1000000000LL
+                                                + end.tv_nsec - start.tv_nsec) / 1000);
+            atomic_fetch_add_explicit(&stats->writes, 1, memory_order_relaxed);
+
+            if (written > 0)
+            {
+                atomic_fetch_add_explicit(&stats->bytes, written, memory_order_relaxed);
+            }
+        }
+
+        if (-1 == written)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+
+            ERROR_LOG("writev() failed: %s\n", strerror(errno));
+            pUserData->bWriteFailed = 1;
+            result = -1;
+            break;
+        }
+
+        pUserData->fileSize += written;
+        pUserData->bDirty = 1;
+
+        // skip fully written entries, then adjust the partially written one
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+
+            if (iov == partial)
+            {
+                *iov = partialOrig;
+            }
+
+            iov++;
+            count--;
+        }
+
+        if (count > 0 && written > 0)
+        {
+            if (iov != partial)
+            {
+                partial     = iov;
+                partialOrig = *iov;
+            }
+
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    if (pUserData->index)
+    {
+        ipc_binlog_index_add(pUserData->index, offset, batch->iov, (int)(iov - batch->iov));
+    }
+
+    batch->iovCount = 0;
+    batch->textUsed = 0;
+
+    pump_roll_if_due(pUserData);
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Publish the batch size and how full the transport is
+ * @param pUserData
+ * @param batch - batch about to be written
+ */
+void pump_sample_stats(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    ipc_stats_master_t* stats = &ipc_stats_shared(pUserData->stats)->master;
+    struct mq_attr attr;
+
+    atomic_fetch_add_explicit(&stats->batches, 1, memory_order_relaxed);
+    ipc_stats_sample(stats->batchHist, batch->count);
+
+    // what is left after taking this batch
+    if (0 == mq_getattr(pUserData->mqueueServer, &attr))
+    {
+        atomic_store_explicit(&stats->queueDepth, attr.mq_curmsgs, memory_order_relaxed);
+        ipc_stats_max(&stats->queueDepthMax, attr.mq_curmsgs);
+    }
+
+    if (pUserData->ring)
+    {
+        size_t used = ipc_ring_used(pUserData->ring);
+
+        atomic_store_explicit(&stats->ringUsed, used, memory_order_relaxed);
+        ipc_stats_max(&stats->ringUsedMax, used);
+    }
+}
+
+/*******************************************************************************
+ * @brief Make what is written durable and acknowledge the sync requests
+ *        that came before it
+ *
+ * One fdatasync() covers every request received since the previous one,
+ * however many producers are waiting (group commit).
+ *
+ * After a failed write or fdatasync(), lines sent before the pending
+ * requests may be lost: those requests are never acknowledged and their
+ * producers time out.
+ *
+ * @param pUserData
+ */
+void pump_commit(appender_ipc_udata_t* pUserData)
+{
+    if (pUserData->bDirty)
+    {
+        pump_sync_output(pUserData);
+    }
+
+    // kept until there are requests to refuse
+    if (pUserData->bWriteFailed)
+    {
+        if (pUserData->numSyncTickets > 0)
+        {
+            ERROR_LOG("Not acknowledging %d sync requests after a failed write\n", pUserData->numSyncTickets);
+
+            pUserData->numSyncTickets = 0;
+            pUserData->numSyncReady   = 0;
+            pUserData->bWriteFailed   = 0;
+        }
+
+        return;
+    }
+
+    int numReady = pUserData->numSyncReady;
+
+    for (int i = 0; i < numReady; i++)
+    {
+        ipc_lease_sync_done(pUserData->lease, pUserData->syncTickets[i]);
+    }
+
+    // the tickets still waiting for the transports to be polled move up
+    pUserData->numSyncTickets -= numReady;
+    pUserData->numSyncReady    = 0;
+    memmove(pUserData->syncTickets, pUserData->syncTickets + numReady,
+            pUserData->numSyncTickets * sizeof(pUserData->syncTickets[0]));
+}
+
+/*******************************************************************************
+ * @brief Commit if the durability policy asks for it now
+ * @param pUserData
+ */
+void pump_commit_if_due(appender_ipc_udata_t* pUserData)
+{
+    struct timespec now;
+
+    switch (pUserData->conf.durability)
+    {
+    case IPC_DURABILITY_GROUP:
+        if (pUserData->numSyncReady > 0)
+        {
+            pump_commit(pUserData);
+        }
+        break;
+
+    case IPC_DURABILITY_PERIODIC:
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        // a request with nothing unsynced before it is acknowledged right away
+        if ((pUserData->numSyncReady > 0 && !pUserData->bDirty)
+            || (pUserData->bDirty && (now.tv_sec > pUserData->nextSync.tv_sec
+                                      || (now.tv_sec == pUserData->nextSync.tv_sec
+                                          && now.tv_nsec >= pUserData->nextSync.tv_nsec))))
+        {
+            pump_commit(pUserData);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*******************************************************************************
+ * @brief Time until the pump has something to do even if nothing comes:
+ *        the next drop report or filter summary, periodic fdatasync() or look at
+ *        the spill journals
+ * @param pUserData
+ * @return milliseconds, -1 if there is nothing to wait for
+ */
+int pump_idle_ms(appender_ipc_udata_t* pUserData)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long ms = -1;
+
+    if (pump_drops_pending(pUserData))
+    {
+        ms = (pUserData->lastDropReport.tv_sec + pUserData->conf.dropReportS - now.tv_sec) * 1000LL;
+        ms = ms > 0 ? ms : 0;
+    }
+
+    if (IPC_DURABILITY_PERIODIC == pUserData->conf.durability && pUserData->bDirty)
+    {
+        long long syncMs = (long long)(pUserData->nextSync.tv_sec - now.tv_sec) * 1000
+                         + (pUserData->nextSync.tv_nsec - now.tv_nsec) / 1000000;
+        syncMs = syncMs > 0 ? syncMs : 0;
+
+        if (ms < 0 || syncMs < ms)
+        {
+            ms = syncMs;
+        }
+    }
+
+    if (pUserData->pumpFilter)
+    {
+        int dueMs = ipc_filter_due_ms(pUserData->pumpFilter, filter_now_ms());
+
+        if (dueMs >= 0 && (ms < 0 || dueMs < ms))
+        {
+            ms = dueMs;
+        }
+    }
+
+    if (IPC_OVERFLOW_SPILL == pUserData->conf.overflow)
+    {
+        long long scanMs = (long long)(pUserData->spillScanAt.tv_sec - now.tv_sec) * 1000
+                         + (pUserData->spillScanAt.tv_nsec - now.tv_nsec) / 1000000;
+        scanMs = scanMs > 0 && !pump_spills_pending(pUserData) ? scanMs : 0;
+
+        if (ms < 0 || scanMs < ms)
+        {
+            ms = scanMs;
+        }
+    }
+
+    return (int)ms;
+}
+
+/*******************************************************************************
+ * @brief Write the batch and start collecting the next one
+ * @param pUserData
+ * @param batch
+ * @return 0 upon success, -1 otherwise
+ */
+int pump_flush_batch(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    if (pUserData->stats && batch->count > 0)
+    {
+        pump_sample_stats(pUserData, batch);
+    }
+
+    int result = pump_write_batch(pUserData, batch);
+
+    pump_commit_if_due(pUserData);
+
+    batch->count = 0;
+
+    if (pUserData->reasm)
+    {
+        ipc_reasm_recycle(pUserData->reasm);
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Absolute CLOCK_REALTIME deadline the batch may linger until
+ * @param pUserData
+ * @param deadline - [out]
+ */
+void pump_linger_deadline(appender_ipc_udata_t* pUserData, struct timespec* deadline)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+
+    deadline->tv_sec  += pUserData->conf.lingerMs / 1000;
+    deadline->tv_nsec += (long)(pUserData->conf.lingerMs % 1000) * 1000000L;
+
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/*******************************************************************************
+ * @brief Milliseconds left until the deadline
+ * @param deadline - absolute CLOCK_REALTIME time
+ * @return 0 if the deadline has passed
+ */
+int pump_ms_left(const struct timespec* deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    long long ms = (long long)(deadline->tv_sec - now.tv_sec) * 1000
+                 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+    return ms > 0 ? (int)ms : 0;
+}
+
+/*******************************************************************************
+ * @brief Look for spill journals next to the output file
+ *
+ * Journals left by processes that are gone are picked up as well: what they
+ * spilled is still to be written.
+ *
+ * @param pUserData
+ */
+void pump_scan_spills(appender_ipc_udata_t* pUserData)
+{
+    const char* filePath = pUserData->filePath;
+    const char* slash = strrchr(filePath, '/');
+    char dir[sizeof(pUserData->filePath)];
+    char prefix[sizeof(pUserData->filePath) + 8];
+
+    if (NULL == slash)
+    {
+        snprintf(dir, sizeof(dir), ".");
+    }
+    else
+    {
+        snprintf(dir, sizeof(dir), "%.*s", slash == filePath ? 1 : (int)(slash - filePath), filePath);
+    }
+
+    int prefixLen = snprintf(prefix, sizeof(prefix), "%s.spill.", slash ? slash + 1 : filePath);
+
+    time_after_ms(CLOCK_MONOTONIC, SPILL_SCAN_MS, &pUserData->spillScanAt);
+
+    DIR* dirp = opendir(dir);
+
+    if (NULL == dirp)
+    {
+        return;
+    }
+
+    struct dirent* entry;
+
+    while (NULL != (entry = readdir(dirp)))
+    {
+        if (0 != strncmp(entry->d_name, prefix, prefixLen))
+        {
+            continue;
+        }
+
+        char path[sizeof(dir) + 256 + 2];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+
+        appender_ipc_spill_source_t* source = pUserData->spillSources;
+
+        while (source && 0 != strcmp(source->path, path))
+        {
+            source = source->next;
+        }
+
+        ipc_spill_t* journal;
+
+        if (source || NULL == (journal = ipc_spill_attach(path)))
+        {
+            continue;
+        }
+
+        if (NULL == (source = (appender_ipc_spill_source_t*) malloc(sizeof(*source) + strlen(path) + 1)))
+        {
+            ipc_spill_close(journal);
+            continue;
+        }
+
+        source->journal = journal;
+        source->bTaken  = 0;
+        strcpy(source->path, path);
+        source->next = pUserData->spillSources;
+        pUserData->spillSources = source;
+    }
+
+    closedir(dirp);
+}
+
+/*******************************************************************************
+ * @brief Forget the journals that are merged and won't grow any more
+ *
+ * The journal of a live process stays, so it's not recreated with every
+ * burst; the one of a process that is gone is removed.
+ *
+ * @param pUserData
+ */
+void pump_retire_spills(appender_ipc_udata_t* pUserData)
+{
+    appender_ipc_spill_source_t** link = &pUserData->spillSources;
+
+    while (*link)
+    {
+        appender_ipc_spill_source_t* source = *link;
+        pid_t owner = ipc_spill_owner(source->journal);
+        int bUnlinked = ipc_spill_unlinked(source->journal);
+
+        if (ipc_spill_pending(source->journal)
+            || (!bUnlinked && (owner == getpid() || 0 == kill(owner, 0) || ESRCH != errno)))
+        {
+            link = &source->next;
+            continue;
+        }
+
+        if (!bUnlinked)
+        {
+            unlink(source->path);
+        }
+
+        ipc_spill_close(source->journal);
+        *link = source->next;
+        free(source);
+    }
+}
+
+/*******************************************************************************
+ * @brief Merge the spill journals back into the output
+ *
+ * The messages of all journals are taken oldest first, by the time they were
+ * spilled. A process spills only when the transport is full and goes on until
+ * its journal is merged, so its journal is taken when the transports are idle
+ * (whatever the process sent before spilling is written by then), or once
+ * the oldest message has waited SPILL_HOLD_MS under a sustained load.
+ *
+ * Called with the pump's own batch written out.
+ *
+ * @param pUserData
+ * @param bIdle - 1 if the transports were just found empty
+ * @return number of messages merged
+ */
+int pump_merge_spills(appender_ipc_udata_t* pUserData, int bIdle)
+{
+    appender_ipc_batch_t* batch = &pUserData->spillBatch;
+    struct timespec now;
+
+    if (IPC_OVERFLOW_SPILL != pUserData->conf.overflow || 0 == batch->capacity)
+    {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (now.tv_sec > pUserData->spillScanAt.tv_sec
+        || (now.tv_sec == pUserData->spillScanAt.tv_sec && now.tv_nsec >= pUserData->spillScanAt.tv_nsec))
+    {
+        pump_retire_spills(pUserData);
+        pump_scan_spills(pUserData);
+    }
+
+    if (!bIdle)
+    {
+        uint64_t oldest = UINT64_MAX;
+
+        for (appender_ipc_spill_source_t* source = pUserData->spillSources; source; source = source->next)
+        {
+            uint64_t stamp;
+            const char* data;
+            size_t len;
+
+            if (ipc_spill_peek(source->journal, &stamp, &data, &len) && stamp < oldest)
+            {
+                oldest = stamp;
+            }
+        }
+
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        if (UINT64_MAX == oldest
+            || (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec < oldest + SPILL_HOLD_MS * 1000000ULL)
+        {
+            return 0;
+        }
+    }
+
+    int merged = 0;
+
+    for (int round = 0; round < SPILL_BATCHES_PER_CALL; round++)
+    {
+        while (batch->count < batch->capacity)
+        {
+            appender_ipc_spill_source_t* next = NULL;
+            uint64_t nextStamp = 0;
+            const char* nextData = NULL;
+            size_t nextLen = 0;
+
+            for (appender_ipc_spill_source_t* source = pUserData->spillSources; source; source = source->next)
+            {
+                uint64_t stamp;
+                const char* data;
+                size_t len;
+
+                if (ipc_spill_peek(source->journal, &stamp, &data, &len) && (NULL == next || stamp < nextStamp))
+                {
+                    next      = source;
+                    nextStamp = stamp;
+                    nextData  = data;
+                    nextLen   = len;
+                }
+            }
+
+            if (NULL == next)
+            {
+                break;
+            }
+
+            // the peek of the chosen journal is still the one returned above
+            ipc_spill_next(next->journal);
+            next->bTaken = 1;
+
+            pump_collect_message(pUserData, batch, nextData, nextLen);
+        }
+
+        int count = batch->count;
+
+        if (0 == count)
+        {
+            break;
+        }
+
+        // the messages are used in place, the journals get them back once written
+        pump_flush_batch(pUserData, batch);
+
+        for (appender_ipc_spill_source_t* source = pUserData->spillSources; source; source = source->next)
+        {
+            if (source->bTaken)
+            {
+                ipc_spill_release(source->journal);
+                source->bTaken = 0;
+            }
+        }
+
+        if (pUserData->stats)
+        {
+            atomic_fetch_add_explicit(&ipc_stats_shared(pUserData->stats)->master.spillMerged, count,
+                                      memory_order_relaxed);
+        }
+
+        merged += count;
+    }
+
+    return merged;
+}
+
+/*******************************************************************************
+ * @brief Check for spilled messages the master can see
+ * @param pUserData
+ * @return 1 if there are some, 0 otherwise
+ */
+int pump_spills_pending(appender_ipc_udata_t* pUserData)
+{
+    if (0 == pUserData->spillBatch.capacity)
+    {
+        return 0;
+    }
+
+    for (appender_ipc_spill_source_t* source = pUserData->spillSources; source; source = source->next)
+    {
+        if (ipc_spill_pending(source->journal))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Write out everything left in the transport
+ *
+ * Called by the last instance only: nobody else would ever read it.
+ *
+ * @param pUserData
+ * @param batch
+ */
+void pump_drain(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    const struct timespec noWait = {0, 0};
+    int bFull = 1;
+
+    while (bFull)
+    {
+        const char* record;
+        size_t len;
+        ssize_t bytes_read;
+
+        while (batch->count < batch->capacity
+               && pUserData->ring && ipc_ring_next(pUserData->ring, &record, &len))
+        {
+            pump_collect_message(pUserData, batch, record, len);
+        }
+
+        while (batch->count < batch->capacity
+               && (bytes_read = mq_timedreceive(pUserData->mqueueServer, pump_batch_slot(batch),
+                                                MAX_MSG_SIZE, 0, &noWait)) >= 0)
+        {
+            pump_collect_message(pUserData, batch, pump_batch_slot(batch), bytes_read);
+        }
+
+        bFull = (batch->count == batch->capacity);
+
+        pump_flush_batch(pUserData, batch);
+
+        if (pUserData->ring)
+        {
+            ipc_ring_release(pUserData->ring);
+        }
+    }
+
+    // journals of every process, including those that are gone
+    pUserData->spillScanAt.tv_sec = 0;
+
+    while (pump_merge_spills(pUserData, 1) > 0)
+    {
+    }
+}
+
+/*******************************************************************************
+ * @brief Pump loop for the shared-memory transport
+ *
+ * Records are consumed in place: the batch refers to the ring memory, which
+ * is released only after the batch is written. The message queue is served
+ * first: it carries the urgent lane, and clients that fell back to it.
+ *
+ * @param pUserData
+ * @param batch
+ */
+void pump_from_ring_to_file(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    const struct timespec noWait = {0, 0};
+    struct timespec deadline;
+
+    while (PUMP_RUNNING == atomic_load(&pUserData->pumpStop))
+    {
+        const char* record;
+        size_t len;
+        int bFirst = (0 == batch->count);
+        int bUrgent = 0;
+        int numSyncSeen = pUserData->numSyncTickets;
+
+        // expired timeout turns mq_timedreceive into a non-blocking poll
+        ssize_t bytes_read;
+        unsigned int priority;
+
+        while (batch->count < batch->capacity
+               && (bytes_read = mq_timedreceive(pUserData->mqueueServer, pump_batch_slot(batch),
+                                                MAX_MSG_SIZE, &priority, &noWait)) >= 0)
+        {
+            pump_collect_message(pUserData, batch, pump_batch_slot(batch), bytes_read);
+            bUrgent |= (IPC_LANE_URGENT == priority);
+        }
+
+        if (batch->count < batch->capacity && ETIMEDOUT != errno && EAGAIN != errno)
+        {
+            ERROR_LOG("mq_timedreceive() failed\n");
+            break;
+        }
+
+        int bQueueEmpty = (batch->count < batch->capacity);
+
+        while (batch->count < batch->capacity && ipc_ring_next(pUserData->ring, &record, &len))
+        {
+            pump_collect_message(pUserData, batch, record, len);
+        }
+
+        // both transports were empty after the request came: whatever was
+        // sent before it is in the batch
+        if (numSyncSeen > 0 && bQueueEmpty && batch->count < batch->capacity)
+        {
+            pump_sync_ready(pUserData, numSyncSeen);
+        }
+
+        if (bFirst && batch->count > 0)
+        {
+            pump_linger_deadline(pUserData, &deadline);
+        }
+
+        // urgent lines and sync requests don't linger
+        int bHurry = bUrgent || pUserData->numSyncTickets > 0;
+        int msLeft = batch->count > 0 ? (bHurry ? 0 : pump_ms_left(&deadline)) : PUMP_IDLE_WAIT_MS;
+        int idleMs = pump_idle_ms(pUserData);
+
+        if (0 == batch->count && idleMs >= 0 && idleMs < msLeft)
+        {
+            msLeft = idleMs;
+        }
+
+        if (batch->count == batch->capacity || (batch->count > 0 && 0 == msLeft))
+        {
+            pump_flush_batch(pUserData, batch);
+            ipc_ring_release(pUserData->ring);
+            pump_report_drops(pUserData, 0);
+            pump_report_filtered(pUserData, batch, 0);
+            pump_merge_spills(pUserData, 0);
+        }
+        else
+        {
+            if (0 == batch->count)
+            {
+                pump_report_drops(pUserData, 0);
+                pump_report_filtered(pUserData, batch, 0);
+                pump_commit_if_due(pUserData);
+
+                // both transports are empty
+                if (pump_merge_spills(pUserData, 1) > 0)
+                {
+                    continue;
+                }
+
+                pump_output_idle(pUserData);
+            }
+
+            ipc_ring_wait_data(pUserData->ring, pUserData->numSyncTickets > pUserData->numSyncReady ? 0 : msLeft);
+        }
+    }
+
+    if (PUMP_DRAIN == atomic_load(&pUserData->pumpStop))
+    {
+        pump_drain(pUserData, batch);
+    }
+
+    pump_flush_batch(pUserData, batch);
+    ipc_ring_release(pUserData->ring);
+    pump_report_drops(pUserData, 1);
+}
+
+/*******************************************************************************
+ * @brief Pump loop for the message queue transport
+ *
+ * Blocks only for the first message of a batch, then takes whatever else is
+ * available (waiting at most the linger time) and writes it all at once.
+ * Stopping is signalled with an empty message.
+ *
+ * @param pUserData
+ * @param batch
+ */
+void pump_from_mqueue_to_file(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    const struct timespec noWait = {0, 0};
+    struct timespec deadline;
+
+    while (PUMP_RUNNING == atomic_load(&pUserData->pumpStop))
+    {
+        ssize_t bytes_read;
+        unsigned int priority = 0;
+
+        DEBUG_LOG("mq_receive(pUserData->_mqueueServer, buffer, MAX_MSG_SIZE, 0)\n");
+
+        /* receive the message */
+        // the writer's partly filled buffer goes out only if the pump is about to block
+        bytes_read = pUserData->writer
+                   ? mq_timedreceive(pUserData->mqueueServer, pump_batch_slot(batch), MAX_MSG_SIZE, &priority, &noWait)
+                   : -1;
+
+        if (bytes_read < 0)
+        {
+            pump_output_idle(pUserData);
+
+            int idleMs = pump_idle_ms(pUserData);
+
+            if (idleMs >= 0)
+            {
+                // wake up in time for the next drop report or fdatasync() even if nothing comes
+                struct timespec wakeAt;
+                time_after_ms(CLOCK_REALTIME, idleMs, &wakeAt);
+
+                bytes_read = mq_timedreceive(pUserData->mqueueServer, pump_batch_slot(batch), MAX_MSG_SIZE,
+                                             &priority, &wakeAt);
+            }
+            else
+            {
+                bytes_read = mq_receive(pUserData->mqueueServer, pump_batch_slot(batch), MAX_MSG_SIZE, &priority);
+            }
+        }
+
+        if (bytes_read < 0)
+        {
+            if (EINTR == errno || ETIMEDOUT == errno)
+            {
+                int bIdle = (ETIMEDOUT == errno);
+
+                pump_report_drops(pUserData, 0);
+                pump_report_filtered(pUserData, batch, 0);
+                pump_commit_if_due(pUserData);
+                pump_merge_spills(pUserData, bIdle);
+                continue;
+            }
+
+            ERROR_LOG("mq_receive() failed\n");
+            break;
+        }
+
+        pump_collect_message(pUserData, batch, pump_batch_slot(batch), bytes_read);
+        pump_linger_deadline(pUserData, &deadline);
+
+        // the queue hands out urgent messages first; once one is in the
+        // batch, take what is there without lingering
+        int bUrgent = (IPC_LANE_URGENT == priority);
+
+        while (batch->count < batch->capacity
+               && (bytes_read = mq_timedreceive(pUserData->mqueueServer, pump_batch_slot(batch), MAX_MSG_SIZE,
+                                                &priority,
+                                                pUserData->conf.lingerMs > 0 && !bUrgent && 0 == pUserData->numSyncReady
+                                                ? &deadline : &noWait)) >= 0)
+        {
+            pump_collect_message(pUserData, batch, pump_batch_slot(batch), bytes_read);
+            bUrgent |= (IPC_LANE_URGENT == priority);
+        }
+
+        pump_flush_batch(pUserData, batch);
+        pump_report_drops(pUserData, 0);
+        pump_report_filtered(pUserData, batch, 0);
+        pump_merge_spills(pUserData, 0);
+    }
+
+    if (PUMP_DRAIN == atomic_load(&pUserData->pumpStop))
+    {
+        pump_drain(pUserData, batch);
+    }
+
+    pump_report_drops(pUserData, 1);
+}
+
+/*******************************************************************************
+ * @brief Take what the socket holds into the batch
+ * @param pUserData
+ * @param batch
+ * @return 1 if every connection was found empty, 0 if the batch is full
+ */
+int pump_receive_socket(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    size_t lens[SOCKET_RECEIVE_MAX];
+
+    while (batch->count < batch->capacity)
+    {
+        int room = batch->capacity - batch->count;
+        int want = room < SOCKET_RECEIVE_MAX ? room : SOCKET_RECEIVE_MAX;
+        int got = ipc_sock_receive(pUserData->sockServer, pump_batch_slot(batch), batch->slotSize, want, lens);
+
+        for (int i = 0; i < got; i++)
+        {
+            pump_collect_message(pUserData, batch, pump_batch_slot(batch), lens[i]);
+        }
+
+        if (got < want)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Pump loop for the socket transport
+ *
+ * Same as the ring loop: the message queue is served first, then the socket
+ * with as few calls as possible, and both are waited for at once. Stopping
+ * is signalled with an empty message in the queue.
+ *
+ * What the connections hold is read to the end whether another instance
+ * takes over or not: nobody else can read it. Senders get EPIPE meanwhile
+ * and turn to the message queue until the next master listens.
+ *
+ * @param pUserData
+ * @param batch
+ */
+void pump_from_socket_to_file(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    const struct timespec noWait = {0, 0};
+    struct timespec deadline;
+
+    while (PUMP_RUNNING == atomic_load(&pUserData->pumpStop))
+    {
+        int bFirst = (0 == batch->count);
+        int bUrgent = 0;
+        int numSyncSeen = pUserData->numSyncTickets;
+
+        // expired timeout turns mq_timedreceive into a non-blocking poll
+        ssize_t bytes_read;
+        unsigned int priority;
+
+        while (batch->count < batch->capacity
+               && (bytes_read = mq_timedreceive(pUserData->mqueueServer, pump_batch_slot(batch),
+                                                MAX_MSG_SIZE, &priority, &noWait)) >= 0)
+        {
+            pump_collect_message(pUserData, batch, pump_batch_slot(batch), bytes_read);
+            bUrgent |= (IPC_LANE_URGENT == priority);
+        }
+
+        if (batch->count < batch->capacity && ETIMEDOUT != errno && EAGAIN != errno)
+        {
+            ERROR_LOG("mq_timedreceive() failed\n");
+            break;
+        }
+
+        int bQueueEmpty = (batch->count < batch->capacity);
+
+        if (bQueueEmpty)
+        {
+            pump_forget_gone(pUserData);
+        }
+
+        int bSocketEmpty = pump_receive_socket(pUserData, batch);
+
+        // both transports were empty after the request came: whatever was
+        // sent before it is in the batch
+        if (numSyncSeen > 0 && bQueueEmpty && bSocketEmpty)
+        {
+            pump_sync_ready(pUserData, numSyncSeen);
+        }
+
+        if (bFirst && batch->count > 0)
+        {
+            pump_linger_deadline(pUserData, &deadline);
+        }
+
+        // urgent lines and sync requests don't linger
+        int bHurry = bUrgent || pUserData->numSyncTickets > 0;
+        int msLeft = batch->count > 0 ? (bHurry ? 0 : pump_ms_left(&deadline)) : PUMP_IDLE_WAIT_MS;
+        int idleMs = pump_idle_ms(pUserData);
+
+        if (0 == batch->count && idleMs >= 0 && idleMs < msLeft)
+        {
+            msLeft = idleMs;
+        }
+
+        if (batch->count == batch->capacity || (batch->count > 0 && 0 == msLeft))
+        {
+            pump_flush_batch(pUserData, batch);
+            pump_report_drops(pUserData, 0);
+            pump_report_filtered(pUserData, batch, 0);
+            pump_merge_spills(pUserData, 0);
+        }
+        else
+        {
+            if (0 == batch->count)
+            {
+                pump_report_drops(pUserData, 0);
+                pump_report_filtered(pUserData, batch, 0);
+                pump_commit_if_due(pUserData);
+
+                // both transports are empty
+                if (pump_merge_spills(pUserData, 1) > 0)
+                {
+                    continue;
+                }
+
+                pump_output_idle(pUserData);
+            }
+
+            ipc_sock_wait(pUserData->sockServer, pUserData->mqueueServer, pUserData->numSyncTickets > pUserData->numSyncReady ? 0 : msLeft);
+        }
+    }
+
+    ipc_sock_shutdown(pUserData->sockServer);
+
+    // a connection closes once it has nothing left
+    while (ipc_sock_clients(pUserData->sockServer) > 0)
+    {
+        pump_receive_socket(pUserData, batch);
+        pump_flush_batch(pUserData, batch);
+    }
+
+    if (PUMP_DRAIN == atomic_load(&pUserData->pumpStop))
+    {
+        pump_drain(pUserData, batch);
+    }
+
+    pump_flush_batch(pUserData, batch);
+    pump_report_drops(pUserData, 1);
+}
+
+/*******************************************************************************
+ * @brief Set up the state of the pump
+ * @param pUserData
+ * @param batch - [out]
+ * @return 0 upon success, -1 otherwise
+ */
+int pump_open(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    // the ring is read in place, only the message queue and the socket need storage
+    size_t slotSize = pUserData->sockServer ? MAX_SOCKET_MESSAGE : (size_t)MAX_MSG_SIZE;
+
+    if (-1 == pump_batch_init(batch, pUserData->conf.batchSize, slotSize))
+    {
+        ERROR_LOG("pump_batch_init() failed\n");
+        return -1;
+    }
+
+    // spilled messages are used in place
+    if (IPC_OVERFLOW_SPILL == pUserData->conf.overflow
+        && -1 == pump_batch_init(&pUserData->spillBatch, pUserData->conf.batchSize, 0))
+    {
+        ERROR_LOG("pump_batch_init() failed, spill journals are not merged\n");
+        memset(&pUserData->spillBatch, 0, sizeof(pUserData->spillBatch));
+    }
+
+    pUserData->spillScanAt.tv_sec  = 0;
+    pUserData->spillScanAt.tv_nsec = 0;
+    pUserData->numGonePids = 0;
+
+    // without it fragmented messages are dropped, the rest still works
+    pUserData->reasm = ipc_reasm_create(pUserData->conf.maxMessage, REASSEMBLY_MEMORY, pump_fragment_lost, pUserData);
+
+    if (NULL == pUserData->reasm)
+    {
+        ERROR_LOG("ipc_reasm_create() failed, large messages will be lost\n");
+    }
+
+    if (IPC_FILTER_ON_MASTER == pUserData->conf.filterOn
+        && (pUserData->conf.filter.dedupMs > 0 || pUserData->conf.filter.rate > 0)
+        && NULL == (pUserData->pumpFilter = ipc_filter_create(&pUserData->conf.filter, 0)))
+    {
+        ERROR_LOG("ipc_filter_create() failed, nothing is held back\n");
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Release the state of the pump
+ * @param pUserData
+ * @param batch
+ */
+void pump_close(appender_ipc_udata_t* pUserData, appender_ipc_batch_t* batch)
+{
+    // the next master starts counting from scratch
+    pump_report_filtered(pUserData, batch, 1);
+    ipc_filter_destroy(pUserData->pumpFilter);
+    pUserData->pumpFilter = NULL;
+
+    pump_batch_free(batch);
+    pump_batch_free(&pUserData->spillBatch);
+    memset(&pUserData->spillBatch, 0, sizeof(pUserData->spillBatch));
+
+    // the next master maps them again
+    while (pUserData->spillSources)
+    {
+        appender_ipc_spill_source_t* source = pUserData->spillSources;
+
+        pUserData->spillSources = source->next;
+        ipc_spill_close(source->journal);
+        free(source);
+    }
+
+    pump_forget_formats(pUserData, 1);
+    ipc_reasm_destroy(pUserData->reasm);
+    pUserData->reasm = NULL;
+}
+
+/*******************************************************************************
+ * @brief pump_from_queue_to_file
+ * @param param
+ * @return 0 upon success, -1 otherwise
+ */
+void* pump_from_queue_to_file(void* param)
+{
+    appender_ipc_udata_t* pUserData = (appender_ipc_udata_t*) param;
+    appender_ipc_batch_t batch;
+
+    INFO_LOG("ENTER\n");
+
+    if (-1 == pump_open(pUserData, &batch))
+    {
+        return (void*)-1;
+    }
+
+    if (pUserData->ring)
+    {
+        pump_from_ring_to_file(pUserData, &batch);
+    }
+    else if (pUserData->sockServer)
+    {
+        pump_from_socket_to_file(pUserData, &batch);
+    }
+    else
+    {
+        pump_from_mqueue_to_file(pUserData, &batch);
+    }
+
+    pump_close(pUserData, &batch);
+
+    INFO_LOG("EXIT\n");
+    return (void*)0;
+}
+
+/*******************************************************************************
+ * @brief Shared loop handler of a master's message queue
+ *
+ * The same batching as pump_from_mqueue_to_file(), but without blocking: a
+ * batch that may linger stays in pUserData until more messages come or the
+ * linger time is over. At most one batch is written per call, so a busy
+ * queue doesn't starve the other masters of the process.
+ *
+ * @param param - user data
+ * @param bReadable - 1 if the queue has messages
+ * @return milliseconds until the next linger, drop report, fdatasync() or journal
+ *         scan deadline, -1 if there is none
+ */
+int pump_on_mqueue(void* param, int bReadable)
+{
+    appender_ipc_udata_t* pUserData = (appender_ipc_udata_t*) param;
+    appender_ipc_batch_t* batch = &pUserData->pumpBatch;
+    const struct timespec noWait = {0, 0};
+    int bFirst = (0 == batch->count);
+    ssize_t bytes_read;
+    unsigned int priority;
+
+    while (bReadable && batch->count < batch->capacity
+           && (bytes_read = mq_timedreceive(pUserData->mqueueServer, pump_batch_slot(batch),
+                                            MAX_MSG_SIZE, &priority, &noWait)) >= 0)
+    {
+        pump_collect_message(pUserData, batch, pump_batch_slot(batch), bytes_read);
+        pUserData->bPumpUrgent |= (IPC_LANE_URGENT == priority);
+    }
+
+    if (bReadable && batch->count < batch->capacity && ETIMEDOUT != errno && EAGAIN != errno)
+    {
+        ERROR_LOG("mq_timedreceive() failed\n");
+    }
+
+    int bQueueEmpty = (batch->count < batch->capacity);
+
+    if (bFirst && batch->count > 0)
+    {
+        pump_linger_deadline(pUserData, &pUserData->pumpDeadline);
+    }
+
+    // urgent lines and sync requests don't linger
+    int msLeft = -1;
+
+    if (batch->count > 0)
+    {
+        msLeft = pUserData->bPumpUrgent || pUserData->numSyncReady > 0 ? 0 : pump_ms_left(&pUserData->pumpDeadline);
+    }
+
+    if (batch->count == batch->capacity || 0 == msLeft)
+    {
+        pump_flush_batch(pUserData, batch);
+        pUserData->bPumpUrgent = 0;
+        msLeft = -1;
+    }
+
+    pump_report_drops(pUserData, 0);
+    pump_report_filtered(pUserData, batch, 0);
+    pump_commit_if_due(pUserData);
+
+    if (0 == batch->count)
+    {
+        pump_merge_spills(pUserData, bQueueEmpty);
+    }
+
+    if (0 == batch->count && bQueueEmpty)
+    {
+        pump_output_idle(pUserData);
+    }
+
+    // wake up in time for the next drop report, filter summary, fdatasync() or journal scan even if nothing comes
+    if (msLeft < 0)
+    {
+        msLeft = pump_idle_ms(pUserData);
+    }
+
+    return msLeft;
+}
+
+/*******************************************************************************
+ * @brief Absolute deadline send_timeout_ms from now
+ * @param pUserData
+ * @param clockId - clock the deadline is measured with
+ * @param deadline - [out]
+ */
+void send_deadline(appender_ipc_udata_t* pUserData, clockid_t clockId, struct timespec* deadline)
+{
+    clock_gettime(clockId, deadline);
+
+    deadline->tv_sec  += pUserData->conf.sendTimeoutMs / 1000;
+    deadline->tv_nsec += (long)(pUserData->conf.sendTimeoutMs % 1000) * 1000000L;
+
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/*******************************************************************************
+ * @brief Write one message into the shared-memory ring
+ *
+ * The low lane is shed as soon as the ring is mostly full, so the room left
+ * goes to the other lanes, and it never waits.
+ *
+ * @param pUserData
+ * @param lane - lane of the message
+ * @param parts - message pieces, gathered straight into the ring
+ * @param numParts - number of pieces
+ * @param len - total message length
+ * @return 0 for success, -1 otherwise (errno EAGAIN/ETIMEDOUT if it's full)
+ */
+int ring_send(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane, const struct iovec* parts, int numParts,
+              size_t len)
+{
+    if (IPC_LANE_LOW == lane
+        && ipc_ring_used(pUserData->ring) * 100 > ipc_ring_capacity(pUserData->ring) * SHED_RING_PERCENT)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    int result = ipc_ring_writev(pUserData->ring, parts, numParts);
+
+    if (0 == result || EAGAIN != errno || IPC_LANE_LOW == lane)
+    {
+        return result;
+    }
+
+    switch (pUserData->conf.overflow)
+    {
+    case IPC_OVERFLOW_BLOCK:
+        // same semantics as blocking mq_send: wait until the pump makes room
+        do
+        {
+            ipc_ring_wait_space(pUserData->ring, len, NULL);
+        }
+        while (-1 == (result = ipc_ring_writev(pUserData->ring, parts, numParts)) && EAGAIN == errno);
+        break;
+
+    case IPC_OVERFLOW_TIMEOUT:
+    {
+        struct timespec deadline;
+        send_deadline(pUserData, CLOCK_MONOTONIC, &deadline);
+
+        do
+        {
+            if (-1 == ipc_ring_wait_space(pUserData->ring, len, &deadline))
+            {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+        }
+        while (-1 == (result = ipc_ring_writev(pUserData->ring, parts, numParts)) && EAGAIN == errno);
+        break;
+    }
+
+    default:
+        // the ring belongs to the consumer, producers can't evict from it,
+        // so drop-oldest degrades to drop-newest
+        break;
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Stats slot of this process
+ * @param pUserData
+ * @return slot, NULL if statistics are not available
+ */
+ipc_stats_client_t* stats_slot(appender_ipc_udata_t* pUserData)
+{
+    return pUserData->stats ? ipc_stats_client(pUserData->stats, current_pid()) : NULL;
+}
+
+/*******************************************************************************
+ * @brief Count records lost by this process
+ * @param pUserData
+ * @param count - number of records
+ */
+void count_drops(appender_ipc_udata_t* pUserData, unsigned long count)
+{
+    atomic_fetch_add(&pUserData->droppedPending, count);
+    atomic_fetch_add(&pUserData->droppedTotal, count);
+
+    ipc_stats_client_t* slot = stats_slot(pUserData);
+
+    if (slot)
+    {
+        atomic_fetch_add_explicit(&slot->drops, count, memory_order_relaxed);
+    }
+}
+
+/*******************************************************************************
+ * @brief Records lost with a message taken out of the queue
+ *
+ * A drop report lives on: its number is added to the drops of this process.
+ *
+ * @param pUserData
+ * @param buffer - message
+ * @param len - its length
+ * @return number of log records
+ */
+long evict_records(appender_ipc_udata_t* pUserData, const char* buffer, size_t len)
+{
+    if (len < sizeof(appender_ipc_frame_t) || '\0' != buffer[0])
+    {
+        return 1;
+    }
+
+    appender_ipc_frame_t frame;
+    memcpy(&frame, buffer, sizeof(frame));
+
+    if (IPC_FRAME_DROPS == frame.kind && len >= sizeof(frame) + sizeof(appender_ipc_drops_t))
+    {
+        appender_ipc_drops_t drops;
+        memcpy(&drops, buffer + sizeof(frame), sizeof(drops));
+        atomic_fetch_add(&pUserData->droppedPending, drops.count);
+        atomic_fetch_add(&pUserData->droppedTotal, drops.count);
+        return 0;
+    }
+
+    return IPC_FRAME_SYNC == frame.kind ? 0 : frame.count;
+}
+
+/*******************************************************************************
+ * @brief Throw away the oldest queued message to make room
+ *
+ * The queue hands out its most urgent message first. Messages more urgent
+ * than the one being sent, and sync requests somebody waits for, are set
+ * aside until one of the lane (or below) comes out; that one is evicted and
+ * the others go back without waiting. One that doesn't fit back any more,
+ * because the queue filled up meanwhile, is counted as dropped.
+ *
+ * @param pUserData
+ * @param lane - lane of the message being sent
+ * @return number of log records lost with the evicted message, -1 if none was
+ */
+long evict_oldest(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane)
+{
+    char held[EVICT_MAX_HELD][MAX_MSG_SIZE];
+    ssize_t heldLen[EVICT_MAX_HELD];
+    unsigned int heldPriority[EVICT_MAX_HELD];
+    int numHeld = 0;
+    long evicted = -1;
+
+    while (numHeld < EVICT_MAX_HELD)
+    {
+        char* buffer = held[numHeld];
+        unsigned int priority = 0;
+        ssize_t bytes_read = mq_receive(pUserData->mqueueEvict, buffer, MAX_MSG_SIZE, &priority);
+
+        // emptied meanwhile: there is room now
+        if (bytes_read < 0)
+        {
+            evicted = 0;
+            break;
+        }
+
+        appender_ipc_frame_t frame;
+        int bSync = 0;
+
+        if (bytes_read >= (ssize_t)sizeof(frame) && '\0' == buffer[0])
+        {
+            memcpy(&frame, buffer, sizeof(frame));
+            bSync = (IPC_FRAME_SYNC == frame.kind);
+        }
+
+        if (priority <= (unsigned int)lane && !bSync)
+        {
+            evicted = evict_records(pUserData, buffer, bytes_read);
+            break;
+        }
+
+        heldLen[numHeld]      = bytes_read;
+        heldPriority[numHeld] = priority;
+        numHeld++;
+    }
+
+    // they go to the back of their lane, there is no way to put them in front
+    const struct timespec noWait = {0, 0};
+    unsigned long lost = 0;
+
+    for (int i = 0; i < numHeld; i++)
+    {
+        if (-1 == mq_timedsend(pUserData->mqueueClient, held[i], heldLen[i], heldPriority[i], &noWait))
+        {
+            lost += evict_records(pUserData, held[i], heldLen[i]);
+        }
+    }
+
+    if (lost > 0)
+    {
+        count_drops(pUserData, lost);
+    }
+
+    return evicted;
+}
+
+/*******************************************************************************
+ * @brief Send one message through the message queue
+ *
+ * The lane is the priority of the message. The low lane is shed when the
+ * queue is full, whatever the overflow policy.
+ *
+ * @param pUserData
+ * @param lane - lane of the message
+ * @param data - message body
+ * @param len - message length
+ * @return 0 for success, -1 otherwise (errno EAGAIN/ETIMEDOUT if it's full)
+ */
+int mqueue_send(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane, const char* data, size_t len)
+{
+    int result;
+
+    if (IPC_LANE_LOW == lane)
+    {
+        // an expired deadline makes mq_timedsend non-blocking
+        const struct timespec noWait = {0, 0};
+
+        return mq_timedsend(pUserData->mqueueClient, data, len, lane, &noWait);
+    }
+
+    switch (pUserData->conf.overflow)
+    {
+    case IPC_OVERFLOW_TIMEOUT:
+    {
+        struct timespec deadline;
+        send_deadline(pUserData, CLOCK_REALTIME, &deadline);
+
+        result = mq_timedsend(pUserData->mqueueClient, data, len, lane, &deadline);
+        break;
+    }
+
+    case IPC_OVERFLOW_DROP_OLDEST:
+    {
+        // the descriptor is non-blocking for both drop policies
+        int numOfRetries = MAX_EVICTIONS_PER_SEND;
+
+        while (-1 == (result = mq_send(pUserData->mqueueClient, data, len, lane))
+               && EAGAIN == errno && numOfRetries-- > 0)
+        {
+            long evicted = evict_oldest(pUserData, lane);
+
+            if (-1 == evicted)
+            {
+                errno = EAGAIN;
+                break;
+            }
+
+            count_drops(pUserData, evicted);
+        }
+        break;
+    }
+
+    default:
+        // larger messages are fragmented by appender_ipc_sendv()
+        result  = mq_send(pUserData->mqueueClient, data, len, lane);
+        break;
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Name the master of a lease generation listens on
+ * @param pUserData
+ * @param generation
+ * @param out - [out]
+ * @param size - size of out
+ */
+void socket_name(appender_ipc_udata_t* pUserData, uint32_t generation, char* out, size_t size)
+{
+    // a name of its own per master: a forked child may keep the old one bound
+    snprintf(out, size, "%s.%u", pUserData->sockName, (unsigned) generation);
+}
+
+/*******************************************************************************
+ * @brief Check whether this process is connected to the current master
+ * @param pUserData
+ * @return 1 if it is, 0 otherwise
+ */
+int socket_ready(appender_ipc_udata_t* pUserData)
+{
+    return atomic_load_explicit(&pUserData->bSockUp, memory_order_acquire)
+        && pUserData->sockPid == current_pid()
+        && pUserData->sockGen == ipc_lease_generation(pUserData->lease);
+}
+
+/*******************************************************************************
+ * @brief Connect this process to the socket of the current master
+ *
+ * A child process and every new master need a connection of their own. While
+ * no master listens, attempts are SOCKET_RETRY_MS apart and the message queue
+ * takes the messages meanwhile.
+ *
+ * @param pUserData
+ * @param epoch - sockEpoch the caller found the connection stale or broken at
+ * @return 0 if connected, -1 otherwise
+ */
+int socket_connect(appender_ipc_udata_t* pUserData, unsigned epoch)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long nowMs = (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    pid_t pid = current_pid();
+    uint32_t generation = ipc_lease_generation(pUserData->lease);
+
+    // nothing changed since the last attempt failed
+    if (!atomic_load_explicit(&pUserData->bSockUp, memory_order_acquire)
+        && pUserData->sockPid == pid && pUserData->sockGen == generation
+        && nowMs < atomic_load_explicit(&pUserData->sockRetryAt, memory_order_relaxed))
+    {
+        return -1;
+    }
+
+    int result;
+
+    pthread_mutex_lock(&pUserData->sockLock);
+
+    // another thread has tried meanwhile
+    if (epoch != atomic_load(&pUserData->sockEpoch))
+    {
+        result = atomic_load(&pUserData->bSockUp) ? 0 : -1;
+    }
+    else
+    {
+        char name[sizeof(pUserData->sockName) + 16];
+        socket_name(pUserData, generation, name, sizeof(name));
+
+        result = ipc_sock_connect(pUserData->sock, name);
+
+        pUserData->sockPid = pid;
+        pUserData->sockGen = generation;
+        atomic_store_explicit(&pUserData->sockRetryAt, nowMs + SOCKET_RETRY_MS, memory_order_relaxed);
+        atomic_store_explicit(&pUserData->bSockUp, 0 == result, memory_order_release);
+        atomic_fetch_add(&pUserData->sockEpoch, 1);
+    }
+
+    pthread_mutex_unlock(&pUserData->sockLock);
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief How long a message may wait for room in the socket
+ *
+ * Producers can't evict from the socket, so drop-oldest degrades to
+ * drop-newest as with the ring; the low lane never waits.
+ *
+ * @param pUserData
+ * @param lane - lane of the message
+ * @return milliseconds, 0 for not at all, -1 for as long as it takes
+ */
+int socket_timeout_ms(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane)
+{
+    if (IPC_LANE_LOW == lane)
+    {
+        return 0;
+    }
+
+    switch (pUserData->conf.overflow)
+    {
+    case IPC_OVERFLOW_BLOCK:
+        return -1;
+
+    case IPC_OVERFLOW_TIMEOUT:
+        return pUserData->conf.sendTimeoutMs;
+
+    default:
+        return 0;
+    }
+}
+
+/*******************************************************************************
+ * @brief Send one message through the socket, connecting first if needed
+ * @param pUserData
+ * @param parts - message pieces
+ * @param numParts - number of pieces
+ * @param timeoutMs - max wait for room, -1 for as long as it takes
+ * @return 0 for success, -1 otherwise (errno EAGAIN/ETIMEDOUT if it's full,
+ *         ENOTCONN if no master listens)
+ */
+int socket_send(appender_ipc_udata_t* pUserData, const struct iovec* parts, int numParts, int timeoutMs)
+{
+    unsigned epoch = atomic_load(&pUserData->sockEpoch);
+
+    if (!socket_ready(pUserData) && -1 == socket_connect(pUserData, epoch))
+    {
+        errno = ENOTCONN;
+        return -1;
+    }
+
+    epoch = atomic_load(&pUserData->sockEpoch);
+
+    int result = ipc_sock_sendv(pUserData->sock, parts, numParts, timeoutMs);
+
+    // the master stepped down: its successor may be listening already
+    if (-1 == result && ENOTCONN == errno)
+    {
+        if (-1 == socket_connect(pUserData, epoch))
+        {
+            errno = ENOTCONN;
+            return -1;
+        }
+
+        result = ipc_sock_sendv(pUserData->sock, parts, numParts, timeoutMs);
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Tell the master how many messages this process has lost
+ *
+ * Never blocks: if there is no room the report waits for the next success.
+ *
+ * @param pUserData
+ */
+void report_drops(appender_ipc_udata_t* pUserData)
+{
+    unsigned long pending = atomic_exchange(&pUserData->droppedPending, 0);
+
+    if (0 == pending)
+    {
+        return;
+    }
+
+    char buffer[sizeof(appender_ipc_frame_t) + sizeof(appender_ipc_drops_t)];
+    appender_ipc_frame_t frame;
+    appender_ipc_drops_t drops;
+
+    frame.zero  = 0;
+    frame.kind  = IPC_FRAME_DROPS;
+    frame.count = 1;
+    drops.pid   = getpid();
+    drops.count = pending > UINT32_MAX ? UINT32_MAX : (uint32_t)pending;
+
+    memcpy(buffer, &frame, sizeof(frame));
+    memcpy(buffer + sizeof(frame), &drops, sizeof(drops));
+
+    const struct timespec noWait = {0, 0};
+    int result = pUserData->ring
+               ? ipc_ring_write(pUserData->ring, buffer, sizeof(buffer))
+               : mq_timedsend(pUserData->mqueueClient, buffer, sizeof(buffer), IPC_LANE_URGENT, &noWait);
+
+    if (-1 == result)
+    {
+        atomic_fetch_add(&pUserData->droppedPending, drops.count);
+    }
+    else if (pending > drops.count)
+    {
+        atomic_fetch_add(&pUserData->droppedPending, pending - drops.count);
+    }
+}
+
+/*******************************************************************************
+ * @brief Send one message that fits into the transport
+ *
+ * With the ring or the socket, the urgent lane still takes the message queue,
+ * which the pump serves first.
+ *
+ * @param pUserData
+ * @param lane - lane of the message
+ * @param parts - message pieces
+ * @param numParts - number of pieces
+ * @param len - total message length
+ * @return 0 for success, -1 otherwise
+ */
+int transport_sendv(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane,
+                    const struct iovec* parts, int numParts, size_t len)
+{
+    int result;
+
+    // not connected: the message queue takes over what fits into it
+    if (pUserData->sock && IPC_LANE_URGENT != lane && len > 0
+        && (0 == (result = socket_send(pUserData, parts, numParts, socket_timeout_ms(pUserData, lane)))
+            || ENOTCONN != errno || len > (size_t)MAX_MSG_SIZE))
+    {
+        return result;
+    }
+
+    if (pUserData->ring && IPC_LANE_URGENT != lane)
+    {
+        result = ring_send(pUserData, lane, parts, numParts, len);
+    }
+    else if (1 == numParts)
+    {
+        result = mqueue_send(pUserData, lane, (const char*) parts[0].iov_base, len);
+    }
+    else if (len > (size_t)MAX_MSG_SIZE)
+    {
+        errno  = EMSGSIZE;
+        result = -1;
+    }
+    else
+    {
+        // a message queue needs the message in one piece
+        char buffer[MAX_MSG_SIZE];
+        char* pos = buffer;
+
+        for (int i = 0; i < numParts; i++)
+        {
+            memcpy(pos, parts[i].iov_base, parts[i].iov_len);
+            pos += parts[i].iov_len;
+        }
+
+        result = mqueue_send(pUserData, lane, buffer, len);
+    }
+
+    // the pump sleeps on the ring
+    if (0 == result && pUserData->ring && IPC_LANE_URGENT == lane)
+    {
+        ipc_ring_wake(pUserData->ring);
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Spill journal of this process, opened on first use
+ *
+ * A child process inherits the journal of its parent and opens its own.
+ * Called with spillLock held.
+ *
+ * @param pUserData
+ * @return journal, NULL if it can't be opened for this process
+ */
+ipc_spill_t* spill_journal(appender_ipc_udata_t* pUserData)
+{
+    ipc_spill_t* spill = atomic_load_explicit(&pUserData->spill, memory_order_relaxed);
+    pid_t pid = current_pid();
+
+    // a journal that failed to open isn't retried for every message
+    if (pUserData->spillPid == pid)
+    {
+        return spill;
+    }
+
+    ipc_spill_t* inherited = spill;
+    char path[sizeof(pUserData->filePath) + 32];
+    snprintf(path, sizeof(path), "%s.spill.%d", pUserData->filePath, (int) pid);
+
+    if (NULL == (spill = ipc_spill_open(path, pUserData->conf.spillSize)))
+    {
+        ERROR_LOG("ipc_spill_open() failed, messages will be dropped: %s\n", path);
+    }
+
+    // the handle carries the pid it was opened by, so the journal is never
+    // seen with the pid of another; the inherited one goes once replaced
+    pUserData->spillPid = pid;
+    atomic_store_explicit(&pUserData->spill, spill, memory_order_release);
+    ipc_spill_close(inherited);
+
+    return spill;
+}
+
+/*******************************************************************************
+ * @brief Check whether this process has spilled messages not merged back yet
+ * @param pUserData
+ * @return 1 if it has, 0 otherwise
+ */
+int spill_pending(appender_ipc_udata_t* pUserData)
+{
+    ipc_spill_t* spill = atomic_load_explicit(&pUserData->spill, memory_order_acquire);
+
+    return spill && ipc_spill_opener(spill) == current_pid() && ipc_spill_pending(spill);
+}
+
+/*******************************************************************************
+ * @brief Append one message to the spill journal of this process
+ * @param pUserData
+ * @param parts - message pieces
+ * @param numParts - number of pieces
+ * @return 0 for success, -1 otherwise (errno ENOSPC if it can't be spilled)
+ */
+int spill_sendv(appender_ipc_udata_t* pUserData, const struct iovec* parts, int numParts)
+{
+    struct timespec now;
+    int result = -1;
+
+    pthread_mutex_lock(&pUserData->spillLock);
+
+    ipc_spill_t* spill = spill_journal(pUserData);
+
+    // stamped under the lock, so the journal is in time order
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    if (spill)
+    {
+        result = ipc_spill_writev(spill, (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec, parts, numParts);
+    }
+
+    pthread_mutex_unlock(&pUserData->spillLock);
+
+    if (-1 == result)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    ipc_stats_client_t* slot = stats_slot(pUserData);
+
+    if (slot)
+    {
+        atomic_fetch_add_explicit(&slot->spilled, 1, memory_order_relaxed);
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Send one message that fits into the transport, spilling it if the
+ *        policy says so and the transport doesn't take it
+ * @param pUserData
+ * @param lane - lane of the message
+ * @param parts - message pieces
+ * @param numParts - number of pieces
+ * @param len - total message length
+ * @return 0 for success, -1 otherwise
+ */
+int message_sendv(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane,
+                  const struct iovec* parts, int numParts, size_t len)
+{
+    if (IPC_OVERFLOW_SPILL != pUserData->conf.overflow)
+    {
+        return transport_sendv(pUserData, lane, parts, numParts, len);
+    }
+
+    // once spilling, the process goes on until the master has merged it all,
+    // or later records would overtake the spilled ones
+    if (!spill_pending(pUserData) && 0 == transport_sendv(pUserData, lane, parts, numParts, len))
+    {
+        return 0;
+    }
+
+    return spill_sendv(pUserData, parts, numParts);
+}
+
+/*******************************************************************************
+ * @brief Send several messages that fit into the transport, in order
+ *
+ * The socket takes as many as it can with one call; the others go one by
+ * one, with the overflow policy applied as usual.
+ *
+ * @param pUserData
+ * @param lane - lane of the messages
+ * @param msgs - pieces of every message
+ * @param lens - length of every message
+ * @param count - number of messages
+ * @return number of messages sent; if less than count, errno tells why the next one wasn't
+ */
+int message_sendm(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane,
+                  const ipc_sock_msg_t* msgs, const size_t* lens, int count)
+{
+    int numSent = 0;
+
+    if (pUserData->sock && IPC_LANE_URGENT != lane && socket_ready(pUserData)
+        && !(IPC_OVERFLOW_SPILL == pUserData->conf.overflow && spill_pending(pUserData)))
+    {
+        numSent = ipc_sock_sendmmsg(pUserData->sock, msgs, count);
+        numSent = numSent < 0 ? 0 : numSent;
+    }
+
+    while (numSent < count
+           && 0 == message_sendv(pUserData, lane, msgs[numSent].parts, msgs[numSent].numParts, lens[numSent]))
+    {
+        numSent++;
+    }
+
+    return numSent;
+}
+
+/*******************************************************************************
+ * @brief Largest message the transport takes at once
+ * @param pUserData
+ * @param lane - lane of the message
+ * @return size in bytes
+ */
+size_t transport_max_message(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane)
+{
+    if (pUserData->sock && IPC_LANE_URGENT != lane && socket_ready(pUserData))
+    {
+        return MAX_SOCKET_MESSAGE;
+    }
+
+    return (pUserData->ring && IPC_LANE_URGENT != lane) ? ipc_ring_max_record(pUserData->ring) : (size_t)MAX_MSG_SIZE;
+}
+
+/*******************************************************************************
+ * @brief Send a message too large for the transport as a sequence of fragments
+ *
+ * The pieces are gathered into the fragments without copying them first, and
+ * up to FRAGMENTS_PER_SEND fragments go out at once. If a fragment can't be
+ * sent the rest is not sent either; the master gives up the message and
+ * reports it as dropped, unless it was the first fragment.
+ *
+ * @param pUserData
+ * @param lane - lane of the message
+ * @param parts - message pieces
+ * @param numParts - number of pieces
+ * @param len - total message length
+ * @param numRecords - log records carried by the message
+ * @param pNumSent - [out] number of fragments sent
+ * @return 0 for success, -1 otherwise
+ */
+int send_fragments(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane, const struct iovec* parts,
+                   int numParts, size_t len, int numRecords, int* pNumSent)
+{
+    static __thread uint32_t nextMsgId = 0;
+
+    // 'count' only on the first fragment
+    appender_ipc_frame_t frames[2];
+    frames[0].zero  = 0;
+    frames[0].kind  = IPC_FRAME_FRAGMENT;
+    frames[0].count = numRecords;
+    frames[1]       = frames[0];
+    frames[1].count = 0;
+
+    appender_ipc_fragment_t fragment;
+    fragment.pid    = current_pid();
+    fragment.tid    = current_tid();
+    fragment.msgId  = nextMsgId++;
+    fragment.total  = len;
+    fragment.offset = 0;
+    fragment.lane   = lane;
+
+    size_t chunk = transport_max_message(pUserData, lane) - sizeof(appender_ipc_frame_t) - sizeof(fragment);
+    appender_ipc_fragment_t headers[FRAGMENTS_PER_SEND];
+    struct iovec iov[FRAGMENTS_PER_SEND][numParts + 2];
+    ipc_sock_msg_t msgs[FRAGMENTS_PER_SEND];
+    size_t lens[FRAGMENTS_PER_SEND];
+    int part = 0;
+    size_t partOffset = 0;
+
+    *pNumSent = 0;
+
+    while (fragment.offset < len)
+    {
+        int numMsgs = 0;
+
+        for (; numMsgs < FRAGMENTS_PER_SEND && fragment.offset < len; numMsgs++)
+        {
+            int numIov = 2;
+            size_t size = 0;
+
+            headers[numMsgs] = fragment;
+
+            iov[numMsgs][0].iov_base = &frames[0 == fragment.offset ? 0 : 1];
+            iov[numMsgs][0].iov_len  = sizeof(appender_ipc_frame_t);
+            iov[numMsgs][1].iov_base = &headers[numMsgs];
+            iov[numMsgs][1].iov_len  = sizeof(fragment);
+
+            while (size < chunk && part < numParts)
+            {
+                size_t take = parts[part].iov_len - partOffset;
+                take = take < chunk - size ? take : chunk - size;
+
+                iov[numMsgs][numIov].iov_base = (char*) parts[part].iov_base + partOffset;
+                iov[numMsgs][numIov].iov_len  = take;
+                numIov++;
+
+                size += take;
+                partOffset += take;
+
+                if (partOffset == parts[part].iov_len)
+                {
+                    part++;
+                    partOffset = 0;
+                }
+            }
+
+            msgs[numMsgs].parts    = iov[numMsgs];
+            msgs[numMsgs].numParts = numIov;
+            lens[numMsgs]          = sizeof(appender_ipc_frame_t) + sizeof(fragment) + size;
+            fragment.offset += size;
+        }
+
+        int numSent = message_sendm(pUserData, lane, msgs, lens, numMsgs);
+
+        *pNumSent += numSent;
+
+        if (numSent < numMsgs)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Hand one message over to the transport, applying the overflow policy
+ * @param pUserData
+ * @param lane - lane of the message
+ * @param parts - message pieces
+ * @param numParts - number of pieces
+ * @param numRecords - log records carried by the message
+ * @return 0 for success, -1 otherwise
+ */
+int appender_ipc_sendv(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane,
+                       const struct iovec* parts, int numParts, int numRecords)
+{
+    size_t len = 0;
+    int numSent = 0;
+    int result;
+
+    for (int i = 0; i < numParts; i++)
+    {
+        len += parts[i].iov_len;
+    }
+
+    if (len <= transport_max_message(pUserData, lane))
+    {
+        result  = message_sendv(pUserData, lane, parts, numParts, len);
+        numSent = (0 == result);
+    }
+    else if (len > pUserData->conf.maxMessage)
+    {
+        errno  = EMSGSIZE;
+        result = -1;
+    }
+    else
+    {
+        result = send_fragments(pUserData, lane, parts, numParts, len, numRecords, &numSent);
+    }
+
+    // the socket went away meanwhile: the message queue takes it in pieces
+    if (-1 == result && 0 == numSent && ENOTCONN == errno && len <= pUserData->conf.maxMessage)
+    {
+        result = send_fragments(pUserData, lane, parts, numParts, len, numRecords, &numSent);
+    }
+
+    // once the first fragment is out, the master accounts for the message
+    if (-1 == result && 0 == numSent
+        && (EAGAIN == errno || ETIMEDOUT == errno || ENOSPC == errno || ENOTCONN == errno))
+    {
+        count_drops(pUserData, numRecords);
+    }
+    else if (0 == result)
+    {
+        ipc_stats_client_t* slot = stats_slot(pUserData);
+
+        if (slot)
+        {
+            atomic_fetch_add_explicit(&slot->records, numRecords, memory_order_relaxed);
+            atomic_fetch_add_explicit(&slot->messages, numSent, memory_order_relaxed);
+            atomic_fetch_add_explicit(&slot->bytes, len, memory_order_relaxed);
+        }
+
+        if (atomic_load_explicit(&pUserData->droppedPending, memory_order_relaxed))
+        {
+            report_drops(pUserData);
+        }
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Hand one contiguous message over to the transport
+ * @param pUserData
+ * @param lane - lane of the message
+ * @param data - message body
+ * @param len - message length
+ * @param numRecords - log records carried by the message
+ * @return 0 for success, -1 otherwise
+ */
+int appender_ipc_send(appender_ipc_udata_t* pUserData, appender_ipc_lane_t lane, const char* data, size_t len,
+                      int numRecords)
+{
+    struct iovec part;
+    part.iov_base = (void*) data;
+    part.iov_len  = len;
+
+    return appender_ipc_sendv(pUserData, lane, &part, 1, numRecords);
+}
+
+/*******************************************************************************
+ * @brief Milliseconds elapsed since the given CLOCK_MONOTONIC time
+ * @param since
+ * @return elapsed time
+ */
+long long stage_age_ms(const struct timespec* since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/*******************************************************************************
+ * @brief Send the staged records as one frame; the stage must be locked
+ * @param stage
+ * @return 0 for success, -1 otherwise
+ */
+int stage_flush_locked(appender_ipc_stage_t* stage)
+{
+    if (0 == stage->count)
+    {
+        return 0;
+    }
+
+    appender_ipc_frame_t frame;
+    frame.zero  = 0;
+    frame.kind  = stage->kind;
+    frame.count = stage->count;
+    memcpy(stage->buffer, &frame, sizeof(frame));
+
+    int result = appender_ipc_send(stage->owner, stage->lane, stage->buffer, stage->used, stage->count);
+
+    stage->count = 0;
+    stage->used  = sizeof(frame);
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Thread-exit destructor of the stage: flush it and forget it
+ * @param param - stage of the exiting thread
+ */
+void stage_destroy(void* param)
+{
+    appender_ipc_stage_t* stage = (appender_ipc_stage_t*) param;
+    appender_ipc_udata_t* pUserData = stage->owner;
+
+    int bFound = 0;
+
+    pthread_mutex_lock(&pUserData->stageLock);
+
+    for (appender_ipc_stage_t** pp = &pUserData->stages; *pp; pp = &(*pp)->next)
+    {
+        if (*pp == stage)
+        {
+            *pp = stage->next;
+            bFound = 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pUserData->stageLock);
+
+    // taken over by stage_shutdown() meanwhile, which frees it
+    if (!bFound)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&stage->lock);
+    stage_flush_locked(stage);
+    pthread_mutex_unlock(&stage->lock);
+
+    pthread_mutex_destroy(&stage->lock);
+    free(stage);
+}
+
+/*******************************************************************************
+ * @brief Staging buffer of the calling thread, created on first use
+ * @param pUserData
+ * @return stage, NULL on failure
+ */
+appender_ipc_stage_t* stage_get(appender_ipc_udata_t* pUserData)
+{
+    appender_ipc_stage_t* stage = (appender_ipc_stage_t*) pthread_getspecific(pUserData->stageKey);
+
+    if (stage)
+    {
+        return stage;
+    }
+
+    // one frame has to fit into one message of the transport
+    size_t capacity = MAX_MSG_SIZE;
+
+    if (pUserData->ring)
+    {
+        capacity = ipc_ring_max_record(pUserData->ring);
+        capacity = capacity < MAX_RING_FRAME ? capacity : MAX_RING_FRAME;
+    }
+    else if (pUserData->sock)
+    {
+        // fragmented through the queue while not connected
+        capacity = MAX_SOCKET_MESSAGE;
+    }
+
+    stage = (appender_ipc_stage_t*) calloc(1, sizeof(appender_ipc_stage_t) + capacity);
+
+    if (NULL == stage)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&stage->lock, NULL);
+    stage->kind     = IPC_FRAME_BATCH;
+    stage->lane     = IPC_LANE_NORMAL;
+    stage->owner    = pUserData;
+    stage->used     = sizeof(appender_ipc_frame_t);
+    stage->capacity = capacity;
+
+    pthread_mutex_lock(&pUserData->stageLock);
+    stage->next = pUserData->stages;
+    pUserData->stages = stage;
+    pthread_mutex_unlock(&pUserData->stageLock);
+
+    pthread_setspecific(pUserData->stageKey, stage);
+
+    return stage;
+}
+
+/*******************************************************************************
+ * @brief Send one record without staging it
+ *
+ * Text records go out as plain messages, the rest in a frame of their own.
+ *
+ * @param pUserData
+ * @param kind - frame kind the record belongs to
+ * @param lane - lane of the record
+ * @param parts - record pieces: length prefix and message for text records,
+ *                header, category and payload for events
+ * @param numParts - number of pieces
+ * @return 0 for success, -1 otherwise
+ */
+int send_record_alone(appender_ipc_udata_t* pUserData, uint8_t kind, appender_ipc_lane_t lane,
+                      const struct iovec* parts, int numParts)
+{
+    if (IPC_FRAME_BATCH == kind)
+    {
+        return appender_ipc_sendv(pUserData, lane, parts + 1, numParts - 1, 1);
+    }
+
+    appender_ipc_frame_t frame;
+    frame.zero  = 0;
+    frame.kind  = kind;
+    frame.count = 1;
+
+    struct iovec framed[numParts + 1];
+    framed[0].iov_base = &frame;
+    framed[0].iov_len  = sizeof(frame);
+    memcpy(framed + 1, parts, numParts * sizeof(struct iovec));
+
+    return appender_ipc_sendv(pUserData, lane, framed, numParts + 1, 1);
+}
+
+/*******************************************************************************
+ * @brief Add one record to the staging buffer of the calling thread
+ *
+ * The buffer is sent when the record doesn't fit any more, when the oldest
+ * record exceeds the latency bound, or by the flush timer.
+ *
+ * A frame carries records of one kind and lane, so switching flushes too.
+ * Urgent records are not staged at all.
+ *
+ * @param pUserData
+ * @param kind - frame kind the record belongs to
+ * @param lane - lane of the record
+ * @param parts - record pieces, see send_record_alone()
+ * @param numParts - number of pieces
+ * @return 0 for success, -1 otherwise
+ */
+int stage_append(appender_ipc_udata_t* pUserData, uint8_t kind, appender_ipc_lane_t lane,
+                 const struct iovec* parts, int numParts)
+{
+    appender_ipc_stage_t* stage = IPC_LANE_URGENT != lane ? stage_get(pUserData) : NULL;
+
+    if (NULL == stage)
+    {
+        return send_record_alone(pUserData, kind, lane, parts, numParts);
+    }
+
+    int result = 0;
+    size_t recSize = 0;
+
+    for (int i = 0; i < numParts; i++)
+    {
+        recSize += parts[i].iov_len;
+    }
+
+    pthread_mutex_lock(&stage->lock);
+
+    if (stage->used + recSize > stage->capacity || stage->kind != kind || stage->lane != lane)
+    {
+        result = stage_flush_locked(stage);
+    }
+
+    if (sizeof(appender_ipc_frame_t) + recSize > stage->capacity)
+    {
+        // doesn't fit into a frame at all, goes out on its own
+        result = send_record_alone(pUserData, kind, lane, parts, numParts);
+    }
+    else
+    {
+        stage->kind = kind;
+        stage->lane = lane;
+
+        for (int i = 0; i < numParts; i++)
+        {
+            memcpy(stage->buffer + stage->used, parts[i].iov_base, parts[i].iov_len);
+            stage->used += parts[i].iov_len;
+        }
+
+        if (0 == stage->count++)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &stage->firstAt);
+        }
+        else if (stage_age_ms(&stage->firstAt) >= pUserData->conf.coalesceMs)
+        {
+            result = stage_flush_locked(stage);
+        }
+    }
+
+    pthread_mutex_unlock(&stage->lock);
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Flush timer: sends staging buffers of threads that went quiet
+ * @param param - user data
+ * @return 0
+ */
+void* stage_flush_timer(void* param)
+{
+    appender_ipc_udata_t* pUserData = (appender_ipc_udata_t*) param;
+
+    // ticking at half the bound keeps records under ~1.5 x coalesce_ms
+    int periodMs = pUserData->conf.coalesceMs / 2 > 0 ? pUserData->conf.coalesceMs / 2 : 1;
+
+    pthread_mutex_lock(&pUserData->stageLock);
+
+    while (!pUserData->flushStop)
+    {
+        struct timespec wakeAt;
+        clock_gettime(CLOCK_MONOTONIC, &wakeAt);
+        wakeAt.tv_nsec += (long)periodMs * 1000000L;
+        wakeAt.tv_sec  += wakeAt.tv_nsec / 1000000000L;
+        wakeAt.tv_nsec %= 1000000000L;
+
+        pthread_cond_timedwait(&pUserData->stageCond, &pUserData->stageLock, &wakeAt);
+
+        for (appender_ipc_stage_t* stage = pUserData->stages; stage; stage = stage->next)
+        {
+            // a busy thread flushes on its own
+            if (0 == pthread_mutex_trylock(&stage->lock))
+            {
+                if (stage->count > 0 && stage_age_ms(&stage->firstAt) >= pUserData->conf.coalesceMs)
+                {
+                    stage_flush_locked(stage);
+                }
+
+                pthread_mutex_unlock(&stage->lock);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&pUserData->stageLock);
+
+    return (void*)0;
+}
+
+/*******************************************************************************
+ * @brief Prepare client-side coalescing
+ * @param pUserData
+ * @return 0 for success, -1 otherwise
+ */
+int stage_init(appender_ipc_udata_t* pUserData)
+{
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&pUserData->stageLock, NULL);
+    pthread_cond_init(&pUserData->stageCond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    if (0 != pthread_key_create(&pUserData->stageKey, stage_destroy))
+    {
+        ERROR_LOG("pthread_key_create() failed\n");
+        return -1;
+    }
+
+    if (0 != pthread_create(&pUserData->flushThread, NULL, stage_flush_timer, pUserData))
+    {
+        ERROR_LOG("Error creating thread 'stage_flush_timer'\n");
+        pthread_key_delete(pUserData->stageKey);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Flush all staging buffers and stop the flush timer
+ * @param pUserData
+ */
+void stage_shutdown(appender_ipc_udata_t* pUserData)
+{
+    pthread_mutex_lock(&pUserData->stageLock);
+    pUserData->flushStop = 1;
+    pthread_cond_signal(&pUserData->stageCond);
+    pthread_mutex_unlock(&pUserData->stageLock);
+
+    pthread_join(pUserData->flushThread, NULL);
+
+    // threads that are still alive won't run the destructor any more
+    pthread_key_delete(pUserData->stageKey);
+
+    // a destructor already running may be unlinking its stage right now
+    pthread_mutex_lock(&pUserData->stageLock);
+    appender_ipc_stage_t* stages = pUserData->stages;
+    pUserData->stages = NULL;
+    pthread_mutex_unlock(&pUserData->stageLock);
+
+    while (stages)
+    {
+        appender_ipc_stage_t* stage = stages;
+        stages = stage->next;
+
+        pthread_mutex_lock(&stage->lock);
+        stage_flush_locked(stage);
+        pthread_mutex_unlock(&stage->lock);
+
+        pthread_mutex_destroy(&stage->lock);
+        free(stage);
+    }
+}
+
+/*******************************************************************************
+ * @brief Send out the staging buffers of all threads of the process
+ * @param pUserData
+ */
+void stage_flush_all(appender_ipc_udata_t* pUserData)
+{
+    pthread_mutex_lock(&pUserData->stageLock);
+
+    for (appender_ipc_stage_t* stage = pUserData->stages; stage; stage = stage->next)
+    {
+        pthread_mutex_lock(&stage->lock);
+
+        if (stage->count > 0)
+        {
+            stage_flush_locked(stage);
+        }
+
+        pthread_mutex_unlock(&stage->lock);
+    }
+
+    pthread_mutex_unlock(&pUserData->stageLock);
+}
+
+/*******************************************************************************
+ * @brief Send a sync request behind everything this process has sent
+ *
+ * Unlike a record of the low lane it is never shed: it waits for room, up
+ * to the deadline, whatever the overflow policy.
+ *
+ * @param pUserData
+ * @param ticket - from the lease
+ * @param deadline - absolute CLOCK_MONOTONIC time
+ * @return 0 for success, -1 otherwise
+ */
+int sync_send(appender_ipc_udata_t* pUserData, uint32_t ticket, const struct timespec* deadline)
+{
+    char buffer[sizeof(appender_ipc_frame_t) + sizeof(appender_ipc_sync_t)];
+    appender_ipc_frame_t frame;
+    appender_ipc_sync_t sync;
+
+    frame.zero  = 0;
+    frame.kind  = IPC_FRAME_SYNC;
+    frame.count = 0;
+    sync.ticket = ticket;
+
+    memcpy(buffer, &frame, sizeof(frame));
+    memcpy(buffer + sizeof(frame), &sync, sizeof(sync));
+
+    // behind the spilled records, which go out after anything in the transport
+    if (IPC_OVERFLOW_SPILL == pUserData->conf.overflow && spill_pending(pUserData))
+    {
+        struct iovec part = { buffer, sizeof(buffer) };
+
+        return spill_sendv(pUserData, &part, 1);
+    }
+
+    // behind what this process sent through the socket
+    if (pUserData->sock)
+    {
+        struct iovec part = { buffer, sizeof(buffer) };
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        long long msLeft = (long long)(deadline->tv_sec - now.tv_sec) * 1000
+                         + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+        if (0 == socket_send(pUserData, &part, 1, msLeft > 0 ? (int) msLeft : 0))
+        {
+            return 0;
+        }
+
+        if (ENOTCONN != errno)
+        {
+            return -1;
+        }
+    }
+
+    if (pUserData->ring)
+    {
+        while (-1 == ipc_ring_write(pUserData->ring, buffer, sizeof(buffer)))
+        {
+            if (EAGAIN != errno || -1 == ipc_ring_wait_space(pUserData->ring, sizeof(buffer), deadline))
+            {
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    // in the low lane the queue hands it out after everything sent before;
+    // the descriptor of the drop policies doesn't block, so retry
+    while (-1 == mq_timedsend(pUserData->mqueueClient, buffer, sizeof(buffer), IPC_LANE_LOW, &(struct timespec){0, 0}))
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if ((EAGAIN != errno && ETIMEDOUT != errno)
+            || now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec))
+        {
+            return -1;
+        }
+
+        nanosleep(&(struct timespec){0, SYNC_RETRY_NS}, NULL);
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Wait until everything this process has appended is on the disk
+ *
+ * Records dropped by the overflow policy are not waited for.
+ *
+ * @param pUserData - user data of a shard
+ * @param timeoutMs - upper bound of the wait
+ * @return 0 for success, -1 otherwise with errno set to ENOTSUP without
+ *         durability, ETIMEDOUT, or ECONNRESET if the master changed meanwhile
+ */
+int appender_sync(appender_ipc_udata_t* pUserData, int timeoutMs)
+{
+    if (IPC_DURABILITY_NONE == pUserData->conf.durability || NULL == pUserData->lease)
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if (pUserData->conf.coalesceMs > 0)
+    {
+        stage_flush_all(pUserData);
+    }
+
+    struct timespec deadline;
+    time_after_ms(CLOCK_MONOTONIC, timeoutMs, &deadline);
+
+    // the generation goes first: a ticket of an earlier master must not count
+    uint32_t generation = ipc_lease_generation(pUserData->lease);
+    uint32_t ticket = ipc_lease_sync_ticket(pUserData->lease);
+
+    if (-1 == sync_send(pUserData, ticket, &deadline))
+    {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long msLeft = (long long)(deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+
+    switch (ipc_lease_sync_wait(pUserData->lease, ticket, generation, msLeft > 0 ? (int)msLeft : 0))
+    {
+    case 1:
+        return 0;
+
+    case 0:
+        errno = ECONNRESET;
+        return -1;
+
+    default:
+        errno = ETIMEDOUT;
+        return -1;
+    }
+}
+
+/*******************************************************************************
+ * @brief Set up everything the master instance owns and start the pump
+ *
+ * The queue and the ring are adopted rather than recreated: whatever a
+ * previous master left unread is written by its successor. Also called by a
+ * client taking over, in which case its transport is used as it is.
+ *
+ * @param pUserData
+ * @return 0 upon success, -1 otherwise
+ */
+int start_master(appender_ipc_udata_t* pUserData)
+{
+    int bTakeOver = (-1 != pUserData->mqueueClient);
+
+    struct mq_attr attr;
+    attr.mq_flags   = 0;
+    attr.mq_maxmsg  = pUserData->conf.queueDepth;
+    attr.mq_msgsize = MAX_MSG_SIZE;
+    attr.mq_curmsgs = 0;
+
+    if (-1 == (pUserData->mqueueServer = mq_open(pUserData->queueName, O_CREAT | O_RDONLY, 0666, &attr)))
+    {
+        ERROR_LOG("mq_open() failed (server-side): %s, %s\n", pUserData->queueName, strerror(errno));
+        return -1;
+    }
+
+    if (!bTakeOver && -1 == open_client_queue(pUserData))
+    {
+        ERROR_LOG("mq_open() failed (client-side): %s, %s\n", pUserData->queueName, strerror(errno));
+        return -1;
+    }
+
+    // a client that fell back to the queue keeps serving the queue alone:
+    // its other threads may be sending right now
+    if (!bTakeOver && IPC_TRANSPORT_SHM == pUserData->conf.transport
+        && NULL == (pUserData->ring = ipc_ring_attach(pUserData->ringName))
+        && NULL == (pUserData->ring = ipc_ring_create(pUserData->ringName, pUserData->conf.ringSize)))
+    {
+        ERROR_LOG("ipc_ring_create() failed: %s\n", pUserData->ringName);
+        return -1;
+    }
+
+    if (pUserData->ring)
+    {
+        ipc_ring_adopt(pUserData->ring);
+    }
+
+    // clients that can't connect keep to the message queue
+    if (IPC_TRANSPORT_SOCKET == pUserData->conf.transport)
+    {
+        char name[sizeof(pUserData->sockName) + 16];
+        socket_name(pUserData, ipc_lease_generation(pUserData->lease), name, sizeof(name));
+
+        if (NULL == (pUserData->sockServer = ipc_sock_listen(name, pump_client_gone, pUserData)))
+        {
+            ERROR_LOG("ipc_sock_listen() failed, clients use the message queue: %s\n", name);
+        }
+    }
+
+    // stream2 appender holding the output stream
+    log4c_appender_t* rollingFileAppender = log4c_appender_get(pUserData->baseName);
+    log4c_appender_set_type(rollingFileAppender, log4c_appender_type_get("stream2"));
+    log4c_stream2_set_flags(rollingFileAppender, LOG4C_STREAM2_UNBUFFERED);
+
+    // layout
+    log4c_layout_t* rawLayout = log4c_layout_get("raw_layout");
+    log4c_layout_set_type(rawLayout, log4c_layout_type_get("raw"));
+    log4c_appender_set_layout(rollingFileAppender, rawLayout);
+
+    // category
+    log4c_category_t* rollingFileCategory = log4c_category_get(pUserData->baseName);
+    log4c_category_set_priority(rollingFileCategory, LOG4C_PRIORITY_TRACE); // the finest ever known
+    log4c_category_set_appender(rollingFileCategory, rollingFileAppender);
+    pUserData->rollingFileCategory = rollingFileCategory;
+    pUserData->rollingFileAppender = rollingFileAppender;
+
+    // before opening: a mapped file is preallocated beyond its data
+    struct stat st;
+    int bExists = (0 == stat(pUserData->filePath, &st));
+
+    pUserData->fileSize = bExists ? st.st_size : 0;
+    pUserData->rollFrom = 0;
+
+    if (-1 == output_open(pUserData))
+    {
+        pUserData->outFd = -1;
+        return -1;
+    }
+
+    pUserData->rollAt   = roll_next_time(pUserData->conf.rollInterval, time(NULL));
+    pUserData->bDirty         = 0;
+    pUserData->bWriteFailed   = 0;
+    pUserData->numSyncTickets = 0;
+    pUserData->numSyncReady   = 0;
+    time_after_ms(CLOCK_MONOTONIC, pUserData->conf.fsyncMs, &pUserData->nextSync);
+
+    if (pUserData->conf.rollSize || pUserData->conf.rollInterval)
+    {
+        if (-1 == ipc_roll_start())
+        {
+            ERROR_LOG("ipc_roll_start() failed, not rolling\n");
+        }
+        else
+        {
+            pUserData->bRolling = 1;
+
+            // written in an earlier period, e.g. before the previous master stopped
+            if (pUserData->fileSize > 0 && pUserData->rollAt
+                && roll_next_time(pUserData->conf.rollInterval, st.st_mtime) <= time(NULL))
+            {
+                pump_roll(pUserData);
+            }
+        }
+    }
+
+    output_open_sinks(pUserData);
+
+    atomic_store(&pUserData->pumpStop, PUMP_RUNNING);
+
+    // the ring's futex can't be polled, its pump always has a thread; so has
+    // the socket's, which waits on the queue and the connections at once
+    if (NULL == pUserData->ring && NULL == pUserData->sockServer && IPC_PUMP_SHARED == pUserData->conf.pump)
+    {
+        if (-1 == pump_open(pUserData, &pUserData->pumpBatch))
+        {
+            output_close_sinks(pUserData);
+            return -1;
+        }
+
+        pUserData->bPumpUrgent = 0;
+
+        if (NULL == (pUserData->pumpSource = ipc_loop_add(pUserData->mqueueServer, pump_on_mqueue, pUserData)))
+        {
+            ERROR_LOG("ipc_loop_add() failed\n");
+            pump_close(pUserData, &pUserData->pumpBatch);
+            output_close_sinks(pUserData);
+            return -1;
+        }
+    }
+    // Start rd/wr thread that will pump messages from queue into rolling file
+    else if (pthread_create(&(pUserData->pumpThread), NULL, pump_from_queue_to_file, pUserData) != 0)
+    {
+        ERROR_LOG("Error creating thread 'pump_from_queue_to_file'\n");
+        pUserData->pumpThread = 0;
+        output_close_sinks(pUserData);
+        return -1;
+    }
+
+    if (pUserData->stats)
+    {
+        atomic_store(&ipc_stats_shared(pUserData->stats)->master.pid, getpid());
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Client side: take over as soon as the master is gone
+ *
+ * Sleeps on the lease for the whole life of the appender; the kernel hands
+ * the lock over when the master exits, crashed or not.
+ *
+ * @param param - user data
+ * @return 0 upon success, -1 otherwise
+ */
+void* master_watchdog(void* param)
+{
+    appender_ipc_udata_t* pUserData = (appender_ipc_udata_t*) param;
+
+    if (1 != ipc_lease_acquire_wait(pUserData->lease))
+    {
+        return (void*)-1;
+    }
+
+    // closing the appender waits for the promotion to complete
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    INFO_LOG("Master is gone, taking over\n");
+
+    if (-1 == start_master(pUserData))
+    {
+        ERROR_LOG("start_master() failed, stepping down\n");
+
+        if (-1 != pUserData->mqueueServer)
+        {
+            mq_close(pUserData->mqueueServer);
+            pUserData->mqueueServer = -1;
+        }
+
+        ipc_sock_server_close(pUserData->sockServer);
+        pUserData->sockServer = NULL;
+
+        ipc_lease_release(pUserData->lease);
+        return (void*)-1;
+    }
+
+    ipc_lease_publish(pUserData->lease);
+
+    return (void*)0;
+}
+
+/*******************************************************************************
+ * @brief Stop the pump and close what only the master uses
+ *
+ * The ring pump reads shared memory in place => it must be gone before the
+ * ring is unmapped. The mqueue and socket pumps are woken up with an empty
+ * message; if the queue is full, they aren't asleep anyway. A queue served by the shared loop is
+ * taken out of it and finished in the calling thread.
+ *
+ * @param pUserData
+ * @param how - PUMP_HAND_OVER or PUMP_DRAIN
+ */
+void stop_master(appender_ipc_udata_t* pUserData, int how)
+{
+    const struct timespec noWait = {0, 0};
+
+    atomic_store(&pUserData->pumpStop, how);
+
+    if (pUserData->pumpSource)
+    {
+        ipc_loop_remove(pUserData->pumpSource);
+        pUserData->pumpSource = NULL;
+
+        if (PUMP_DRAIN == how)
+        {
+            pump_drain(pUserData, &pUserData->pumpBatch);
+        }
+
+        pump_flush_batch(pUserData, &pUserData->pumpBatch);
+        pump_report_drops(pUserData, 1);
+        pump_close(pUserData, &pUserData->pumpBatch);
+    }
+    else
+    {
+        if (pUserData->ring)
+        {
+            ipc_ring_wake(pUserData->ring);
+        }
+        else
+        {
+            mq_timedsend(pUserData->mqueueClient, "", 0, 0, &noWait);
+        }
+
+        pthread_join(pUserData->pumpThread, NULL);
+        pUserData->pumpThread = 0;
+    }
+
+    ipc_sock_server_close(pUserData->sockServer);
+    pUserData->sockServer = NULL;
+
+    if (pUserData->stats)
+    {
+        int32_t pid = getpid();
+        atomic_compare_exchange_strong(&ipc_stats_shared(pUserData->stats)->master.pid, &pid, 0);
+    }
+
+    mq_close(pUserData->mqueueServer);
+    pUserData->mqueueServer = -1;
+
+    // closing returns with everything written on the disk; requests
+    // left in the transport go to the next master
+    if (IPC_DURABILITY_NONE != pUserData->conf.durability)
+    {
+        if (PUMP_DRAIN == how)
+        {
+            pump_sync_ready(pUserData, pUserData->numSyncTickets);
+        }
+
+        pUserData->bDirty = 1;
+        pump_commit(pUserData);
+    }
+
+    // waits for the writes in flight
+    ipc_writer_destroy(pUserData->writer);
+    pUserData->writer = NULL;
+
+    ipc_segment_close(pUserData->segment);
+    pUserData->segment = NULL;
+
+    // compresses what is left and writes the last frame
+    ipc_gzip_destroy(pUserData->gzip);
+    pUserData->gzip = NULL;
+
+    ipc_binlog_index_close(pUserData->index);
+    pUserData->index = NULL;
+
+    log4c_appender_close(pUserData->rollingFileAppender);
+    pUserData->outFd = -1;
+
+    // the pump is gone, they only have to catch up
+    output_close_sinks(pUserData);
+
+    // waits for the files rolled over if it's the last master of the process
+    if (pUserData->bRolling)
+    {
+        ipc_roll_stop();
+        pUserData->bRolling = 0;
+    }
+}
+
+/*******************************************************************************
+ * @brief Output file of a shard: the shard number goes before the extension,
+ *        e.g. "log.txt" => "log.2.txt"
+ * @param out - [out]
+ * @param size - size of out
+ * @param dir - directory
+ * @param file - base file name
+ * @param shard - shard number
+ * @return 0 upon success, -1 if the path doesn't fit
+ */
+static int shard_file_path(char* out, size_t size, const char* dir, const char* file, int shard)
+{
+    const char* ext = strrchr(file, '.');
+
+    if (NULL == ext || ext == file)
+    {
+        ext = file + strlen(file);
+    }
+
+    // a truncated path could be the one of another shard
+    if ((int) size <= snprintf(out, size, "%s/%.*s.%d%s", dir, (int)(ext - file), file, shard, ext))
+    {
+        ERROR_LOG("Path of shard %d too long: %s/%s\n", shard, dir, file);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief File sink of a shard, named like the output file of the shard,
+ *        e.g. "/archive/log.txt" => "/archive/log.2.txt"
+ * @param out - [out]
+ * @param size - size of out
+ * @param path - file sink of the appender
+ * @param shard - shard number
+ * @return 0 upon success, -1 if the path doesn't fit
+ */
+static int shard_sink_path(char* out, size_t size, const char* path, int shard)
+{
+    char dir[512];
+    const char* slash = strrchr(path, '/');
+
+    if ((int) sizeof(dir) <= snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) : 1, slash ? path : "."))
+    {
+        ERROR_LOG("Path of shard %d too long: %s\n", shard, path);
+        return -1;
+    }
+
+    return shard_file_path(out, size, dir, slash ? slash + 1 : path, shard);
+}
+
+/*******************************************************************************
+ * @brief Open one shard: elect its master, becoming it or a client of it
+ *
+ * Without shards=N the appender is a single shard.
+ *
+ * @param pUserData - user data of the shard
+ * @param conf - parsed settings
+ * @param shardName - names the queue, the ring, the lease and the statistics
+ * @param filePath - file the master of the shard writes
+ * @param layoutName - layout formatting binary events on the master
+ * @return 0 for success, -1 otherwise
+ */
+static int shard_open(appender_ipc_udata_t* pUserData, const appender_ipc_conf_t* conf,
+                      const char* shardName, const char* filePath, const char* layoutName)
+{
+    int result = 0;
+
+    pUserData->conf = *conf;
+
+    if (NULL == pUserData->formats)
+    {
+        pthread_mutex_init(&pUserData->formatLock, NULL);
+        pthread_mutex_init(&pUserData->spillLock, NULL);
+        pthread_mutex_init(&pUserData->sockLock, NULL);
+        pUserData->formats = (appender_ipc_format_t*) calloc(FORMAT_CACHE_SIZE, sizeof(appender_ipc_format_t));
+    }
+
+    snprintf(pUserData->queueName, sizeof(pUserData->queueName), "/%s_mqueue", shardName);
+    snprintf(pUserData->ringName,  sizeof(pUserData->ringName),  "/%s_ring", shardName);
+    snprintf(pUserData->sockName,  sizeof(pUserData->sockName),  "/%s_sock", shardName);
+    snprintf(pUserData->leaseName, sizeof(pUserData->leaseName), "/%s_ctl", shardName);
+    snprintf(pUserData->statsName, sizeof(pUserData->statsName), "/%s_stats", shardName);
+    snprintf(pUserData->baseName,  sizeof(pUserData->baseName),  "%s", shardName);
+    snprintf(pUserData->filePath,  sizeof(pUserData->filePath),  "%s", filePath);
+
+    pUserData->mqueueServer = -1;
+    pUserData->mqueueClient = -1;
+    pUserData->mqueueEvict  = -1;
+    pUserData->eventLayout  = log4c_layout_get(layoutName);
+
+    // statistics are optional, the appender works without them
+    if (NULL == pUserData->stats && NULL == (pUserData->stats = ipc_stats_open(pUserData->statsName, 0)))
+    {
+        ERROR_LOG("ipc_stats_open() failed, no statistics: %s\n", pUserData->statsName);
+    }
+
+    if (conf->traceSignal && -1 == ipc_trace_dump_on_signal(conf->traceSignal))
+    {
+        ERROR_LOG("Signal %d has a handler already, no trace dumps\n", conf->traceSignal);
+    }
+
+    // We need to differentiate 1st appender from the rest to make preparations
+    // only once per appender type usage.
+    INFO_LOG("elect_master(pUserData)\n");
+
+    int masterInstanceExists = elect_master(pUserData);
+
+    if (-1 == masterInstanceExists)
+    {
+        ERROR_LOG("elect_master() failed\n");
+        result = -1;
+    }
+    else if (0 == masterInstanceExists)
+    {
+        INFO_LOG("We are the 1st instance!!!\n");
+
+        if (-1 == start_master(pUserData))
+        {
+            result = -1;
+        }
+        else
+        {
+            // the queue buffers whatever is logged before the pump runs,
+            // so the others can come in right away
+            ipc_lease_publish(pUserData->lease);
+        }
+    }
+
+    else
+    {
+        INFO_LOG("We are the 2nd instance!!!\n");
+
+        // The 2nd+ instance of the appender => no need to do any extra steps.
+        open_client_queue(pUserData);
+
+        // message queue stays as a fallback if the ring can't be mapped,
+        // e.g. the master instance runs with a different transport
+        if (IPC_TRANSPORT_SHM == conf->transport
+            && NULL == (pUserData->ring = ipc_ring_attach(pUserData->ringName)))
+        {
+            ERROR_LOG("ipc_ring_attach() failed, falling back to mqueue: %s\n", pUserData->ringName);
+        }
+
+        // without a successor a dead master would stall everybody
+        if (pthread_create(&(pUserData->watchdogThread), NULL, master_watchdog, pUserData) != 0)
+        {
+            ERROR_LOG("Error creating thread 'master_watchdog'\n");
+            pUserData->watchdogThread = 0;
+        }
+    }
+
+    // connecting right away lets the first messages take the socket already
+    if (0 == result && IPC_TRANSPORT_SOCKET == conf->transport)
+    {
+        if (NULL == (pUserData->sock = ipc_sock_open(conf->socketBuffer)))
+        {
+            ERROR_LOG("ipc_sock_open() failed, falling back to mqueue\n");
+        }
+        else if (-1 == socket_connect(pUserData, atomic_load(&pUserData->sockEpoch)))
+        {
+            ERROR_LOG("ipc_sock_connect() failed, using mqueue until the master listens\n");
+        }
+    }
+
+    if (0 == result && IPC_FILTER_ON_CLIENT == conf->filterOn && NULL == pUserData->filter
+        && (conf->filter.dedupMs > 0 || conf->filter.rate > 0)
+        && NULL == (pUserData->filter = ipc_filter_create(&conf->filter, 1)))
+    {
+        ERROR_LOG("ipc_filter_create() failed, nothing is held back\n");
+    }
+
+    if (0 == result && pUserData->conf.coalesceMs > 0 && -1 == stage_init(pUserData))
+    {
+        // coalescing is just an optimization => send records one by one
+        ERROR_LOG("stage_init() failed, coalescing disabled\n");
+        pUserData->conf.coalesceMs = 0;
+    }
+
+    if (-1 == result)
+    {
+        INFO_LOG("Cleanup\n");
+
+        // the queue and the ring may hold the backlog of other instances,
+        // so they are left alone
+        if (pUserData)
+        {
+            if (-1 != pUserData->mqueueServer)
+            {
+                mq_close(pUserData->mqueueServer);
+            }
+            if (-1 != pUserData->mqueueClient)
+            {
+                mq_close(pUserData->mqueueClient);
+            }
+            if (-1 != pUserData->mqueueEvict)
+            {
+                mq_close(pUserData->mqueueEvict);
+            }
+
+            ipc_sock_server_close(pUserData->sockServer);
+            pUserData->sockServer = NULL;
+
+            if (pUserData->ring)
+            {
+                ipc_ring_detach(pUserData->ring);
+                pUserData->ring = NULL;
+            }
+
+            ipc_lease_close(pUserData->lease);
+            pUserData->lease = NULL;
+
+            ipc_stats_close(pUserData->stats);
+            pUserData->stats = NULL;
+        }
+    }
+
+    return result;
+}
+
+
+/*******************************************************************************
+ * @brief Close one shard, handing its backlog over or draining it
+ * @param pUserData - user data of the shard
+ * @return 0 for success, -1 otherwise
+ */
+static int shard_close(appender_ipc_udata_t* pUserData)
+{
+    // what the filter of this process held back goes out with the rest
+    if (pUserData->filter)
+    {
+        filter_report(pUserData, IPC_FILTER_FLUSH);
+        ipc_filter_destroy(pUserData->filter);
+        pUserData->filter = NULL;
+    }
+
+    // staged records go out while the transport is still there
+    if (pUserData->conf.coalesceMs > 0)
+    {
+        stage_shutdown(pUserData);
+        pUserData->conf.coalesceMs = 0;
+    }
+
+    // last chance to tell the master about lost messages
+    report_drops(pUserData);
+
+    // no take-over from now on; a promotion in progress completes first
+    if (pUserData->watchdogThread)
+    {
+        pthread_cancel(pUserData->watchdogThread);
+        pthread_join(pUserData->watchdogThread, NULL);
+        pUserData->watchdogThread = 0;
+    }
+
+    ipc_lease_leave(pUserData->lease);
+
+    int bDrained = 0;
+
+    // a running pump is an indirect indicator of master appender instance
+    // => clean up commonly used data
+    if (pUserData->pumpThread || pUserData->pumpSource)
+    {
+        // newcomers wait until we are gone; the others take the backlog over
+        ipc_lease_withdraw(pUserData->lease);
+
+        bDrained = !ipc_lease_others(pUserData->lease);
+        stop_master(pUserData, bDrained ? PUMP_DRAIN : PUMP_HAND_OVER);
+
+        // the master steps down only when its pump is gone, so the successor
+        // never competes with it for the backlog
+        ipc_lease_release(pUserData->lease);
+    }
+
+    // the others may have closed meanwhile, none of them taking over => the
+    // last one out writes what is left (a no-op while a master is alive)
+    if (!bDrained && !ipc_lease_others(pUserData->lease) && 1 == ipc_lease_acquire(pUserData->lease))
+    {
+        INFO_LOG("Last instance, draining the backlog\n");
+
+        if (0 == start_master(pUserData))
+        {
+            stop_master(pUserData, PUMP_DRAIN);
+            bDrained = 1;
+        }
+
+        ipc_lease_release(pUserData->lease);
+    }
+
+    if (bDrained)
+    {
+        mq_unlink(pUserData->queueName);
+
+        if (pUserData->ring)
+        {
+            ipc_ring_unlink(pUserData->ringName);
+        }
+    }
+
+    if (pUserData->ring)
+    {
+        ipc_ring_detach(pUserData->ring);
+        pUserData->ring = NULL;
+    }
+
+    if (-1 != pUserData->mqueueClient)
+    {
+        mq_close(pUserData->mqueueClient);
+        pUserData->mqueueClient = -1;
+    }
+
+    if (-1 != pUserData->mqueueEvict)
+    {
+        mq_close(pUserData->mqueueEvict);
+        pUserData->mqueueEvict = -1;
+    }
+
+    if (pUserData->sock)
+    {
+        ipc_sock_close(pUserData->sock);
+        pUserData->sock = NULL;
+        atomic_store(&pUserData->bSockUp, 0);
+
+        // the master forgets the formats of a connection that hangs up
+        for (int i = 0; pUserData->formats && i < FORMAT_CACHE_SIZE; i++)
+        {
+            atomic_store_explicit(&pUserData->formats[i].definedFor, 0, memory_order_relaxed);
+        }
+    }
+
+    // a journal with messages left is merged by the next master
+    ipc_spill_t* spill = atomic_exchange(&pUserData->spill, NULL);
+
+    if (spill)
+    {
+        if (ipc_spill_opener(spill) == current_pid() && !ipc_spill_pending(spill))
+        {
+            char path[sizeof(pUserData->filePath) + 32];
+            snprintf(path, sizeof(path), "%s.spill.%d", pUserData->filePath, (int) ipc_spill_opener(spill));
+            unlink(path);
+        }
+
+        ipc_spill_close(spill);
+    }
+
+    pUserData->spillPid = 0;
+
+    ipc_lease_close(pUserData->lease);
+    pUserData->lease = NULL;
+
+    ipc_stats_close(pUserData->stats);
+    pUserData->stats = NULL;
+
+    return 0;
+}
+
+/*********************************************************************************
+ * @brief appender_ipc_open
+ * @param appender
+ * @return 0 for success, -1 otherwise
+ */
+static int appender_ipc_open(log4c_appender_t* appender)
+{
+    int result = 0;
+
+    INFO_LOG("ENTER\n");
+
+    appender_ipc_udata_t* pUserData = NULL;
+
+    char* name = strdup(log4c_appender_get_name(appender));
+
+    // We encode name, path and base file name because of limitation of log4c:
+    // it doesn't allow to read XML-attributes except 'name' for custom appenders.
+    // To avoid modifying log4c, extra information "embedded" within appender name
+    // e.g. "test_name;/tmp/;log.txt;test_layout" or
+    // "test_name;/tmp/;log.txt;test_layout;transport=shm,ring_size=4m"
+
+    char* tokens[MAX_NUM_OF_NAME_TOKENS];
+    int numTokens=MAX_NUM_OF_NAME_TOKENS;
+    split_tokens(name, ";", tokens, &numTokens);
+
+    if (numTokens<NUM_OF_NAME_TOKENS || numTokens>MAX_NUM_OF_NAME_TOKENS)
+    {
+        ERROR_LOG("Incorrect appender name\n");
+        return -1;
+    }
+
+    appender_ipc_conf_t conf;
+    conf.transport = IPC_TRANSPORT_MQUEUE;
+    conf.pump      = IPC_PUMP_SHARED;
+    conf.shards    = 1;
+    conf.shardBy   = IPC_SHARD_BY_CATEGORY;
+    conf.output    = IPC_OUTPUT_STREAM;
+    conf.writeBuffer = DEFAULT_WRITE_BUFFER;
+    conf.segmentSize = DEFAULT_SEGMENT_SIZE;
+    conf.gzipLevel = DEFAULT_GZIP_LEVEL;
+    conf.gzipFrame = DEFAULT_GZIP_FRAME;
+    conf.gzipFlushMs = DEFAULT_GZIP_FLUSH_MS;
+    conf.fileFormat = IPC_FILE_TEXT;
+    conf.indexInterval = DEFAULT_INDEX_INTERVAL;
+    conf.rollSize  = 0;
+    conf.rollInterval = 0;
+    conf.bCompress = 1;
+    conf.numSinks  = 0;
+    conf.sinkBuffer = DEFAULT_SINK_BUFFER;
+    conf.durability = IPC_DURABILITY_NONE;
+    conf.fsyncMs   = DEFAULT_FSYNC_MS;
+    conf.syncPriority  = -1;     // none
+    conf.syncTimeoutMs = DEFAULT_SYNC_TIMEOUT_MS;
+    conf.ringSize  = DEFAULT_RING_SIZE;
+    conf.socketBuffer = DEFAULT_SOCKET_BUFFER;
+    conf.spillSize = DEFAULT_SPILL_SIZE;
+    conf.queueDepth = DEFAULT_QUEUE_DEPTH;
+    conf.batchSize = DEFAULT_BATCH_SIZE;
+    conf.lingerMs  = DEFAULT_LINGER_MS;
+    conf.coalesceMs = DEFAULT_COALESCE_MS;
+    conf.overflow  = IPC_OVERFLOW_BLOCK;
+    conf.sendTimeoutMs = DEFAULT_SEND_TIMEOUT_MS;
+    conf.dropReportS = DEFAULT_DROP_REPORT_S;
+    conf.record    = IPC_RECORD_TEXT;
+    conf.minPriority = LOG4C_PRIORITY_UNKNOWN;
+    conf.filter.dedupMs = 0;
+    conf.filter.rate    = 0;
+    conf.filter.burst   = 0;    // rate_limit
+    conf.filter.bByCategory = 0;
+    conf.filterOn  = IPC_FILTER_ON_MASTER;
+    conf.traceSignal = 0;
+    conf.maxMessage  = DEFAULT_MAX_MESSAGE;
+    conf.urgentPriority = LOG4C_PRIORITY_ERROR;
+    conf.shedPriority   = LOG4C_PRIORITY_UNKNOWN;  // opt-in: nothing is shed unless asked for
+
+    if (numTokens==MAX_NUM_OF_NAME_TOKENS && -1 == parse_options(tokens[4], &conf))
+    {
+        ERROR_LOG("Incorrect appender options\n");
+        return -1;
+    }
+
+    if (0 == conf.filter.burst)
+    {
+        conf.filter.burst = conf.filter.rate;
+    }
+
+    // the index of a binary file points into it uncompressed
+    if (IPC_OUTPUT_GZIP == conf.output && IPC_FILE_BINARY == conf.fileFormat)
+    {
+        ERROR_LOG("writer=gzip takes text, not binary records\n");
+        return -1;
+    }
+
+    for (int i = 0; i < conf.numSinks; i++)
+    {
+        if (IPC_SINK_SYSLOG == conf.sinks[i].kind && IPC_FILE_BINARY == conf.fileFormat)
+        {
+            ERROR_LOG("A syslog sink takes lines, not binary records: %s\n", conf.sinks[i].target);
+            return -1;
+        }
+    }
+
+    set_client_layout(appender, &conf, tokens[3]);
+
+    INFO_LOG("log4c_appender_get_udata(...)\n");
+
+    pUserData = (appender_ipc_udata_t*) log4c_appender_get_udata(appender);
+
+    if (NULL == pUserData)
+    {
+        pUserData = appender_ipc_make_udata();
+    }
+
+    if (conf.shards <= 1)
+    {
+        char filePath[512];
+        snprintf(filePath, sizeof(filePath), "%s/%s", tokens[1], tokens[2]);
+
+        result = shard_open(pUserData, &conf, tokens[0], filePath, tokens[3]);
+    }
+    else
+    {
+        // a shard has its own writer thread, the point is to write in parallel
+        appender_ipc_conf_t shardConf = conf;
+        shardConf.pump = IPC_PUMP_THREAD;
+
+        pUserData->conf = conf;
+
+        if (NULL == pUserData->shards)
+        {
+            pUserData->shards    = (appender_ipc_udata_t**) calloc(conf.shards, sizeof(appender_ipc_udata_t*));
+            pUserData->numShards = conf.shards;
+        }
+
+        int numOpen = 0;
+
+        while (pUserData->shards && numOpen < pUserData->numShards)
+        {
+            appender_ipc_udata_t* shard = pUserData->shards[numOpen];
+            char shardName[256];
+            char filePath[512];
+
+            if (NULL == shard && NULL == (shard = pUserData->shards[numOpen] = appender_ipc_make_udata()))
+            {
+                break;
+            }
+
+            int bPathsFit = ((int) sizeof(shardName) > snprintf(shardName, sizeof(shardName), "%s_%d", tokens[0], numOpen)
+                             && 0 == shard_file_path(filePath, sizeof(filePath), tokens[1], tokens[2], numOpen));
+
+            // every shard has a file sink of its own, named like its output file
+            for (int i = 0; bPathsFit && i < conf.numSinks; i++)
+            {
+                if (IPC_SINK_FILE == conf.sinks[i].kind
+                    && -1 == shard_sink_path(shardConf.sinks[i].target, sizeof(shardConf.sinks[i].target),
+                                             conf.sinks[i].target, numOpen))
+                {
+                    bPathsFit = 0;
+                }
+            }
+
+            if (!bPathsFit || -1 == shard_open(shard, &shardConf, shardName, filePath, tokens[3]))
+            {
+                break;
+            }
+
+            numOpen++;
+        }
+
+        if (NULL == pUserData->shards || numOpen < pUserData->numShards)
+        {
+            ERROR_LOG("Opening shard %d failed\n", numOpen);
+            result = -1;
+
+            while (numOpen > 0)
+            {
+                shard_close(pUserData->shards[--numOpen]);
+            }
+        }
+    }
+
+    if (0 == result)
+    {
+        log4c_appender_set_udata(appender, pUserData);
+    }
+
+    INFO_LOG("EXIT (%d)\n", result);
+
+    return result;
+}
+
+static pid_t cachedPid = 0;
+static __thread int cachedTid = 0;
+static pthread_once_t idsOnce = PTHREAD_ONCE_INIT;
+
+/*******************************************************************************
+ * @brief fork() handler: the child has to look its ids up again
+ */
+static void forget_ids()
+{
+    cachedPid = 0;
+    cachedTid = 0;
+}
+
+/*******************************************************************************
+ * @brief Reset the cached ids in children of the process
+ */
+static void register_forget_ids()
+{
+    pthread_atfork(NULL, NULL, forget_ids);
+}
+
+/*******************************************************************************
+ * @brief Id of the calling process, cached since getpid() is a system call
+ * @return process id
+ */
+static pid_t current_pid()
+{
+    if (0 == cachedPid)
+    {
+        pthread_once(&idsOnce, register_forget_ids);
+        cachedPid = getpid();
+    }
+
+    return cachedPid;
+}
+
+/*******************************************************************************
+ * @brief Id of the calling thread, cached since gettid() is a system call
+ * @return thread id
+ */
+static int current_tid()
+{
+    if (0 == cachedTid)
+    {
+        pthread_once(&idsOnce, register_forget_ids);
+        cachedTid = (int) syscall(SYS_gettid);
+    }
+
+    return cachedTid;
+}
+
+/*******************************************************************************
+ * @brief Lane of a record
+ * @param pUserData
+ * @param priority - LOG4C_PRIORITY_*
+ * @return lane
+ */
+static appender_ipc_lane_t lane_of(appender_ipc_udata_t* pUserData, int priority)
+{
+    if (priority <= pUserData->conf.urgentPriority)
+    {
+        return IPC_LANE_URGENT;
+    }
+
+    return priority >= pUserData->conf.shedPriority ? IPC_LANE_LOW : IPC_LANE_NORMAL;
+}
+
+/*******************************************************************************
+ * @brief Shard a record goes to
+ * @param pUserData - user data of the appender
+ * @param category - category name
+ * @return user data of the shard, pUserData itself without shards
+ */
+static appender_ipc_udata_t* shard_of(appender_ipc_udata_t* pUserData, const char* category)
+{
+    if (NULL == pUserData->shards)
+    {
+        return pUserData;
+    }
+
+    uint32_t key;
+
+    if (IPC_SHARD_BY_PID == pUserData->conf.shardBy)
+    {
+        key = current_pid();
+    }
+    else
+    {
+        // FNV-1a
+        key = 2166136261u;
+
+        for (const char* c = category ? category : ""; *c; c++)
+        {
+            key = (key ^ (uint8_t)*c) * 16777619u;
+        }
+    }
+
+    return pUserData->shards[key % pUserData->numShards];
+}
+
+/*******************************************************************************
+ * @brief Ship the event itself instead of its rendered text
+ * @param pUserData
+ * @param event - event being appended
+ * @return 0 for success, -1 otherwise
+ */
+static int append_event(appender_ipc_udata_t* pUserData, const log4c_logging_event_t* event)
+{
+    const char* category = event->evt_category ? event->evt_category : "";
+    const char* msg      = event->evt_msg ? event->evt_msg : "";
+
+    appender_ipc_event_t header;
+    header.timestamp   = (uint64_t)event->evt_timestamp.tv_sec * 1000000 + event->evt_timestamp.tv_usec;
+    header.pid         = current_pid();
+    header.tid         = current_tid();
+    header.priority    = event->evt_priority;
+    header.categoryLen = strlen(category) + 1;
+    header.msgLen      = strlen(msg) + 1;
+
+    // the terminating NUL travels on its own, so the message can be truncated
+    size_t room = sizeof(appender_ipc_frame_t) + sizeof(header) + header.categoryLen + 1;
+
+    if (room < pUserData->conf.maxMessage && room + header.msgLen - 1 > pUserData->conf.maxMessage)
+    {
+        header.msgLen = pUserData->conf.maxMessage - room + 1;
+    }
+
+    struct iovec parts[4] = {
+        { &header, sizeof(header) },
+        { (void*) category, header.categoryLen },
+        { (void*) msg, header.msgLen - 1 },
+        { (void*) "", 1 },
+    };
+
+    if (pUserData->conf.coalesceMs > 0)
+    {
+        return stage_append(pUserData, IPC_FRAME_EVENTS, lane_of(pUserData, header.priority), parts, 4);
+    }
+
+    return send_record_alone(pUserData, IPC_FRAME_EVENTS, lane_of(pUserData, header.priority), parts, 4);
+}
+
+/*******************************************************************************
+ * @brief Find the entry of a format string in the cache of the process
+ * @param pUserData
+ * @param format - format string, identified by its address
+ * @param pFree - [out] first free slot on the way, NULL if there is none
+ * @return entry, NULL if the format isn't cached
+ */
+static appender_ipc_format_t* format_probe(appender_ipc_udata_t* pUserData, const char* format,
+                                           appender_ipc_format_t** pFree)
+{
+    unsigned start = (unsigned)(((uintptr_t)format >> 3) * 2654435761u) % FORMAT_CACHE_SIZE;
+
+    *pFree = NULL;
 
-    sem_t* sema = sem_open(sem_name, O_CREAT, 0777, init_val);
+    for (int i = 0; i < FORMAT_CACHE_SIZE; i++)
+    {
+        appender_ipc_format_t* entry = &pUserData->formats[(start + i) % FORMAT_CACHE_SIZE];
+        const char* key = atomic_load_explicit(&entry->format, memory_order_acquire);
 
-    return sema;
-}
+        if (key == format)
+        {
+            return entry;
+        }
 
-/*******************************************************************************
- * @brief Close and unlink semaphore by its id and name
- * @param sem - semaphore id
- * @param base_name - base name used for name construction
- * @param suffix - suffix used for name construction
- */
-void close_semaphore(sem_t* sem, const char* base_name, const char* suffix)
-{
-    char sem_name[256];
-    sprintf(sem_name, "/%s_%s", base_name, suffix);
+        if (NULL == key)
+        {
+            *pFree = entry;
+            break;
+        }
+    }
 
-    sem_close(sem);
-    sem_unlink(sem_name);
+    return NULL;
 }
 
 /*******************************************************************************
- * @brief Determine if master appender is already started
+ * @brief Cache entry of a format string, parsed on first use
+ *
+ * Lookups don't lock: entries are only ever added, and an entry is published
+ * by storing its key after everything else is filled in.
+ *
  * @param pUserData
- * @return 0 if we don't get response,
- *         1 if we get response
- *        -1 if funstion fails
+ * @param format - format string, identified by its address
+ * @return entry, NULL if the cache is full
  */
-int master_handshake(appender_ipc_udata_t* pUserData)
+static appender_ipc_format_t* format_get(appender_ipc_udata_t* pUserData, const char* format)
 {
-    int result = 0;
+    appender_ipc_format_t* freeEntry;
+    appender_ipc_format_t* entry = format_probe(pUserData, format, &freeEntry);
 
-    INFO_LOG("ENTER\n");
+    if (entry)
+    {
+        return entry;
+    }
 
-    struct mq_attr attr;
-    attr.mq_flags   |= O_NONBLOCK;
-    attr.mq_maxmsg  = 10;
-    attr.mq_msgsize = MAX_MSG_SIZE;
-    attr.mq_curmsgs = 0;
+    pthread_mutex_lock(&pUserData->formatLock);
 
-    mqd_t mqid = mq_open(pUserData->queueName, O_WRONLY, 0600, &attr);
-    mqd_t mqid_resp = 0;
+    // another thread may have added it meanwhile
+    entry = format_probe(pUserData, format, &freeEntry);
 
-    // can open, need further check
-    if (mqid != -1)
+    if (NULL == entry && freeEntry)
     {
-        INFO_LOG("mq_unlink(pUserData->_queueNameHShake)\n");
+        entry = freeEntry;
+        entry->numArgs = ipc_fmt_parse(format, entry->types);
+        atomic_store_explicit(&entry->definedFor, 0, memory_order_relaxed);
+        atomic_store_explicit(&entry->format, format, memory_order_release);
+    }
+
+    pthread_mutex_unlock(&pUserData->formatLock);
 
-        // sanity check in case of uncleaned resources
-        mq_unlink(pUserData->queueNameHandShake);
+    return entry;
+}
+
+/*******************************************************************************
+ * @brief Tell the master the format string behind a format id
+ *
+ * The definition travels in the lane of the record, so it's never overtaken
+ * by it: lanes are served out of order.
+ *
+ * @param pUserData
+ * @param entry - cache entry of the format
+ * @param pid - current process
+ * @param generation - lease generation of the current master
+ * @param lane - lane of the record about to use it
+ * @return 0 for success, -1 otherwise
+ */
+static int format_define(appender_ipc_udata_t* pUserData, appender_ipc_format_t* entry, pid_t pid,
+                         unsigned generation, appender_ipc_lane_t lane)
+{
+    const char* format = atomic_load_explicit(&entry->format, memory_order_relaxed);
 
-        struct mq_attr attr_resv;
-        attr_resv.mq_flags   = 0;
-        attr_resv.mq_maxmsg  = 10;
-        attr_resv.mq_msgsize = MAX_MSG_SIZE;
-        attr_resv.mq_curmsgs = 0;
+    appender_ipc_frame_t frame;
+    frame.zero  = 0;
+    frame.kind  = IPC_FRAME_FORMAT;
+    frame.count = 1;
 
-        struct timespec timeout;
+    appender_ipc_format_def_t def;
+    def.pid      = pid;
+    def.formatId = entry - pUserData->formats;
 
-        INFO_LOG("mq_open(pUserData->_queueNameHShake, O_CREAT | O_RDONLY, ...)\n");
+    struct iovec parts[3] = {
+        { &frame, sizeof(frame) },
+        { &def, sizeof(def) },
+        { (void*) format, strlen(format) + 1 },
+    };
 
-        if (-1 == (mqid_resp = mq_open(pUserData->queueNameHandShake, O_CREAT | O_RDONLY, 0666, &attr_resv)))
+    if (-1 == appender_ipc_sendv(pUserData, lane, parts, 3, 0))
+    {
+        // too long for the transport => it will never be deferred
+        if (EMSGSIZE == errno)
         {
-            ERROR_LOG("mq_open(pUserData->_queueNameHShake,...) failed (%d): %s\n", errno, strerror(errno));
-            result = -1;
+            entry->numArgs = -1;
         }
 
-        else
-        {
-            INFO_LOG("mq_send(mqid, PING_MESSAGE, strlen(PING_MESSAGE), 0)\n");
+        return -1;
+    }
 
-            clock_gettime(CLOCK_REALTIME, &timeout);
-            timeout.tv_sec += PING_PONG_TIMEOUT_S;
+    if (atomic_load_explicit(&entry->definedFor, memory_order_relaxed) == pid
+        && atomic_load_explicit(&entry->definedGen, memory_order_relaxed) == generation)
+    {
+        atomic_fetch_or_explicit(&entry->definedLanes, 1u << lane, memory_order_relaxed);
+    }
+    else
+    {
+        atomic_store_explicit(&entry->definedLanes, 1u << lane, memory_order_relaxed);
+        atomic_store_explicit(&entry->definedGen, generation, memory_order_relaxed);
+        atomic_store_explicit(&entry->definedFor, pid, memory_order_relaxed);
+    }
 
-            if (-1 == mq_timedsend(mqid, PING_MESSAGE, strlen(PING_MESSAGE), 0, &timeout))
-            {
-                ERROR_LOG("mq_send(mqid, PING_MESSAGE,...) failed (%d): %s\n", errno, strerror(errno));
-                // we interpret queue overflow as "no response" case
-                if(errno != EAGAIN)
-                {
-                    result = -1;
-                }
-            }
-            else
-            {
-                clock_gettime(CLOCK_REALTIME, &timeout);
-                timeout.tv_sec += PING_PONG_TIMEOUT_S;
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Ship the format id and the raw arguments instead of the message
+ * @param pUserData
+ * @param category - category logged to
+ * @param priority - priority of the message
+ * @param format - printf-style format string
+ * @param ap - arguments, left untouched
+ * @return 0 for success, -1 otherwise, 1 if the message can't be deferred
+ */
+static int append_deferred(appender_ipc_udata_t* pUserData, const log4c_category_t* category,
+                           int priority, const char* format, va_list ap)
+{
+    appender_ipc_format_t* entry = pUserData->formats ? format_get(pUserData, format) : NULL;
 
-                char buffer[MAX_MSG_SIZE+1];
+    if (NULL == entry || entry->numArgs < 0)
+    {
+        return 1;
+    }
 
-                INFO_LOG("mq_timedreceive(mqid_resp, ...)\n");
+    pid_t pid = current_pid();
+    unsigned generation = ipc_lease_generation(pUserData->lease);
+    appender_ipc_lane_t lane = lane_of(pUserData, priority);
 
-                int bytes_read = mq_timedreceive(mqid_resp,
-                                                 buffer,
-                                                 MAX_MSG_SIZE,
-                                                 0, &timeout);
+    // children inherit the cache, but the master knows formats per process;
+    // a new master knows none of them
+    if ((atomic_load_explicit(&entry->definedFor, memory_order_relaxed) != pid
+         || atomic_load_explicit(&entry->definedGen, memory_order_relaxed) != generation
+         || 0 == (atomic_load_explicit(&entry->definedLanes, memory_order_relaxed) & (1u << lane)))
+        && -1 == format_define(pUserData, entry, pid, generation, lane))
+    {
+        return 1;
+    }
 
-                if (bytes_read>=0)
-                {
-                    buffer[bytes_read] = '\0';
+    char args[MAX_MSG_SIZE];
+    va_list copy;
+    va_copy(copy, ap);
+    size_t argsLen = ipc_fmt_pack(entry->types, entry->numArgs, copy, args, sizeof(args));
+    va_end(copy);
 
-                    INFO_LOG("Handshake response (PONG_MESSAGE): %s\n", buffer);
+    if (0 == argsLen && entry->numArgs > 0)
+    {
+        return 1;
+    }
 
-                    if (strcmp(buffer, PONG_MESSAGE) !=0 )
-                    {
-                        INFO_LOG("Handshake DOESN'T match!\n");
-                        result = -1;
-                    }
+    const char* name = log4c_category_get_name(category);
 
-                    else
-                    {
-                        INFO_LOG("Handshake matches!\n");
-                        result = 1;
-                    }
-                }
-                else
-                {
-                    ERROR_LOG("mq_timedreceive(...) failed (-1): %s\n", strerror(errno));
-                }
-            }
-        }
+    // the arguments tell apart what the format doesn't; a summary quotes the format
+    if (pUserData->filter && filter_message(pUserData, priority, name, args, argsLen, (uintptr_t) format, format))
+    {
+        return 0;
     }
 
-    INFO_LOG("Clean up\n");
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
 
-    mq_close(mqid);
-    mq_close(mqid_resp);
-    mq_unlink(pUserData->queueNameHandShake);
+    appender_ipc_deferred_t header;
+    header.timestamp   = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    header.pid         = pid;
+    header.tid         = current_tid();
+    header.priority    = priority;
+    header.categoryLen = strlen(name) + 1;
+    header.formatId    = entry - pUserData->formats;
+    header.argsLen     = argsLen;
 
-    INFO_LOG("EXIT\n");
+    struct iovec parts[3] = {
+        { &header, sizeof(header) },
+        { (void*) name, header.categoryLen },
+        { args, argsLen },
+    };
 
-    return result;
+    int result = pUserData->conf.coalesceMs > 0
+               ? stage_append(pUserData, IPC_FRAME_DEFERRED, lane, parts, 3)
+               : send_record_alone(pUserData, IPC_FRAME_DEFERRED, lane, parts, 3);
+
+    return (-1 == result && EMSGSIZE == errno) ? 1 : result;
 }
 
 /*******************************************************************************
- * @brief pump_from_queue_to_file
- * @param param
- * @return 0 upon success, -1 otherwise
+ * @brief Write the trace of all threads of the process to a descriptor
+ * @param fd - destination
  */
-void* pump_from_queue_to_file(void* param)
+void log4c_appender_ipc_dump_trace(int fd)
 {
-    appender_ipc_udata_t* pUserData = (appender_ipc_udata_t*) param;
-    char buffer[MAX_MSG_SIZE+1];
-
-    INFO_LOG("ENTER\n");
+    ipc_trace_dump(fd);
+}
 
-    while(1)
-    {
-        ssize_t bytes_read;
+/*******************************************************************************
+ * @brief Render a message that can't be deferred and append it to the appender
+ *
+ * Like a deferred message, it goes to this appender only, not to the other
+ * appenders of the category.
+ *
+ * @param appender
+ * @param category
+ * @param priority
+ * @param format
+ * @param ap
+ * @return 0 for success, -1 otherwise
+ */
+static int append_rendered(log4c_appender_t* appender, const log4c_category_t* category,
+                           int priority, const char* format, va_list ap)
+{
+    char msg[1024];
+    char* text = msg;
+    va_list copy;
 
-        INFO_LOG("mq_receive(pUserData->_mqueueServer, buffer, MAX_MSG_SIZE, 0)\n");
+    va_copy(copy, ap);
+    int len = vsnprintf(msg, sizeof(msg), format, copy);
+    va_end(copy);
 
-        /* receive the message */
-        bytes_read = mq_receive(pUserData->mqueueServer, buffer, MAX_MSG_SIZE, 0);
+    if (len < 0)
+    {
+        return -1;
+    }
 
-        if (bytes_read >= 0)
+    if ((size_t) len >= sizeof(msg))
+    {
+        if (NULL == (text = (char*) malloc(len + 1)))
         {
-            buffer[bytes_read] = '\0';
-
-            INFO_LOG("Received (PUMP_THREAD): %s\n", buffer);
+            return -1;
+        }
 
-            // propagate further only meaningfull
-            if (strcmp(PING_MESSAGE, buffer) != 0)
-            {
-                INFO_LOG("log4c_category_log(...)\n");
+        vsnprintf(text, len + 1, format, ap);
+    }
 
-                log4c_category_log(pUserData->rollingFileCategory, LOG4C_PRIORITY_INFO, "%s", buffer);
-            }
-            else
-            {
-                mqd_t mqid_resp = 0;
+    size_t lineSize = len + EVENT_FORMAT_SLACK;
+    char* line = (char*) malloc(lineSize);
+    struct timespec wallClock;
+    clock_gettime(CLOCK_REALTIME, &wallClock);
 
-                INFO_LOG("mq_open(pUserData->_queueNameHShake, O_WRONLY)\n");
+    log4c_logging_event_t event;
+    memset(&event, 0, sizeof(event));
+    event.evt_category = log4c_category_get_name(category);
+    event.evt_priority = priority;
+    event.evt_msg      = text;
+    event.evt_timestamp.tv_sec  = wallClock.tv_sec;
+    event.evt_timestamp.tv_usec = wallClock.tv_nsec / 1000;
+    event.evt_buffer.buf_data    = line;
+    event.evt_buffer.buf_size    = lineSize;
+    event.evt_buffer.buf_maxsize = lineSize;
 
-                if (-1 == (mqid_resp = mq_open(pUserData->queueNameHandShake, O_WRONLY)))
-                {
-                    ERROR_LOG("mq_open(pUserData->_queueNameHShake,...) failed\n");
-                }
+    int result = line ? log4c_appender_append(appender, &event) : -1;
 
-                else if (-1 == mq_send(mqid_resp, PONG_MESSAGE, strlen(PONG_MESSAGE), 0))
-                {
-                    ERROR_LOG("mq_send(mqid_resp, PONG_MESSAGE...) failed\n");
-                }
+    free(line);
 
-                INFO_LOG("mq_close(...)\n");
-                mq_close(mqid_resp);
-            }
-        }
-        else
-        {
-            ERROR_LOG("mq_receive() failed\n");
-            break;
-        }
+    if (text != msg)
+    {
+        free(text);
     }
 
-    INFO_LOG("EXIT\n");
-    return (void*)0;
+    return result < 0 ? -1 : 0;
 }
 
-/*********************************************************************************
- * @brief appender_ipc_open
- * @param appender
+/*******************************************************************************
+ * @brief Log a printf-style message rendered by the master instance
+ * @param appender - IPC appender the category logs to
+ * @param category - category to log to
+ * @param priority - priority of the message
+ * @param format - format string with static storage duration
  * @return 0 for success, -1 otherwise
  */
-static int appender_ipc_open(log4c_appender_t* appender)
+int log4c_appender_ipc_log(log4c_appender_t* appender, const log4c_category_t* category,
+                           int priority, const char* format, ...)
 {
-    int result = 0;
+    if (NULL == appender)
+    {
+        errno = EINVAL;
+        return -1;
+    }
 
-    INFO_LOG("ENTER\n");
+    if (!log4c_category_is_priority_enabled(category, priority))
+    {
+        return 0;
+    }
 
     appender_ipc_udata_t* pUserData = NULL;
-    sem_t* guardSem = NULL;
 
-    char* name = strdup(log4c_appender_get_name(appender));
-
-    // We encode name, path and base file name because of limitation of log4c:
-    // it doesn't allow to read XML-attributes except 'name' for custom appenders.
-    // To avoid modifying log4c, extra information "embedded" within appender name
-    // e.g. "test_name;/tmp/;log.txt;test_layout"
-
-    char* tokens[NUM_OF_NAME_TOKENS];
-    int numTokens=NUM_OF_NAME_TOKENS;
-    split_tokens(name, ";", tokens, &numTokens);
+    if (&log4c_appender_type_appender_ipc == log4c_appender_get_type(appender))
+    {
+        pUserData = (appender_ipc_udata_t*) log4c_appender_get_udata(appender);
+    }
 
-    if (numTokens!=NUM_OF_NAME_TOKENS)
+    if (pUserData)
     {
-        ERROR_LOG("Incorrect appender name\n");
-        return -1;
+        pUserData = shard_of(pUserData, log4c_category_get_name(category));
     }
 
-    INFO_LOG("open_semaphore(tokens[0], GUARD_SUFFIX, 1)\n");
+    va_list ap;
+    va_start(ap, format);
 
-    int bOK = 0;
-    int numOfRetries = 3;
+    int result = pUserData ? append_deferred(pUserData, category, priority, format, ap) : 1;
 
-    while(!bOK && numOfRetries > 0)
+    // anything that can't be deferred is rendered here, for the same appender
+    if (1 == result)
+    {
+        result = append_rendered(appender, category, priority, format, ap);
+    }
+    else if (0 == result && priority <= pUserData->conf.syncPriority
+             && -1 == appender_sync(pUserData, pUserData->conf.syncTimeoutMs))
     {
-        // ensure exclusive access to commonly used data (mqueue, semaphore)
-        guardSem = open_semaphore(tokens[0], GUARD_SUFFIX, 1);
-        struct timespec timeout;
-        clock_gettime(CLOCK_REALTIME, &timeout);
-        timeout.tv_sec += SEM_GUARD_TIMEOUT_S;
+        ERROR_LOG("appender_sync() failed: %s\n", strerror(errno));
+        result = -1;
+    }
 
-        if (SEM_FAILED == guardSem)
-        {
-            ERROR_LOG("SEM_FAILED == guard_sem\n");
-        }
-        else if (-1 == sem_timedwait(guardSem, &timeout))
-        {
-            // we don't differentiate timeout from the rest of failure reasons
-            ERROR_LOG("sem_timedwait(guard_sem) failed: %s\n", strerror(errno));
-            close_semaphore(guardSem, tokens[0], GUARD_SUFFIX);
-        }
-        else
-        {
-            bOK = 1;
-        }
+    va_end(ap);
 
-        numOfRetries--;
-    }
+    return result;
+}
 
-    if (!bOK && 0==numOfRetries)
+/*******************************************************************************
+ * @brief Wait until everything the process has appended is on the disk
+ * @param appender - IPC appender
+ * @param timeoutMs - upper bound of the wait
+ * @return 0 for success, -1 otherwise
+ */
+int log4c_appender_ipc_sync(log4c_appender_t* appender, int timeoutMs)
+{
+    if (NULL == appender || &log4c_appender_type_appender_ipc != log4c_appender_get_type(appender))
     {
-        ERROR_LOG("Inconsistent appender state: exiting abnormally\n");
-        close_semaphore(guardSem, tokens[0], GUARD_SUFFIX);
+        errno = EINVAL;
         return -1;
     }
 
-    INFO_LOG("log4c_appender_get_udata(...)\n");
-
-    pUserData = (appender_ipc_udata_t*) log4c_appender_get_udata(appender);
+    appender_ipc_udata_t* pUserData = (appender_ipc_udata_t*) log4c_appender_get_udata(appender);
 
     if (NULL == pUserData)
     {
-        pUserData = appender_ipc_make_udata();
+        errno = EINVAL;
+        return -1;
     }
 
-    sprintf(pUserData->queueName,       "/%s_mqueue", tokens[0]);
-    sprintf(pUserData->queueNameHandShake, "%s_hshake", pUserData->queueName);
-
-    // We need to differentiate 1st appender from the rest to make preparations
-    // only once per appender type usage.
-    INFO_LOG("handshake(pUserData)\n");
-
-    int masterInstanceExists = master_handshake(pUserData);
-
-    if (-1 == masterInstanceExists)
+    if (NULL == pUserData->shards)
     {
-        ERROR_LOG("does_instance_exist() failed\n");
-        result = -1;
+        return appender_sync(pUserData, timeoutMs);
     }
-    else if (0 == masterInstanceExists)
-    {
-        INFO_LOG("We are the 1st instance!!!\n");
 
-        struct mq_attr attr;
-        attr.mq_flags   = 0;
-        attr.mq_maxmsg  = 10;
-        attr.mq_msgsize = MAX_MSG_SIZE;
-        attr.mq_curmsgs = 0;
+    // one after another: the shards share the deadline
+    struct timespec deadline;
+    time_after_ms(CLOCK_MONOTONIC, timeoutMs, &deadline);
 
-        INFO_LOG("mq_unlink(pUserData->_queueName)\n");
+    for (int i = 0; i < pUserData->numShards; i++)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
 
-        // in case of the first appender instance we cleanup existing message queue, if any
-        mq_unlink(pUserData->queueName);
+        long long msLeft = (long long)(deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
 
-        if (-1 == (pUserData->mqueueServer = mq_open(pUserData->queueName, O_CREAT | O_RDONLY, 0666, &attr)))
+        if (-1 == appender_sync(pUserData->shards[i], msLeft > 0 ? (int)msLeft : 0))
         {
-            ERROR_LOG("mq_open() failed (server-side): %s, %s\n", pUserData->queueName, strerror(errno));
-            result = -1;
+            return -1;
         }
+    }
 
-        else if (-1 == (pUserData->mqueueClient = mq_open(pUserData->queueName, O_WRONLY)))
-        {
-            ERROR_LOG("mq_open() failed (client-side): %s, %s\n", pUserData->queueName, strerror(errno));
-            result = -1;
-        }
+    return 0;
+}
 
-        else
-        {
-            INFO_LOG("Rollingfile appender\n");
-
-// we might want to try rolling file
-#if 0
-            // Rolling file appender
-            log4c_appender_t* rollingFileAppender = log4c_appender_get("rollingFileAppender");
-            log4c_appender_set_type  (rollingFileAppender, log4c_appender_type_get("rollingfile"));
-#endif
-            // stream appender
-            log4c_appender_t* rollingFileAppender = log4c_appender_get(tokens[0]);
-            log4c_appender_set_type(rollingFileAppender, log4c_appender_type_get("stream2"));
-            log4c_stream2_set_flags(rollingFileAppender, LOG4C_STREAM2_UNBUFFERED);
-            char filepath[256];
-            sprintf(filepath, "%s/%s", tokens[1], tokens[2]);
-            log4c_stream2_set_fp(rollingFileAppender, fopen(filepath, "a"));
-
-            // layout
-            log4c_layout_t* rawLayout = log4c_layout_get("raw_layout");
-            log4c_layout_set_type(rawLayout, log4c_layout_type_get("raw"));
-            log4c_appender_set_layout(rollingFileAppender, rawLayout);
-
-#if 0
-            // set file, dir
-            rollingfile_udata_t* userData = rollingfile_make_udata();
-            rollingfile_udata_set_logdir        (userData, tokens[1]);
-            rollingfile_udata_set_files_prefix  (userData, tokens[2]);
-
-            // policy
-            log4c_rollingpolicy_t* rollingPolicy = log4c_rollingpolicy_get(tokens[3]);
-            rollingfile_udata_set_policy (userData, rollingPolicy);
-            log4c_appender_set_udata(rollingFileAppender, userData);
-            log4c_rollingpolicy_init(rollingPolicy, userData);
-#endif
-            // category
-            log4c_category_t* rollingFileCategory = log4c_category_get(tokens[0]);
-            log4c_category_set_priority(rollingFileCategory, LOG4C_PRIORITY_TRACE); // the finest ever known
-            log4c_category_set_appender(rollingFileCategory, rollingFileAppender);
-            pUserData->rollingFileCategory = rollingFileCategory;
-            pUserData->rollingFileAppender = rollingFileAppender;
-
-            // current appender
-            log4c_appender_set_layout(appender, log4c_layout_get(tokens[3]));
-
-            // Start rd/wr thread that will pump messages from queue into rolling file
-            if (pthread_create(&(pUserData->pumpThread), NULL, pump_from_queue_to_file, pUserData) != 0)
-            {
-                ERROR_LOG("Error creating thread 'pump_from_queue_to_file'\n");
-                result = -1;
-            }
-            else
-            {
-                log4c_appender_set_udata(appender, pUserData);
+/********************************************************************************
+ * @brief Ship the rendered message
+ * @param pUserData
+ * @param event - event being appended
+ * @return 0 for success, -1 otherwise
+ */
+static int append_text(appender_ipc_udata_t* pUserData, const log4c_logging_event_t* event)
+{
+    int result;
+    size_t len = strlen(event->evt_rendered_msg);
+    appender_ipc_lane_t lane = lane_of(pUserData, event->evt_priority);
 
-                // let the pumping thread to start up before continue to log
-                usleep(THREAD_SLACKNESS_MS * 1000);
-            }
-        }
+    // beyond what the master reassembles, a truncated line beats a lost one;
+    // the layout's line end is kept
+    size_t endLen = 0;
+
+    if (len > pUserData->conf.maxMessage)
+    {
+        endLen = ('\n' == event->evt_rendered_msg[len - 1]);
+        len    = pUserData->conf.maxMessage - endLen;
     }
 
-    else
+    if (pUserData->conf.coalesceMs > 0)
     {
-        INFO_LOG("We are the 2nd instance!!!\n");
+        appender_ipc_reclen_t recLen = len + endLen;
+        struct iovec parts[3] = {
+            { &recLen, sizeof(recLen) },
+            { (void*) event->evt_rendered_msg, len },
+            { (void*) "\n", endLen },
+        };
 
-        // The 2nd+ instance of the appender => no need to do any extra steps.
-        pUserData->mqueueClient = mq_open(pUserData->queueName, O_WRONLY);
-        log4c_appender_set_layout(appender, log4c_layout_get(tokens[3]));
-        log4c_appender_set_udata(appender, pUserData);
+        result = stage_append(pUserData, IPC_FRAME_BATCH, lane, parts, 3);
     }
-
-    if (SEM_FAILED != guardSem)
+    else if (endLen > 0)
     {
-        INFO_LOG("sem_post(guard_sem)\n");
+        struct iovec parts[2] = {
+            { (void*) event->evt_rendered_msg, len },
+            { (void*) "\n", endLen },
+        };
 
-        sem_post(guardSem);
-        close_semaphore(guardSem, tokens[0], GUARD_SUFFIX);
+        result = appender_ipc_sendv(pUserData, lane, parts, 2, 1);
+    }
+    else
+    {
+        result = appender_ipc_send(pUserData, lane, event->evt_rendered_msg, len, 1);
     }
 
-    if (-1 == result)
+    return result;
+}
+
+/********************************************************************************
+ * @brief Send the summaries of the filter of this process that are due
+ *
+ * They are logged like any other message, with the layout of the appender.
+ *
+ * @param pUserData
+ * @param nowMs - CLOCK_MONOTONIC milliseconds, IPC_FILTER_FLUSH for all of them
+ */
+static void filter_report(appender_ipc_udata_t* pUserData, uint64_t nowMs)
+{
+    ipc_filter_summary_t summary;
+
+    while (ipc_filter_next_report(pUserData->filter, nowMs, &summary))
     {
-        INFO_LOG("Cleanup\n");
+        char msg[IPC_FILTER_TEXT + 64];
+        char line[sizeof(msg) + 512];
+        const char* category;
+        struct timespec wallClock;
+        clock_gettime(CLOCK_REALTIME, &wallClock);
 
-        if (pUserData)
+        log4c_logging_event_t event;
+        memset(&event, 0, sizeof(event));
+        event.evt_priority = filter_summary_event(&summary, msg, sizeof(msg), &category);
+        event.evt_category = category;
+        event.evt_msg      = msg;
+        event.evt_timestamp.tv_sec  = wallClock.tv_sec;
+        event.evt_timestamp.tv_usec = wallClock.tv_nsec / 1000;
+        event.evt_buffer.buf_data    = line;
+        event.evt_buffer.buf_size    = sizeof(line);
+        event.evt_buffer.buf_maxsize = sizeof(line);
+
+        if (IPC_RECORD_BINARY == pUserData->conf.record)
         {
-            mq_close(pUserData->mqueueServer);
-            mq_close(pUserData->mqueueClient);
-            if (strlen(pUserData->queueName)>0)
-            {
-                mq_unlink(pUserData->queueName);
-            }
+            append_event(pUserData, &event);
+            continue;
+        }
+
+        event.evt_rendered_msg = pUserData->eventLayout ? log4c_layout_format(pUserData->eventLayout, &event) : msg;
+
+        if (event.evt_rendered_msg)
+        {
+            append_text(pUserData, &event);
         }
     }
+}
 
-    INFO_LOG("EXIT (%d)\n", result);
+/********************************************************************************
+ * @brief Hold a message back if it's a duplicate or its source is over the
+ *        rate limit (filter_on=client)
+ *
+ * Summaries that are due go out first.
+ *
+ * @param pUserData
+ * @param priority - priority of the message
+ * @param category - category name
+ * @param key - bytes telling the message apart
+ * @param keyLen
+ * @param tag - tells apart further, 0 if the key says it all
+ * @param text - what a summary quotes
+ * @return 1 if the message is held back, 0 if it goes out
+ */
+static int filter_message(appender_ipc_udata_t* pUserData, int priority, const char* category,
+                          const void* key, size_t keyLen, uintptr_t tag, const char* text)
+{
+    uint64_t nowMs = filter_now_ms();
 
-    return result;
+    ipc_filter_record_t rec;
+    rec.pid         = current_pid();
+    rec.priority    = priority;
+    rec.category    = category;
+    rec.categoryLen = category ? strlen(category) : 0;
+    rec.key         = key;
+    rec.keyLen      = keyLen;
+    rec.tag         = tag;
+    rec.text        = text;
+    rec.textLen     = strlen(text);
+
+    ipc_filter_verdict_t verdict = ipc_filter_check(pUserData->filter, nowMs, &rec);
+
+    filter_report(pUserData, nowMs);
+
+    if (IPC_FILTER_PASS == verdict)
+    {
+        return 0;
+    }
+
+    ipc_stats_client_t* slot = stats_slot(pUserData);
+
+    if (slot)
+    {
+        atomic_fetch_add_explicit(&slot->filtered, 1, memory_order_relaxed);
+    }
+
+    return 1;
 }
 
 /********************************************************************************
@@ -495,14 +7152,41 @@ static int appender_ipc_open(log4c_appender_t* appender)
 static int appender_ipc_append(log4c_appender_t* appender,
                                const log4c_logging_event_t* event)
 {
-    INFO_LOG("appender_ipc_append: %s\n", event->evt_rendered_msg);
+    DEBUG_LOG("appender_ipc_append: %s\n", event->evt_rendered_msg);
 
     appender_ipc_udata_t* pUserData = (appender_ipc_udata_t*) log4c_appender_get_udata(appender);
+    int result = 0;
+
+    // open failed => nowhere to send
+    if (NULL == pUserData)
+    {
+        return -1;
+    }
+
+    pUserData = shard_of(pUserData, event->evt_category);
+
+    if (pUserData->filter && event->evt_msg
+        && filter_message(pUserData, event->evt_priority, event->evt_category,
+                          event->evt_msg, strlen(event->evt_msg), 0, event->evt_msg))
+    {
+        return 0;
+    }
+
+    if (IPC_RECORD_BINARY == pUserData->conf.record)
+    {
+        result = append_event(pUserData, event);
+    }
+    else
+    {
+        result = append_text(pUserData, event);
+    }
 
-    // if the actual message size exceeds the MAX_MSG_SIZE, it will be trancated
-    int result  = mq_send(pUserData->mqueueClient,
-                          event->evt_rendered_msg,
-                          strlen(event->evt_rendered_msg), 0);
+    if (0 == result && event->evt_priority <= pUserData->conf.syncPriority
+        && -1 == appender_sync(pUserData, pUserData->conf.syncTimeoutMs))
+    {
+        ERROR_LOG("appender_sync() failed: %s\n", strerror(errno));
+        result = -1;
+    }
 
     return result;
 }
@@ -516,15 +7200,14 @@ static int appender_ipc_close(log4c_appender_t* appender)
 {
     appender_ipc_udata_t* pUserData = (appender_ipc_udata_t*) log4c_appender_get_udata(appender);
 
-    // _pumpThread is an indirect indicator of master appender instance
-    // => clean up commonly used data
-    if (pUserData->pumpThread)
+    if (NULL == pUserData->shards)
     {
-        mq_close(pUserData->mqueueServer);
-        mq_close(pUserData->mqueueClient);
-        mq_unlink(pUserData->queueName);
+        return shard_close(pUserData);
+    }
 
-        log4c_appender_close(pUserData->rollingFileAppender);
+    for (int i = 0; i < pUserData->numShards; i++)
+    {
+        shard_close(pUserData->shards[i]);
     }
 
     return 0;
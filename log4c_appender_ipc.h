@@ -20,16 +20,111 @@
  * This instance will be aslo in charge for queue creation and destroy. For this reason,
  * it is called "master" instance.
  *
- * The crusial part is recovering after crash. As message queue and semaphores
- * has kernel persistance, they remain in file system after abnormal termination.
- * At the same time we need to differentiate master instance from non-master to
- * avoid doubling commonly used data. File system objects can't be an
- * indicator of the number of instances, as files may remain after a crash.
+ * The crusial part is recovering after crash. As message queues and shared
+ * memory have kernel persistance, they remain in file system after abnormal
+ * termination. At the same time we need to differentiate master instance from
+ * non-master to avoid doubling commonly used data. File system objects can't
+ * be an indicator of the number of instances, as files may remain after a crash.
  *
- * We use "handshake" messages to check if the master instance available.
- * For this, we send one request message (ping) and waits will response ("pong").
- * These service messages are skipped from message flow.  If crashed, we can
- * stably determine that master instance is dead regardless of file system state.
+ * The master is elected with a lease: it holds a lock on a small control block
+ * for its whole life (see log4c_appender_ipc_lease.h). The kernel releases the
+ * lock together with a crashed process, so we can stably determine that master
+ * instance is dead regardless of file system state, and opening the appender
+ * takes a couple of system calls instead of a ping/pong round trip.
+ *
+ * Every other instance keeps a thread blocked on the lease, so when the master
+ * dies or closes, one of them takes over right away. The queue and the ring
+ * are never recreated: a new master adopts them with whatever backlog they
+ * hold, and only the last instance to close drains and removes them. Records
+ * the dead master had fetched from the ring but not written yet are written
+ * again (at-least-once); messages it had already received from the message
+ * queue are gone with it.
+ *
+ * By default messages travel through the POSIX message queue, one mq_send per
+ * message. With "transport=shm" in the options token of the appender name,
+ * the master creates a shared-memory ring instead (see log4c_appender_ipc_ring.h),
+ * so appending a message costs no system call. The message queue is kept for
+ * instances that can't map the ring. With "transport=socket" the master
+ * listens on a Unix-domain SOCK_SEQPACKET socket instead (see
+ * log4c_appender_ipc_sock.h): it isn't bound by the mqueue limits, takes many
+ * messages per system call, and tells the master when a process is gone.
+ *
+ * The queues of all master instances of a process are drained by one thread
+ * waiting on all of them with epoll (see log4c_appender_ipc_loop.h) rather
+ * than by a thread each; "pump=thread" restores the dedicated thread.
+ *
+ * "shards=N" splits the appender into N independent ones, each with its own
+ * transport, master, writer thread and output file; records are routed by
+ * category (or by process with "shard_by=pid").
+ *
+ * "writer=uring" (or "writer=thread") lets the pump hand its batches to an
+ * asynchronous writer (see log4c_appender_ipc_writer.h), so draining the
+ * transport overlaps with disk I/O. "writer=mmap" copies batches into
+ * preallocated, mapped segments of the file instead (see
+ * log4c_appender_ipc_segment.h), and "writer=gzip" has a thread compress
+ * them into independent gzip frames (see log4c_appender_ipc_gzip.h).
+ *
+ * "roll_size" and "roll_interval" make the master roll the file over: it is
+ * renamed after the time of rolling and a new one is opened, while a
+ * background thread closes the old one and compresses it with gzip (see
+ * log4c_appender_ipc_roll.h).
+ *
+ * "sink=file:<path>" and "sink=syslog:<path>" make the master write every
+ * line to further destinations as well, each with a buffer and a thread of
+ * its own, so a stalled one drops its own lines instead of holding up the
+ * pump (see log4c_appender_ipc_sink.h).
+ *
+ * "durability=periodic" makes the master fdatasync() the file every
+ * "fsync_ms", "durability=group" after every round of writes that answered a
+ * sync request. log4c_appender_ipc_sync() and records of "sync_priority" or
+ * worse wait until everything appended before them is on the disk; one
+ * fdatasync() acknowledges all requests of a round (see
+ * log4c_appender_ipc_lease.h).
+ *
+ * Messages larger than one message of the transport are split into fragments
+ * and reassembled by the master (see log4c_appender_ipc_reasm.h), up to
+ * "max_message" bytes; longer records are truncated.
+ *
+ * With "coalesce_ms=N" every thread packs its records into a staging buffer
+ * which is sent as one multi-record message when it's full, when its oldest
+ * record is N ms old (a small flush timer takes care of quiet threads), or
+ * when the appender is closed. The pump thread unpacks such messages.
+ *
+ * With "record=binary" clients don't render messages at all. They ship the
+ * event itself (timestamp, priority, pid/tid, category and the raw message)
+ * and the master formats it with its own layout, so timestamps and levels
+ * are the original ones. "min_priority=<level>" makes the master drop binary
+ * events less severe than the given level.
+ *
+ * "dedup_ms" collapses copies of a message within a window into a "message
+ * repeated N more times" line, "rate_limit" and "rate_burst" cap the lines a
+ * process (or a category, "rate_by=category") may log a second. The master
+ * applies both to binary events; with "filter_on=client" every process does
+ * before sending (see log4c_appender_ipc_filter.h).
+ *
+ * Records are sent in priority lanes: "urgent_priority" and worse go through
+ * the message queue ahead of everything else and are written without
+ * lingering; if "shed_priority" is given, records that mild or milder are
+ * dropped first when the transport fills up.
+ *
+ * "overflow=spill" never waits for a full transport: the record goes to a
+ * journal file of the process, which the master merges back into the output
+ * in time order (see log4c_appender_ipc_spill.h).
+ *
+ * "file_format=binary" makes the master write length-prefixed records with
+ * a sparse time index instead of lines (see log4c_appender_ipc_binlog.h);
+ * the ipc_query tool prints them as text.
+ *
+ * log4c_appender_ipc_log() goes one step further and defers the printf-style
+ * rendering itself to the master (see log4c_appender_ipc_fmt.h).
+ *
+ * Counters of every instance are published in a shared memory segment, see
+ * log4c_appender_ipc_stats.h and the ipc_stat tool.
+ *
+ * The appender's own diagnostics are kept in per-thread trace rings instead of
+ * being printed (see log4c_appender_ipc_trace.h); "trace_signal=usr1|usr2|<n>"
+ * dumps them to stderr when the process gets that signal. Only errors go to
+ * stderr directly.
  *
  * See the documentation in the appender_type_stream2.h file for
  * more details on the standard stream2 appender.
@@ -39,6 +134,7 @@
 
 #include <log4c/defs.h>
 #include <log4c/appender.h>
+#include <log4c/category.h>
 #include <log4c/rollingpolicy.h>
 
 __LOG4C_BEGIN_DECLS
@@ -60,6 +156,54 @@ extern const log4c_appender_type_t log4c_appender_type_appender_ipc;
  */
 extern const log4c_layout_type_t log4c_layout_type_raw;
 
+/**
+ * Fast logging entry point, a deferred-formatting counterpart of
+ * log4c_category_log().
+ *
+ * The message is not rendered by the caller: only an id of the format string
+ * and the raw argument bytes travel to the master instance, which renders the
+ * message and formats it with its own layout. The format string is sent once
+ * per process and identified by its address afterwards, so it must have static
+ * storage duration (a string literal).
+ *
+ * The message goes to this appender only, not to the other appenders of the
+ * category or its parents. Messages that can't be deferred (see
+ * log4c_appender_ipc_fmt.h for the supported conversions), or an appender
+ * of another type, are rendered in the calling thread and appended to the
+ * appender the same way.
+ *
+ * @param appender - IPC appender the category logs to, not NULL
+ * @param category - category to log to
+ * @param priority - priority of the message
+ * @param format - printf-style format string
+ * @return 0 upon success, -1 otherwise
+ */
+extern int log4c_appender_ipc_log(log4c_appender_t* appender, const log4c_category_t* category,
+                                  int priority, const char* format, ...)
+    LOG4C_ATTRIBUTE((format(printf, 4, 5)));
+
+/**
+ * Wait until everything the process appended through the appender is on the
+ * disk, i.e. written and fdatasync()ed by the master instance.
+ *
+ * Records dropped by the overflow policy are not waited for.
+ *
+ * @param appender - IPC appender
+ * @param timeoutMs - upper bound of the wait
+ * @return 0 upon success, -1 otherwise with errno set: ENOTSUP with
+ *         "durability=none", ETIMEDOUT, or ECONNRESET if another master
+ *         took over meanwhile (the records may or may not be on the disk)
+ */
+extern int log4c_appender_ipc_sync(log4c_appender_t* appender, int timeoutMs);
+
+/**
+ * Write the trace of the appender, all threads of the process, to a
+ * descriptor. Async-signal-safe.
+ *
+ * @param fd - destination, e.g. STDERR_FILENO
+ */
+extern void log4c_appender_ipc_dump_trace(int fd);
+
 __LOG4C_END_DECLS
 
 
@@ -0,0 +1,231 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "log4c_appender_ipc_binlog.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define INDEX_WRITE_ENTRIES 64          // entries written at once
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __ipc_binlog_index
+{
+    int fd;
+    size_t interval;
+    uint64_t next;          // records at or after this offset get an entry
+    uint64_t maxStamp;      // of the records accounted for so far
+    int bFailed;            // reported a write error already
+};
+
+/*******************************************************************************
+ * @brief Build a record
+ * @param dst - room for the record
+ * @param timestamp - microseconds since the epoch
+ * @param priority
+ * @param pid
+ * @param tid
+ * @param category - may be NULL
+ * @param categoryLen
+ * @param msg
+ * @param msgLen
+ * @return length of the record
+ */
+size_t ipc_binlog_encode(char* dst, uint64_t timestamp, int priority, int32_t pid, int32_t tid,
+                         const char* category, size_t categoryLen, const char* msg, size_t msgLen)
+{
+    ipc_binlog_record_t header;
+    char* pos = dst + sizeof(header);
+
+    if (categoryLen > UINT16_MAX)
+    {
+        categoryLen = UINT16_MAX;
+    }
+
+    if (categoryLen > 0)
+    {
+        memcpy(pos, category, categoryLen);
+        pos += categoryLen;
+    }
+
+    memcpy(pos, msg, msgLen);
+    pos += msgLen;
+
+    if (0 == msgLen || '\n' != msg[msgLen - 1])
+    {
+        *pos++ = '\n';
+    }
+
+    header.len         = pos - dst;
+    header.priority    = priority;
+    header.categoryLen = categoryLen;
+    header.timestamp   = timestamp;
+    header.pid         = pid;
+    header.tid         = tid;
+    memcpy(dst, &header, sizeof(header));
+
+    return header.len;
+}
+
+/*******************************************************************************
+ * @brief Name of the index of a file
+ * @param buf
+ * @param size
+ * @param path - the file
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_binlog_index_path(char* buf, size_t size, const char* path)
+{
+    int len = snprintf(buf, size, "%s%s", path, IPC_BINLOG_INDEX_SUFFIX);
+
+    return (len < 0 || (size_t)len >= size) ? -1 : 0;
+}
+
+/*******************************************************************************
+ * @brief Open the index of a file for appending
+ * @param path - the file
+ * @param dataEnd - size of the file
+ * @param interval - bytes of records between two entries
+ * @return handle, NULL on failure
+ */
+ipc_binlog_index_t* ipc_binlog_index_open(const char* path, uint64_t dataEnd, size_t interval)
+{
+    char indexPath[4096];
+
+    if (-1 == ipc_binlog_index_path(indexPath, sizeof(indexPath), path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    ipc_binlog_index_t* index = (ipc_binlog_index_t*) calloc(1, sizeof(ipc_binlog_index_t));
+
+    if (NULL == index)
+    {
+        return NULL;
+    }
+
+    // nothing but the magic: whatever the index says is about another file
+    int bFresh = dataEnd <= IPC_BINLOG_MAGIC_SIZE;
+
+    if (-1 == (index->fd = open(indexPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (bFresh ? O_TRUNC : 0), 0644)))
+    {
+        IPC_TRACE_ERROR_LOG("Can't open %s: %s\n", indexPath, strerror(errno));
+        free(index);
+        return NULL;
+    }
+
+    index->interval = interval;
+
+    if (!bFresh)
+    {
+        // records already there are unknown: they can't be later than now
+        struct timeval now;
+        gettimeofday(&now, NULL);
+
+        index->next     = dataEnd;
+        index->maxStamp = (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+    }
+
+    return index;
+}
+
+/*******************************************************************************
+ * @brief Close the index
+ * @param index
+ */
+void ipc_binlog_index_close(ipc_binlog_index_t* index)
+{
+    if (index)
+    {
+        close(index->fd);
+        free(index);
+    }
+}
+
+/*******************************************************************************
+ * @brief Write entries out
+ * @param index
+ * @param entries
+ * @param count
+ * @return 0 upon success, -1 otherwise
+ */
+static int index_write(ipc_binlog_index_t* index, const ipc_binlog_entry_t* entries, int count)
+{
+    size_t len = count * sizeof(ipc_binlog_entry_t);
+
+    // whole entries or none: O_APPEND writes of regular files aren't split
+    if ((ssize_t)len != write(index->fd, entries, len))
+    {
+        if (!index->bFailed)
+        {
+            IPC_TRACE_ERROR_LOG("Can't write the index: %s\n", strerror(errno));
+            index->bFailed = 1;
+        }
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Account for records about to be written
+ * @param index
+ * @param offset - of the first record
+ * @param iov - one record per entry
+ * @param count
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_binlog_index_add(ipc_binlog_index_t* index, uint64_t offset, const struct iovec* iov, int count)
+{
+    ipc_binlog_entry_t entries[INDEX_WRITE_ENTRIES];
+    int numEntries = 0;
+    int result = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        ipc_binlog_record_t header;
+
+        if (iov[i].iov_len < sizeof(header))
+        {
+            offset += iov[i].iov_len;
+            continue;
+        }
+
+        memcpy(&header, iov[i].iov_base, sizeof(header));
+
+        if (offset >= index->next)
+        {
+            entries[numEntries].stamp  = index->maxStamp;
+            entries[numEntries].offset = offset;
+            index->next = offset + index->interval;
+
+            if (INDEX_WRITE_ENTRIES == ++numEntries)
+            {
+                result |= index_write(index, entries, numEntries);
+                numEntries = 0;
+            }
+        }
+
+        if (header.timestamp > index->maxStamp)
+        {
+            index->maxStamp = header.timestamp;
+        }
+
+        offset += iov[i].iov_len;
+    }
+
+    if (numEntries > 0)
+    {
+        result |= index_write(index, entries, numEntries);
+    }
+
+    return result;
+}
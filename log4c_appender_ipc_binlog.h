@@ -0,0 +1,150 @@
+#ifndef LOG4C_APPENDER_IPC_BINLOG_H
+#define LOG4C_APPENDER_IPC_BINLOG_H
+
+
+/**
+ * @file log4c_appender_ipc_binlog.h
+ *
+ * @brief Binary output format of the IPC appender and its sparse index.
+ *
+ * With "file_format=binary" the master writes length-prefixed records
+ * instead of text lines. The file starts with the 8 bytes "IPCBLOG1",
+ * followed by records of the form
+ *
+ *     ipc_binlog_record_t | category | message
+ *
+ * where the message always ends with a newline (so neither a record nor the
+ * file ever ends with a zero byte) and nothing is padded: fields are read
+ * with memcpy(). All integers are in host byte order.
+ *
+ * Next to the file, "<file>.idx" holds an ipc_binlog_entry_t every
+ * index_interval bytes of records. An entry tells the offset of a record and
+ * the highest timestamp of all records before it, which never decreases
+ * along the index even though records of different processes arrive
+ * slightly out of order: the records at or after a given time can only be
+ * found after the last entry whose stamp is below it.
+ *
+ * The index is a hint. Entries are written as their records are handed to
+ * the output, so after a crash they may point past the data; a reader must
+ * check that an entry points to a record before relying on it.
+ *
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#define IPC_BINLOG_MAGIC        "IPCBLOG1"
+#define IPC_BINLOG_MAGIC_SIZE   8
+#define IPC_BINLOG_INDEX_SUFFIX ".idx"
+
+// header of every record
+struct __ipc_binlog_record
+{
+    uint32_t len;           // of the whole record, this header included
+    uint16_t priority;      // LOG4C_PRIORITY_*; UNKNOWN for lines rendered by the client
+    uint16_t categoryLen;   // no terminating NUL; 0 for lines rendered by the client
+    uint64_t timestamp;     // microseconds since the epoch
+    int32_t pid;            // 0 if unknown
+    int32_t tid;
+};
+
+typedef struct __ipc_binlog_record ipc_binlog_record_t;
+
+// entry of the sparse index
+struct __ipc_binlog_entry
+{
+    uint64_t stamp;         // highest timestamp of the records before the offset
+    uint64_t offset;        // of a record in the (uncompressed) file
+};
+
+typedef struct __ipc_binlog_entry ipc_binlog_entry_t;
+
+typedef struct __ipc_binlog_index ipc_binlog_index_t;
+
+/**
+ * Room a record may take, at most.
+ */
+static inline size_t ipc_binlog_record_size(size_t categoryLen, size_t msgLen)
+{
+    return sizeof(ipc_binlog_record_t) + categoryLen + msgLen + 1;
+}
+
+/**
+ * Build a record.
+ *
+ * @param dst - at least ipc_binlog_record_size() bytes
+ * @param category - not null-terminated, NULL if there is none
+ * @param msg - not null-terminated; a newline is added if it lacks one
+ * @return length of the record
+ */
+size_t ipc_binlog_encode(char* dst, uint64_t timestamp, int priority, int32_t pid, int32_t tid,
+                         const char* category, size_t categoryLen, const char* msg, size_t msgLen);
+
+/**
+ * Name of the index of a file: "<path>.idx".
+ *
+ * @return 0 upon success, -1 if it doesn't fit
+ */
+int ipc_binlog_index_path(char* buf, size_t size, const char* path);
+
+/**
+ * Open the index of a file for appending.
+ *
+ * An index next to an empty file is stale and gets truncated.
+ *
+ * @param path - the file, not the index
+ * @param dataEnd - current size of the file
+ * @param interval - bytes of records between two entries
+ * @return handle, NULL on failure
+ */
+ipc_binlog_index_t* ipc_binlog_index_open(const char* path, uint64_t dataEnd, size_t interval);
+
+/**
+ * Close the index.
+ */
+void ipc_binlog_index_close(ipc_binlog_index_t* index);
+
+/**
+ * Account for records about to be written at the given offset, adding
+ * entries as they become due.
+ *
+ * @param offset - file offset of the first record
+ * @param iov - one record per entry
+ * @return 0 upon success, -1 if the index couldn't be written
+ */
+int ipc_binlog_index_add(ipc_binlog_index_t* index, uint64_t offset, const struct iovec* iov, int count);
+
+/**
+ * Reader side: where to start looking for the records at or after a time.
+ *
+ * @param entries - the whole index
+ * @param count - number of entries
+ * @param from - microseconds since the epoch
+ * @return position of the last entry whose stamp is below 'from', -1 if none
+ */
+static inline long ipc_binlog_index_seek(const ipc_binlog_entry_t* entries, size_t count, uint64_t from)
+{
+    // stamps never decrease along the index
+    size_t low = 0;
+    size_t high = count;
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+
+        if (entries[mid].stamp < from)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return (long) low - 1;
+}
+
+
+#endif // LOG4C_APPENDER_IPC_BINLOG_H
@@ -0,0 +1,494 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log4c_appender_ipc_filter.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define FILTER_DEDUP_SLOTS  512         // distinct messages tracked at once
+#define FILTER_RATE_SLOTS   1024        // sources tracked at once
+#define FILTER_PENDING      16          // summaries of evicted slots not taken yet
+#define FILTER_REPORT_MS    1000        // a limited source is reported at most this often
+#define FILTER_TOKEN        1000        // a line in thousandths of a token
+#define FILTER_NEVER        UINT64_MAX
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __ipc_filter_entry
+{
+    uint64_t hash;              // 0 if free
+    uint64_t startMs;           // first copy, the window starts with it
+    unsigned count;             // copies held back since
+    int32_t pid;
+    int priority;
+    char category[IPC_FILTER_CATEGORY];
+    char text[IPC_FILTER_TEXT];
+};
+
+typedef struct __ipc_filter_entry ipc_filter_entry_t;
+
+struct __ipc_filter_bucket
+{
+    uint64_t key;               // 0 if free
+    uint64_t tokens;            // thousandths of a line
+    uint64_t lastMs;            // last refill
+    uint64_t reportMs;          // when the lines held back are due to be reported
+    unsigned count;             // lines held back since the last report
+    int32_t pid;
+    int priority;
+    char category[IPC_FILTER_CATEGORY];
+};
+
+typedef struct __ipc_filter_bucket ipc_filter_bucket_t;
+
+struct __ipc_filter
+{
+    ipc_filter_conf_t conf;
+    int bShared;
+    pthread_mutex_t lock;
+    uint64_t nextDueMs;         // no summary is due before, FILTER_NEVER if none is pending
+    ipc_filter_entry_t* entries;
+    ipc_filter_bucket_t* buckets;
+    int numPending;
+    ipc_filter_summary_t pending[FILTER_PENDING];
+};
+
+// FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t len)
+{
+    const uint8_t* byte = (const uint8_t*) data;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ byte[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static void copy_text(char* out, size_t size, const char* text, size_t len)
+{
+    len = text ? (len < size - 1 ? len : size - 1) : 0;
+
+    // a summary is a line of its own
+    while (len > 0 && '\n' == text[len - 1])
+    {
+        len--;
+    }
+
+    if (len > 0)
+    {
+        memcpy(out, text, len);
+    }
+
+    out[len] = '\0';
+}
+
+static void due_at(ipc_filter_t* filter, uint64_t ms)
+{
+    if (ms < filter->nextDueMs)
+    {
+        filter->nextDueMs = ms;
+    }
+}
+
+/*******************************************************************************
+ * @brief Queue the summary of a message slot and free it
+ * @param filter
+ * @param entry
+ * @return 1 upon success, 0 if the queue is full
+ */
+static int entry_report(ipc_filter_t* filter, ipc_filter_entry_t* entry)
+{
+    if (FILTER_PENDING == filter->numPending)
+    {
+        return 0;
+    }
+
+    ipc_filter_summary_t* summary = &filter->pending[filter->numPending++];
+
+    summary->verdict  = IPC_FILTER_REPEATED;
+    summary->count    = entry->count;
+    summary->pid      = entry->pid;
+    summary->priority = entry->priority;
+    memcpy(summary->category, entry->category, sizeof(summary->category));
+    memcpy(summary->text, entry->text, sizeof(summary->text));
+
+    entry->hash  = 0;
+    entry->count = 0;
+
+    return 1;
+}
+
+/*******************************************************************************
+ * @brief Queue the summary of a source slot; the slot keeps its tokens
+ * @param filter
+ * @param bucket
+ * @return 1 upon success, 0 if the queue is full
+ */
+static int bucket_report(ipc_filter_t* filter, ipc_filter_bucket_t* bucket)
+{
+    if (FILTER_PENDING == filter->numPending)
+    {
+        return 0;
+    }
+
+    ipc_filter_summary_t* summary = &filter->pending[filter->numPending++];
+
+    summary->verdict  = IPC_FILTER_LIMITED;
+    summary->count    = bucket->count;
+    summary->pid      = bucket->pid;
+    summary->priority = bucket->priority;
+    summary->text[0]  = '\0';
+    memcpy(summary->category, bucket->category, sizeof(summary->category));
+
+    bucket->count = 0;
+
+    return 1;
+}
+
+/*******************************************************************************
+ * @brief Create a filter
+ * @param conf - dedupMs and rate must not be both 0
+ * @param bShared - 1 if several threads use it
+ * @return handle, NULL on failure
+ */
+ipc_filter_t* ipc_filter_create(const ipc_filter_conf_t* conf, int bShared)
+{
+    ipc_filter_t* filter = (ipc_filter_t*) calloc(1, sizeof(ipc_filter_t));
+
+    if (NULL == filter)
+    {
+        return NULL;
+    }
+
+    filter->conf      = *conf;
+    filter->bShared   = bShared;
+    filter->nextDueMs = FILTER_NEVER;
+
+    if (filter->conf.burst < 1)
+    {
+        filter->conf.burst = 1;
+    }
+
+    if (conf->dedupMs > 0)
+    {
+        filter->entries = (ipc_filter_entry_t*) calloc(FILTER_DEDUP_SLOTS, sizeof(ipc_filter_entry_t));
+    }
+
+    if (conf->rate > 0)
+    {
+        filter->buckets = (ipc_filter_bucket_t*) calloc(FILTER_RATE_SLOTS, sizeof(ipc_filter_bucket_t));
+    }
+
+    if ((conf->dedupMs > 0 && NULL == filter->entries) || (conf->rate > 0 && NULL == filter->buckets)
+        || (bShared && 0 != pthread_mutex_init(&filter->lock, NULL)))
+    {
+        free(filter->entries);
+        free(filter->buckets);
+        free(filter);
+        return NULL;
+    }
+
+    return filter;
+}
+
+/*******************************************************************************
+ * @brief Free the filter
+ * @param filter
+ */
+void ipc_filter_destroy(ipc_filter_t* filter)
+{
+    if (NULL == filter)
+    {
+        return;
+    }
+
+    if (filter->bShared)
+    {
+        pthread_mutex_destroy(&filter->lock);
+    }
+
+    free(filter->entries);
+    free(filter->buckets);
+    free(filter);
+}
+
+/*******************************************************************************
+ * @brief Hold a message back if it's a copy within the window
+ * @param filter
+ * @param nowMs
+ * @param rec
+ * @param pEntry - [out] slot the message took, NULL if it took none
+ * @return IPC_FILTER_PASS or IPC_FILTER_REPEATED
+ */
+static ipc_filter_verdict_t filter_dedup(ipc_filter_t* filter, uint64_t nowMs, const ipc_filter_record_t* rec,
+                                         ipc_filter_entry_t** pEntry)
+{
+    uint64_t hash = hash_bytes(14695981039346656037ull, &rec->pid, sizeof(rec->pid));
+    hash = hash_bytes(hash, &rec->priority, sizeof(rec->priority));
+    hash = hash_bytes(hash, rec->category, rec->category ? rec->categoryLen : 0);
+    hash = hash_bytes(hash, &rec->tag, sizeof(rec->tag));
+    hash = hash_bytes(hash, rec->key, rec->keyLen);
+    hash = hash ? hash : 1;
+
+    ipc_filter_entry_t* entry = &filter->entries[hash % FILTER_DEDUP_SLOTS];
+
+    *pEntry = NULL;
+
+    if (entry->hash == hash && nowMs - entry->startMs < (uint64_t) filter->conf.dedupMs)
+    {
+        if (0 == entry->count++)
+        {
+            due_at(filter, entry->startMs + filter->conf.dedupMs);
+        }
+
+        return IPC_FILTER_REPEATED;
+    }
+
+    // no room for the summary of the slot: leave it, the message passes untracked
+    if (entry->count > 0 && !entry_report(filter, entry))
+    {
+        return IPC_FILTER_PASS;
+    }
+
+    entry->hash     = hash;
+    entry->startMs  = nowMs;
+    entry->count    = 0;
+    entry->pid      = rec->pid;
+    entry->priority = rec->priority;
+    copy_text(entry->category, sizeof(entry->category), rec->category, rec->categoryLen);
+    copy_text(entry->text, sizeof(entry->text), rec->text, rec->textLen);
+
+    *pEntry = entry;
+
+    return IPC_FILTER_PASS;
+}
+
+/*******************************************************************************
+ * @brief Take a token from the bucket of the source of a message
+ * @param filter
+ * @param nowMs
+ * @param rec
+ * @return IPC_FILTER_PASS or IPC_FILTER_LIMITED
+ */
+static ipc_filter_verdict_t filter_rate(ipc_filter_t* filter, uint64_t nowMs, const ipc_filter_record_t* rec)
+{
+    uint64_t key = filter->conf.bByCategory
+                 ? hash_bytes(14695981039346656037ull, rec->category, rec->category ? rec->categoryLen : 0)
+                 : (uint64_t)(uint32_t) rec->pid | (1ull << 32);
+    key = key ? key : 1;
+
+    ipc_filter_bucket_t* bucket = &filter->buckets[key % FILTER_RATE_SLOTS];
+    uint64_t capacity = (uint64_t) filter->conf.burst * FILTER_TOKEN;
+
+    if (bucket->key != key)
+    {
+        if (bucket->count > 0 && !bucket_report(filter, bucket))
+        {
+            return IPC_FILTER_PASS;
+        }
+
+        bucket->key    = key;
+        bucket->tokens = capacity;
+        bucket->lastMs = nowMs;
+        bucket->count  = 0;
+        bucket->pid    = rec->pid;
+        bucket->category[0] = '\0';
+
+        if (filter->conf.bByCategory)
+        {
+            copy_text(bucket->category, sizeof(bucket->category), rec->category, rec->categoryLen);
+        }
+    }
+
+    // "rate" lines a second is "rate" thousandths of a line a millisecond
+    if (nowMs > bucket->lastMs)
+    {
+        uint64_t tokens = bucket->tokens + (nowMs - bucket->lastMs) * filter->conf.rate;
+
+        bucket->tokens = tokens < capacity ? tokens : capacity;
+        bucket->lastMs = nowMs;
+    }
+
+    if (bucket->tokens >= FILTER_TOKEN)
+    {
+        bucket->tokens -= FILTER_TOKEN;
+        return IPC_FILTER_PASS;
+    }
+
+    if (0 == bucket->count++)
+    {
+        bucket->priority = rec->priority;
+        bucket->reportMs = nowMs + FILTER_REPORT_MS;
+        due_at(filter, bucket->reportMs);
+    }
+
+    return IPC_FILTER_LIMITED;
+}
+
+/*******************************************************************************
+ * @brief Decide about a message
+ * @param filter
+ * @param nowMs - CLOCK_MONOTONIC milliseconds
+ * @param rec
+ * @return verdict
+ */
+ipc_filter_verdict_t ipc_filter_check(ipc_filter_t* filter, uint64_t nowMs, const ipc_filter_record_t* rec)
+{
+    ipc_filter_verdict_t verdict = IPC_FILTER_PASS;
+    ipc_filter_entry_t* entry = NULL;
+
+    if (filter->bShared)
+    {
+        pthread_mutex_lock(&filter->lock);
+    }
+
+    // copies held back don't use up the tokens of their source
+    if (filter->entries)
+    {
+        verdict = filter_dedup(filter, nowMs, rec, &entry);
+    }
+
+    if (IPC_FILTER_PASS == verdict && filter->buckets)
+    {
+        verdict = filter_rate(filter, nowMs, rec);
+
+        // the first copy isn't written => the next one mustn't count as a repeat
+        if (IPC_FILTER_LIMITED == verdict && entry)
+        {
+            entry->hash = 0;
+        }
+    }
+
+    if (filter->bShared)
+    {
+        pthread_mutex_unlock(&filter->lock);
+    }
+
+    return verdict;
+}
+
+/*******************************************************************************
+ * @brief Queue the summary of the first slot that is due
+ * @param filter
+ * @param nowMs
+ * @return 1 if one was queued, 0 if none is due
+ */
+static int filter_sweep(ipc_filter_t* filter, uint64_t nowMs)
+{
+    uint64_t nextDueMs = FILTER_NEVER;
+
+    for (int i = 0; filter->entries && i < FILTER_DEDUP_SLOTS; i++)
+    {
+        ipc_filter_entry_t* entry = &filter->entries[i];
+
+        if (0 == entry->count)
+        {
+            continue;
+        }
+
+        uint64_t dueMs = entry->startMs + filter->conf.dedupMs;
+
+        if (dueMs <= nowMs)
+        {
+            return entry_report(filter, entry);
+        }
+
+        nextDueMs = dueMs < nextDueMs ? dueMs : nextDueMs;
+    }
+
+    for (int i = 0; filter->buckets && i < FILTER_RATE_SLOTS; i++)
+    {
+        ipc_filter_bucket_t* bucket = &filter->buckets[i];
+
+        if (0 == bucket->count)
+        {
+            continue;
+        }
+
+        if (bucket->reportMs <= nowMs)
+        {
+            return bucket_report(filter, bucket);
+        }
+
+        nextDueMs = bucket->reportMs < nextDueMs ? bucket->reportMs : nextDueMs;
+    }
+
+    // every slot was looked at
+    filter->nextDueMs = nextDueMs;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Take the next summary that is due
+ * @param filter
+ * @param nowMs - CLOCK_MONOTONIC milliseconds, IPC_FILTER_FLUSH for all of them
+ * @param summary - [out]
+ * @return 1 if there was one, 0 otherwise
+ */
+int ipc_filter_next_report(ipc_filter_t* filter, uint64_t nowMs, ipc_filter_summary_t* summary)
+{
+    int bFound = 0;
+
+    if (filter->bShared)
+    {
+        pthread_mutex_lock(&filter->lock);
+    }
+
+    if (0 == filter->numPending && nowMs >= filter->nextDueMs)
+    {
+        filter_sweep(filter, nowMs);
+    }
+
+    if (filter->numPending > 0)
+    {
+        *summary = filter->pending[0];
+        filter->numPending--;
+        memmove(&filter->pending[0], &filter->pending[1], filter->numPending * sizeof(filter->pending[0]));
+        bFound = 1;
+    }
+
+    if (filter->bShared)
+    {
+        pthread_mutex_unlock(&filter->lock);
+    }
+
+    return bFound;
+}
+
+/*******************************************************************************
+ * @brief Time until the next summary is due
+ * @param filter
+ * @param nowMs - CLOCK_MONOTONIC milliseconds
+ * @return milliseconds, -1 if nothing is held back
+ */
+int ipc_filter_due_ms(ipc_filter_t* filter, uint64_t nowMs)
+{
+    int ms = -1;
+
+    if (filter->bShared)
+    {
+        pthread_mutex_lock(&filter->lock);
+    }
+
+    if (filter->numPending > 0 || filter->nextDueMs <= nowMs)
+    {
+        ms = 0;
+    }
+    else if (FILTER_NEVER != filter->nextDueMs)
+    {
+        uint64_t left = filter->nextDueMs - nowMs;
+
+        ms = left < INT32_MAX ? (int) left : INT32_MAX;
+    }
+
+    if (filter->bShared)
+    {
+        pthread_mutex_unlock(&filter->lock);
+    }
+
+    return ms;
+}
@@ -0,0 +1,129 @@
+#ifndef LOG4C_APPENDER_IPC_FILTER_H
+#define LOG4C_APPENDER_IPC_FILTER_H
+
+
+/**
+ * @file log4c_appender_ipc_filter.h
+ *
+ * @brief Duplicate suppression and rate limiting of the IPC appender.
+ *
+ * When a subsystem misbehaves, processes emit the same line thousands of
+ * times a second and bury everything else. The filter keeps the first copy
+ * of a message and counts the copies that follow it within a window
+ * ("dedup_ms"); when the window is over, the count comes out as a summary.
+ * Messages are told apart by their producer, priority, category and text.
+ * Independently, a token bucket per producer (or per category) lets through
+ * "rate_limit" lines a second with bursts of "rate_burst"; what exceeds it
+ * is counted and summarised once a second.
+ *
+ * Both tables are direct-mapped and of a fixed size: a message or a source
+ * that collides with another one takes its slot, and the summary of what the
+ * slot had counted so far comes out early. Counts are never lost.
+ *
+ * The master filters as it collects, or every process filters before it
+ * sends, saving the transport too. The filter does no I/O: the caller asks
+ * for the summaries that are due and writes them itself.
+ *
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define IPC_FILTER_CATEGORY     64      // category kept for a summary, with the NUL
+#define IPC_FILTER_TEXT         160     // message kept for a summary, with the NUL
+#define IPC_FILTER_FLUSH        UINT64_MAX      // "now" that makes every summary due
+
+typedef struct __ipc_filter ipc_filter_t;
+
+enum __ipc_filter_verdict
+{
+    IPC_FILTER_PASS = 0,        // write the message
+    IPC_FILTER_REPEATED,        // a copy of a message seen within the window
+    IPC_FILTER_LIMITED,         // its source is over the rate limit
+};
+
+typedef enum __ipc_filter_verdict ipc_filter_verdict_t;
+
+struct __ipc_filter_conf
+{
+    int dedupMs;                // window of duplicates, 0 for none
+    unsigned rate;              // lines per second per source, 0 for no limit
+    unsigned burst;             // lines a source may send at once
+    int bByCategory;            // 1 to limit per category instead of per process
+};
+
+typedef struct __ipc_filter_conf ipc_filter_conf_t;
+
+// a message to check
+struct __ipc_filter_record
+{
+    int32_t pid;
+    int priority;
+    const char* category;       // may be NULL
+    size_t categoryLen;
+    const void* key;            // bytes telling the message apart, e.g. its text
+    size_t keyLen;
+    uintptr_t tag;              // tells apart further, e.g. the format of the key; 0 if none
+    const char* text;           // what a summary quotes
+    size_t textLen;
+};
+
+typedef struct __ipc_filter_record ipc_filter_record_t;
+
+// what the filter held back
+struct __ipc_filter_summary
+{
+    ipc_filter_verdict_t verdict;       // IPC_FILTER_REPEATED or IPC_FILTER_LIMITED
+    unsigned count;                     // messages held back
+    int32_t pid;                        // source
+    int priority;                       // of the repeated message, of the first one limited
+    char category[IPC_FILTER_CATEGORY]; // "" if the source is a process
+    char text[IPC_FILTER_TEXT];         // the repeated message, truncated; "" if limited
+};
+
+typedef struct __ipc_filter_summary ipc_filter_summary_t;
+
+/**
+ * Create a filter.
+ *
+ * @param conf - dedupMs and rate must not be both 0
+ * @param bShared - 1 if several threads use it
+ * @return handle, NULL on failure
+ */
+ipc_filter_t* ipc_filter_create(const ipc_filter_conf_t* conf, int bShared);
+
+/**
+ * Free the filter. Summaries not taken yet are lost.
+ */
+void ipc_filter_destroy(ipc_filter_t* filter);
+
+/**
+ * Decide about a message. May make summaries due: take them with
+ * ipc_filter_next_report() before writing the message, so a summary never
+ * follows the message that made it due.
+ *
+ * @param nowMs - CLOCK_MONOTONIC milliseconds
+ * @return verdict
+ */
+ipc_filter_verdict_t ipc_filter_check(ipc_filter_t* filter, uint64_t nowMs, const ipc_filter_record_t* rec);
+
+/**
+ * Take the next summary that is due.
+ *
+ * @param nowMs - CLOCK_MONOTONIC milliseconds, IPC_FILTER_FLUSH to take
+ *                every summary, e.g. before closing
+ * @param summary - [out]
+ * @return 1 if there was one, 0 otherwise
+ */
+int ipc_filter_next_report(ipc_filter_t* filter, uint64_t nowMs, ipc_filter_summary_t* summary);
+
+/**
+ * Time until the next summary is due.
+ *
+ * @param nowMs - CLOCK_MONOTONIC milliseconds
+ * @return milliseconds, -1 if nothing is held back
+ */
+int ipc_filter_due_ms(ipc_filter_t* filter, uint64_t nowMs);
+
+
+#endif // LOG4C_APPENDER_IPC_FILTER_H
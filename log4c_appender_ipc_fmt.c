@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "log4c_appender_ipc_fmt.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+static const size_t MAX_SPEC_LEN    = 32;
+static const size_t MAX_STRING_LEN  = 65534;    // fits the 16-bit prefix with the NUL
+
+static const char* const NULL_STRING = "(null)";
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+
+// C type an argument is read with, the same on both ends
+enum __ipc_fmt_arg
+{
+    IPC_FMT_NONE = 0,   // conversion without an argument, i.e. "%%"
+    IPC_FMT_INT,
+    IPC_FMT_LONG,
+    IPC_FMT_LLONG,
+    IPC_FMT_SIZE,
+    IPC_FMT_INTMAX,
+    IPC_FMT_PTRDIFF,
+    IPC_FMT_DOUBLE,
+    IPC_FMT_STRING,
+    IPC_FMT_POINTER,
+};
+
+enum __ipc_fmt_length
+{
+    LEN_NONE = 0,
+    LEN_HH,
+    LEN_H,
+    LEN_L,
+    LEN_LL,
+    LEN_J,
+    LEN_Z,
+    LEN_T,
+    LEN_BIG_L,
+};
+
+// one conversion specification, from '%' to the conversion character
+struct __ipc_fmt_spec
+{
+    const char* start;
+    size_t len;
+    int stars;          // '*' width and/or precision, each takes an int
+    uint8_t type;
+};
+
+typedef struct __ipc_fmt_spec ipc_fmt_spec_t;
+
+/*******************************************************************************
+ * @brief Argument type of an integer conversion
+ * @param length - length modifier
+ * @return IPC_FMT_* type
+ */
+static uint8_t integer_type(int length)
+{
+    switch (length)
+    {
+    case LEN_L:     return IPC_FMT_LONG;
+    case LEN_LL:    return IPC_FMT_LLONG;
+    case LEN_J:     return IPC_FMT_INTMAX;
+    case LEN_Z:     return IPC_FMT_SIZE;
+    case LEN_T:     return IPC_FMT_PTRDIFF;
+    default:        return IPC_FMT_INT;     // char and short are promoted
+    }
+}
+
+/*******************************************************************************
+ * @brief Scan one conversion specification
+ * @param pos - points to the '%' character
+ * @param spec - [out]
+ * @return position after the specification, NULL if it is not supported
+ */
+static const char* scan_spec(const char* pos, ipc_fmt_spec_t* spec)
+{
+    const char* p = pos + 1;
+
+    spec->start = pos;
+    spec->stars = 0;
+    spec->type  = IPC_FMT_NONE;
+
+    if ('%' == *p)
+    {
+        spec->len = 2;
+        return p + 1;
+    }
+
+    // flags
+    while (*p && strchr("-+ #0'I", *p))
+    {
+        p++;
+    }
+
+    // width
+    if ('*' == *p)
+    {
+        spec->stars++;
+        p++;
+    }
+    else
+    {
+        while (*p >= '0' && *p <= '9')
+        {
+            p++;
+        }
+
+        // positional arguments ("%1$d") can't be packed in order
+        if ('$' == *p)
+        {
+            return NULL;
+        }
+    }
+
+    // precision
+    int bPrecision = ('.' == *p);
+
+    if (bPrecision)
+    {
+        p++;
+
+        if ('*' == *p)
+        {
+            spec->stars++;
+            p++;
+        }
+        else
+        {
+            while (*p >= '0' && *p <= '9')
+            {
+                p++;
+            }
+        }
+    }
+
+    // length modifier
+    int length = LEN_NONE;
+
+    switch (*p)
+    {
+    case 'h':
+        length = ('h' == p[1]) ? LEN_HH : LEN_H;
+        p += (LEN_HH == length) ? 2 : 1;
+        break;
+    case 'l':
+        length = ('l' == p[1]) ? LEN_LL : LEN_L;
+        p += (LEN_LL == length) ? 2 : 1;
+        break;
+    case 'q':
+        length = LEN_LL;
+        p++;
+        break;
+    case 'j':
+        length = LEN_J;
+        p++;
+        break;
+    case 'z':
+    case 'Z':
+        length = LEN_Z;
+        p++;
+        break;
+    case 't':
+        length = LEN_T;
+        p++;
+        break;
+    case 'L':
+        length = LEN_BIG_L;
+        p++;
+        break;
+    }
+
+    // conversion
+    switch (*p)
+    {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+        spec->type = integer_type(length);
+        break;
+
+    case 'c':
+        if (LEN_NONE != length)
+        {
+            return NULL;    // wint_t
+        }
+        spec->type = IPC_FMT_INT;
+        break;
+
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        if (LEN_BIG_L == length)
+        {
+            return NULL;    // long double
+        }
+        spec->type = IPC_FMT_DOUBLE;
+        break;
+
+    case 's':
+        if (LEN_NONE != length)
+        {
+            return NULL;    // wide string
+        }
+        // the string needn't be terminated within the precision, strlen() could overrun it
+        if (bPrecision)
+        {
+            return NULL;
+        }
+        spec->type = IPC_FMT_STRING;
+        break;
+
+    case 'p':
+        spec->type = IPC_FMT_POINTER;
+        break;
+
+    default:
+        // %n writes into the caller, %m depends on errno at the call => no way
+        return NULL;
+    }
+
+    p++;
+    spec->len = p - pos;
+
+    return spec->len < MAX_SPEC_LEN ? p : NULL;
+}
+
+/*******************************************************************************
+ * @brief Check a format string and list the types of its arguments
+ * @param format
+ * @param types - [out] IPC_FMT_MAX_ARGS entries
+ * @return number of arguments, -1 if not supported
+ */
+int ipc_fmt_parse(const char* format, uint8_t* types)
+{
+    int numArgs = 0;
+    const char* p = format;
+
+    while (NULL != (p = strchr(p, '%')))
+    {
+        ipc_fmt_spec_t spec;
+
+        if (NULL == (p = scan_spec(p, &spec)))
+        {
+            return -1;
+        }
+
+        if (IPC_FMT_NONE == spec.type)
+        {
+            continue;
+        }
+
+        if (numArgs + spec.stars + 1 > IPC_FMT_MAX_ARGS)
+        {
+            return -1;
+        }
+
+        for (int i = 0; i < spec.stars; i++)
+        {
+            types[numArgs++] = IPC_FMT_INT;
+        }
+
+        types[numArgs++] = spec.type;
+    }
+
+    return numArgs;
+}
+
+#define PACK_VALUE(TYPE) do { \
+    TYPE value = va_arg(ap, TYPE); \
+    if (pos + sizeof(value) > end) return 0; \
+    memcpy(pos, &value, sizeof(value)); \
+    pos += sizeof(value); \
+}while(0)
+
+/*******************************************************************************
+ * @brief Copy the arguments of a call into a byte string
+ * @param types - argument types
+ * @param numArgs - number of arguments
+ * @param ap - arguments
+ * @param out - destination
+ * @param size - size of the destination
+ * @return number of bytes used, 0 if they don't fit
+ */
+size_t ipc_fmt_pack(const uint8_t* types, int numArgs, va_list ap, char* out, size_t size)
+{
+    char* pos = out;
+    char* end = out + size;
+
+    for (int i = 0; i < numArgs; i++)
+    {
+        switch (types[i])
+        {
+        case IPC_FMT_INT:       PACK_VALUE(int);        break;
+        case IPC_FMT_LONG:      PACK_VALUE(long);       break;
+        case IPC_FMT_LLONG:     PACK_VALUE(long long);  break;
+        case IPC_FMT_SIZE:      PACK_VALUE(size_t);     break;
+        case IPC_FMT_INTMAX:    PACK_VALUE(intmax_t);   break;
+        case IPC_FMT_PTRDIFF:   PACK_VALUE(ptrdiff_t);  break;
+        case IPC_FMT_DOUBLE:    PACK_VALUE(double);     break;
+        case IPC_FMT_POINTER:   PACK_VALUE(void*);      break;
+
+        case IPC_FMT_STRING:
+        {
+            const char* str = va_arg(ap, const char*);
+            size_t len = strlen(str ? str : NULL_STRING);
+
+            // the terminating NUL travels too, so the string is used in place
+            uint16_t prefix = len + 1;
+
+            if (len > MAX_STRING_LEN || pos + sizeof(prefix) + prefix > end)
+            {
+                return 0;
+            }
+
+            memcpy(pos, &prefix, sizeof(prefix));
+            memcpy(pos + sizeof(prefix), str ? str : NULL_STRING, prefix);
+            pos += sizeof(prefix) + prefix;
+            break;
+        }
+
+        default:
+            return 0;
+        }
+    }
+
+    return pos - out;
+}
+
+#define UNPACK_VALUE(TYPE, VAR) \
+    TYPE VAR; \
+    if (pos + sizeof(VAR) > end) return -1; \
+    memcpy(&VAR, pos, sizeof(VAR)); \
+    pos += sizeof(VAR)
+
+#define RENDER_VALUE(VALUE) \
+    (0 == spec.stars ? snprintf(out + used, size - used, conv, VALUE) \
+     : 1 == spec.stars ? snprintf(out + used, size - used, conv, stars[0], VALUE) \
+     : snprintf(out + used, size - used, conv, stars[0], stars[1], VALUE))
+
+/*******************************************************************************
+ * @brief Render a message from a format string and its packed arguments
+ * @param format
+ * @param args - packed arguments
+ * @param argsLen - their length
+ * @param out - destination
+ * @param size - size of the destination
+ * @return length of the message, -1 if the arguments don't match
+ */
+int ipc_fmt_render(const char* format, const char* args, size_t argsLen, char* out, size_t size)
+{
+    const char* pos = args;
+    const char* end = args + argsLen;
+    const char* p   = format;
+    size_t used = 0;
+
+    out[0] = '\0';
+
+    while (*p && used < size - 1)
+    {
+        const char* percent = strchr(p, '%');
+        size_t literal = percent ? (size_t)(percent - p) : strlen(p);
+
+        if (literal > size - 1 - used)
+        {
+            literal = size - 1 - used;
+        }
+
+        memcpy(out + used, p, literal);
+        used += literal;
+        out[used] = '\0';
+
+        if (NULL == percent || used == size - 1)
+        {
+            break;
+        }
+
+        ipc_fmt_spec_t spec;
+
+        if (NULL == (p = scan_spec(percent, &spec)))
+        {
+            return -1;
+        }
+
+        if (IPC_FMT_NONE == spec.type)
+        {
+            out[used++] = '%';
+            out[used]   = '\0';
+            continue;
+        }
+
+        char conv[MAX_SPEC_LEN];
+        memcpy(conv, spec.start, spec.len);
+        conv[spec.len] = '\0';
+
+        int stars[2] = {0, 0};
+
+        for (int i = 0; i < spec.stars; i++)
+        {
+            if (pos + sizeof(int) > end)
+            {
+                return -1;
+            }
+
+            memcpy(&stars[i], pos, sizeof(int));
+            pos += sizeof(int);
+        }
+
+        int written = 0;
+
+        switch (spec.type)
+        {
+        case IPC_FMT_INT:       { UNPACK_VALUE(int, v);        written = RENDER_VALUE(v); break; }
+        case IPC_FMT_LONG:      { UNPACK_VALUE(long, v);       written = RENDER_VALUE(v); break; }
+        case IPC_FMT_LLONG:     { UNPACK_VALUE(long long, v);  written = RENDER_VALUE(v); break; }
+        case IPC_FMT_SIZE:      { UNPACK_VALUE(size_t, v);     written = RENDER_VALUE(v); break; }
+        case IPC_FMT_INTMAX:    { UNPACK_VALUE(intmax_t, v);   written = RENDER_VALUE(v); break; }
+        case IPC_FMT_PTRDIFF:   { UNPACK_VALUE(ptrdiff_t, v);  written = RENDER_VALUE(v); break; }
+        case IPC_FMT_DOUBLE:    { UNPACK_VALUE(double, v);     written = RENDER_VALUE(v); break; }
+        case IPC_FMT_POINTER:   { UNPACK_VALUE(void*, v);      written = RENDER_VALUE(v); break; }
+
+        case IPC_FMT_STRING:
+        {
+            UNPACK_VALUE(uint16_t, prefix);
+
+            if (0 == prefix || pos + prefix > end || '\0' != pos[prefix - 1])
+            {
+                return -1;
+            }
+
+            written = RENDER_VALUE(pos);
+            pos += prefix;
+            break;
+        }
+        }
+
+        if (written < 0)
+        {
+            return -1;
+        }
+
+        used += (size_t)written < size - used ? (size_t)written : size - 1 - used;
+    }
+
+    return (int)used;
+}
@@ -0,0 +1,69 @@
+#ifndef LOG4C_APPENDER_IPC_FMT_H
+#define LOG4C_APPENDER_IPC_FMT_H
+
+
+/**
+ * @file log4c_appender_ipc_fmt.h
+ *
+ * @brief Deferred printf-style formatting for the IPC appender.
+ *
+ * Instead of rendering a message, the producer packs the raw arguments of a
+ * printf-style call into a compact byte string. The master instance renders
+ * the message later from the very same format string.
+ *
+ * Only the portable subset of conversions is supported: integers of every
+ * standard width, doubles, C strings, pointers and '*' width/precision.
+ * Formats using anything else (%n, %m, long double, wide characters,
+ * positional arguments, a string with a precision, which may point to a
+ * buffer that isn't terminated) are reported as unsupported, and the caller
+ * is expected to render such messages itself.
+ *
+ * Numbers are copied byte by byte, strings are copied with a 16-bit length
+ * prefix, so the packed arguments carry no pointers into the producer.
+ *
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+// max number of arguments one format may consume (including '*' ones)
+#define IPC_FMT_MAX_ARGS    16
+
+/**
+ * Check a format string and list the types of the arguments it consumes.
+ *
+ * @param format - printf-style format string
+ * @param types - [out] argument types, IPC_FMT_MAX_ARGS entries
+ * @return number of arguments, -1 if the format is not supported
+ */
+int ipc_fmt_parse(const char* format, uint8_t* types);
+
+/**
+ * Copy the arguments of a call into a byte string.
+ *
+ * @param types - argument types returned by ipc_fmt_parse()
+ * @param numArgs - number of arguments
+ * @param ap - arguments of the call
+ * @param out - destination
+ * @param size - size of the destination
+ * @return number of bytes used, 0 if the arguments don't fit
+ */
+size_t ipc_fmt_pack(const uint8_t* types, int numArgs, va_list ap, char* out, size_t size);
+
+/**
+ * Render a message from a format string and the arguments packed for it.
+ *
+ * The output is always null-terminated and truncated to fit.
+ *
+ * @param format - the format string the arguments were packed for
+ * @param args - packed arguments
+ * @param argsLen - length of the packed arguments
+ * @param out - destination
+ * @param size - size of the destination, at least 1
+ * @return length of the message, -1 if the arguments don't match the format
+ */
+int ipc_fmt_render(const char* format, const char* args, size_t argsLen, char* out, size_t size);
+
+
+#endif // LOG4C_APPENDER_IPC_FMT_H
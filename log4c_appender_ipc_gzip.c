@@ -0,0 +1,627 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "log4c_appender_ipc_gzip.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define GZIP_HEADER_SIZE    20          // with an extra field of one subfield
+#define GZIP_FIXED_SIZE     16          // the part of the header that never changes
+#define GZIP_TRAILER_SIZE   8           // CRC-32 and size of the input
+#define GZIP_LENGTH_AT      16          // offset of the length of the frame in the header
+
+// ID1 ID2 CM FLG(FEXTRA), MTIME 0, XFL 0, OS Unix, XLEN 8, subfield 'I' 'P' of 4 bytes
+static const unsigned char GZIP_HEADER[GZIP_FIXED_SIZE] =
+{
+    0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0x03, 8, 0, 'I', 'P', 4, 0
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __ipc_gzip_buffer
+{
+    size_t used;
+    char* data;
+};
+
+typedef struct __ipc_gzip_buffer ipc_gzip_buffer_t;
+
+struct __ipc_gzip
+{
+    int fd;
+    off_t end;                  // of the frames written, thread only
+    size_t frameSize;
+    int flushMs;
+    size_t bufferSize;
+    int numBuffers;
+    ipc_gzip_buffer_t* buffers;
+    int head;                   // oldest buffer handed to the thread
+    int queued;                 // buffers handed to the thread; the pump fills the one after them
+    atomic_int error;           // errno of a failed write, reported once
+    pthread_t thread;
+    pthread_mutex_t lock;       // head, queued, the buffer being filled
+    pthread_cond_t cond;
+    int bIdle;                  // the thread waits for work
+    int bStop;
+    unsigned syncWanted;        // syncs asked for, and the ones done
+    unsigned syncDone;
+    // thread only
+    z_stream zs;
+    int bInFrame;
+    uLong crc;                  // of the input of the frame
+    size_t frameIn;             // bytes of input of the frame
+    struct timespec frameDue;   // CLOCK_MONOTONIC time the frame ends at the latest
+    unsigned char* out;         // the frame being built, header included
+    size_t outSize;
+};
+
+/*******************************************************************************
+ * @brief Store a 32 bits value little endian
+ */
+static void gzip_put32(unsigned char* at, uint32_t value)
+{
+    at[0] = value;
+    at[1] = value >> 8;
+    at[2] = value >> 16;
+    at[3] = value >> 24;
+}
+
+/*******************************************************************************
+ * @brief Whether a time is reached
+ */
+static int gzip_due(const struct timespec* at)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec > at->tv_sec || (now.tv_sec == at->tv_sec && now.tv_nsec >= at->tv_nsec);
+}
+
+/*******************************************************************************
+ * @brief Cut off a frame cut short at the end of the file
+ * @param fd
+ * @param path - for the log
+ * @return end of the file, -1 on failure
+ */
+static off_t gzip_recover(int fd, const char* path)
+{
+    off_t end = lseek(fd, 0, SEEK_END);
+    off_t offset = 0;
+
+    while (end > offset)
+    {
+        unsigned char header[GZIP_HEADER_SIZE];
+        size_t want = (end - offset < GZIP_HEADER_SIZE) ? (size_t)(end - offset) : GZIP_HEADER_SIZE;
+        size_t fixed = want < GZIP_FIXED_SIZE ? want : GZIP_FIXED_SIZE;
+
+        // not one of ours: appended to as it is
+        if ((ssize_t)want != pread(fd, header, want, offset) || 0 != memcmp(header, GZIP_HEADER, fixed))
+        {
+            return end;
+        }
+
+        uint32_t length = want < GZIP_HEADER_SIZE ? 0
+            : header[16] | header[17] << 8 | header[18] << 16 | (uint32_t)header[19] << 24;
+
+        if (want == GZIP_HEADER_SIZE && length < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE)
+        {
+            return end;
+        }
+
+        if (want < GZIP_HEADER_SIZE || offset + (off_t)length > end)
+        {
+            IPC_TRACE_INFO_LOG("Cutting off a frame of %s cut short, %lld bytes\n", path, (long long)(end - offset));
+
+            return (-1 == ftruncate(fd, offset)) ? -1 : offset;
+        }
+
+        offset += length;
+    }
+
+    return end;
+}
+
+/*******************************************************************************
+ * @brief Make room at the end of the frame being built
+ * @param gzip
+ * @param room - bytes needed at least
+ * @return 0 upon success, -1 if out of memory
+ */
+static int gzip_reserve(ipc_gzip_t* gzip, size_t room)
+{
+    size_t used = gzip->outSize - gzip->zs.avail_out;
+
+    if (gzip->zs.avail_out >= room)
+    {
+        return 0;
+    }
+
+    size_t size = gzip->outSize * 2;
+
+    while (size - used < room)
+    {
+        size *= 2;
+    }
+
+    unsigned char* out = (unsigned char*) realloc(gzip->out, size);
+
+    if (NULL == out)
+    {
+        return -1;
+    }
+
+    gzip->out           = out;
+    gzip->outSize       = size;
+    gzip->zs.next_out   = out + used;
+    gzip->zs.avail_out  = size - used;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Write a frame in one go, or nothing of it
+ * @param gzip
+ * @param len
+ * @return 0 upon success, -1 otherwise
+ */
+static int gzip_write_frame(ipc_gzip_t* gzip, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t written = write(gzip->fd, gzip->out + done, len - done);
+
+        if (written > 0)
+        {
+            done += written;
+        }
+        else if (EINTR != errno)
+        {
+            IPC_TRACE_ERROR_LOG("write() failed: %s\n", strerror(errno));
+            gzip->error = errno;
+
+            // a torn frame would hide every frame after it from the readers
+            if (done > 0 && -1 == ftruncate(gzip->fd, gzip->end))
+            {
+                IPC_TRACE_ERROR_LOG("ftruncate() failed: %s\n", strerror(errno));
+            }
+
+            return -1;
+        }
+    }
+
+    gzip->end += len;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Finish the frame being built and write it
+ * @param gzip
+ * @return 0 upon success or if there is none, -1 otherwise
+ */
+static int gzip_end_frame(ipc_gzip_t* gzip)
+{
+    if (!gzip->bInFrame)
+    {
+        return 0;
+    }
+
+    gzip->bInFrame = 0;
+
+    int status;
+
+    do
+    {
+        if (-1 == gzip_reserve(gzip, 1))
+        {
+            IPC_TRACE_ERROR_LOG("Out of memory compressing a frame\n");
+            gzip->error = ENOMEM;
+            return -1;
+        }
+
+        status = deflate(&gzip->zs, Z_FINISH);
+    }
+    while (Z_OK == status || Z_BUF_ERROR == status);
+
+    if (Z_STREAM_END != status || -1 == gzip_reserve(gzip, GZIP_TRAILER_SIZE))
+    {
+        IPC_TRACE_ERROR_LOG("Can't finish a frame: %s\n", Z_STREAM_END != status ? zError(status) : "out of memory");
+        gzip->error = Z_STREAM_END != status ? EIO : ENOMEM;
+        return -1;
+    }
+
+    size_t len = gzip->outSize - gzip->zs.avail_out;
+
+    gzip_put32(gzip->out + len, gzip->crc);
+    gzip_put32(gzip->out + len + 4, (uint32_t) gzip->frameIn);
+    len += GZIP_TRAILER_SIZE;
+    gzip_put32(gzip->out + GZIP_LENGTH_AT, (uint32_t) len);
+
+    return gzip_write_frame(gzip, len);
+}
+
+/*******************************************************************************
+ * @brief Compress a buffer into the frame, ending the frame when it's due
+ * @param gzip
+ * @param data
+ * @param len
+ */
+static void gzip_compress(ipc_gzip_t* gzip, const char* data, size_t len)
+{
+    if (!gzip->bInFrame)
+    {
+        deflateReset(&gzip->zs);
+        memcpy(gzip->out, GZIP_HEADER, GZIP_FIXED_SIZE);
+        gzip->zs.next_out  = gzip->out + GZIP_HEADER_SIZE;
+        gzip->zs.avail_out = gzip->outSize - GZIP_HEADER_SIZE;
+        gzip->crc          = crc32(0, Z_NULL, 0);
+        gzip->frameIn      = 0;
+        gzip->bInFrame     = 1;
+
+        clock_gettime(CLOCK_MONOTONIC, &gzip->frameDue);
+        gzip->frameDue.tv_sec  += gzip->flushMs / 1000;
+        gzip->frameDue.tv_nsec += (long)(gzip->flushMs % 1000) * 1000000L;
+
+        if (gzip->frameDue.tv_nsec >= 1000000000L)
+        {
+            gzip->frameDue.tv_sec++;
+            gzip->frameDue.tv_nsec -= 1000000000L;
+        }
+    }
+
+    gzip->crc           = crc32(gzip->crc, (const Bytef*) data, len);
+    gzip->frameIn      += len;
+    gzip->zs.next_in    = (Bytef*) data;
+    gzip->zs.avail_in   = len;
+
+    while (gzip->zs.avail_in > 0)
+    {
+        // never short of room in the end: the data is dropped rather than spun on
+        if (-1 == gzip_reserve(gzip, 1))
+        {
+            IPC_TRACE_ERROR_LOG("Out of memory compressing a frame\n");
+            gzip->error    = ENOMEM;
+            gzip->bInFrame = 0;
+            return;
+        }
+
+        deflate(&gzip->zs, Z_NO_FLUSH);
+    }
+
+    if (gzip->frameIn >= gzip->frameSize || gzip_due(&gzip->frameDue))
+    {
+        gzip_end_frame(gzip);
+    }
+}
+
+/*******************************************************************************
+ * @brief Compress the buffers handed over, end frames and sync on request
+ * @param param - the writer
+ * @return 0
+ */
+static void* gzip_run(void* param)
+{
+    ipc_gzip_t* gzip = (ipc_gzip_t*) param;
+
+    pthread_mutex_lock(&gzip->lock);
+
+    for (;;)
+    {
+        // with nothing else to do, the buffer being filled is taken as it is
+        if (0 == gzip->queued && gzip->buffers[gzip->head].used > 0)
+        {
+            gzip->queued = 1;
+        }
+
+        if (gzip->queued > 0)
+        {
+            ipc_gzip_buffer_t* buffer = &gzip->buffers[gzip->head];
+
+            pthread_mutex_unlock(&gzip->lock);
+
+            gzip_compress(gzip, buffer->data, buffer->used);
+
+            pthread_mutex_lock(&gzip->lock);
+
+            buffer->used = 0;
+            gzip->head   = (gzip->head + 1) % gzip->numBuffers;
+            gzip->queued--;
+            pthread_cond_broadcast(&gzip->cond);
+            continue;
+        }
+
+        if (gzip->syncDone != gzip->syncWanted)
+        {
+            unsigned wanted = gzip->syncWanted;
+
+            pthread_mutex_unlock(&gzip->lock);
+
+            if (0 == gzip_end_frame(gzip) && -1 == fdatasync(gzip->fd))
+            {
+                IPC_TRACE_ERROR_LOG("fdatasync() failed: %s\n", strerror(errno));
+                gzip->error = errno;
+            }
+
+            pthread_mutex_lock(&gzip->lock);
+
+            gzip->syncDone = wanted;
+            pthread_cond_broadcast(&gzip->cond);
+            continue;
+        }
+
+        if (gzip->bStop)
+        {
+            break;
+        }
+
+        if (gzip->bInFrame && gzip_due(&gzip->frameDue))
+        {
+            pthread_mutex_unlock(&gzip->lock);
+            gzip_end_frame(gzip);
+            pthread_mutex_lock(&gzip->lock);
+            continue;
+        }
+
+        gzip->bIdle = 1;
+
+        if (gzip->bInFrame)
+        {
+            pthread_cond_timedwait(&gzip->cond, &gzip->lock, &gzip->frameDue);
+        }
+        else
+        {
+            pthread_cond_wait(&gzip->cond, &gzip->lock);
+        }
+
+        gzip->bIdle = 0;
+    }
+
+    pthread_mutex_unlock(&gzip->lock);
+
+    gzip_end_frame(gzip);
+
+    return (void*)0;
+}
+
+/*******************************************************************************
+ * @brief Hand the buffer being filled over to the thread and take the next one
+ *
+ * The lock is held.
+ *
+ * @param gzip
+ */
+static void gzip_hand_over(ipc_gzip_t* gzip)
+{
+    gzip->queued++;
+    pthread_cond_broadcast(&gzip->cond);
+
+    while (gzip->queued == gzip->numBuffers)
+    {
+        pthread_cond_wait(&gzip->cond, &gzip->lock);
+    }
+}
+
+/*******************************************************************************
+ * @brief Report a failed write once
+ * @param gzip
+ * @return 0 if there is none, -1 otherwise
+ */
+static int gzip_status(ipc_gzip_t* gzip)
+{
+    int error = atomic_exchange(&gzip->error, 0);
+
+    if (0 == error)
+    {
+        return 0;
+    }
+
+    errno = error;
+
+    return -1;
+}
+
+/*******************************************************************************
+ * @brief Open the file for appending and start the thread
+ * @param path - output file
+ * @param level - zlib level
+ * @param frameSize - bytes of input per frame
+ * @param flushMs - max age of a frame
+ * @param bufferSize - bytes per buffer
+ * @param numBuffers - buffers waiting for the thread at most
+ * @return handle, NULL on failure
+ */
+ipc_gzip_t* ipc_gzip_create(const char* path, int level, size_t frameSize, int flushMs,
+                            size_t bufferSize, int numBuffers)
+{
+    if (0 == bufferSize || bufferSize > UINT32_MAX / 4 || numBuffers < 2)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ipc_gzip_t* gzip = (ipc_gzip_t*) calloc(1, sizeof(ipc_gzip_t));
+
+    if (NULL == gzip)
+    {
+        return NULL;
+    }
+
+    // read as well, to walk the frames
+    gzip->fd         = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    gzip->frameSize  = frameSize;
+    gzip->flushMs    = flushMs;
+    gzip->bufferSize = bufferSize;
+    gzip->numBuffers = numBuffers;
+    gzip->buffers    = (ipc_gzip_buffer_t*) calloc(numBuffers, sizeof(ipc_gzip_buffer_t));
+    gzip->outSize    = GZIP_HEADER_SIZE + bufferSize / 2;
+    gzip->out        = (unsigned char*) malloc(gzip->outSize);
+    gzip->end        = (-1 == gzip->fd) ? -1 : gzip_recover(gzip->fd, path);
+
+    for (int i = 0; gzip->buffers && i < numBuffers; i++)
+    {
+        if (NULL == (gzip->buffers[i].data = (char*) malloc(bufferSize)))
+        {
+            gzip->end = -1;
+        }
+    }
+
+    if (-1 == gzip->end || NULL == gzip->buffers || NULL == gzip->out)
+    {
+        IPC_TRACE_ERROR_LOG("Can't set up the compressing writer of %s: %s\n", path, strerror(errno));
+        ipc_gzip_destroy(gzip);
+        return NULL;
+    }
+
+    // raw deflate: the header and the trailer are written here
+    if (Z_OK != deflateInit2(&gzip->zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY))
+    {
+        IPC_TRACE_ERROR_LOG("deflateInit2() failed for %s\n", path);
+        ipc_gzip_destroy(gzip);
+        return NULL;
+    }
+
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&gzip->cond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+    pthread_mutex_init(&gzip->lock, NULL);
+
+    if (0 != pthread_create(&gzip->thread, NULL, gzip_run, gzip))
+    {
+        IPC_TRACE_ERROR_LOG("Error creating thread 'gzip_run'\n");
+        ipc_gzip_destroy(gzip);
+        return NULL;
+    }
+
+    return gzip;
+}
+
+/*******************************************************************************
+ * @brief Compress and write what is left, end the frame and close the file
+ * @param gzip
+ */
+void ipc_gzip_destroy(ipc_gzip_t* gzip)
+{
+    if (NULL == gzip)
+    {
+        return;
+    }
+
+    if (gzip->thread)
+    {
+        pthread_mutex_lock(&gzip->lock);
+        gzip->bStop = 1;
+        pthread_cond_broadcast(&gzip->cond);
+        pthread_mutex_unlock(&gzip->lock);
+
+        pthread_join(gzip->thread, NULL);
+
+        pthread_cond_destroy(&gzip->cond);
+        pthread_mutex_destroy(&gzip->lock);
+    }
+
+    if (gzip->zs.state)
+    {
+        deflateEnd(&gzip->zs);
+    }
+
+    for (int i = 0; gzip->buffers && i < gzip->numBuffers; i++)
+    {
+        free(gzip->buffers[i].data);
+    }
+
+    if (-1 != gzip->fd)
+    {
+        close(gzip->fd);
+    }
+
+    free(gzip->buffers);
+    free(gzip->out);
+    free(gzip);
+}
+
+/*******************************************************************************
+ * @brief Copy lines for compressing
+ * @param gzip
+ * @param iov
+ * @param count
+ * @return 0 upon success, -1 if a write has failed since the last call
+ */
+int ipc_gzip_writev(ipc_gzip_t* gzip, const struct iovec* iov, int count)
+{
+    pthread_mutex_lock(&gzip->lock);
+
+    for (int i = 0; i < count; i++)
+    {
+        const char* data = (const char*) iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        ipc_gzip_buffer_t* buffer = &gzip->buffers[(gzip->head + gzip->queued) % gzip->numBuffers];
+
+        // a line that doesn't fit starts the next buffer, so a frame ends on a whole line
+        if (len <= gzip->bufferSize && buffer->used + len > gzip->bufferSize)
+        {
+            gzip_hand_over(gzip);
+        }
+
+        while (len > 0)
+        {
+            buffer = &gzip->buffers[(gzip->head + gzip->queued) % gzip->numBuffers];
+
+            size_t room = gzip->bufferSize - buffer->used;
+            size_t chunk = len < room ? len : room;
+
+            memcpy(buffer->data + buffer->used, data, chunk);
+            buffer->used += chunk;
+            data += chunk;
+            len  -= chunk;
+
+            if (buffer->used == gzip->bufferSize)
+            {
+                gzip_hand_over(gzip);
+            }
+        }
+    }
+
+    if (gzip->bIdle)
+    {
+        pthread_cond_broadcast(&gzip->cond);
+    }
+
+    pthread_mutex_unlock(&gzip->lock);
+
+    return gzip_status(gzip);
+}
+
+/*******************************************************************************
+ * @brief Compress everything copied so far, write it and flush it to the disk
+ * @param gzip
+ * @return 0 upon success, -1 if a write or fdatasync() has failed
+ */
+int ipc_gzip_sync(ipc_gzip_t* gzip)
+{
+    pthread_mutex_lock(&gzip->lock);
+
+    unsigned wanted = ++gzip->syncWanted;
+    pthread_cond_broadcast(&gzip->cond);
+
+    while (gzip->syncDone != wanted)
+    {
+        pthread_cond_wait(&gzip->cond, &gzip->lock);
+    }
+
+    pthread_mutex_unlock(&gzip->lock);
+
+    return gzip_status(gzip);
+}
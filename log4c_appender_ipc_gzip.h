@@ -0,0 +1,76 @@
+#ifndef LOG4C_APPENDER_IPC_GZIP_H
+#define LOG4C_APPENDER_IPC_GZIP_H
+
+
+/**
+ * @file log4c_appender_ipc_gzip.h
+ *
+ * @brief Compressing writer of the output file.
+ *
+ * Log text compresses several times over, so writing it compressed takes
+ * that much less of the disk. The pump copies its batches into a few large
+ * buffers, like with the asynchronous writer; a thread of the writer
+ * compresses them and appends the result to the file. The pump never does
+ * the CPU work and waits only when every buffer is still to be compressed.
+ *
+ * The file is a sequence of gzip members ("frames"), each decodable on its
+ * own; gzip, zcat and zless read the whole sequence. A frame ends once it
+ * holds "frameSize" bytes of input, once its first line is "flushMs" old, or
+ * when the file is synced or closed, and it's written with a single write().
+ * A crash thus loses the frame being built and the buffers behind it, never
+ * what was written before.
+ *
+ * Every frame carries its own length in an extra field of its header, like
+ * BGZF does. Opening a file walks the frames by these and cuts off a frame
+ * that was cut short, e.g. by a power loss, so what is appended after it
+ * can still be read. A file that doesn't end with such frames is appended to
+ * as it is.
+ *
+ * Only the pump thread uses it, there is no locking on that side but a short
+ * one per batch.
+ *
+*/
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+typedef struct __ipc_gzip ipc_gzip_t;
+
+/**
+ * Open the file for appending and start the thread.
+ *
+ * @param path - output file, created if needed
+ * @param level - zlib level, 1 (fastest) to 9 (smallest)
+ * @param frameSize - bytes of input per frame at most (a frame holds whole
+ *                    buffers, so it may be up to a buffer larger)
+ * @param flushMs - max age of the first line of a frame
+ * @param bufferSize - bytes per buffer
+ * @param numBuffers - buffers that may wait for the thread at once
+ * @return handle, NULL on failure
+ */
+ipc_gzip_t* ipc_gzip_create(const char* path, int level, size_t frameSize, int flushMs,
+                            size_t bufferSize, int numBuffers);
+
+/**
+ * Compress and write what is left, end the frame and close the file.
+ */
+void ipc_gzip_destroy(ipc_gzip_t* gzip);
+
+/**
+ * Copy lines for compressing. A line is never split between two buffers
+ * unless it's longer than a buffer.
+ *
+ * @return 0 upon success, -1 if a write has failed since the last call
+ */
+int ipc_gzip_writev(ipc_gzip_t* gzip, const struct iovec* iov, int count);
+
+/**
+ * Compress everything copied so far, end the frame, write it and
+ * fdatasync() the file.
+ *
+ * @return 0 upon success, -1 if a write or the sync has failed
+ */
+int ipc_gzip_sync(ipc_gzip_t* gzip);
+
+
+#endif // LOG4C_APPENDER_IPC_GZIP_H
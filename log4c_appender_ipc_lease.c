@@ -0,0 +1,511 @@
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "log4c_appender_ipc_lease.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+
+// state of the control block
+static const uint32_t LEASE_EMPTY       = 0;    // no master, or it stepped down
+static const uint32_t LEASE_STARTING    = 1;    // master creates the queue and the ring
+static const uint32_t LEASE_READY       = 2;
+
+// how often a waiting instance checks that the master is still alive
+static const int      LEASE_POLL_MS     = 10;
+
+// tickets acknowledged on their own, beyond the contiguous syncDone
+#define LEASE_SYNC_SLOTS    64
+
+// locked bytes of the control block
+static const off_t    MASTER_BYTE       = 0;    // write-locked by the master
+static const off_t    MEMBER_BYTE       = 1;    // read-locked by every instance
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+
+// The shared memory object; only meaningful while masterPid holds the lock.
+struct __ipc_lease_shared
+{
+    _Atomic uint32_t state;
+    _Atomic int32_t masterPid;
+    _Atomic uint32_t generation;    // bumped by every new master
+    _Atomic uint32_t syncTicket;    // last sync ticket handed out
+    _Atomic uint32_t syncDone;      // this ticket and all before it are durable
+    _Atomic uint32_t syncAcks;      // bumped by every acknowledgement (futex)
+    _Atomic uint32_t syncAcked[LEASE_SYNC_SLOTS];   // by ticket % LEASE_SYNC_SLOTS
+};
+
+typedef struct __ipc_lease_shared ipc_lease_shared_t;
+
+struct __ipc_lease
+{
+    ipc_lease_shared_t* shared;
+    int fd;                         // the lock lives on it, kept open
+    int bMaster;
+};
+
+/*******************************************************************************
+ * @brief futex wrappers; shared futexes since the block spans processes
+ */
+static int futex_wait(_Atomic uint32_t* addr, uint32_t val, const struct timespec* rel)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, rel, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+/*******************************************************************************
+ * @brief Describe a lock taken on the control block
+ * @param lock - [out]
+ * @param type - F_WRLCK, F_RDLCK or F_UNLCK
+ * @param byte - MASTER_BYTE or MEMBER_BYTE
+ */
+static void lease_lock(struct flock* lock, short type, off_t byte)
+{
+    memset(lock, 0, sizeof(*lock));
+    lock->l_type   = type;
+    lock->l_whence = SEEK_SET;
+    lock->l_start  = byte;
+    lock->l_len    = 1;
+}
+
+/*******************************************************************************
+ * @brief Pid of the process holding the lease
+ * @param lease
+ * @return pid, 0 if nobody holds it (or it's the caller itself)
+ */
+static pid_t lease_holder(ipc_lease_t* lease)
+{
+    struct flock lock;
+    lease_lock(&lock, F_WRLCK, MASTER_BYTE);
+
+    if (-1 == fcntl(lease->fd, F_GETLK, &lock))
+    {
+        IPC_TRACE_ERROR_LOG("fcntl(F_GETLK) failed: %s\n", strerror(errno));
+        return 0;
+    }
+
+    return F_UNLCK == lock.l_type ? 0 : lock.l_pid;
+}
+
+/*******************************************************************************
+ * @brief Open (or create) the control block
+ * @param name - name of the shared memory object
+ * @return lease handle, NULL on failure
+ */
+ipc_lease_t* ipc_lease_open(const char* name)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+
+    if (-1 == fd)
+    {
+        IPC_TRACE_ERROR_LOG("shm_open(%s) failed: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    // every opener sizes it the same way, so racing creators agree
+    struct stat st;
+
+    if (-1 == fstat(fd, &st)
+        || ((size_t)st.st_size < sizeof(ipc_lease_shared_t) && -1 == ftruncate(fd, sizeof(ipc_lease_shared_t))))
+    {
+        IPC_TRACE_ERROR_LOG("sizing %s failed: %s\n", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    void* addr = mmap(NULL, sizeof(ipc_lease_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (MAP_FAILED == addr)
+    {
+        IPC_TRACE_ERROR_LOG("mmap(%s) failed: %s\n", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    ipc_lease_t* lease = (ipc_lease_t*) calloc(1, sizeof(ipc_lease_t));
+
+    if (NULL == lease)
+    {
+        munmap(addr, sizeof(ipc_lease_shared_t));
+        close(fd);
+        return NULL;
+    }
+
+    lease->shared = (ipc_lease_shared_t*) addr;
+    lease->fd     = fd;
+
+    // membership: lets the last instance know it's the last one
+    struct flock lock;
+    lease_lock(&lock, F_RDLCK, MEMBER_BYTE);
+
+    if (-1 == fcntl(fd, F_SETLK, &lock))
+    {
+        IPC_TRACE_ERROR_LOG("fcntl(F_SETLK) failed: %s\n", strerror(errno));
+    }
+
+    return lease;
+}
+
+/*******************************************************************************
+ * @brief Mark the lock just taken as the lease of this process
+ * @param lease
+ */
+static void lease_taken(ipc_lease_t* lease)
+{
+    ipc_lease_shared_t* shared = lease->shared;
+
+    // tickets taken before the generation changes are never waited for
+    // again, whatever the previous master received of them
+    uint32_t lastTicket = atomic_load(&shared->syncTicket);
+
+    // the pid goes last: until it matches the lock holder, nobody trusts
+    // whatever state a previous master left behind
+    atomic_store(&shared->state, LEASE_STARTING);
+    atomic_fetch_add(&shared->generation, 1);
+    atomic_store(&shared->syncDone, lastTicket);
+    atomic_store(&shared->masterPid, getpid());
+
+    lease->bMaster = 1;
+}
+
+/*******************************************************************************
+ * @brief Try to become the master
+ * @param lease
+ * @return 1 if the caller is the master now, 0 if another instance is,
+ *         -1 on failure
+ */
+int ipc_lease_acquire(ipc_lease_t* lease)
+{
+    struct flock lock;
+    lease_lock(&lock, F_WRLCK, MASTER_BYTE);
+
+    if (-1 == fcntl(lease->fd, F_SETLK, &lock))
+    {
+        if (EAGAIN == errno || EACCES == errno)
+        {
+            return 0;
+        }
+
+        IPC_TRACE_ERROR_LOG("fcntl(F_SETLK) failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    lease_taken(lease);
+
+    return 1;
+}
+
+/*******************************************************************************
+ * @brief Block until the caller becomes the master
+ * @param lease
+ * @return 1 once the caller is the master, -1 on failure
+ */
+int ipc_lease_acquire_wait(ipc_lease_t* lease)
+{
+    struct flock lock;
+    lease_lock(&lock, F_WRLCK, MASTER_BYTE);
+
+    while (-1 == fcntl(lease->fd, F_SETLKW, &lock))
+    {
+        if (EINTR != errno)
+        {
+            IPC_TRACE_ERROR_LOG("fcntl(F_SETLKW) failed: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    lease_taken(lease);
+
+    return 1;
+}
+
+/*******************************************************************************
+ * @brief Master side: let the waiting instances in
+ * @param lease
+ */
+void ipc_lease_publish(ipc_lease_t* lease)
+{
+    atomic_store_explicit(&lease->shared->state, LEASE_READY, memory_order_release);
+    futex_wake(&lease->shared->state, INT_MAX);
+}
+
+/*******************************************************************************
+ * @brief Master side: keep newcomers out while stepping down
+ * @param lease
+ */
+void ipc_lease_withdraw(ipc_lease_t* lease)
+{
+    atomic_store(&lease->shared->state, LEASE_STARTING);
+}
+
+/*******************************************************************************
+ * @brief Stop counting as an instance
+ * @param lease
+ */
+void ipc_lease_leave(ipc_lease_t* lease)
+{
+    struct flock lock;
+    lease_lock(&lock, F_UNLCK, MEMBER_BYTE);
+    fcntl(lease->fd, F_SETLK, &lock);
+}
+
+/*******************************************************************************
+ * @brief Check if other instances still have the control block open
+ * @param lease
+ * @return 1 if there are others, 0 otherwise
+ */
+int ipc_lease_others(ipc_lease_t* lease)
+{
+    // our own read lock never conflicts with our own query
+    struct flock lock;
+    lease_lock(&lock, F_WRLCK, MEMBER_BYTE);
+
+    if (-1 == fcntl(lease->fd, F_GETLK, &lock))
+    {
+        IPC_TRACE_ERROR_LOG("fcntl(F_GETLK) failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    return F_UNLCK != lock.l_type;
+}
+
+/*******************************************************************************
+ * @brief Wait until the master instance is ready
+ * @param lease
+ * @param timeout_ms - upper bound of the wait
+ * @return 1 if ready, 0 if there is no master any more, -1 on timeout
+ */
+int ipc_lease_wait_master(ipc_lease_t* lease, int timeout_ms)
+{
+    ipc_lease_shared_t* shared = lease->shared;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (1)
+    {
+        uint32_t state = atomic_load_explicit(&shared->state, memory_order_acquire);
+        pid_t holder = lease_holder(lease);
+
+        if (0 == holder)
+        {
+            return 0;
+        }
+
+        if (LEASE_READY == state && holder == atomic_load(&shared->masterPid))
+        {
+            return 1;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        int64_t elapsed = (int64_t)(now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+
+        if (elapsed >= timeout_ms)
+        {
+            return -1;
+        }
+
+        // woken up by ipc_lease_publish(), the timeout catches a dying master
+        struct timespec rel = {0, LEASE_POLL_MS * 1000000L};
+        futex_wait(&shared->state, state, &rel);
+    }
+}
+
+/*******************************************************************************
+ * @brief Pid of the ready master instance
+ * @param lease
+ * @return pid, 0 if there is none
+ */
+pid_t ipc_lease_master(ipc_lease_t* lease)
+{
+    if (lease->bMaster)
+    {
+        return getpid();
+    }
+
+    ipc_lease_shared_t* shared = lease->shared;
+    pid_t holder = lease_holder(lease);
+
+    if (0 == holder
+        || LEASE_READY != atomic_load_explicit(&shared->state, memory_order_acquire)
+        || holder != atomic_load(&shared->masterPid))
+    {
+        return 0;
+    }
+
+    return holder;
+}
+
+/*******************************************************************************
+ * @brief Number of masters elected so far
+ * @param lease
+ * @return generation counter
+ */
+uint32_t ipc_lease_generation(ipc_lease_t* lease)
+{
+    return atomic_load_explicit(&lease->shared->generation, memory_order_acquire);
+}
+
+/*******************************************************************************
+ * @brief Take a ticket for a durability acknowledgement
+ * @param lease
+ * @return ticket, never 0
+ */
+uint32_t ipc_lease_sync_ticket(ipc_lease_t* lease)
+{
+    uint32_t ticket;
+
+    // 0 would look acknowledged by a fresh control block
+    while (0 == (ticket = atomic_fetch_add(&lease->shared->syncTicket, 1) + 1))
+    {
+    }
+
+    return ticket;
+}
+
+/*******************************************************************************
+ * @brief Wait until the master made the ticket durable
+ * @param lease
+ * @param ticket - from ipc_lease_sync_ticket()
+ * @param generation - ipc_lease_generation() before taking the ticket
+ * @param timeout_ms - upper bound of the wait
+ * @return 1 once durable, 0 if the master changed meanwhile, -1 on timeout
+ */
+int ipc_lease_sync_wait(ipc_lease_t* lease, uint32_t ticket, uint32_t generation, int timeout_ms)
+{
+    ipc_lease_shared_t* shared = lease->shared;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (1)
+    {
+        // read first, so an acknowledgement after the checks ends the wait
+        uint32_t acks = atomic_load_explicit(&shared->syncAcks, memory_order_acquire);
+        uint32_t done = atomic_load_explicit(&shared->syncDone, memory_order_acquire);
+
+        // a new master bumps the generation before acknowledging anything,
+        // and it may acknowledge a later ticket while ours was lost
+        if (generation != atomic_load_explicit(&shared->generation, memory_order_acquire))
+        {
+            return 0;
+        }
+
+        if ((int32_t)(done - ticket) >= 0
+            || ticket == atomic_load_explicit(&shared->syncAcked[ticket % LEASE_SYNC_SLOTS], memory_order_acquire))
+        {
+            return 1;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        int64_t elapsed = (int64_t)(now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+
+        if (elapsed >= timeout_ms)
+        {
+            return -1;
+        }
+
+        // woken up by ipc_lease_sync_done(), the timeout catches a dying master
+        struct timespec rel = {0, LEASE_POLL_MS * 1000000L};
+        futex_wait(&shared->syncAcks, acks, &rel);
+    }
+}
+
+/*******************************************************************************
+ * @brief Master side: everything sent before the ticket is durable
+ *
+ * Tickets are taken before their requests are sent, so they may arrive out
+ * of order: syncDone only moves over tickets all acknowledged, a ticket
+ * beyond one still missing is acknowledged in its slot.
+ *
+ * @param lease
+ * @param ticket
+ */
+void ipc_lease_sync_done(ipc_lease_t* lease, uint32_t ticket)
+{
+    ipc_lease_shared_t* shared = lease->shared;
+
+    atomic_store_explicit(&shared->syncAcked[ticket % LEASE_SYNC_SLOTS], ticket, memory_order_release);
+
+    uint32_t done = atomic_load(&shared->syncDone);
+
+    for (;;)
+    {
+        // 0 is never handed out
+        uint32_t next = (0 == done + 1) ? 1 : done + 1;
+
+        if (next != atomic_load(&shared->syncAcked[next % LEASE_SYNC_SLOTS]))
+        {
+            break;
+        }
+
+        if (atomic_compare_exchange_weak_explicit(&shared->syncDone, &done, next,
+                                                  memory_order_release, memory_order_relaxed))
+        {
+            done = next;
+        }
+    }
+
+    atomic_fetch_add_explicit(&shared->syncAcks, 1, memory_order_release);
+    futex_wake(&shared->syncAcks, INT_MAX);
+}
+
+/*******************************************************************************
+ * @brief Step down, keeping the control block mapped
+ * @param lease
+ */
+void ipc_lease_release(ipc_lease_t* lease)
+{
+    if (!lease->bMaster)
+    {
+        return;
+    }
+
+    atomic_store(&lease->shared->state, LEASE_EMPTY);
+    atomic_store(&lease->shared->masterPid, 0);
+    futex_wake(&lease->shared->state, INT_MAX);
+
+    struct flock lock;
+    lease_lock(&lock, F_UNLCK, MASTER_BYTE);
+    fcntl(lease->fd, F_SETLK, &lock);
+
+    lease->bMaster = 0;
+}
+
+/*******************************************************************************
+ * @brief Unmap the control block, stepping down if we are the master
+ * @param lease
+ */
+void ipc_lease_close(ipc_lease_t* lease)
+{
+    if (NULL == lease)
+    {
+        return;
+    }
+
+    ipc_lease_release(lease);
+
+    munmap(lease->shared, sizeof(ipc_lease_shared_t));
+    close(lease->fd);
+    free(lease);
+}
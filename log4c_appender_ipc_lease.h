@@ -0,0 +1,153 @@
+#ifndef LOG4C_APPENDER_IPC_LEASE_H
+#define LOG4C_APPENDER_IPC_LEASE_H
+
+
+/**
+ * @file log4c_appender_ipc_lease.h
+ *
+ * @brief Master election for the IPC appender.
+ *
+ * A tiny POSIX shared memory object (the control block) names the master
+ * instance. Being the master means holding a write lock on the control block,
+ * taken with fcntl(F_SETLK). The kernel drops the lock when its holder exits
+ * for whatever reason, so a crashed master never blocks the election, and
+ * the lock is not inherited by fork() children.
+ *
+ * The master publishes its pid and switches the state to "ready" once the
+ * queue (and the ring) exist. Other instances trust the control block only
+ * while its pid matches the current lock holder, which makes leftovers of a
+ * crashed master harmless.
+ *
+ * Nothing in the election takes more than a couple of system calls unless a
+ * master is starting up concurrently, in which case the others sleep on a
+ * futex until it is ready.
+ *
+ * Instances that lost the election may block in ipc_lease_acquire_wait() to
+ * take over as soon as the master is gone.
+ *
+ * The control block also carries the durability acknowledgements: producers
+ * take increasing tickets, send them behind their records, and sleep on a
+ * futex until the master announces their ticket as durable, or all tickets
+ * up to a higher one.
+ *
+*/
+
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct __ipc_lease ipc_lease_t;
+
+/**
+ * Open (or create) the control block.
+ *
+ * @param name - name of the shared memory object, e.g. "/test_ctl"
+ * @return lease handle, NULL on failure
+ */
+ipc_lease_t* ipc_lease_open(const char* name);
+
+/**
+ * Try to become the master. Never blocks.
+ *
+ * @return 1 if the caller is the master now, 0 if another instance is,
+ *         -1 on failure
+ */
+int ipc_lease_acquire(ipc_lease_t* lease);
+
+/**
+ * Block until the caller becomes the master, i.e. until the current master
+ * steps down or dies. A cancellation point.
+ *
+ * @return 1 once the caller is the master, -1 on failure
+ */
+int ipc_lease_acquire_wait(ipc_lease_t* lease);
+
+/**
+ * Master side: the shared resources are ready, let the others in.
+ */
+void ipc_lease_publish(ipc_lease_t* lease);
+
+/**
+ * Master side: keep newcomers waiting while the master steps down; they
+ * will either adopt what it leaves behind or start from scratch.
+ */
+void ipc_lease_withdraw(ipc_lease_t* lease);
+
+/**
+ * Stop counting as an instance, e.g. while closing the appender.
+ */
+void ipc_lease_leave(ipc_lease_t* lease);
+
+/**
+ * Check if other instances still have the control block open. Every instance
+ * holds a shared lock on it, which goes away with the process, so crashed
+ * instances are never counted.
+ *
+ * @return 1 if there are others, 0 otherwise
+ */
+int ipc_lease_others(ipc_lease_t* lease);
+
+/**
+ * Wait until the master instance is ready.
+ *
+ * @param timeout_ms - upper bound of the wait
+ * @return 1 if the master is ready, 0 if there is no master any more (the
+ *         caller should try to acquire the lease), -1 on timeout
+ */
+int ipc_lease_wait_master(ipc_lease_t* lease, int timeout_ms);
+
+/**
+ * Pid of the ready master instance, 0 if there is none.
+ */
+pid_t ipc_lease_master(ipc_lease_t* lease);
+
+/**
+ * Number of masters elected so far; changes whenever a new master takes over,
+ * so per-master state (e.g. format definitions) can be refreshed.
+ */
+uint32_t ipc_lease_generation(ipc_lease_t* lease);
+
+/**
+ * Take a ticket for a durability acknowledgement. Tickets are handed out in
+ * increasing order to all instances.
+ *
+ * @return ticket, never 0
+ */
+uint32_t ipc_lease_sync_ticket(ipc_lease_t* lease);
+
+/**
+ * Wait until the master announced the ticket as durable.
+ *
+ * @param ticket - from ipc_lease_sync_ticket()
+ * @param generation - ipc_lease_generation() read before taking the ticket
+ * @param timeout_ms - upper bound of the wait
+ * @return 1 once durable, 0 if another master took over meanwhile (what the
+ *         previous one had received may be lost), -1 on timeout
+ */
+int ipc_lease_sync_wait(ipc_lease_t* lease, uint32_t ticket, uint32_t generation, int timeout_ms);
+
+/**
+ * Master side: everything sent before the given ticket is durable; wakes
+ * up the waiting producers.
+ *
+ * Only this ticket is acknowledged: a lower one whose request hasn't come
+ * yet is still waited for. Up to 64 tickets beyond a missing one are held
+ * on their own, older ones time out.
+ */
+void ipc_lease_sync_done(ipc_lease_t* lease, uint32_t ticket);
+
+/**
+ * Master side: step down. The lock goes to an instance waiting in
+ * ipc_lease_acquire_wait(), if any.
+ */
+void ipc_lease_release(ipc_lease_t* lease);
+
+/**
+ * Unmap the control block; the master also steps down.
+ *
+ * The shared memory object itself is never removed: an instance that opened
+ * it just before the removal would hold a lock nobody else can see.
+ */
+void ipc_lease_close(ipc_lease_t* lease);
+
+
+#endif // LOG4C_APPENDER_IPC_LEASE_H
@@ -0,0 +1,316 @@
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "log4c_appender_ipc_loop.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define LOOP_MAX_EVENTS     64
+#define LOOP_WAKE_ID        0           // epoll id of the stop event
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __ipc_loop_source
+{
+    struct __ipc_loop_source* next;
+    uint64_t id;                // epoll data: a stale event never reaches a freed source
+    int fd;
+    ipc_loop_fn handler;
+    void* context;
+    int64_t deadlineMs;         // CLOCK_MONOTONIC, -1 for none
+};
+
+// lifeLock serializes starting and stopping the thread; loopLock guards the
+// sources and is held while a handler runs
+static pthread_mutex_t lifeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t loopLock = PTHREAD_MUTEX_INITIALIZER;
+static ipc_loop_source_t* sources = NULL;
+static uint64_t nextId = LOOP_WAKE_ID + 1;
+static int epollFd = -1;
+static int wakeFd = -1;
+static int bStop = 0;
+static pthread_t loopThread;
+
+static int64_t now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*******************************************************************************
+ * @brief Call a handler and remember when it wants to be called again
+ * @param source
+ * @param bReadable
+ */
+static void loop_dispatch(ipc_loop_source_t* source, int bReadable)
+{
+    int ms = source->handler(source->context, bReadable);
+
+    source->deadlineMs = ms < 0 ? -1 : now_ms() + ms;
+}
+
+/*******************************************************************************
+ * @brief epoll_wait() timeout until the nearest deadline of the sources
+ * @return milliseconds, -1 to wait for events only
+ */
+static int loop_timeout()
+{
+    int64_t nearest = -1;
+
+    for (ipc_loop_source_t* source = sources; source; source = source->next)
+    {
+        if (source->deadlineMs >= 0 && (nearest < 0 || source->deadlineMs < nearest))
+        {
+            nearest = source->deadlineMs;
+        }
+    }
+
+    if (nearest < 0)
+    {
+        return -1;
+    }
+
+    int64_t left = nearest - now_ms();
+
+    return left > 0 ? (int)left : 0;
+}
+
+/*******************************************************************************
+ * @brief Thread serving all sources
+ * @param param - unused
+ * @return 0
+ */
+static void* loop_run(void* param)
+{
+    struct epoll_event events[LOOP_MAX_EVENTS];
+
+    IPC_TRACE_INFO_LOG("ENTER\n");
+
+    pthread_mutex_lock(&loopLock);
+
+    while (!bStop)
+    {
+        int timeout = loop_timeout();
+
+        pthread_mutex_unlock(&loopLock);
+        int n = epoll_wait(epollFd, events, LOOP_MAX_EVENTS, timeout);
+        pthread_mutex_lock(&loopLock);
+
+        if (-1 == n && EINTR != errno)
+        {
+            IPC_TRACE_ERROR_LOG("epoll_wait() failed: %s\n", strerror(errno));
+        }
+
+        for (int i = 0; i < n && !bStop; i++)
+        {
+            // the source may have been removed since epoll_wait() returned
+            for (ipc_loop_source_t* source = sources; source; source = source->next)
+            {
+                if (source->id == events[i].data.u64)
+                {
+                    loop_dispatch(source, 1);
+                    break;
+                }
+            }
+        }
+
+        int64_t now = now_ms();
+
+        for (ipc_loop_source_t* source = sources; source && !bStop; source = source->next)
+        {
+            if (source->deadlineMs >= 0 && source->deadlineMs <= now)
+            {
+                loop_dispatch(source, 0);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&loopLock);
+
+    IPC_TRACE_INFO_LOG("EXIT\n");
+    return (void*)0;
+}
+
+/*******************************************************************************
+ * @brief Create the epoll set and start the thread
+ * @return 0 upon success, -1 otherwise
+ */
+static int loop_start()
+{
+    if (-1 == (epollFd = epoll_create1(EPOLL_CLOEXEC)))
+    {
+        IPC_TRACE_ERROR_LOG("epoll_create1() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events   = EPOLLIN;
+    event.data.u64 = LOOP_WAKE_ID;
+
+    if (-1 == (wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+        || -1 == epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event))
+    {
+        IPC_TRACE_ERROR_LOG("eventfd() failed: %s\n", strerror(errno));
+    }
+    else if (0 == pthread_create(&loopThread, NULL, loop_run, NULL))
+    {
+        return 0;
+    }
+    else
+    {
+        IPC_TRACE_ERROR_LOG("Error creating thread 'loop_run'\n");
+    }
+
+    if (-1 != wakeFd)
+    {
+        close(wakeFd);
+        wakeFd = -1;
+    }
+
+    close(epollFd);
+    epollFd = -1;
+
+    return -1;
+}
+
+/*******************************************************************************
+ * @brief Stop the thread and close the epoll set
+ */
+static void loop_stop()
+{
+    const uint64_t one = 1;
+
+    pthread_mutex_lock(&loopLock);
+    bStop = 1;
+    pthread_mutex_unlock(&loopLock);
+
+    if (-1 == write(wakeFd, &one, sizeof(one)))
+    {
+        IPC_TRACE_ERROR_LOG("write() failed: %s\n", strerror(errno));
+    }
+
+    pthread_join(loopThread, NULL);
+
+    close(wakeFd);
+    close(epollFd);
+    wakeFd  = -1;
+    epollFd = -1;
+    bStop   = 0;
+}
+
+/*******************************************************************************
+ * @brief Register a descriptor with the shared loop
+ * @param fd - descriptor to wait for
+ * @param handler
+ * @param context - passed to the handler
+ * @return source, NULL on failure
+ */
+ipc_loop_source_t* ipc_loop_add(int fd, ipc_loop_fn handler, void* context)
+{
+    ipc_loop_source_t* source = (ipc_loop_source_t*) calloc(1, sizeof(ipc_loop_source_t));
+
+    if (NULL == source)
+    {
+        return NULL;
+    }
+
+    source->fd         = fd;
+    source->handler    = handler;
+    source->context    = context;
+    source->deadlineMs = -1;
+
+    pthread_mutex_lock(&lifeLock);
+
+    if (NULL == sources && -1 == loop_start())
+    {
+        pthread_mutex_unlock(&lifeLock);
+        free(source);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&loopLock);
+
+    source->id = nextId++;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events   = EPOLLIN;
+    event.data.u64 = source->id;
+
+    int result = epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+
+    if (0 == result)
+    {
+        source->next = sources;
+        sources = source;
+    }
+    else
+    {
+        IPC_TRACE_ERROR_LOG("epoll_ctl() failed: %s\n", strerror(errno));
+    }
+
+    pthread_mutex_unlock(&loopLock);
+
+    if (-1 == result)
+    {
+        if (NULL == sources)
+        {
+            loop_stop();
+        }
+
+        free(source);
+        source = NULL;
+    }
+
+    pthread_mutex_unlock(&lifeLock);
+
+    return source;
+}
+
+/*******************************************************************************
+ * @brief Unregister a source, stop the thread with the last one
+ * @param source
+ */
+void ipc_loop_remove(ipc_loop_source_t* source)
+{
+    if (NULL == source)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&lifeLock);
+    pthread_mutex_lock(&loopLock);
+
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, source->fd, NULL);
+
+    for (ipc_loop_source_t** link = &sources; *link; link = &(*link)->next)
+    {
+        if (*link == source)
+        {
+            *link = source->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&loopLock);
+
+    if (NULL == sources)
+    {
+        loop_stop();
+    }
+
+    pthread_mutex_unlock(&lifeLock);
+
+    free(source);
+}
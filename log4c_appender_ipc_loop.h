@@ -0,0 +1,55 @@
+#ifndef LOG4C_APPENDER_IPC_LOOP_H
+#define LOG4C_APPENDER_IPC_LOOP_H
+
+
+/**
+ * @file log4c_appender_ipc_loop.h
+ *
+ * @brief Event loop shared by the pumps of all master instances of a process.
+ *
+ * A process configuring one appender per subsystem is the master of many
+ * queues at once. Instead of a thread blocked in mq_receive() per queue, the
+ * descriptors (a Linux mqd_t is pollable) are registered in one epoll set
+ * served by a single thread, started with the first source and stopped with
+ * the last one.
+ *
+ * A handler is called when its descriptor is readable and when the timeout it
+ * asked for expires, e.g. to write out a lingering batch. It should consume a
+ * bounded amount of work per call: the set is level-triggered, so a source
+ * that still has data is simply called again, after the others.
+ *
+ * Handlers run with the loop locked: removing a source waits until its
+ * handler has returned, and a handler must not add or remove sources.
+ *
+*/
+
+typedef struct __ipc_loop_source ipc_loop_source_t;
+
+/**
+ * Source handler.
+ *
+ * @param context - as passed to ipc_loop_add()
+ * @param bReadable - 1 if the descriptor is readable, 0 if the timeout expired
+ * @return milliseconds until the handler wants to be called anyway,
+ *         -1 to wait for the descriptor only
+ */
+typedef int (*ipc_loop_fn)(void* context, int bReadable);
+
+/**
+ * Register a descriptor with the shared loop, starting its thread if needed.
+ *
+ * @param fd - descriptor to wait for, e.g. the server side of a message queue
+ * @param handler
+ * @param context - passed to the handler
+ * @return source, NULL on failure
+ */
+ipc_loop_source_t* ipc_loop_add(int fd, ipc_loop_fn handler, void* context);
+
+/**
+ * Unregister a source; the handler is not running and won't be called after
+ * this returns. Stops the thread with the last source.
+ */
+void ipc_loop_remove(ipc_loop_source_t* source);
+
+
+#endif // LOG4C_APPENDER_IPC_LOOP_H
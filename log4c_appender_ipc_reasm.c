@@ -0,0 +1,442 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log4c_appender_ipc_reasm.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define REASM_SLOTS         64          // messages in flight at once
+#define REASM_MIN_SHIFT     12          // smallest pooled buffer: 4 KB
+#define REASM_CLASSES       20          // largest pooled buffer: 2 GB
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+enum __ipc_reasm_state
+{
+    REASM_FREE = 0,
+    REASM_PARTIAL,
+    REASM_DONE,         // handed out, waits for ipc_reasm_recycle()
+};
+
+struct __ipc_reasm_buffer
+{
+    struct __ipc_reasm_buffer* next;    // in the pool
+    int sizeClass;
+    char data[];
+};
+
+typedef struct __ipc_reasm_buffer ipc_reasm_buffer_t;
+
+struct __ipc_reasm_slot
+{
+    int state;
+    int32_t pid;
+    int32_t tid;
+    int lane;
+    uint32_t msgId;
+    uint32_t total;
+    uint32_t received;
+    uint64_t lastUse;
+    ipc_reasm_buffer_t* buffer;
+};
+
+typedef struct __ipc_reasm_slot ipc_reasm_slot_t;
+
+struct __ipc_reasm
+{
+    size_t maxMessage;
+    size_t memoryLimit;
+    size_t memoryUsed;          // buffers in slots and in the pool
+    uint64_t clock;             // orders the slots by last use
+    ipc_reasm_lost_fn onLost;
+    void* context;
+    ipc_reasm_buffer_t* pool[REASM_CLASSES];
+    ipc_reasm_slot_t slots[REASM_SLOTS];
+};
+
+static size_t class_size(int sizeClass)
+{
+    return (size_t)1 << (sizeClass + REASM_MIN_SHIFT);
+}
+
+static int class_of(size_t size)
+{
+    int sizeClass = 0;
+
+    while (class_size(sizeClass) < size)
+    {
+        sizeClass++;
+    }
+
+    return sizeClass;
+}
+
+/*******************************************************************************
+ * @brief Create the reassembly state
+ * @param maxMessage - largest message accepted
+ * @param memoryLimit - max bytes of buffers in the pool
+ * @param onLost - lost message callback, may be NULL
+ * @param context - passed to the callback
+ * @return handle, NULL on failure
+ */
+ipc_reasm_t* ipc_reasm_create(size_t maxMessage, size_t memoryLimit, ipc_reasm_lost_fn onLost, void* context)
+{
+    if (0 == maxMessage || maxMessage > class_size(REASM_CLASSES - 1))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ipc_reasm_t* reasm = (ipc_reasm_t*) calloc(1, sizeof(ipc_reasm_t));
+
+    if (NULL == reasm)
+    {
+        return NULL;
+    }
+
+    // the largest message must always fit, even with another one in flight
+    size_t minLimit = 2 * class_size(class_of(maxMessage));
+
+    reasm->maxMessage  = maxMessage;
+    reasm->memoryLimit = memoryLimit > minLimit ? memoryLimit : minLimit;
+    reasm->onLost      = onLost;
+    reasm->context     = context;
+
+    return reasm;
+}
+
+/*******************************************************************************
+ * @brief Free the reassembly state, pooled buffers included
+ * @param reasm
+ */
+void ipc_reasm_destroy(ipc_reasm_t* reasm)
+{
+    if (NULL == reasm)
+    {
+        return;
+    }
+
+    for (int i = 0; i < REASM_SLOTS; i++)
+    {
+        free(reasm->slots[i].buffer);
+    }
+
+    for (int i = 0; i < REASM_CLASSES; i++)
+    {
+        while (reasm->pool[i])
+        {
+            ipc_reasm_buffer_t* buffer = reasm->pool[i];
+            reasm->pool[i] = buffer->next;
+            free(buffer);
+        }
+    }
+
+    free(reasm);
+}
+
+/*******************************************************************************
+ * @brief Return a buffer to the pool
+ * @param reasm
+ * @param buffer
+ */
+static void pool_put(ipc_reasm_t* reasm, ipc_reasm_buffer_t* buffer)
+{
+    buffer->next = reasm->pool[buffer->sizeClass];
+    reasm->pool[buffer->sizeClass] = buffer;
+}
+
+/*******************************************************************************
+ * @brief Free one pooled buffer, the largest one, to make room for another size
+ * @param reasm
+ * @return 1 if a buffer was freed, 0 if the pool is empty
+ */
+static int pool_shrink(ipc_reasm_t* reasm)
+{
+    for (int i = REASM_CLASSES - 1; i >= 0; i--)
+    {
+        ipc_reasm_buffer_t* buffer = reasm->pool[i];
+
+        if (buffer)
+        {
+            reasm->pool[i] = buffer->next;
+            reasm->memoryUsed -= sizeof(ipc_reasm_buffer_t) + class_size(i);
+            free(buffer);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Give up an unfinished message
+ * @param reasm
+ * @param slot
+ */
+static void slot_give_up(ipc_reasm_t* reasm, ipc_reasm_slot_t* slot)
+{
+    pool_put(reasm, slot->buffer);
+
+    slot->buffer = NULL;
+    slot->state  = REASM_FREE;
+
+    if (reasm->onLost)
+    {
+        reasm->onLost(reasm->context, slot->pid);
+    }
+}
+
+/*******************************************************************************
+ * @brief The unfinished message extended longest ago
+ * @param reasm
+ * @return slot, NULL if there is none
+ */
+static ipc_reasm_slot_t* slot_oldest(ipc_reasm_t* reasm)
+{
+    ipc_reasm_slot_t* oldest = NULL;
+
+    for (int i = 0; i < REASM_SLOTS; i++)
+    {
+        ipc_reasm_slot_t* slot = &reasm->slots[i];
+
+        if (REASM_PARTIAL == slot->state && (NULL == oldest || slot->lastUse < oldest->lastUse))
+        {
+            oldest = slot;
+        }
+    }
+
+    return oldest;
+}
+
+/*******************************************************************************
+ * @brief The unfinished message of a thread in a lane
+ * @param reasm
+ * @param pid
+ * @param tid
+ * @param lane
+ * @return slot, NULL if there is none
+ */
+static ipc_reasm_slot_t* slot_find(ipc_reasm_t* reasm, int32_t pid, int32_t tid, int lane)
+{
+    for (int i = 0; i < REASM_SLOTS; i++)
+    {
+        ipc_reasm_slot_t* slot = &reasm->slots[i];
+
+        if (REASM_PARTIAL == slot->state && slot->pid == pid && slot->tid == tid && slot->lane == lane)
+        {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+ * @brief A buffer for a message, from the pool if possible
+ *
+ * Unfinished messages are given up, the oldest first, if the memory limit
+ * is reached.
+ *
+ * @param reasm
+ * @param size - message length
+ * @return buffer, NULL on failure (errno ENOBUFS or ENOMEM)
+ */
+static ipc_reasm_buffer_t* buffer_get(ipc_reasm_t* reasm, size_t size)
+{
+    int sizeClass = class_of(size);
+    size_t need = sizeof(ipc_reasm_buffer_t) + class_size(sizeClass);
+
+    for (;;)
+    {
+        ipc_reasm_buffer_t* buffer = reasm->pool[sizeClass];
+
+        if (buffer)
+        {
+            reasm->pool[sizeClass] = buffer->next;
+            return buffer;
+        }
+
+        if (reasm->memoryUsed + need <= reasm->memoryLimit)
+        {
+            break;
+        }
+
+        if (pool_shrink(reasm))
+        {
+            continue;
+        }
+
+        ipc_reasm_slot_t* oldest = slot_oldest(reasm);
+
+        if (NULL == oldest)
+        {
+            // everything is held by complete messages
+            errno = ENOBUFS;
+            return NULL;
+        }
+
+        slot_give_up(reasm, oldest);
+    }
+
+    ipc_reasm_buffer_t* buffer = (ipc_reasm_buffer_t*) malloc(need);
+
+    if (NULL == buffer)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    buffer->sizeClass = sizeClass;
+    reasm->memoryUsed += need;
+
+    return buffer;
+}
+
+/*******************************************************************************
+ * @brief Start a new message
+ * @param reasm
+ * @param pid
+ * @param tid
+ * @param lane
+ * @param msgId
+ * @param total - message length
+ * @return slot, NULL on failure (errno ENOBUFS or ENOMEM)
+ */
+static ipc_reasm_slot_t* slot_start(ipc_reasm_t* reasm, int32_t pid, int32_t tid, int lane, uint32_t msgId,
+                                    uint32_t total)
+{
+    ipc_reasm_slot_t* slot = NULL;
+
+    for (int i = 0; i < REASM_SLOTS && NULL == slot; i++)
+    {
+        if (REASM_FREE == reasm->slots[i].state)
+        {
+            slot = &reasm->slots[i];
+        }
+    }
+
+    if (NULL == slot && NULL != (slot = slot_oldest(reasm)))
+    {
+        slot_give_up(reasm, slot);
+    }
+
+    if (NULL == slot)
+    {
+        errno = ENOBUFS;
+        return NULL;
+    }
+
+    if (NULL == (slot->buffer = buffer_get(reasm, total)))
+    {
+        return NULL;
+    }
+
+    slot->state    = REASM_PARTIAL;
+    slot->pid      = pid;
+    slot->tid      = tid;
+    slot->lane     = lane;
+    slot->msgId    = msgId;
+    slot->total    = total;
+    slot->received = 0;
+
+    return slot;
+}
+
+/*******************************************************************************
+ * @brief Add a fragment
+ * @param reasm
+ * @param pid - producer process
+ * @param tid - producer thread
+ * @param lane - priority lane the message travels in
+ * @param msgId - message number, per thread
+ * @param total - message length
+ * @param offset - position of the fragment in the message
+ * @param data - fragment payload
+ * @param len - payload length
+ * @param message - [out] the complete message, valid until ipc_reasm_recycle()
+ * @return 1 if the message is complete, 0 if more fragments are needed,
+ *         -1 if the fragment was dropped
+ */
+int ipc_reasm_add(ipc_reasm_t* reasm, int32_t pid, int32_t tid, int lane, uint32_t msgId, uint32_t total,
+                  uint32_t offset, const char* data, size_t len, const char** message)
+{
+    ipc_reasm_slot_t* slot = slot_find(reasm, pid, tid, lane);
+
+    if (0 == offset)
+    {
+        // the thread has moved on, the rest of its previous message is lost
+        if (slot)
+        {
+            slot_give_up(reasm, slot);
+        }
+
+        if (0 == total || total > reasm->maxMessage)
+        {
+            if (reasm->onLost)
+            {
+                reasm->onLost(reasm->context, pid);
+            }
+
+            errno = EMSGSIZE;
+            return -1;
+        }
+
+        if (NULL == (slot = slot_start(reasm, pid, tid, lane, msgId, total)))
+        {
+            if (ENOBUFS != errno && reasm->onLost)
+            {
+                reasm->onLost(reasm->context, pid);
+            }
+
+            return -1;
+        }
+    }
+    else if (NULL == slot)
+    {
+        // the head never arrived, whoever dropped it has counted it
+        errno = EPROTO;
+        return -1;
+    }
+
+    if (slot->msgId != msgId || slot->received != offset || len > slot->total - offset)
+    {
+        slot_give_up(reasm, slot);
+        errno = EPROTO;
+        return -1;
+    }
+
+    memcpy(slot->buffer->data + offset, data, len);
+    slot->received += len;
+    slot->lastUse   = ++reasm->clock;
+
+    if (slot->received < slot->total)
+    {
+        return 0;
+    }
+
+    slot->state = REASM_DONE;
+    *message    = slot->buffer->data;
+
+    return 1;
+}
+
+/*******************************************************************************
+ * @brief Return the buffers of all complete messages to the pool
+ * @param reasm
+ */
+void ipc_reasm_recycle(ipc_reasm_t* reasm)
+{
+    for (int i = 0; i < REASM_SLOTS; i++)
+    {
+        ipc_reasm_slot_t* slot = &reasm->slots[i];
+
+        if (REASM_DONE == slot->state)
+        {
+            pool_put(reasm, slot->buffer);
+
+            slot->buffer = NULL;
+            slot->state  = REASM_FREE;
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef LOG4C_APPENDER_IPC_REASM_H
+#define LOG4C_APPENDER_IPC_REASM_H
+
+
+/**
+ * @file log4c_appender_ipc_reasm.h
+ *
+ * @brief Reassembly of messages split into fragments.
+ *
+ * A message larger than one message of the transport is sent as a sequence
+ * of fragments. Fragments of one message come from one thread, in order, but
+ * fragments of different threads and processes interleave, and so do those
+ * of different lanes (priorities) of one thread. The pump keeps one assembly
+ * per (pid, tid, lane) in flight.
+ *
+ * Memory is bounded: assemblies live in a fixed table and their buffers come
+ * from a pool of power-of-two size classes that grows up to a limit and is
+ * then recycled, so reassembling costs one copy and no malloc per message.
+ * When the limit or the table is exhausted, the least recently extended
+ * assembly is given up and reported as lost.
+ *
+ * Only the pump thread uses it, there is no locking.
+ *
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct __ipc_reasm ipc_reasm_t;
+
+/**
+ * Called when a partially received message of the process is given up.
+ */
+typedef void (*ipc_reasm_lost_fn)(void* context, int32_t pid);
+
+/**
+ * Create the reassembly state.
+ *
+ * @param maxMessage - largest message accepted
+ * @param memoryLimit - max bytes of buffers in the pool
+ * @param onLost - lost message callback, may be NULL
+ * @param context - passed to the callback
+ * @return handle, NULL on failure
+ */
+ipc_reasm_t* ipc_reasm_create(size_t maxMessage, size_t memoryLimit, ipc_reasm_lost_fn onLost, void* context);
+
+/**
+ * Free the reassembly state, pooled buffers included.
+ */
+void ipc_reasm_destroy(ipc_reasm_t* reasm);
+
+/**
+ * Add a fragment.
+ *
+ * A fragment with offset 0 starts a message and gives up an unfinished one of
+ * the same thread. A fragment that doesn't continue the message of its thread
+ * is ignored: its head was lost before it reached us.
+ *
+ * @param reasm
+ * @param pid - producer process
+ * @param tid - producer thread
+ * @param lane - priority lane the message travels in
+ * @param msgId - message number, per thread
+ * @param total - message length
+ * @param offset - position of the fragment in the message
+ * @param data - fragment payload
+ * @param len - payload length
+ * @param message - [out] the complete message, valid until ipc_reasm_recycle()
+ * @return 1 if the message is complete, 0 if more fragments are needed,
+ *         -1 if the fragment was dropped (errno ENOBUFS if all memory is held
+ *         by complete messages: recycle them and add the fragment again)
+ */
+int ipc_reasm_add(ipc_reasm_t* reasm, int32_t pid, int32_t tid, int lane, uint32_t msgId, uint32_t total,
+                  uint32_t offset, const char* data, size_t len, const char** message);
+
+/**
+ * Return the buffers of all complete messages to the pool.
+ */
+void ipc_reasm_recycle(ipc_reasm_t* reasm);
+
+
+#endif // LOG4C_APPENDER_IPC_REASM_H
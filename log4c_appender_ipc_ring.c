@@ -0,0 +1,729 @@
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "log4c_appender_ipc_ring.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define IPC_RING_CACHELINE      64
+#define IPC_RING_RESERVERS      64      // producers between reserving and publishing at once
+
+static const uint32_t IPC_RING_MAGIC    = 0x52435049; // "IPCR"
+static const uint32_t IPC_RING_VERSION  = 2;
+
+// record header word: state bits + payload length
+static const uint32_t REC_BUSY          = 0x80000000u;
+static const uint32_t REC_READY         = 0x40000000u;
+static const uint32_t REC_PAD           = 0x20000000u;
+static const uint32_t REC_LEN_MASK      = 0x1fffffffu;
+
+static const size_t   REC_HDR_SIZE      = 8;
+static const size_t   MIN_CAPACITY      = 4096;
+
+// how long an unpublished record may block the consumer before recovery
+static const int      STALL_TIMEOUT_MS  = 2000;
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+
+// Placed at the beginning of the shared memory object. Cursors are free
+// running byte counters, the offset in the data area is (cursor & mask).
+struct __ipc_ring_shared
+{
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+
+    // producers
+    _Alignas(IPC_RING_CACHELINE) _Atomic uint64_t head;
+
+    // consumer
+    _Alignas(IPC_RING_CACHELINE) _Atomic uint64_t tail;
+
+    // consumer sleeps on dataSeq, producers on spaceSeq
+    _Alignas(IPC_RING_CACHELINE) _Atomic uint32_t dataSeq;
+    _Atomic uint32_t consumerSleeping;
+    _Alignas(IPC_RING_CACHELINE) _Atomic uint32_t spaceSeq;
+    _Atomic uint32_t spaceWaiters;
+
+    // pid of every producer from before it reserves until it publishes,
+    // so space with no header yet is known to have a live writer
+    struct
+    {
+        _Alignas(IPC_RING_CACHELINE) _Atomic int32_t pid;
+    } reservers[IPC_RING_RESERVERS];
+};
+
+typedef struct __ipc_ring_shared ipc_ring_shared_t;
+
+// header of every record, 8 bytes to keep payloads aligned
+struct __ipc_ring_record
+{
+    _Atomic uint32_t word;
+    _Atomic int32_t  pid;
+};
+
+typedef struct __ipc_ring_record ipc_ring_record_t;
+
+struct __ipc_ring
+{
+    ipc_ring_shared_t* shared;
+    char* data;
+    size_t mapSize;
+    uint64_t mask;
+
+    // consumer-private state
+    uint64_t readPos;
+    uint64_t stallPos;
+    struct timespec stallSince;
+};
+
+/*******************************************************************************
+ * @brief futex wrappers; shared futexes since the ring spans processes
+ */
+static int futex_wait(_Atomic uint32_t* addr, uint32_t val, const struct timespec* rel)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, rel, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+static size_t align_record(size_t len)
+{
+    return (REC_HDR_SIZE + len + 7) & ~(size_t)7;
+}
+
+static ipc_ring_record_t* record_at(ipc_ring_t* ring, uint64_t pos)
+{
+    return (ipc_ring_record_t*)(ring->data + (pos & ring->mask));
+}
+
+static size_t shared_header_size(void)
+{
+    return (sizeof(ipc_ring_shared_t) + IPC_RING_CACHELINE - 1) & ~(size_t)(IPC_RING_CACHELINE - 1);
+}
+
+/*******************************************************************************
+ * @brief Check if a record fits between head and tail
+ * @param ring - ring handle
+ * @param head - reservation cursor
+ * @param tail - release cursor
+ * @param need - aligned record size
+ * @param pad - [out] size of the padding record needed to wrap around
+ * @return 1 if it fits, 0 otherwise
+ */
+static int record_fits(ipc_ring_t* ring, uint64_t head, uint64_t tail, uint64_t need, uint64_t* pad)
+{
+    uint64_t capacity = ring->shared->capacity;
+    uint64_t contig   = capacity - (head & ring->mask);
+
+    *pad = (need > contig) ? contig : 0;
+
+    return head + *pad + need - tail <= capacity;
+}
+
+/*******************************************************************************
+ * @brief Register the calling producer before it reserves space
+ * @param ring - ring handle
+ * @param pid - of the caller
+ * @return slot to clear once published, -1 if all are taken
+ */
+static int reserver_claim(ipc_ring_t* ring, pid_t pid)
+{
+    // threads keep coming back to the slot they had, away from the others
+    static __thread unsigned hint;
+
+    for (unsigned i = 0; i < IPC_RING_RESERVERS; i++)
+    {
+        unsigned slot = (hint + i) % IPC_RING_RESERVERS;
+        int32_t expected = 0;
+
+        if (atomic_compare_exchange_strong_explicit(&ring->shared->reservers[slot].pid, &expected, pid,
+                                                    memory_order_seq_cst, memory_order_relaxed))
+        {
+            hint = slot;
+            return (int) slot;
+        }
+    }
+
+    return -1;
+}
+
+static void reserver_done(ipc_ring_t* ring, int slot)
+{
+    atomic_store_explicit(&ring->shared->reservers[slot].pid, 0, memory_order_release);
+}
+
+static int64_t elapsed_ms(const struct timespec* since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/*******************************************************************************
+ * @brief Map the shared memory object into the process
+ * @param fd - descriptor of the shared memory object
+ * @param mapSize - size of the object
+ * @return ring handle, NULL on failure
+ */
+static ipc_ring_t* map_ring(int fd, size_t mapSize)
+{
+    void* addr = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (MAP_FAILED == addr)
+    {
+        IPC_TRACE_ERROR_LOG("mmap() failed: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    ipc_ring_t* ring = (ipc_ring_t*) calloc(1, sizeof(ipc_ring_t));
+
+    if (NULL == ring)
+    {
+        munmap(addr, mapSize);
+        return NULL;
+    }
+
+    ring->shared  = (ipc_ring_shared_t*) addr;
+    ring->data    = (char*) addr + shared_header_size();
+    ring->mapSize = mapSize;
+
+    return ring;
+}
+
+/*******************************************************************************
+ * @brief Create (or recreate) the shared ring
+ * @param name - name of the shared memory object
+ * @param capacity - requested size of the data area
+ * @return ring handle, NULL on failure
+ */
+ipc_ring_t* ipc_ring_create(const char* name, size_t capacity)
+{
+    size_t cap = MIN_CAPACITY;
+
+    while (cap < capacity)
+    {
+        cap <<= 1;
+    }
+
+    // sanity check in case of uncleaned resources
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+
+    if (-1 == fd)
+    {
+        IPC_TRACE_ERROR_LOG("shm_open(%s) failed: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    // umask shouldn't prevent other users from attaching
+    fchmod(fd, 0666);
+
+    size_t mapSize = shared_header_size() + cap;
+    ipc_ring_t* ring = NULL;
+
+    if (-1 == ftruncate(fd, mapSize))
+    {
+        IPC_TRACE_ERROR_LOG("ftruncate(%s) failed: %s\n", name, strerror(errno));
+    }
+    else if (NULL != (ring = map_ring(fd, mapSize)))
+    {
+        ipc_ring_shared_t* shared = ring->shared;
+
+        // fresh object is zero-filled, which is also the "empty" state of records
+        shared->version  = IPC_RING_VERSION;
+        shared->capacity = cap;
+        ring->mask       = cap - 1;
+
+        atomic_store_explicit(&shared->magic, IPC_RING_MAGIC, memory_order_release);
+    }
+
+    close(fd);
+
+    if (NULL == ring)
+    {
+        shm_unlink(name);
+    }
+
+    return ring;
+}
+
+/*******************************************************************************
+ * @brief Map the ring created by the master instance
+ * @param name - name of the shared memory object
+ * @return ring handle, NULL on failure
+ */
+ipc_ring_t* ipc_ring_attach(const char* name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+
+    if (-1 == fd)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    ipc_ring_t* ring = NULL;
+
+    if (0 == fstat(fd, &st) && (size_t)st.st_size > shared_header_size())
+    {
+        ring = map_ring(fd, st.st_size);
+    }
+
+    close(fd);
+
+    if (NULL == ring)
+    {
+        return NULL;
+    }
+
+    ipc_ring_shared_t* shared = ring->shared;
+    uint32_t magic = atomic_load_explicit(&shared->magic, memory_order_acquire);
+
+    if (magic != IPC_RING_MAGIC
+        || shared->version != IPC_RING_VERSION
+        || shared->capacity + shared_header_size() != ring->mapSize)
+    {
+        IPC_TRACE_ERROR_LOG("%s is not a compatible ring\n", name);
+        ipc_ring_detach(ring);
+        return NULL;
+    }
+
+    ring->mask = shared->capacity - 1;
+
+    return ring;
+}
+
+/*******************************************************************************
+ * @brief Unmap the ring
+ * @param ring - ring handle
+ */
+void ipc_ring_detach(ipc_ring_t* ring)
+{
+    if (ring)
+    {
+        munmap(ring->shared, ring->mapSize);
+        free(ring);
+    }
+}
+
+/*******************************************************************************
+ * @brief Remove the shared memory object
+ * @param name - name of the shared memory object
+ */
+void ipc_ring_unlink(const char* name)
+{
+    shm_unlink(name);
+}
+
+/*******************************************************************************
+ * @brief Largest payload a single record can carry
+ * @param ring - ring handle
+ * @return size in bytes
+ */
+size_t ipc_ring_max_record(const ipc_ring_t* ring)
+{
+    // a record never takes more than half of the ring, so padding up to the
+    // end of the data area always leaves room for it after wrap-around
+    return ring->shared->capacity / 2 - REC_HDR_SIZE;
+}
+
+/*******************************************************************************
+ * @brief Publish one record
+ * @param ring - ring handle
+ * @param data - payload
+ * @param len - payload size
+ * @return 0 upon success, -1 otherwise (errno is EAGAIN or EMSGSIZE)
+ */
+int ipc_ring_write(ipc_ring_t* ring, const void* data, size_t len)
+{
+    struct iovec part;
+    part.iov_base = (void*) data;
+    part.iov_len  = len;
+
+    return ipc_ring_writev(ring, &part, 1);
+}
+
+/*******************************************************************************
+ * @brief Publish one record gathered from several parts
+ * @param ring - ring handle
+ * @param parts - payload pieces, concatenated in the record
+ * @param numParts - number of pieces
+ * @return 0 upon success, -1 otherwise (errno is EAGAIN or EMSGSIZE)
+ */
+int ipc_ring_writev(ipc_ring_t* ring, const struct iovec* parts, int numParts)
+{
+    ipc_ring_shared_t* shared = ring->shared;
+    size_t len = 0;
+
+    for (int i = 0; i < numParts; i++)
+    {
+        len += parts[i].iov_len;
+    }
+
+    if (len > ipc_ring_max_record(ring))
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    pid_t pid = getpid();
+    int slot = reserver_claim(ring, pid);
+
+    // as if full: the caller waits or takes another way
+    if (-1 == slot)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    uint64_t need = align_record(len);
+    uint64_t head = atomic_load_explicit(&shared->head, memory_order_seq_cst);
+    uint64_t pad;
+
+    // reserve: the record must be contiguous, so the rest of the data area is
+    // skipped with a padding record if it is too short
+    do
+    {
+        uint64_t tail = atomic_load_explicit(&shared->tail, memory_order_acquire);
+
+        if (!record_fits(ring, head, tail, need, &pad))
+        {
+            reserver_done(ring, slot);
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+    while (!atomic_compare_exchange_weak_explicit(&shared->head, &head, head + pad + need,
+                                                  memory_order_seq_cst, memory_order_relaxed));
+
+    if (pad)
+    {
+        atomic_store_explicit(&record_at(ring, head)->word, REC_PAD | (uint32_t)(pad - REC_HDR_SIZE),
+                              memory_order_release);
+        head += pad;
+    }
+
+    ipc_ring_record_t* rec = record_at(ring, head);
+
+    // leave a trace for the consumer in case we die before publishing
+    atomic_store_explicit(&rec->pid, pid, memory_order_relaxed);
+    atomic_store_explicit(&rec->word, REC_BUSY | (uint32_t)len, memory_order_release);
+
+    char* payload = (char*)rec + REC_HDR_SIZE;
+
+    for (int i = 0; i < numParts; i++)
+    {
+        memcpy(payload, parts[i].iov_base, parts[i].iov_len);
+        payload += parts[i].iov_len;
+    }
+
+    // sequentially consistent publish pairs with the consumer's
+    // "set sleeping, then re-check" in ipc_ring_wait_data()
+    atomic_store_explicit(&rec->word, REC_READY | (uint32_t)len, memory_order_seq_cst);
+    reserver_done(ring, slot);
+
+    if (atomic_load_explicit(&shared->consumerSleeping, memory_order_seq_cst))
+    {
+        atomic_fetch_add_explicit(&shared->dataSeq, 1, memory_order_seq_cst);
+        futex_wake(&shared->dataSeq, 1);
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Sleep until the consumer releases some space
+ * @param ring - ring handle
+ * @param len - payload size the caller failed to write
+ * @param deadline - absolute CLOCK_MONOTONIC deadline, NULL for no limit
+ * @return 0 if woken up, -1 on timeout
+ */
+int ipc_ring_wait_space(ipc_ring_t* ring, size_t len, const struct timespec* deadline)
+{
+    ipc_ring_shared_t* shared = ring->shared;
+    struct timespec rel;
+    struct timespec* pRel = NULL;
+
+    if (deadline)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        rel.tv_sec  = deadline->tv_sec - now.tv_sec;
+        rel.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+
+        if (rel.tv_nsec < 0)
+        {
+            rel.tv_sec--;
+            rel.tv_nsec += 1000000000L;
+        }
+
+        if (rel.tv_sec < 0)
+        {
+            return -1;
+        }
+
+        pRel = &rel;
+    }
+
+    atomic_fetch_add_explicit(&shared->spaceWaiters, 1, memory_order_seq_cst);
+    uint32_t seq = atomic_load_explicit(&shared->spaceSeq, memory_order_seq_cst);
+
+    // the consumer may have released the space right before we registered
+    uint64_t head = atomic_load_explicit(&shared->head, memory_order_seq_cst);
+    uint64_t tail = atomic_load_explicit(&shared->tail, memory_order_seq_cst);
+    uint64_t pad;
+    int result = 0;
+
+    if (!record_fits(ring, head, tail, align_record(len), &pad))
+    {
+        if (-1 == futex_wait(&shared->spaceSeq, seq, pRel) && ETIMEDOUT == errno)
+        {
+            result = -1;
+        }
+    }
+
+    atomic_fetch_sub_explicit(&shared->spaceWaiters, 1, memory_order_seq_cst);
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Recover from a record that is reserved but never published
+ * @param ring - ring handle
+ * @param word - current header word of the record at readPos
+ * @return 1 if the consumer can move on, 0 if it should keep waiting
+ */
+static int recover_stalled_record(ipc_ring_t* ring, uint32_t word)
+{
+    ipc_ring_record_t* rec = record_at(ring, ring->readPos);
+
+    if (word & REC_BUSY)
+    {
+        // the length is known, so the record can be skipped as soon as the
+        // producer is proven to be dead
+        pid_t pid = atomic_load_explicit(&rec->pid, memory_order_relaxed);
+
+        if (pid > 0 && -1 == kill(pid, 0) && ESRCH == errno)
+        {
+            IPC_TRACE_ERROR_LOG("skipping record of dead producer %d\n", (int)pid);
+            ring->readPos += align_record(word & REC_LEN_MASK);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    if (ring->stallPos != ring->readPos)
+    {
+        ring->stallPos = ring->readPos;
+        clock_gettime(CLOCK_MONOTONIC, &ring->stallSince);
+        return 0;
+    }
+
+    if (elapsed_ms(&ring->stallSince) < STALL_TIMEOUT_MS)
+    {
+        return 0;
+    }
+
+    // head first: every reservation below it was registered before, so a
+    // live producer that may still write into the space shows up below
+    uint64_t head = atomic_load_explicit(&ring->shared->head, memory_order_seq_cst);
+
+    for (int i = 0; i < IPC_RING_RESERVERS; i++)
+    {
+        pid_t pid = atomic_load_explicit(&ring->shared->reservers[i].pid, memory_order_seq_cst);
+
+        if (0 == pid)
+        {
+            continue;
+        }
+
+        if (-1 == kill(pid, 0) && ESRCH == errno)
+        {
+            int32_t expected = pid;
+            atomic_compare_exchange_strong(&ring->shared->reservers[i].pid, &expected, 0);
+            continue;
+        }
+
+        // maybe only stopped: its header and payload would land in released space
+        IPC_TRACE_ERROR_LOG("ring stalled by producer %d\n", (int)pid);
+        clock_gettime(CLOCK_MONOTONIC, &ring->stallSince);
+
+        return 0;
+    }
+
+    // the producer died between reservation and writing the header: records
+    // behind it can't be located any more, so drop whatever is in flight
+    IPC_TRACE_ERROR_LOG("ring stalled, dropping %llu bytes\n", (unsigned long long)(head - ring->readPos));
+    ring->readPos = head;
+
+    return 1;
+}
+
+/*******************************************************************************
+ * @brief Fetch the next published record
+ * @param ring - ring handle
+ * @param data - [out] payload inside the shared memory
+ * @param len - [out] payload size
+ * @return 1 if a record is returned, 0 otherwise
+ */
+int ipc_ring_next(ipc_ring_t* ring, const char** data, size_t* len)
+{
+    ipc_ring_shared_t* shared = ring->shared;
+
+    while (1)
+    {
+        uint64_t head = atomic_load_explicit(&shared->head, memory_order_acquire);
+
+        if (ring->readPos == head)
+        {
+            return 0;
+        }
+
+        ipc_ring_record_t* rec = record_at(ring, ring->readPos);
+        uint32_t word = atomic_load_explicit(&rec->word, memory_order_acquire);
+
+        if (word & REC_PAD)
+        {
+            ring->readPos += REC_HDR_SIZE + (word & REC_LEN_MASK);
+        }
+        else if (word & REC_READY)
+        {
+            *data = (const char*)rec + REC_HDR_SIZE;
+            *len  = word & REC_LEN_MASK;
+            ring->readPos += align_record(*len);
+            return 1;
+        }
+        else if (!recover_stalled_record(ring, word))
+        {
+            return 0;
+        }
+    }
+}
+
+/*******************************************************************************
+ * @brief Give back the space of all records fetched so far
+ * @param ring - ring handle
+ */
+void ipc_ring_release(ipc_ring_t* ring)
+{
+    ipc_ring_shared_t* shared = ring->shared;
+    uint64_t tail = atomic_load_explicit(&shared->tail, memory_order_relaxed);
+
+    if (tail == ring->readPos)
+    {
+        return;
+    }
+
+    // zero the space: an all-zero header means "not published yet" for
+    // whichever record lands on this spot during the next lap
+    uint64_t offset = tail & ring->mask;
+    uint64_t size   = ring->readPos - tail;
+
+    if (offset + size > shared->capacity)
+    {
+        memset(ring->data + offset, 0, shared->capacity - offset);
+        memset(ring->data, 0, offset + size - shared->capacity);
+    }
+    else
+    {
+        memset(ring->data + offset, 0, size);
+    }
+
+    atomic_store_explicit(&shared->tail, ring->readPos, memory_order_seq_cst);
+
+    if (atomic_load_explicit(&shared->spaceWaiters, memory_order_seq_cst))
+    {
+        atomic_fetch_add_explicit(&shared->spaceSeq, 1, memory_order_seq_cst);
+        futex_wake(&shared->spaceSeq, INT_MAX);
+    }
+}
+
+/*******************************************************************************
+ * @brief Size of the data area
+ * @param ring
+ * @return capacity in bytes
+ */
+size_t ipc_ring_capacity(const ipc_ring_t* ring)
+{
+    return ring->shared->capacity;
+}
+
+/*******************************************************************************
+ * @brief Bytes taken by records not released yet
+ * @param ring
+ * @return used size of the data area
+ */
+size_t ipc_ring_used(const ipc_ring_t* ring)
+{
+    uint64_t head = atomic_load_explicit(&ring->shared->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->shared->tail, memory_order_relaxed);
+
+    return head > tail ? (size_t)(head - tail) : 0;
+}
+
+/*******************************************************************************
+ * @brief Become the consumer of a ring attached as a producer
+ * @param ring
+ */
+void ipc_ring_adopt(ipc_ring_t* ring)
+{
+    // records the previous consumer read but didn't release are read again
+    ring->readPos = atomic_load_explicit(&ring->shared->tail, memory_order_acquire);
+    ring->stallPos = ring->readPos;
+    clock_gettime(CLOCK_MONOTONIC, &ring->stallSince);
+}
+
+/*******************************************************************************
+ * @brief Sleep on the futex while the ring is empty
+ * @param ring - ring handle
+ * @param timeout_ms - upper bound of the sleep
+ */
+void ipc_ring_wait_data(ipc_ring_t* ring, int timeout_ms)
+{
+    ipc_ring_shared_t* shared = ring->shared;
+    struct timespec rel = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+
+    atomic_store_explicit(&shared->consumerSleeping, 1, memory_order_seq_cst);
+    uint32_t seq  = atomic_load_explicit(&shared->dataSeq, memory_order_seq_cst);
+    uint32_t word = atomic_load_explicit(&record_at(ring, ring->readPos)->word, memory_order_seq_cst);
+
+    if (0 == (word & (REC_READY | REC_PAD)))
+    {
+        futex_wait(&shared->dataSeq, seq, &rel);
+    }
+
+    atomic_store_explicit(&shared->consumerSleeping, 0, memory_order_relaxed);
+}
+
+/*******************************************************************************
+ * @brief Wake the consumer up
+ * @param ring - ring handle
+ */
+void ipc_ring_wake(ipc_ring_t* ring)
+{
+    atomic_fetch_add_explicit(&ring->shared->dataSeq, 1, memory_order_seq_cst);
+    futex_wake(&ring->shared->dataSeq, 1);
+}
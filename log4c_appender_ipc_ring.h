@@ -0,0 +1,138 @@
+#ifndef LOG4C_APPENDER_IPC_RING_H
+#define LOG4C_APPENDER_IPC_RING_H
+
+
+/**
+ * @file log4c_appender_ipc_ring.h
+ *
+ * @brief Shared-memory transport for the IPC appender.
+ *
+ * The ring is a multi-producer single-consumer byte queue placed into a POSIX
+ * shared memory object. The master instance creates it, every other instance
+ * maps it and writes variable-length records into it.
+ *
+ * Producers reserve space by advancing the shared head with compare-and-swap,
+ * copy their payload in place and publish the record by flipping its header
+ * word to "ready". The consumer (pump thread) reads records in place, and
+ * releases them by zeroing the space and advancing the tail.
+ *
+ * Neither side makes a system call while the other one keeps up: the
+ * consumer sleeps on a futex only when the ring is empty, and producers are
+ * woken from a futex only if they had to wait for free space.
+ *
+ * The record of a producer that crashed before publishing is skipped once its
+ * pid is gone, so a dead client can't stall the whole ring. Producers also
+ * register their pid for the time between reserving and publishing: space
+ * without a header yet is only given up when none of them is alive, a
+ * stopped producer may still write into it.
+ *
+*/
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/uio.h>
+
+typedef struct __ipc_ring ipc_ring_t;
+
+/**
+ * Create (or recreate) the shared ring. Called by the master instance.
+ *
+ * @param name - name of the shared memory object, e.g. "/test_ring"
+ * @param capacity - size of the data area; rounded up to a power of two
+ * @return ring handle, NULL on failure
+ */
+ipc_ring_t* ipc_ring_create(const char* name, size_t capacity);
+
+/**
+ * Map the ring created by the master instance.
+ *
+ * @param name - name of the shared memory object
+ * @return ring handle, NULL if there is no valid ring with this name
+ */
+ipc_ring_t* ipc_ring_attach(const char* name);
+
+/**
+ * Unmap the ring. The shared memory object itself is left intact.
+ */
+void ipc_ring_detach(ipc_ring_t* ring);
+
+/**
+ * Remove the shared memory object from the system.
+ */
+void ipc_ring_unlink(const char* name);
+
+/**
+ * Largest payload a single record can carry.
+ */
+size_t ipc_ring_max_record(const ipc_ring_t* ring);
+
+/**
+ * Publish one record. Never blocks.
+ *
+ * @return 0 upon success, -1 otherwise with errno set to
+ *         EAGAIN if there is not enough free space (or 64 producers are
+ *         writing at once), EMSGSIZE if the record can never fit.
+ */
+int ipc_ring_write(ipc_ring_t* ring, const void* data, size_t len);
+
+/**
+ * Publish one record gathered from several parts, copied straight into the
+ * ring. Same semantics as ipc_ring_write().
+ */
+int ipc_ring_writev(ipc_ring_t* ring, const struct iovec* parts, int numParts);
+
+/**
+ * Sleep until the consumer releases some space.
+ *
+ * @param len - payload size the caller failed to write
+ * @param deadline - absolute CLOCK_MONOTONIC deadline, NULL to wait forever
+ * @return 0 if woken up (space is likely available), -1 on timeout
+ */
+int ipc_ring_wait_space(ipc_ring_t* ring, size_t len, const struct timespec* deadline);
+
+/**
+ * Consumer side: fetch the next published record.
+ *
+ * The returned pointer refers to the shared memory and stays valid until the
+ * next ipc_ring_release(). Several records can be fetched before releasing.
+ *
+ * @return 1 if a record is returned, 0 if nothing is available yet
+ */
+int ipc_ring_next(ipc_ring_t* ring, const char** data, size_t* len);
+
+/**
+ * Consumer side: give back the space of all records fetched so far.
+ */
+void ipc_ring_release(ipc_ring_t* ring);
+
+/**
+ * Size of the data area.
+ */
+size_t ipc_ring_capacity(const ipc_ring_t* ring);
+
+/**
+ * Bytes taken by records not released yet, padding included.
+ */
+size_t ipc_ring_used(const ipc_ring_t* ring);
+
+/**
+ * Take over as the consumer of an attached ring, e.g. after the master died.
+ * Consumption resumes at the last released record, so the records the
+ * previous consumer fetched but didn't release are delivered again.
+ */
+void ipc_ring_adopt(ipc_ring_t* ring);
+
+/**
+ * Consumer side: sleep on the futex while the ring is empty.
+ *
+ * @param timeout_ms - upper bound of the sleep
+ */
+void ipc_ring_wait_data(ipc_ring_t* ring, int timeout_ms);
+
+/**
+ * Wake the consumer up, e.g. to let it notice a shutdown request.
+ */
+void ipc_ring_wake(ipc_ring_t* ring);
+
+
+#endif // LOG4C_APPENDER_IPC_RING_H
@@ -0,0 +1,321 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+
+#include "log4c_appender_ipc_roll.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define ROLL_NICE           10          // compression yields to the pumps
+#define ROLL_CHUNK          (128 * 1024)
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __ipc_roll_job
+{
+    struct __ipc_roll_job* next;
+    ipc_roll_close_fn closeFn;
+    void* handle;
+    int bCompress;
+    int bSync;
+    char path[];
+};
+
+typedef struct __ipc_roll_job ipc_roll_job_t;
+
+// lifeLock serializes starting and stopping the thread; queueLock guards the jobs
+static pthread_mutex_t lifeLock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueCond  = PTHREAD_COND_INITIALIZER;
+static ipc_roll_job_t* head = NULL;
+static ipc_roll_job_t** tail = &head;
+static int numUsers = 0;
+static int bStop = 0;
+static pthread_t rollThread;
+
+/*******************************************************************************
+ * @brief Close the old output and compress the file
+ * @param job - freed
+ */
+static void roll_run_job(ipc_roll_job_t* job)
+{
+    if (job->closeFn)
+    {
+        job->closeFn(job->handle);
+    }
+
+    if (job->bCompress)
+    {
+        ipc_roll_compress(job->path, job->bSync);
+    }
+
+    free(job);
+}
+
+/*******************************************************************************
+ * @brief Thread working through the rolled files
+ * @param param - unused
+ * @return 0
+ */
+static void* roll_run(void* param)
+{
+    IPC_TRACE_INFO_LOG("ENTER\n");
+
+    // per thread on Linux
+    if (-1 == setpriority(PRIO_PROCESS, syscall(SYS_gettid), ROLL_NICE))
+    {
+        IPC_TRACE_ERROR_LOG("setpriority() failed: %s\n", strerror(errno));
+    }
+
+    pthread_mutex_lock(&queueLock);
+
+    for (;;)
+    {
+        while (NULL == head && !bStop)
+        {
+            pthread_cond_wait(&queueCond, &queueLock);
+        }
+
+        // queued files are finished before stopping
+        if (NULL == head)
+        {
+            break;
+        }
+
+        ipc_roll_job_t* job = head;
+
+        if (NULL == (head = job->next))
+        {
+            tail = &head;
+        }
+
+        pthread_mutex_unlock(&queueLock);
+        roll_run_job(job);
+        pthread_mutex_lock(&queueLock);
+    }
+
+    pthread_mutex_unlock(&queueLock);
+
+    IPC_TRACE_INFO_LOG("EXIT\n");
+    return (void*)0;
+}
+
+/*******************************************************************************
+ * @brief Register a user, starting the thread with the first one
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_roll_start(void)
+{
+    int result = 0;
+
+    pthread_mutex_lock(&lifeLock);
+
+    if (0 == numUsers)
+    {
+        bStop = 0;
+
+        if (0 != pthread_create(&rollThread, NULL, roll_run, NULL))
+        {
+            IPC_TRACE_ERROR_LOG("Error creating thread 'roll_run'\n");
+            result = -1;
+        }
+    }
+
+    if (0 == result)
+    {
+        numUsers++;
+    }
+
+    pthread_mutex_unlock(&lifeLock);
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Unregister a user, the last one finishes the queue and stops the thread
+ */
+void ipc_roll_stop(void)
+{
+    pthread_mutex_lock(&lifeLock);
+
+    if (numUsers > 0 && 0 == --numUsers)
+    {
+        pthread_mutex_lock(&queueLock);
+        bStop = 1;
+        pthread_cond_signal(&queueCond);
+        pthread_mutex_unlock(&queueLock);
+
+        pthread_join(rollThread, NULL);
+    }
+
+    pthread_mutex_unlock(&lifeLock);
+}
+
+/*******************************************************************************
+ * @brief Queue a rolled file
+ * @param path - the file under the name it was rolled to
+ * @param closeFn - closes the old output, may be NULL
+ * @param handle - passed to closeFn
+ * @param bCompress - 1 to compress the file once closed
+ * @param bSync - 1 to sync the archive and the directory before the removal
+ */
+void ipc_roll_submit(const char* path, ipc_roll_close_fn closeFn, void* handle, int bCompress, int bSync)
+{
+    size_t len = strlen(path) + 1;
+    ipc_roll_job_t* job = (ipc_roll_job_t*) malloc(sizeof(ipc_roll_job_t) + len);
+
+    if (NULL == job)
+    {
+        // the file stays as it is
+        if (closeFn)
+        {
+            closeFn(handle);
+        }
+
+        return;
+    }
+
+    job->next      = NULL;
+    job->closeFn   = closeFn;
+    job->handle    = handle;
+    job->bCompress = bCompress;
+    job->bSync     = bSync;
+    memcpy(job->path, path, len);
+
+    pthread_mutex_lock(&queueLock);
+    *tail = job;
+    tail  = &job->next;
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&queueLock);
+}
+
+/*******************************************************************************
+ * @brief fsync() a file, or the directory holding it
+ * @param path
+ * @param bDirectory - 1 for the directory of path
+ * @return 0 upon success, -1 otherwise
+ */
+static int roll_sync_path(const char* path, int bDirectory)
+{
+    char dir[1024];
+    const char* slash = strrchr(path, '/');
+
+    if (bDirectory)
+    {
+        snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) + 1 : 1, slash ? path : ".");
+        path = dir;
+    }
+
+    int fd = open(path, (bDirectory ? O_RDONLY | O_DIRECTORY : O_RDONLY) | O_CLOEXEC);
+
+    if (-1 == fd || -1 == fsync(fd))
+    {
+        IPC_TRACE_ERROR_LOG("Can't sync %s: %s\n", path, strerror(errno));
+
+        if (-1 != fd)
+        {
+            close(fd);
+        }
+
+        return -1;
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Compress a closed file into "<path>.gz" and remove it
+ * @param path
+ * @param bSync - 1 to sync the archive and the directory before the removal
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_roll_compress(const char* path, int bSync)
+{
+    char gzPath[1024];
+    char tmpPath[1024];
+
+    if ((int)sizeof(gzPath) <= snprintf(gzPath, sizeof(gzPath), "%s.gz", path)
+        || (int)sizeof(tmpPath) <= snprintf(tmpPath, sizeof(tmpPath), "%s.gz.tmp", path))
+    {
+        IPC_TRACE_ERROR_LOG("Path too long: %s\n", path);
+        return -1;
+    }
+
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (-1 == in)
+    {
+        IPC_TRACE_ERROR_LOG("open() failed: %s, %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    gzFile out = gzopen(tmpPath, "wb");
+    char* chunk = (char*) malloc(ROLL_CHUNK);
+    int result = (out && chunk) ? 0 : -1;
+    ssize_t len;
+
+    while (0 == result && 0 != (len = read(in, chunk, ROLL_CHUNK)))
+    {
+        if (-1 == len)
+        {
+            if (EINTR != errno)
+            {
+                IPC_TRACE_ERROR_LOG("read() failed: %s, %s\n", path, strerror(errno));
+                result = -1;
+            }
+        }
+        else if (len != gzwrite(out, chunk, (unsigned) len))
+        {
+            IPC_TRACE_ERROR_LOG("gzwrite() failed: %s\n", tmpPath);
+            result = -1;
+        }
+    }
+
+    free(chunk);
+    close(in);
+
+    // gzclose() writes the trailer
+    if (out && Z_OK != gzclose(out))
+    {
+        IPC_TRACE_ERROR_LOG("gzclose() failed: %s\n", tmpPath);
+        result = -1;
+    }
+
+    // the archive is on disk before it takes the name
+    if (0 == result && bSync && -1 == roll_sync_path(tmpPath, 0))
+    {
+        result = -1;
+    }
+
+    if (0 == result && -1 == rename(tmpPath, gzPath))
+    {
+        IPC_TRACE_ERROR_LOG("rename() failed: %s, %s\n", tmpPath, strerror(errno));
+        result = -1;
+    }
+
+    if (-1 == result)
+    {
+        unlink(tmpPath);
+        return -1;
+    }
+
+    // without the rename on disk, a crash could leave neither file
+    if (bSync && -1 == roll_sync_path(gzPath, 1))
+    {
+        return -1;
+    }
+
+    unlink(path);
+
+    return 0;
+}
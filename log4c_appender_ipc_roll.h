@@ -0,0 +1,67 @@
+#ifndef LOG4C_APPENDER_IPC_ROLL_H
+#define LOG4C_APPENDER_IPC_ROLL_H
+
+
+/**
+ * @file log4c_appender_ipc_roll.h
+ *
+ * @brief Background work on rolled output files.
+ *
+ * Rolling itself is a rename() and an open() done by the pump. Everything
+ * that may take long is queued here instead: closing the old output (which
+ * waits for the writes in flight) and compressing the closed file with gzip.
+ * The pump goes back to draining the transport right away, a stalled pump
+ * would block every producer.
+ *
+ * One thread serves all masters of the process; it runs at a lower priority
+ * and handles the files in the order they were rolled. It starts with the
+ * first master that rolls and exits with the last one, after finishing the
+ * queued files.
+ *
+*/
+
+/**
+ * Closes the old output of a rolled file, on the roll thread.
+ */
+typedef void (*ipc_roll_close_fn)(void* handle);
+
+/**
+ * Register a user, starting the thread with the first one.
+ *
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_roll_start(void);
+
+/**
+ * Unregister a user; the last one waits for the queued files and stops
+ * the thread.
+ */
+void ipc_roll_stop(void);
+
+/**
+ * Queue a rolled file.
+ *
+ * Done right away on the calling thread if the job can't be queued.
+ *
+ * @param path - the file under the name it was rolled to
+ * @param closeFn - closes the old output, NULL if there is nothing to close
+ * @param handle - passed to closeFn
+ * @param bCompress - 1 to replace the file with "<path>.gz" once closed
+ * @param bSync - 1 to fsync() the archive and its directory before the
+ *                file is removed
+ */
+void ipc_roll_submit(const char* path, ipc_roll_close_fn closeFn, void* handle, int bCompress, int bSync);
+
+/**
+ * Compress a closed file into "<path>.gz" and remove it.
+ *
+ * The archive is written under a temporary name first, so "<path>.gz"
+ * is always complete. With bSync, the archive and the rename are on disk
+ * before the file is removed.
+ *
+ * @return 0 upon success, -1 otherwise (the file is left as it is)
+ */
+int ipc_roll_compress(const char* path, int bSync);
+
+
+#endif // LOG4C_APPENDER_IPC_ROLL_H
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE     // fallocate()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log4c_appender_ipc_segment.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define SEGMENT_SCAN_CHUNK  65536       // trailing zeros are looked for backwards by this much
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __ipc_segment
+{
+    int fd;
+    size_t size;            // of a segment
+    off_t start;            // file offset of the mapped segment
+    size_t used;            // data in the mapped segment
+    char* base;             // NULL if nothing is mapped
+};
+
+/*******************************************************************************
+ * @brief End of the data: the file size without trailing zero bytes
+ *
+ * Only the last segment can have them, so the scan stops after one segment.
+ *
+ * @param fd
+ * @param size - file size
+ * @param segmentSize
+ * @return offset, -1 on failure
+ */
+static off_t segment_data_end(int fd, off_t size, size_t segmentSize)
+{
+    char chunk[SEGMENT_SCAN_CHUNK];
+    off_t limit = size > (off_t) segmentSize ? size - (off_t) segmentSize : 0;
+    off_t end = size;
+
+    while (end > limit)
+    {
+        off_t from = end - SEGMENT_SCAN_CHUNK > limit ? end - SEGMENT_SCAN_CHUNK : limit;
+        ssize_t len = pread(fd, chunk, end - from, from);
+
+        if (len != end - from)
+        {
+            return -1;
+        }
+
+        while (len > 0 && '\0' == chunk[len - 1])
+        {
+            len--;
+        }
+
+        if (len > 0)
+        {
+            return from + len;
+        }
+
+        end = from;
+    }
+
+    return end;
+}
+
+/*******************************************************************************
+ * @brief Allocate and map the segment starting at the given offset
+ * @param segment
+ * @param start - file offset, aligned to the page size
+ * @return 0 upon success, -1 otherwise
+ */
+static int segment_map(ipc_segment_t* segment, off_t start)
+{
+    if (segment->base)
+    {
+        munmap(segment->base, segment->size);
+        segment->base = NULL;
+    }
+
+    // no sparse fallback: writing a page that has no block would be SIGBUS
+    if (-1 == fallocate(segment->fd, 0, start, segment->size))
+    {
+        IPC_TRACE_ERROR_LOG("fallocate() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    void* base = mmap(NULL, segment->size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, start);
+
+    if (MAP_FAILED == base)
+    {
+        IPC_TRACE_ERROR_LOG("mmap() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    segment->base  = (char*) base;
+    segment->start = start;
+    segment->used  = 0;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Open the file and map the segment its data ends in
+ * @param path - output file
+ * @param segmentSize - bytes per segment
+ * @return handle, NULL on failure
+ */
+ipc_segment_t* ipc_segment_open(const char* path, size_t segmentSize)
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+
+    if (0 == segmentSize || 0 != segmentSize % pageSize)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ipc_segment_t* segment = (ipc_segment_t*) calloc(1, sizeof(ipc_segment_t));
+
+    if (NULL == segment)
+    {
+        return NULL;
+    }
+
+    segment->size = segmentSize;
+
+    struct stat st;
+    off_t end = -1;
+
+    if (-1 != (segment->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) && 0 == fstat(segment->fd, &st))
+    {
+        end = segment_data_end(segment->fd, st.st_size, segmentSize);
+    }
+
+    // the data may end in the middle of a page, the mapping starts at the page
+    off_t start = end & ~((off_t) pageSize - 1);
+
+    if (-1 == end || -1 == segment_map(segment, start))
+    {
+        IPC_TRACE_ERROR_LOG("Can't map %s: %s\n", path, strerror(errno));
+        ipc_segment_close(segment);
+        return NULL;
+    }
+
+    segment->used = end - start;
+
+    return segment;
+}
+
+/*******************************************************************************
+ * @brief Unmap, truncate the file to its data and close it
+ * @param segment
+ */
+void ipc_segment_close(ipc_segment_t* segment)
+{
+    if (NULL == segment)
+    {
+        return;
+    }
+
+    if (segment->base)
+    {
+        munmap(segment->base, segment->size);
+
+        if (-1 == ftruncate(segment->fd, segment->start + segment->used))
+        {
+            IPC_TRACE_ERROR_LOG("ftruncate() failed: %s\n", strerror(errno));
+        }
+    }
+
+    if (-1 != segment->fd)
+    {
+        close(segment->fd);
+    }
+
+    free(segment);
+}
+
+/*******************************************************************************
+ * @brief Flush the copied data to the disk
+ * @param segment
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_segment_sync(ipc_segment_t* segment)
+{
+    // covers the pages dirtied through earlier mappings as well, unlike msync()
+    if (-1 == fdatasync(segment->fd))
+    {
+        IPC_TRACE_ERROR_LOG("fdatasync() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Copy data into the mapping
+ * @param segment
+ * @param iov
+ * @param count
+ * @return 0 upon success, -1 if a new segment couldn't be allocated
+ */
+int ipc_segment_writev(ipc_segment_t* segment, const struct iovec* iov, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const char* data = (const char*) iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        while (len > 0)
+        {
+            if (segment->used == segment->size
+                && -1 == segment_map(segment, segment->start + (off_t) segment->size))
+            {
+                return -1;
+            }
+
+            size_t room = segment->size - segment->used;
+            size_t chunk = len < room ? len : room;
+
+            memcpy(segment->base + segment->used, data, chunk);
+            segment->used += chunk;
+            data += chunk;
+            len  -= chunk;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef LOG4C_APPENDER_IPC_SEGMENT_H
+#define LOG4C_APPENDER_IPC_SEGMENT_H
+
+
+/**
+ * @file log4c_appender_ipc_segment.h
+ *
+ * @brief Output file written through a memory mapping.
+ *
+ * The file is extended by segments of a fixed size: each one is allocated
+ * with fallocate() (so the mapping never faults on a full disk) and mapped,
+ * appending a line is a memcpy() and the kernel writes the pages back. When
+ * the segment is full, the next one is allocated and mapped.
+ *
+ * While the file is open, it ends with the unused, zero-filled part of the
+ * current segment; closing truncates it to the data. After a crash the zeros
+ * stay until the next master opens the file: it finds the end of the data by
+ * skipping trailing zero bytes. Pages already copied into the mapping are in
+ * the page cache and survive the crash of the process.
+ *
+ * Only the pump thread uses it, there is no locking.
+ *
+*/
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+typedef struct __ipc_segment ipc_segment_t;
+
+/**
+ * Open the file and map the segment its data ends in.
+ *
+ * @param path - output file, created if needed
+ * @param segmentSize - bytes per segment, a multiple of the page size
+ * @return handle, NULL on failure (e.g. the file system can't fallocate)
+ */
+ipc_segment_t* ipc_segment_open(const char* path, size_t segmentSize);
+
+/**
+ * Unmap, truncate the file to its data and close it.
+ */
+void ipc_segment_close(ipc_segment_t* segment);
+
+/**
+ * Flush everything copied so far to the disk (fdatasync() of the file).
+ *
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_segment_sync(ipc_segment_t* segment);
+
+/**
+ * Copy data into the mapping, moving on to new segments as needed.
+ *
+ * @return 0 upon success, -1 if a new segment couldn't be allocated
+ *         (the data that didn't fit is lost)
+ */
+int ipc_segment_writev(ipc_segment_t* segment, const struct iovec* iov, int count);
+
+
+#endif // LOG4C_APPENDER_IPC_SEGMENT_H
@@ -0,0 +1,770 @@
+#define _GNU_SOURCE     // pthread_timedjoin_np(), sendmmsg()
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "log4c_appender_ipc_sink.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define SINK_MAX_IOV        1024        // IOV_MAX on Linux
+#define SINK_MAX_BATCH      64          // datagrams per sendmmsg()
+#define SINK_WRAP           UINT32_MAX  // the rest of the lap is unused
+#define SINK_ALIGN          8
+
+static const int SINK_RETRY_MS        = 1000;   // between attempts to write a failed target
+static const int SINK_SEND_TIMEOUT_MS = 1000;   // a full socket is retried, so closing can stop the thread
+static const uint32_t SINK_DROP_REPORT_MS = 10000;  // how often lines dropped are reported
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+
+// header of every line in the buffer, always at a multiple of SINK_ALIGN
+struct __ipc_sink_entry
+{
+    uint32_t len;           // of the line, SINK_WRAP at the end of a lap
+    uint32_t queuedMs;      // CLOCK_MONOTONIC ms, truncated
+};
+
+typedef struct __ipc_sink_entry ipc_sink_entry_t;
+
+struct __ipc_sink
+{
+    ipc_sink_kind_t kind;
+    int fd;                     // -1 while the target can't be written
+    char* data;
+    size_t size;                // a multiple of SINK_ALIGN
+    atomic_ullong head;         // end of the lines queued, advanced by the pump
+    atomic_ullong tail;         // end of the lines written, advanced by the thread
+    _Atomic(ipc_stats_sink_t*) stats;   // NULL once left behind by ipc_sink_close()
+    pthread_t thread;
+    pthread_mutex_t lock;       // sleeping and stopping only
+    pthread_cond_t cond;
+    int bStop;
+    int bExited;
+    int bOrphan;                // closed while busy: the thread frees the sink
+    unsigned long dropsUnreported;  // pump thread only
+    uint32_t dropReportMs;      // time of the last report, pump thread only
+    int bFailing;               // reported a write error already, sink thread only
+    char* preamble;
+    size_t preambleLen;
+    char target[];
+};
+
+/*******************************************************************************
+ * @brief CLOCK_MONOTONIC milliseconds, truncated to 32 bits
+ */
+static uint32_t sink_now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+/*******************************************************************************
+ * @brief Room a line takes in the buffer
+ */
+static size_t sink_entry_space(size_t len)
+{
+    return sizeof(ipc_sink_entry_t) + ((len + SINK_ALIGN - 1) & ~(size_t)(SINK_ALIGN - 1));
+}
+
+/*******************************************************************************
+ * @brief Header of the line at a position
+ */
+static ipc_sink_entry_t sink_entry_at(const ipc_sink_t* sink, uint64_t pos)
+{
+    ipc_sink_entry_t entry;
+    memcpy(&entry, sink->data + pos % sink->size, sizeof(entry));
+
+    return entry;
+}
+
+/*******************************************************************************
+ * @brief Count a failed write, reporting it once until the sink works again
+ * @param sink
+ * @param what - the failed call
+ */
+static void sink_error(ipc_sink_t* sink, const char* what)
+{
+    ipc_stats_sink_t* stats = atomic_load(&sink->stats);
+
+    if (stats)
+    {
+        atomic_fetch_add_explicit(&stats->errors, 1, memory_order_relaxed);
+    }
+
+    if (!sink->bFailing)
+    {
+        IPC_TRACE_ERROR_LOG("%s failed on sink %s: %s\n", what, sink->target, strerror(errno));
+        sink->bFailing = 1;
+    }
+}
+
+/*******************************************************************************
+ * @brief Count a failed write and close the target, to be opened again
+ * @param sink
+ * @param what - the failed call
+ */
+static void sink_failed(ipc_sink_t* sink, const char* what)
+{
+    sink_error(sink, what);
+
+    if (-1 != sink->fd)
+    {
+        close(sink->fd);
+        sink->fd = -1;
+    }
+}
+
+/*******************************************************************************
+ * @brief Open the target of the sink
+ * @param sink
+ * @return 0 upon success, -1 otherwise
+ */
+static int sink_connect(ipc_sink_t* sink)
+{
+    if (IPC_SINK_FILE == sink->kind)
+    {
+        struct stat st;
+
+        if (-1 == (sink->fd = open(sink->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)))
+        {
+            sink_failed(sink, "open()");
+            return -1;
+        }
+
+        if (sink->preamble && 0 == fstat(sink->fd, &st) && 0 == st.st_size
+            && (ssize_t)sink->preambleLen != write(sink->fd, sink->preamble, sink->preambleLen))
+        {
+            sink_failed(sink, "write()");
+            return -1;
+        }
+
+        return 0;
+    }
+
+    struct sockaddr_un addr;
+    struct timeval timeout = { SINK_SEND_TIMEOUT_MS / 1000, (SINK_SEND_TIMEOUT_MS % 1000) * 1000 };
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sink->target, sizeof(addr.sun_path) - 1);
+
+    if (-1 == (sink->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0))
+        || -1 == setsockopt(sink->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))
+        || -1 == connect(sink->fd, (struct sockaddr*) &addr, sizeof(addr)))
+    {
+        sink_failed(sink, "connect()");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Count lines written, and how long they have waited
+ * @param sink
+ * @param first - header of the oldest of them
+ * @param lines
+ * @param bytes
+ */
+static void sink_account(ipc_sink_t* sink, const ipc_sink_entry_t* first, int lines, size_t bytes)
+{
+    ipc_stats_sink_t* stats = atomic_load(&sink->stats);
+
+    sink->bFailing = 0;
+
+    if (stats)
+    {
+        uint32_t lagMs = sink_now_ms() - first->queuedMs;
+
+        atomic_fetch_add_explicit(&stats->lines, lines, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->bytes, bytes, memory_order_relaxed);
+        atomic_store_explicit(&stats->lagMs, lagMs, memory_order_relaxed);
+        ipc_stats_max(&stats->lagMsMax, lagMs);
+    }
+}
+
+/*******************************************************************************
+ * @brief Write lines to the file with writev(), as many at once as possible
+ *
+ * A line cut short by a failure is written again in full by the next attempt.
+ *
+ * @param sink
+ * @param end - of the lines to write
+ * @return 0 upon success, -1 if a write failed
+ */
+static int sink_write_file(ipc_sink_t* sink, uint64_t end)
+{
+    struct iovec iov[SINK_MAX_IOV];
+    uint64_t ends[SINK_MAX_IOV];        // position after every line
+    uint64_t pos = atomic_load(&sink->tail);
+
+    while (pos < end)
+    {
+        ipc_sink_entry_t first = sink_entry_at(sink, pos);
+        uint64_t next = pos;
+        int count = 0;
+        size_t bytes = 0;
+
+        while (next < end && count < SINK_MAX_IOV)
+        {
+            ipc_sink_entry_t entry = sink_entry_at(sink, next);
+
+            if (SINK_WRAP == entry.len)
+            {
+                next += sink->size - next % sink->size;
+                continue;
+            }
+
+            iov[count].iov_base = sink->data + next % sink->size + sizeof(entry);
+            iov[count].iov_len  = entry.len;
+            bytes += entry.len;
+            next += sink_entry_space(entry.len);
+            ends[count++] = next;
+        }
+
+        // skip fully written entries, then adjust the partially written one
+        struct iovec* left = iov;
+        int numLeft = count;
+
+        while (numLeft > 0)
+        {
+            ssize_t written = writev(sink->fd, left, numLeft < SINK_MAX_IOV ? numLeft : SINK_MAX_IOV);
+
+            if (-1 == written)
+            {
+                if (EINTR == errno)
+                {
+                    continue;
+                }
+
+                int numDone = count - numLeft;
+
+                if (numDone > 0)
+                {
+                    atomic_store_explicit(&sink->tail, ends[numDone - 1], memory_order_release);
+                }
+
+                sink_failed(sink, "writev()");
+                return -1;
+            }
+
+            while (numLeft > 0 && (size_t)written >= left->iov_len)
+            {
+                written -= left->iov_len;
+                left++;
+                numLeft--;
+            }
+
+            if (numLeft > 0)
+            {
+                left->iov_base = (char*)left->iov_base + written;
+                left->iov_len -= written;
+            }
+        }
+
+        if (count > 0)
+        {
+            sink_account(sink, &first, count, bytes);
+        }
+
+        atomic_store_explicit(&sink->tail, next, memory_order_release);
+        pos = next;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Send lines as datagrams, without their newline, with sendmmsg()
+ *
+ * A line the socket refuses for itself (e.g. it's too long) is dropped and
+ * counted as an error; a socket staying full is retried.
+ *
+ * @param sink
+ * @param end - of the lines to send
+ * @return 0 upon success, -1 if the socket is gone
+ */
+static int sink_write_socket(ipc_sink_t* sink, uint64_t end)
+{
+    struct mmsghdr msgs[SINK_MAX_BATCH];
+    struct iovec iov[SINK_MAX_BATCH];
+    uint64_t ends[SINK_MAX_BATCH];      // position after every message
+    uint64_t pos = atomic_load(&sink->tail);
+
+    memset(msgs, 0, sizeof(msgs));
+
+    while (pos < end)
+    {
+        ipc_sink_entry_t first = sink_entry_at(sink, pos);
+        uint64_t next = pos;
+        int count = 0;
+
+        while (next < end && count < SINK_MAX_BATCH)
+        {
+            ipc_sink_entry_t entry = sink_entry_at(sink, next);
+
+            if (SINK_WRAP == entry.len)
+            {
+                next += sink->size - next % sink->size;
+                continue;
+            }
+
+            char* line = sink->data + next % sink->size + sizeof(entry);
+            size_t len = entry.len;
+
+            if (len > 0 && '\n' == line[len - 1])
+            {
+                len--;
+            }
+
+            next += sink_entry_space(entry.len);
+
+            // an empty datagram means nothing to a syslog daemon
+            if (0 == len)
+            {
+                continue;
+            }
+
+            iov[count].iov_base = line;
+            iov[count].iov_len  = len;
+            msgs[count].msg_hdr.msg_iov    = &iov[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+            ends[count] = next;
+            count++;
+        }
+
+        int numSent = 0;
+        int numFailed = 0;
+        size_t bytes = 0;
+
+        while (numSent < count)
+        {
+            int sent = sendmmsg(sink->fd, msgs + numSent, count - numSent, 0);
+
+            if (sent > 0)
+            {
+                for (int i = numSent; i < numSent + sent; i++)
+                {
+                    bytes += iov[i].iov_len;
+                }
+
+                numSent += sent;
+                atomic_store_explicit(&sink->tail, ends[numSent - 1], memory_order_release);
+                continue;
+            }
+
+            int bStop;
+
+            switch (errno)
+            {
+            case EINTR:
+                break;
+
+            case EAGAIN:
+                // the reader is slow: keep trying unless the sink is closing
+                pthread_mutex_lock(&sink->lock);
+                bStop = sink->bStop;
+                pthread_mutex_unlock(&sink->lock);
+
+                if (bStop)
+                {
+                    sink_failed(sink, "sendmmsg()");
+                    return -1;
+                }
+                break;
+
+            case ECONNREFUSED:
+            case ENOTCONN:
+            case ENOENT:
+            case EPIPE:
+                sink_failed(sink, "sendmmsg()");
+                return -1;
+
+            default:
+                // this line only, e.g. longer than the socket takes
+                sink_error(sink, "sendmmsg()");
+                atomic_store_explicit(&sink->tail, ends[numSent], memory_order_release);
+                numSent++;
+                numFailed++;
+                break;
+            }
+        }
+
+        if (count > numFailed)
+        {
+            sink_account(sink, &first, count - numFailed, bytes);
+        }
+
+        atomic_store_explicit(&sink->tail, next, memory_order_release);
+        pos = next;
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Give up on the lines left, counting them as dropped
+ * @param sink
+ * @param end - of the lines to give up
+ */
+static void sink_discard(ipc_sink_t* sink, uint64_t end)
+{
+    ipc_stats_sink_t* stats = atomic_load(&sink->stats);
+    uint64_t pos = atomic_load(&sink->tail);
+    unsigned long long lines = 0;
+
+    while (pos < end)
+    {
+        ipc_sink_entry_t entry = sink_entry_at(sink, pos);
+
+        if (SINK_WRAP == entry.len)
+        {
+            pos += sink->size - pos % sink->size;
+            continue;
+        }
+
+        pos += sink_entry_space(entry.len);
+        lines++;
+    }
+
+    if (lines > 0)
+    {
+        IPC_TRACE_ERROR_LOG("Sink %s closed with %llu lines unwritten\n", sink->target, lines);
+    }
+
+    if (stats)
+    {
+        atomic_fetch_add_explicit(&stats->drops, lines, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&sink->tail, end, memory_order_release);
+}
+
+/*******************************************************************************
+ * @brief Release everything
+ */
+static void sink_free(ipc_sink_t* sink)
+{
+    if (-1 != sink->fd)
+    {
+        close(sink->fd);
+    }
+
+    pthread_cond_destroy(&sink->cond);
+    pthread_mutex_destroy(&sink->lock);
+    free(sink->preamble);
+    free(sink->data);
+    free(sink);
+}
+
+/*******************************************************************************
+ * @brief Thread writing the lines queued by the pump
+ * @param param - the sink
+ * @return 0
+ */
+static void* sink_run(void* param)
+{
+    ipc_sink_t* sink = (ipc_sink_t*) param;
+
+    IPC_TRACE_INFO_LOG("ENTER %s\n", sink->target);
+
+    pthread_mutex_lock(&sink->lock);
+
+    for (;;)
+    {
+        while (atomic_load(&sink->head) == atomic_load(&sink->tail) && !sink->bStop)
+        {
+            pthread_cond_wait(&sink->cond, &sink->lock);
+        }
+
+        uint64_t end = atomic_load_explicit(&sink->head, memory_order_acquire);
+        int bStop = sink->bStop;
+
+        // written out, or left behind by a close that couldn't wait
+        if ((bStop && end == atomic_load(&sink->tail)) || sink->bOrphan)
+        {
+            break;
+        }
+
+        pthread_mutex_unlock(&sink->lock);
+
+        int result = (-1 == sink->fd) ? sink_connect(sink) : 0;
+
+        if (0 == result)
+        {
+            result = (IPC_SINK_FILE == sink->kind) ? sink_write_file(sink, end) : sink_write_socket(sink, end);
+        }
+
+        // nobody waits for a broken sink to come back once it's closed
+        if (-1 == result && bStop)
+        {
+            sink_discard(sink, end);
+        }
+
+        pthread_mutex_lock(&sink->lock);
+
+        // lines stay buffered until the target is back; new ones drop once it's full
+        if (-1 == result && !sink->bStop)
+        {
+            struct timespec retryAt;
+            clock_gettime(CLOCK_MONOTONIC, &retryAt);
+            retryAt.tv_sec += SINK_RETRY_MS / 1000;
+
+            // woken by every batch of the pump meanwhile
+            while (!sink->bStop && ETIMEDOUT != pthread_cond_timedwait(&sink->cond, &sink->lock, &retryAt))
+            {
+            }
+        }
+    }
+
+    int bOrphan = sink->bOrphan;
+    sink->bExited = 1;
+
+    pthread_mutex_unlock(&sink->lock);
+
+    IPC_TRACE_INFO_LOG("EXIT %s\n", sink->target);
+
+    if (bOrphan)
+    {
+        sink_free(sink);
+    }
+
+    return (void*)0;
+}
+
+/*******************************************************************************
+ * @brief Set a sink up and start its thread
+ * @param kind
+ * @param target - path of the file or the socket
+ * @param bufferSize - bytes of lines the sink may fall behind by
+ * @param preamble - written to an empty file first, NULL for none
+ * @param preambleLen
+ * @param stats - may be NULL
+ * @return handle, NULL on failure
+ */
+ipc_sink_t* ipc_sink_open(ipc_sink_kind_t kind, const char* target, size_t bufferSize,
+                          const void* preamble, size_t preambleLen, ipc_stats_sink_t* stats)
+{
+    size_t targetLen = strlen(target);
+
+    if (IPC_SINK_SYSLOG == kind && targetLen >= sizeof(((struct sockaddr_un*)0)->sun_path))
+    {
+        IPC_TRACE_ERROR_LOG("Socket path too long: %s\n", target);
+        return NULL;
+    }
+
+    ipc_sink_t* sink = (ipc_sink_t*) calloc(1, sizeof(ipc_sink_t) + targetLen + 1);
+
+    if (NULL == sink)
+    {
+        return NULL;
+    }
+
+    sink->kind = kind;
+    sink->fd   = -1;
+    sink->size = (bufferSize + SINK_ALIGN - 1) & ~(size_t)(SINK_ALIGN - 1);
+    memcpy(sink->target, target, targetLen + 1);
+    atomic_init(&sink->head, 0);
+    atomic_init(&sink->tail, 0);
+    atomic_init(&sink->stats, stats);
+    sink->dropReportMs = sink_now_ms() - SINK_DROP_REPORT_MS;
+
+    if (NULL == (sink->data = (char*) malloc(sink->size))
+        || (preamble && NULL == (sink->preamble = (char*) malloc(preambleLen))))
+    {
+        free(sink->data);
+        free(sink);
+        return NULL;
+    }
+
+    if (preamble)
+    {
+        memcpy(sink->preamble, preamble, preambleLen);
+        sink->preambleLen = preambleLen;
+    }
+
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sink->cond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+    pthread_mutex_init(&sink->lock, NULL);
+
+    // a target that isn't there yet is retried by the thread
+    sink_connect(sink);
+
+    if (0 != pthread_create(&sink->thread, NULL, sink_run, sink))
+    {
+        IPC_TRACE_ERROR_LOG("Error creating the thread of sink %s\n", target);
+        sink_free(sink);
+        return NULL;
+    }
+
+    return sink;
+}
+
+/*******************************************************************************
+ * @brief Write out what is buffered, stop the thread and close the sink
+ * @param sink
+ * @param timeoutMs - max wait
+ */
+void ipc_sink_close(ipc_sink_t* sink, int timeoutMs)
+{
+    if (NULL == sink)
+    {
+        return;
+    }
+
+    if (sink->dropsUnreported > 0)
+    {
+        IPC_TRACE_ERROR_LOG("Sink %s dropped %lu more lines\n", sink->target, sink->dropsUnreported);
+    }
+
+    pthread_mutex_lock(&sink->lock);
+    sink->bStop = 1;
+    pthread_cond_signal(&sink->cond);
+    pthread_mutex_unlock(&sink->lock);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec  += timeoutMs / 1000;
+    deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    if (0 != pthread_timedjoin_np(sink->thread, NULL, &deadline))
+    {
+        pthread_mutex_lock(&sink->lock);
+
+        int bExited = sink->bExited;
+
+        // the stats segment may go away before the thread is done
+        if (!bExited)
+        {
+            sink->bOrphan = 1;
+            atomic_store(&sink->stats, NULL);
+        }
+
+        pthread_mutex_unlock(&sink->lock);
+
+        if (!bExited)
+        {
+            IPC_TRACE_ERROR_LOG("Sink %s is stalled, leaving it behind\n", sink->target);
+            pthread_detach(sink->thread);
+            return;
+        }
+
+        pthread_join(sink->thread, NULL);
+    }
+
+    sink_free(sink);
+}
+
+/*******************************************************************************
+ * @brief Copy lines into the buffer of the sink, dropping what doesn't fit
+ * @param sink
+ * @param iov - lines
+ * @param count
+ * @return number of lines dropped
+ */
+int ipc_sink_writev(ipc_sink_t* sink, const struct iovec* iov, int count)
+{
+    uint64_t start = atomic_load_explicit(&sink->head, memory_order_relaxed);
+    uint64_t head = start;
+    uint64_t tail = atomic_load_explicit(&sink->tail, memory_order_acquire);
+    ipc_sink_entry_t entry;
+    int dropped = 0;
+
+    entry.queuedMs = sink_now_ms();
+
+    for (int i = 0; i < count; i++)
+    {
+        size_t space = sink_entry_space(iov[i].iov_len);
+        size_t offset = head % sink->size;
+        size_t skip = (sink->size - offset < space) ? sink->size - offset : 0;
+
+        if (iov[i].iov_len >= SINK_WRAP || head + skip + space - tail > sink->size)
+        {
+            dropped++;
+            continue;
+        }
+
+        // lines never wrap around, the rest of the lap is skipped
+        if (skip)
+        {
+            entry.len = SINK_WRAP;
+            memcpy(sink->data + offset, &entry, sizeof(entry));
+            head  += skip;
+            offset = 0;
+        }
+
+        entry.len = iov[i].iov_len;
+        memcpy(sink->data + offset, &entry, sizeof(entry));
+        memcpy(sink->data + offset + sizeof(entry), iov[i].iov_base, iov[i].iov_len);
+        head += space;
+    }
+
+    if (head != start)
+    {
+        atomic_store_explicit(&sink->head, head, memory_order_release);
+
+        pthread_mutex_lock(&sink->lock);
+        pthread_cond_signal(&sink->cond);
+        pthread_mutex_unlock(&sink->lock);
+    }
+
+    ipc_stats_sink_t* stats = atomic_load(&sink->stats);
+
+    if (stats)
+    {
+        atomic_store_explicit(&stats->queued, head - tail, memory_order_relaxed);
+        ipc_stats_max(&stats->queuedMax, head - tail);
+    }
+
+    if (dropped > 0)
+    {
+        if (stats)
+        {
+            atomic_fetch_add_explicit(&stats->drops, dropped, memory_order_relaxed);
+        }
+
+        // the first drop of a while is reported right away, the others summed up
+        if (0 == sink->dropsUnreported && entry.queuedMs - sink->dropReportMs >= SINK_DROP_REPORT_MS)
+        {
+            IPC_TRACE_ERROR_LOG("Sink %s is behind by %llu bytes, dropping lines\n", sink->target,
+                                (unsigned long long)(head - tail));
+            sink->dropReportMs = entry.queuedMs;
+        }
+        else
+        {
+            sink->dropsUnreported += dropped;
+        }
+    }
+
+    if (sink->dropsUnreported > 0 && entry.queuedMs - sink->dropReportMs >= SINK_DROP_REPORT_MS)
+    {
+        IPC_TRACE_ERROR_LOG("Sink %s dropped %lu more lines\n", sink->target, sink->dropsUnreported);
+        sink->dropsUnreported = 0;
+        sink->dropReportMs    = entry.queuedMs;
+    }
+
+    return dropped;
+}
@@ -0,0 +1,77 @@
+#ifndef LOG4C_APPENDER_IPC_SINK_H
+#define LOG4C_APPENDER_IPC_SINK_H
+
+
+/**
+ * @file log4c_appender_ipc_sink.h
+ *
+ * @brief Secondary outputs of the IPC appender.
+ *
+ * With "sink=<kind>:<target>" options the master writes every line to
+ * further destinations next to its output file: another file (e.g. an
+ * archive on another disk) or a local syslog socket. Each sink has a
+ * bounded buffer and a thread of its own. The pump copies its batches into
+ * the buffer and goes back to the transport; if the buffer is full, the
+ * lines are dropped for this sink only and counted. A stalled sink thus
+ * never holds up the pump, the other sinks or the producers.
+ *
+ * A sink that can't be written keeps its buffered lines and retries every
+ * second, so a short outage costs nothing as long as the buffer holds.
+ *
+ * Only the pump thread feeds a sink, there is no locking on that side but a
+ * short one per batch.
+ *
+*/
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "log4c_appender_ipc_stats.h"
+
+typedef struct __ipc_sink ipc_sink_t;
+
+enum __ipc_sink_kind
+{
+    IPC_SINK_FILE = 0,          // appended to a file, created if needed
+    IPC_SINK_SYSLOG,            // a datagram per line to a Unix socket, e.g. /dev/log
+};
+
+typedef enum __ipc_sink_kind ipc_sink_kind_t;
+
+/**
+ * Set a sink up and start its thread.
+ *
+ * The target doesn't have to be there yet; the thread retries until it is.
+ *
+ * @param kind
+ * @param target - path of the file or the socket
+ * @param bufferSize - bytes of lines the sink may fall behind by
+ * @param preamble - written to an empty file before any line, NULL for none
+ * @param preambleLen
+ * @param stats - counters of the sink, may be NULL
+ * @return handle, NULL on failure
+ */
+ipc_sink_t* ipc_sink_open(ipc_sink_kind_t kind, const char* target, size_t bufferSize,
+                          const void* preamble, size_t preambleLen, ipc_stats_sink_t* stats);
+
+/**
+ * Write out what is buffered, then stop the thread and close the sink.
+ *
+ * If the sink is still busy after the timeout, the thread is left to finish
+ * on its own and frees the sink when done.
+ *
+ * @param timeoutMs - max wait
+ */
+void ipc_sink_close(ipc_sink_t* sink, int timeoutMs);
+
+/**
+ * Copy lines into the buffer of the sink. Never waits for the sink.
+ *
+ * @param iov - one line per entry; the sink sends them one by one
+ * @param count
+ * @return number of lines dropped because the buffer was full
+ */
+int ipc_sink_writev(ipc_sink_t* sink, const struct iovec* iov, int count);
+
+
+#endif // LOG4C_APPENDER_IPC_SINK_H
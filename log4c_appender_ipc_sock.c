@@ -0,0 +1,603 @@
+#define _GNU_SOURCE     // accept4(), recvmmsg(), sendmmsg(), struct ucred
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "log4c_appender_ipc_sock.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define SOCK_MAX_EVENTS     64          // connections looked at per epoll_wait()
+#define SOCK_MAX_BATCH      64          // messages per recvmmsg() / sendmmsg()
+
+static const int LISTEN_BACKLOG = 128;
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __ipc_sock_conn
+{
+    struct __ipc_sock_conn* next;
+    struct __ipc_sock_conn* prev;
+    int fd;
+    pid_t pid;              // of the process that connected, 0 if unknown
+};
+
+typedef struct __ipc_sock_conn ipc_sock_conn_t;
+
+struct __ipc_sock_server
+{
+    int listenFd;
+    int epollFd;            // the listener (data.ptr NULL) and every connection
+    ipc_sock_conn_t* conns;
+    int numConns;
+    ipc_sock_gone_fn onGone;
+    void* context;
+};
+
+struct __ipc_sock
+{
+    int fd;                 // replaced in place by every connect
+    size_t sendBuffer;
+};
+
+/*******************************************************************************
+ * @brief Build the address of an abstract socket
+ * @param addr - [out]
+ * @param name
+ * @return length of the address, 0 if the name is too long
+ */
+static socklen_t sock_address(struct sockaddr_un* addr, const char* name)
+{
+    size_t len = strlen(name);
+
+    // the leading NUL puts it into the abstract namespace
+    if (len > sizeof(addr->sun_path) - 1)
+    {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path + 1, name, len);
+
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + len);
+}
+
+/*******************************************************************************
+ * @brief Tell why a send failed the way the header promises
+ * @return -1
+ */
+static int sock_send_error()
+{
+    if (EPIPE == errno || ECONNRESET == errno || ECONNREFUSED == errno)
+    {
+        errno = ENOTCONN;
+    }
+    else if (EWOULDBLOCK == errno)
+    {
+        errno = EAGAIN;
+    }
+
+    return -1;
+}
+
+/*******************************************************************************
+ * @brief Bind and listen
+ * @param name - abstract socket name
+ * @param onGone - called for every process whose connection hangs up
+ * @param context - passed to onGone
+ * @return handle, NULL on failure
+ */
+ipc_sock_server_t* ipc_sock_listen(const char* name, ipc_sock_gone_fn onGone, void* context)
+{
+    struct sockaddr_un addr;
+    socklen_t addrLen = sock_address(&addr, name);
+
+    if (0 == addrLen)
+    {
+        IPC_TRACE_ERROR_LOG("Socket name too long: %s\n", name);
+        return NULL;
+    }
+
+    ipc_sock_server_t* server = (ipc_sock_server_t*) calloc(1, sizeof(ipc_sock_server_t));
+
+    if (NULL == server)
+    {
+        return NULL;
+    }
+
+    server->onGone  = onGone;
+    server->context = context;
+    server->epollFd = -1;
+
+    struct epoll_event event;
+    event.events   = EPOLLIN;
+    event.data.ptr = NULL;
+
+    if (-1 == (server->listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))
+        || -1 == bind(server->listenFd, (struct sockaddr*) &addr, addrLen)
+        || -1 == listen(server->listenFd, LISTEN_BACKLOG)
+        || -1 == (server->epollFd = epoll_create1(EPOLL_CLOEXEC))
+        || -1 == epoll_ctl(server->epollFd, EPOLL_CTL_ADD, server->listenFd, &event))
+    {
+        IPC_TRACE_ERROR_LOG("Can't listen on %s: %s\n", name, strerror(errno));
+
+        if (-1 != server->listenFd)
+        {
+            close(server->listenFd);
+        }
+
+        if (-1 != server->epollFd)
+        {
+            close(server->epollFd);
+        }
+
+        free(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+/*******************************************************************************
+ * @brief Close a connection
+ * @param server
+ * @param conn
+ * @param bGone - 1 to report the process as gone
+ */
+static void conn_close(ipc_sock_server_t* server, ipc_sock_conn_t* conn, int bGone)
+{
+    epoll_ctl(server->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+
+    if (conn->prev)
+    {
+        conn->prev->next = conn->next;
+    }
+    else
+    {
+        server->conns = conn->next;
+    }
+
+    if (conn->next)
+    {
+        conn->next->prev = conn->prev;
+    }
+
+    server->numConns--;
+
+    if (bGone && server->onGone && conn->pid > 0)
+    {
+        server->onGone(server->context, conn->pid);
+    }
+
+    free(conn);
+}
+
+/*******************************************************************************
+ * @brief Close the listener and every connection
+ * @param server
+ */
+void ipc_sock_server_close(ipc_sock_server_t* server)
+{
+    if (server)
+    {
+        while (server->conns)
+        {
+            conn_close(server, server->conns, 0);
+        }
+
+        close(server->epollFd);
+        close(server->listenFd);
+        free(server);
+    }
+}
+
+/*******************************************************************************
+ * @brief Take every pending connection
+ * @param server
+ */
+static void accept_all(ipc_sock_server_t* server)
+{
+    int fd;
+
+    while (-1 != (fd = accept4(server->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)))
+    {
+        ipc_sock_conn_t* conn = (ipc_sock_conn_t*) calloc(1, sizeof(ipc_sock_conn_t));
+        struct epoll_event event;
+
+        event.events   = EPOLLIN;
+        event.data.ptr = conn;
+
+        // the client sees EPIPE and falls back to its other transport
+        if (NULL == conn || -1 == epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event))
+        {
+            IPC_TRACE_ERROR_LOG("Can't take a connection: %s\n", strerror(errno));
+            free(conn);
+            close(fd);
+            continue;
+        }
+
+        struct ucred cred;
+        socklen_t credLen = sizeof(cred);
+
+        conn->fd  = fd;
+        conn->pid = (0 == getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen)) ? cred.pid : 0;
+
+        conn->next = server->conns;
+
+        if (server->conns)
+        {
+            server->conns->prev = conn;
+        }
+
+        server->conns = conn;
+        server->numConns++;
+    }
+
+    if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno && ECONNABORTED != errno)
+    {
+        IPC_TRACE_ERROR_LOG("accept4() failed: %s\n", strerror(errno));
+    }
+}
+
+/*******************************************************************************
+ * @brief Take the messages waiting in one connection
+ * @param server
+ * @param conn - closed if it hangs up
+ * @param slots - room for 'max' messages
+ * @param slotSize
+ * @param max
+ * @param lens - [out]
+ * @return number of messages received
+ */
+static int conn_receive(ipc_sock_server_t* server, ipc_sock_conn_t* conn, char* slots, size_t slotSize, int max,
+                        size_t* lens)
+{
+    struct mmsghdr msgs[SOCK_MAX_BATCH];
+    struct iovec iov[SOCK_MAX_BATCH];
+    int count = 0;
+
+    while (count < max)
+    {
+        int want = max - count < SOCK_MAX_BATCH ? max - count : SOCK_MAX_BATCH;
+
+        for (int i = 0; i < want; i++)
+        {
+            iov[i].iov_base = slots + (size_t)(count + i) * slotSize;
+            iov[i].iov_len  = slotSize;
+
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov    = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int got = recvmmsg(conn->fd, msgs, want, MSG_DONTWAIT, NULL);
+
+        if (-1 == got)
+        {
+            if (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno)
+            {
+                break;
+            }
+
+            IPC_TRACE_ERROR_LOG("recvmmsg() failed: %s\n", strerror(errno));
+            conn_close(server, conn, 1);
+            break;
+        }
+
+        // every receive past the end of the connection returns 0 bytes
+        for (int i = 0; i < got; i++)
+        {
+            if (0 == msgs[i].msg_len)
+            {
+                conn_close(server, conn, 1);
+                return count + i;
+            }
+
+            lens[count + i] = msgs[i].msg_len;
+        }
+
+        count += got;
+
+        if (got < want)
+        {
+            break;
+        }
+    }
+
+    return count;
+}
+
+/*******************************************************************************
+ * @brief Take the messages waiting in the connections, without blocking
+ * @param server
+ * @param slots - room for 'max' messages of 'slotSize' bytes each
+ * @param slotSize
+ * @param max
+ * @param lens - [out] length of every message received
+ * @return number of messages received
+ */
+int ipc_sock_receive(ipc_sock_server_t* server, char* slots, size_t slotSize, int max, size_t* lens)
+{
+    struct epoll_event events[SOCK_MAX_EVENTS];
+    int count = 0;
+    int numEvents;
+
+    // level-triggered: a connection cut short by 'max' comes up again next time
+    do
+    {
+        numEvents = epoll_wait(server->epollFd, events, SOCK_MAX_EVENTS, 0);
+
+        for (int i = 0; i < numEvents && count < max; i++)
+        {
+            ipc_sock_conn_t* conn = (ipc_sock_conn_t*) events[i].data.ptr;
+
+            if (NULL == conn)
+            {
+                accept_all(server);
+            }
+            else
+            {
+                count += conn_receive(server, conn, slots + (size_t)count * slotSize, slotSize, max - count,
+                                      lens + count);
+            }
+        }
+    }
+    while (SOCK_MAX_EVENTS == numEvents && count < max);
+
+    return count;
+}
+
+/*******************************************************************************
+ * @brief Wait until there is something to receive
+ * @param server
+ * @param otherFd - also waited for, -1 for none
+ * @param timeoutMs - -1 waits forever
+ * @return 1 if something is ready, 0 on timeout, -1 on error
+ */
+int ipc_sock_wait(ipc_sock_server_t* server, int otherFd, int timeoutMs)
+{
+    struct pollfd fds[2];
+
+    fds[0].fd     = server->epollFd;
+    fds[0].events = POLLIN;
+    fds[1].fd     = otherFd;
+    fds[1].events = POLLIN;
+
+    int result = poll(fds, -1 == otherFd ? 1 : 2, timeoutMs);
+
+    return result > 0 ? 1 : result;
+}
+
+/*******************************************************************************
+ * @brief Stop taking messages, keeping what is queued
+ * @param server
+ */
+void ipc_sock_shutdown(ipc_sock_server_t* server)
+{
+    // connecting is refused from now on; the backlog is taken so that
+    // whatever was sent into it is received too
+    shutdown(server->listenFd, SHUT_RD);
+    accept_all(server);
+    epoll_ctl(server->epollFd, EPOLL_CTL_DEL, server->listenFd, NULL);
+
+    for (ipc_sock_conn_t* conn = server->conns; conn; conn = conn->next)
+    {
+        shutdown(conn->fd, SHUT_RD);
+    }
+}
+
+/*******************************************************************************
+ * @brief Number of connections not closed yet
+ * @param server
+ * @return count
+ */
+int ipc_sock_clients(const ipc_sock_server_t* server)
+{
+    return server->numConns;
+}
+
+/*******************************************************************************
+ * @brief A socket not connected to anything yet
+ * @param sendBuffer - bytes in flight at most
+ * @return handle, NULL on failure
+ */
+ipc_sock_t* ipc_sock_open(size_t sendBuffer)
+{
+    ipc_sock_t* sock = (ipc_sock_t*) calloc(1, sizeof(ipc_sock_t));
+
+    if (NULL == sock)
+    {
+        return NULL;
+    }
+
+    // sending on it fails with ENOTCONN until the first connect
+    if (-1 == (sock->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)))
+    {
+        IPC_TRACE_ERROR_LOG("socket() failed: %s\n", strerror(errno));
+        free(sock);
+        return NULL;
+    }
+
+    sock->sendBuffer = sendBuffer;
+
+    return sock;
+}
+
+/*******************************************************************************
+ * @brief Connect to a master, replacing the previous connection
+ * @param sock
+ * @param name - abstract socket name
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_sock_connect(ipc_sock_t* sock, const char* name)
+{
+    struct sockaddr_un addr;
+    socklen_t addrLen = sock_address(&addr, name);
+    int fd;
+
+    if (0 == addrLen || -1 == (fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)))
+    {
+        return -1;
+    }
+
+    // the kernel doubles it, and caps it at net.core.wmem_max
+    int size = sock->sendBuffer > INT32_MAX / 2 ? INT32_MAX / 2 : (int) sock->sendBuffer;
+
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    if (-1 == connect(fd, (struct sockaddr*) &addr, addrLen))
+    {
+        close(fd);
+        return -1;
+    }
+
+    // senders never see the descriptor closed: dup2() swaps it atomically
+    int result = dup2(fd, sock->fd);
+
+    close(fd);
+
+    return -1 == result ? -1 : 0;
+}
+
+/*******************************************************************************
+ * @brief Close the handle
+ * @param sock
+ */
+void ipc_sock_close(ipc_sock_t* sock)
+{
+    if (sock)
+    {
+        close(sock->fd);
+        free(sock);
+    }
+}
+
+/*******************************************************************************
+ * @brief Milliseconds left until a deadline
+ * @param deadline - CLOCK_MONOTONIC
+ * @return ms, 0 if it's over
+ */
+static int ms_left(const struct timespec* deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long ms = (deadline->tv_sec - now.tv_sec) * 1000LL + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+    return ms > 0 ? (int) ms : 0;
+}
+
+/*******************************************************************************
+ * @brief Send one message gathered from several parts
+ * @param sock
+ * @param parts
+ * @param numParts
+ * @param timeoutMs - max wait for room; 0 never waits, -1 waits forever
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_sock_sendv(ipc_sock_t* sock, const struct iovec* parts, int numParts, int timeoutMs)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = (struct iovec*) parts;
+    msg.msg_iovlen = numParts;
+
+    // blocking sends wait in the kernel, the others poll for room
+    int flags = MSG_NOSIGNAL | (timeoutMs < 0 ? 0 : MSG_DONTWAIT);
+    struct timespec deadline;
+
+    if (timeoutMs > 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec  += timeoutMs / 1000;
+        deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    while (-1 == sendmsg(sock->fd, &msg, flags))
+    {
+        if (EINTR == errno)
+        {
+            continue;
+        }
+
+        if ((EAGAIN != errno && EWOULDBLOCK != errno) || 0 == timeoutMs)
+        {
+            return sock_send_error();
+        }
+
+        int msLeft = ms_left(&deadline);
+        struct pollfd pfd = { sock->fd, POLLOUT, 0 };
+
+        if (0 == msLeft || 0 == poll(&pfd, 1, msLeft))
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Send several messages at once, never waiting
+ * @param sock
+ * @param msgs
+ * @param count
+ * @return number of messages sent, -1 if none was
+ */
+int ipc_sock_sendmmsg(ipc_sock_t* sock, const ipc_sock_msg_t* msgs, int count)
+{
+    struct mmsghdr hdrs[SOCK_MAX_BATCH];
+    int sent = 0;
+
+    while (sent < count)
+    {
+        int want = count - sent < SOCK_MAX_BATCH ? count - sent : SOCK_MAX_BATCH;
+
+        for (int i = 0; i < want; i++)
+        {
+            memset(&hdrs[i], 0, sizeof(hdrs[i]));
+            hdrs[i].msg_hdr.msg_iov    = (struct iovec*) msgs[sent + i].parts;
+            hdrs[i].msg_hdr.msg_iovlen = msgs[sent + i].numParts;
+        }
+
+        int result = sendmmsg(sock->fd, hdrs, want, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if (-1 == result && EINTR == errno)
+        {
+            continue;
+        }
+
+        if (-1 == result)
+        {
+            return 0 == sent ? sock_send_error() : sent;
+        }
+
+        sent += result;
+
+        if (result < want)
+        {
+            break;
+        }
+    }
+
+    return sent;
+}
@@ -0,0 +1,135 @@
+#ifndef LOG4C_APPENDER_IPC_SOCK_H
+#define LOG4C_APPENDER_IPC_SOCK_H
+
+
+/**
+ * @file log4c_appender_ipc_sock.h
+ *
+ * @brief Unix-domain socket transport of the IPC appender.
+ *
+ * With "transport=socket" the master listens on a SOCK_SEQPACKET socket in
+ * the abstract namespace and every process connects to it once. Message
+ * boundaries are kept like with the message queue, but neither the number
+ * nor the size of queued messages is bound by the mqueue limits: a process
+ * may have as many bytes in flight as its send buffer holds. Clients send
+ * several messages per call with sendmmsg(), the master takes dozens per
+ * call with recvmmsg().
+ *
+ * The master learns about a process going away when its connection hangs
+ * up; clients learn about the master going away from EPIPE. Either way,
+ * messages already queued in a connection are still received.
+ *
+ * Names must not be longer than 107 characters. Zero-length messages can't
+ * be sent: the receiver takes them for the end of the connection.
+ *
+*/
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef struct __ipc_sock_server ipc_sock_server_t;
+typedef struct __ipc_sock ipc_sock_t;
+
+// called for every process whose connection hangs up
+typedef void (*ipc_sock_gone_fn)(void* context, pid_t pid);
+
+// one message of ipc_sock_sendmmsg()
+struct __ipc_sock_msg
+{
+    const struct iovec* parts;
+    int numParts;
+};
+
+typedef struct __ipc_sock_msg ipc_sock_msg_t;
+
+/**
+ * Master side: bind and listen.
+ *
+ * @param name - abstract socket name
+ * @param onGone - may be NULL
+ * @param context - passed to onGone
+ * @return handle, NULL on failure (e.g. the name is taken)
+ */
+ipc_sock_server_t* ipc_sock_listen(const char* name, ipc_sock_gone_fn onGone, void* context);
+
+/**
+ * Close the listener and every connection. Whatever they still hold is lost.
+ */
+void ipc_sock_server_close(ipc_sock_server_t* server);
+
+/**
+ * Take the messages waiting in the connections, without blocking. Accepts
+ * new connections and closes those hung up on the way.
+ *
+ * @param slots - room for 'max' messages of 'slotSize' bytes each
+ * @param lens - [out] length of every message received
+ * @return number of messages received; less than 'max' means every
+ *         connection was found empty
+ */
+int ipc_sock_receive(ipc_sock_server_t* server, char* slots, size_t slotSize, int max, size_t* lens);
+
+/**
+ * Wait until a connection has something to receive or 'otherFd' (-1 for
+ * none) becomes readable.
+ *
+ * @param timeoutMs - -1 waits forever
+ * @return 1 if something is ready, 0 on timeout, -1 on error
+ */
+int ipc_sock_wait(ipc_sock_server_t* server, int otherFd, int timeoutMs);
+
+/**
+ * Stop taking messages: new connections are refused and senders get EPIPE,
+ * but messages queued before can still be received until every connection
+ * is closed.
+ */
+void ipc_sock_shutdown(ipc_sock_server_t* server);
+
+/**
+ * Number of connections not closed yet.
+ */
+int ipc_sock_clients(const ipc_sock_server_t* server);
+
+/**
+ * Client side: a socket not connected to anything yet.
+ *
+ * @param sendBuffer - bytes in flight at most; capped by net.core.wmem_max
+ * @return handle, NULL on failure
+ */
+ipc_sock_t* ipc_sock_open(size_t sendBuffer);
+
+/**
+ * Connect to a master, replacing the connection the handle had so far.
+ * Threads sending at the same time use either connection, never a closed
+ * descriptor. On failure the old connection is left as it was.
+ *
+ * @param name - abstract socket name
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_sock_connect(ipc_sock_t* sock, const char* name);
+
+/**
+ * Close the handle.
+ */
+void ipc_sock_close(ipc_sock_t* sock);
+
+/**
+ * Send one message gathered from several parts.
+ *
+ * @param timeoutMs - max wait for room; 0 never waits, -1 waits forever
+ * @return 0 upon success, -1 otherwise with errno set to
+ *         EAGAIN if it's full, ETIMEDOUT if it stayed full,
+ *         ENOTCONN if no master is listening on the other end
+ */
+int ipc_sock_sendv(ipc_sock_t* sock, const struct iovec* parts, int numParts, int timeoutMs);
+
+/**
+ * Send several messages at once, never waiting.
+ *
+ * @return number of messages sent, the rest didn't fit; -1 if none was sent
+ *         with errno set as by ipc_sock_sendv()
+ */
+int ipc_sock_sendmmsg(ipc_sock_t* sock, const ipc_sock_msg_t* msgs, int count);
+
+
+#endif // LOG4C_APPENDER_IPC_SOCK_H
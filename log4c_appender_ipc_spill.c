@@ -0,0 +1,443 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log4c_appender_ipc_spill.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define SPILL_CACHELINE     64
+#define SPILL_HEADER_SIZE   4096        // keeps the data area page aligned
+
+static const uint32_t SPILL_MAGIC       = 0x4c505349; // "ISPL"
+static const uint32_t SPILL_VERSION     = 1;
+static const uint32_t REC_PAD           = 1;        // filler up to the end of the data area
+static const size_t   REC_HDR_SIZE      = 16;
+static const size_t   MIN_CAPACITY      = 65536;
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+
+// Placed at the beginning of the file. Cursors are free running byte
+// counters, the offset in the data area is (cursor & mask).
+struct __ipc_spill_shared
+{
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    _Atomic int32_t pid;
+
+    // producer
+    _Alignas(SPILL_CACHELINE) _Atomic uint64_t head;
+
+    // consumer
+    _Alignas(SPILL_CACHELINE) _Atomic uint64_t tail;
+};
+
+typedef struct __ipc_spill_shared ipc_spill_shared_t;
+
+// header of every message, 16 bytes to keep payloads aligned
+struct __ipc_spill_record
+{
+    uint32_t len;
+    uint32_t flags;
+    uint64_t stamp;
+};
+
+typedef struct __ipc_spill_record ipc_spill_record_t;
+
+struct __ipc_spill
+{
+    int fd;
+    ipc_spill_shared_t* shared;
+    char* data;
+    size_t mapSize;
+    uint64_t mask;
+    pid_t opener;           // process that opened it to spill, 0 if attached
+
+    // consumer-private state
+    uint64_t readPos;
+    size_t peeked;          // size of the message returned by the last peek, 0 if none
+};
+
+static size_t align_record(size_t len)
+{
+    return (REC_HDR_SIZE + len + 15) & ~(size_t)15;
+}
+
+static ipc_spill_record_t* record_at(ipc_spill_t* spill, uint64_t pos)
+{
+    return (ipc_spill_record_t*)(spill->data + (pos & spill->mask));
+}
+
+/*******************************************************************************
+ * @brief Map the journal file
+ * @param fd - descriptor of the file, owned by the handle from now on
+ * @param mapSize - size of the file
+ * @return journal handle, NULL on failure
+ */
+static ipc_spill_t* map_spill(int fd, size_t mapSize)
+{
+    void* addr = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (MAP_FAILED == addr)
+    {
+        IPC_TRACE_ERROR_LOG("mmap() failed: %s\n", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    ipc_spill_t* spill = (ipc_spill_t*) calloc(1, sizeof(ipc_spill_t));
+
+    if (NULL == spill)
+    {
+        munmap(addr, mapSize);
+        close(fd);
+        return NULL;
+    }
+
+    spill->fd      = fd;
+    spill->shared  = (ipc_spill_shared_t*) addr;
+    spill->data    = (char*) addr + SPILL_HEADER_SIZE;
+    spill->mapSize = mapSize;
+
+    return spill;
+}
+
+/*******************************************************************************
+ * @brief Check the header of a mapped journal
+ * @param spill
+ * @return 0 if it's valid, -1 otherwise
+ */
+static int check_spill(ipc_spill_t* spill)
+{
+    ipc_spill_shared_t* shared = spill->shared;
+
+    if (SPILL_MAGIC != atomic_load_explicit(&shared->magic, memory_order_acquire)
+        || SPILL_VERSION != shared->version
+        || shared->capacity + SPILL_HEADER_SIZE != spill->mapSize
+        || 0 != (shared->capacity & (shared->capacity - 1)))
+    {
+        return -1;
+    }
+
+    spill->mask    = shared->capacity - 1;
+    spill->readPos = atomic_load_explicit(&shared->tail, memory_order_acquire);
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Open the journal of this process
+ * @param path - journal file
+ * @param capacity - requested size of the data area
+ * @return journal handle, NULL on failure
+ */
+ipc_spill_t* ipc_spill_open(const char* path, size_t capacity)
+{
+    size_t cap = MIN_CAPACITY;
+
+    while (cap < capacity)
+    {
+        cap <<= 1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+
+    if (-1 == fd || -1 == fstat(fd, &st))
+    {
+        IPC_TRACE_ERROR_LOG("Can't open %s: %s\n", path, strerror(errno));
+
+        if (-1 != fd)
+        {
+            close(fd);
+        }
+
+        return NULL;
+    }
+
+    ipc_spill_t* spill;
+
+    // continue what a process of the same pid left behind
+    if (st.st_size > SPILL_HEADER_SIZE && NULL != (spill = map_spill(fd, st.st_size)))
+    {
+        if (0 == check_spill(spill))
+        {
+            spill->opener = getpid();
+            atomic_store_explicit(&spill->shared->pid, spill->opener, memory_order_relaxed);
+            return spill;
+        }
+
+        // not a journal: start over on the same descriptor
+        fd = spill->fd;
+        munmap(spill->shared, spill->mapSize);
+        free(spill);
+    }
+    else if (st.st_size > SPILL_HEADER_SIZE)
+    {
+        // map_spill() closed it
+        return NULL;
+    }
+
+    // a journal with holes would SIGBUS the producer once the disk is full
+    if (-1 == ftruncate(fd, 0) || 0 != posix_fallocate(fd, 0, SPILL_HEADER_SIZE + cap))
+    {
+        IPC_TRACE_ERROR_LOG("Can't allocate %s\n", path);
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    if (NULL == (spill = map_spill(fd, SPILL_HEADER_SIZE + cap)))
+    {
+        unlink(path);
+        return NULL;
+    }
+
+    // the fresh file is zero-filled: both cursors at 0
+    ipc_spill_shared_t* shared = spill->shared;
+
+    shared->version  = SPILL_VERSION;
+    shared->capacity = cap;
+    spill->mask      = cap - 1;
+    spill->opener    = getpid();
+
+    atomic_store_explicit(&shared->pid, spill->opener, memory_order_relaxed);
+    atomic_store_explicit(&shared->magic, SPILL_MAGIC, memory_order_release);
+
+    return spill;
+}
+
+/*******************************************************************************
+ * @brief Map the journal of another process
+ * @param path - journal file
+ * @return journal handle, NULL on failure
+ */
+ipc_spill_t* ipc_spill_attach(const char* path)
+{
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    struct stat st;
+
+    if (-1 == fd)
+    {
+        return NULL;
+    }
+
+    if (-1 == fstat(fd, &st) || st.st_size <= SPILL_HEADER_SIZE)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    ipc_spill_t* spill = map_spill(fd, st.st_size);
+
+    if (spill && -1 == check_spill(spill))
+    {
+        ipc_spill_close(spill);
+        return NULL;
+    }
+
+    return spill;
+}
+
+/*******************************************************************************
+ * @brief Unmap the journal
+ * @param spill
+ */
+void ipc_spill_close(ipc_spill_t* spill)
+{
+    if (spill)
+    {
+        munmap(spill->shared, spill->mapSize);
+        close(spill->fd);
+        free(spill);
+    }
+}
+
+/*******************************************************************************
+ * @brief Process the journal was last opened by
+ * @param spill
+ * @return pid
+ */
+pid_t ipc_spill_owner(const ipc_spill_t* spill)
+{
+    return atomic_load_explicit(&spill->shared->pid, memory_order_relaxed);
+}
+
+/*******************************************************************************
+ * @brief Process that opened this handle to spill
+ * @param spill
+ * @return pid, 0 for a journal attached to
+ */
+pid_t ipc_spill_opener(const ipc_spill_t* spill)
+{
+    return spill->opener;
+}
+
+/*******************************************************************************
+ * @brief Check whether the file has been removed
+ * @param spill
+ * @return 1 if it has, 0 otherwise
+ */
+int ipc_spill_unlinked(const ipc_spill_t* spill)
+{
+    struct stat st;
+
+    return 0 == fstat(spill->fd, &st) && 0 == st.st_nlink;
+}
+
+/*******************************************************************************
+ * @brief Largest message a journal can take
+ * @param spill
+ * @return size in bytes
+ */
+size_t ipc_spill_max_message(const ipc_spill_t* spill)
+{
+    // half the data area, so a message fits whatever the wrap-around
+    return spill->shared->capacity / 2 - REC_HDR_SIZE;
+}
+
+/*******************************************************************************
+ * @brief Append one message
+ * @param spill
+ * @param stamp - CLOCK_REALTIME time in nanoseconds
+ * @param parts - message pieces
+ * @param numParts - number of pieces
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_spill_writev(ipc_spill_t* spill, uint64_t stamp, const struct iovec* parts, int numParts)
+{
+    ipc_spill_shared_t* shared = spill->shared;
+    size_t len = 0;
+
+    for (int i = 0; i < numParts; i++)
+    {
+        len += parts[i].iov_len;
+    }
+
+    if (len > ipc_spill_max_message(spill))
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    uint64_t head = atomic_load_explicit(&shared->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&shared->tail, memory_order_acquire);
+    uint64_t need = align_record(len);
+    uint64_t contig = shared->capacity - (head & spill->mask);
+    uint64_t pad = contig < need ? contig : 0;
+
+    if (head + pad + need - tail > shared->capacity)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    if (pad > 0)
+    {
+        ipc_spill_record_t* filler = record_at(spill, head);
+        filler->len   = pad - REC_HDR_SIZE;
+        filler->flags = REC_PAD;
+        filler->stamp = 0;
+        head += pad;
+    }
+
+    ipc_spill_record_t* rec = record_at(spill, head);
+    char* pos = (char*)(rec + 1);
+
+    rec->len   = len;
+    rec->flags = 0;
+    rec->stamp = stamp;
+
+    for (int i = 0; i < numParts; i++)
+    {
+        memcpy(pos, parts[i].iov_base, parts[i].iov_len);
+        pos += parts[i].iov_len;
+    }
+
+    atomic_store_explicit(&shared->head, head + need, memory_order_release);
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Check for messages not released yet
+ * @param spill
+ * @return 1 if there are some, 0 otherwise
+ */
+int ipc_spill_pending(const ipc_spill_t* spill)
+{
+    return atomic_load_explicit(&spill->shared->head, memory_order_acquire)
+        != atomic_load_explicit(&spill->shared->tail, memory_order_acquire);
+}
+
+/*******************************************************************************
+ * @brief Look at the next message
+ * @param spill
+ * @param stamp - [out] time the message was spilled at
+ * @param data - [out] message
+ * @param len - [out] message length
+ * @return 1 if a message is returned, 0 if there is none
+ */
+int ipc_spill_peek(ipc_spill_t* spill, uint64_t* stamp, const char** data, size_t* len)
+{
+    uint64_t head = atomic_load_explicit(&spill->shared->head, memory_order_acquire);
+
+    while (spill->readPos != head)
+    {
+        ipc_spill_record_t* rec = record_at(spill, spill->readPos);
+        uint64_t contig = spill->shared->capacity - (spill->readPos & spill->mask);
+
+        // a damaged journal must not make the message run past the mapping
+        if (rec->len > contig - REC_HDR_SIZE || align_record(rec->len) > head - spill->readPos)
+        {
+            IPC_TRACE_ERROR_LOG("Damaged spill journal of process %d, skipping the rest\n",
+                                (int) atomic_load_explicit(&spill->shared->pid, memory_order_relaxed));
+            spill->readPos = head;
+            break;
+        }
+
+        if (REC_PAD & rec->flags)
+        {
+            spill->readPos += REC_HDR_SIZE + rec->len;
+            continue;
+        }
+
+        *stamp = rec->stamp;
+        *data  = (const char*)(rec + 1);
+        *len   = rec->len;
+        spill->peeked = align_record(rec->len);
+
+        return 1;
+    }
+
+    spill->peeked = 0;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Take the message returned by the last peek
+ * @param spill
+ */
+void ipc_spill_next(ipc_spill_t* spill)
+{
+    spill->readPos += spill->peeked;
+    spill->peeked   = 0;
+}
+
+/*******************************************************************************
+ * @brief Give back the space of the messages taken so far
+ * @param spill
+ */
+void ipc_spill_release(ipc_spill_t* spill)
+{
+    atomic_store_explicit(&spill->shared->tail, spill->readPos, memory_order_release);
+}
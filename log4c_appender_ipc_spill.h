@@ -0,0 +1,114 @@
+#ifndef LOG4C_APPENDER_IPC_SPILL_H
+#define LOG4C_APPENDER_IPC_SPILL_H
+
+
+/**
+ * @file log4c_appender_ipc_spill.h
+ *
+ * @brief Per-process spill journal of the IPC appender.
+ *
+ * With "overflow=spill" a producer that finds the transport full (or
+ * unusable) appends the message to a journal file of its own instead of
+ * waiting or dropping it. The journal is a single-producer single-consumer
+ * ring in a mapped, preallocated file: the producer copies messages in and
+ * advances the head, the master reads them in place and advances the tail
+ * once they are written to the output.
+ *
+ * Every message carries the CLOCK_REALTIME time it was spilled at; the
+ * master merges the journals of all processes by it.
+ *
+ * The journal lives next to the output file, so it survives the producer
+ * and the master: whatever is left in it is picked up by the next master.
+ * Threads of a process share the journal, the caller serializes writing.
+ *
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef struct __ipc_spill ipc_spill_t;
+
+/**
+ * Producer side: open the journal of this process, creating and
+ * preallocating it if needed. An existing journal of the same name (left by
+ * a process of the same pid) is continued.
+ *
+ * @param path - journal file
+ * @param capacity - size of the data area; rounded up to a power of two
+ * @return journal handle, NULL on failure (e.g. the disk is full)
+ */
+ipc_spill_t* ipc_spill_open(const char* path, size_t capacity);
+
+/**
+ * Consumer side: map the journal of another process.
+ *
+ * @param path - journal file
+ * @return journal handle, NULL if there is no valid journal at the path
+ */
+ipc_spill_t* ipc_spill_attach(const char* path);
+
+/**
+ * Unmap the journal. The file itself is left intact.
+ */
+void ipc_spill_close(ipc_spill_t* spill);
+
+/**
+ * Process the journal was last opened by.
+ */
+pid_t ipc_spill_owner(const ipc_spill_t* spill);
+
+/**
+ * Process that opened this handle with ipc_spill_open(), 0 for a journal
+ * mapped with ipc_spill_attach(). Unlike ipc_spill_owner(), it doesn't
+ * change when another process opens the same file.
+ */
+pid_t ipc_spill_opener(const ipc_spill_t* spill);
+
+/**
+ * 1 if the file has been removed since the journal was mapped.
+ */
+int ipc_spill_unlinked(const ipc_spill_t* spill);
+
+/**
+ * Largest message a journal can take.
+ */
+size_t ipc_spill_max_message(const ipc_spill_t* spill);
+
+/**
+ * Append one message gathered from several parts. Never blocks.
+ *
+ * @param stamp - CLOCK_REALTIME time in nanoseconds
+ * @return 0 upon success, -1 otherwise with errno set to
+ *         ENOSPC if the journal is full, EMSGSIZE if the message can never fit
+ */
+int ipc_spill_writev(ipc_spill_t* spill, uint64_t stamp, const struct iovec* parts, int numParts);
+
+/**
+ * 1 if the journal holds messages the consumer hasn't released yet.
+ */
+int ipc_spill_pending(const ipc_spill_t* spill);
+
+/**
+ * Consumer side: look at the next message without taking it.
+ *
+ * The returned pointer stays valid until the next ipc_spill_release().
+ *
+ * @param stamp - [out] time the message was spilled at
+ * @return 1 if a message is returned, 0 if there is none
+ */
+int ipc_spill_peek(ipc_spill_t* spill, uint64_t* stamp, const char** data, size_t* len);
+
+/**
+ * Consumer side: take the message returned by ipc_spill_peek().
+ */
+void ipc_spill_next(ipc_spill_t* spill);
+
+/**
+ * Consumer side: give back the space of all messages taken so far.
+ */
+void ipc_spill_release(ipc_spill_t* spill);
+
+
+#endif // LOG4C_APPENDER_IPC_SPILL_H
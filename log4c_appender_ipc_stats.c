@@ -0,0 +1,267 @@
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log4c_appender_ipc_stats.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+static const uint32_t IPC_STATS_MAGIC   = 0x53435049; // "IPCS"
+static const uint32_t IPC_STATS_VERSION = 4;
+static const uint32_t CLAIM_RETRY_S     = 1;        // a process without a slot looks again after this
+
+// not IPC_TRACE_ERROR_LOG: ipc_stat links this file without the trace rings
+#define ERROR_LOG(FMT, ...) do { \
+    fprintf(stderr, "[%d] %s (%d): ", getpid(), __PRETTY_FUNCTION__, __LINE__); \
+    fprintf(stderr, FMT, ##__VA_ARGS__); \
+    fprintf(stderr, "\n"); \
+}while(0)
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __ipc_stats
+{
+    ipc_stats_shared_t* shared;
+    _Atomic(ipc_stats_client_t*) slot;     // claimed by this process (or its parent)
+    atomic_ullong claimFailed;  // pid << 32 | second of the next attempt, after finding no slot
+    int bReadOnly;
+};
+
+/*******************************************************************************
+ * @brief Open (or create) the stats segment
+ * @param name - name of the shared memory object
+ * @param bReadOnly - 1 to map an existing segment for reading only
+ * @return handle, NULL on failure
+ */
+ipc_stats_t* ipc_stats_open(const char* name, int bReadOnly)
+{
+    int fd = shm_open(name, bReadOnly ? O_RDONLY : O_RDWR | O_CREAT, 0666);
+
+    if (-1 == fd)
+    {
+        if (!bReadOnly)
+        {
+            ERROR_LOG("shm_open(%s) failed: %s", name, strerror(errno));
+        }
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (-1 == fstat(fd, &st)
+        || ((size_t)st.st_size < sizeof(ipc_stats_shared_t)
+            && (bReadOnly || -1 == ftruncate(fd, sizeof(ipc_stats_shared_t)))))
+    {
+        ERROR_LOG("sizing %s failed: %s", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    void* addr = mmap(NULL, sizeof(ipc_stats_shared_t), bReadOnly ? PROT_READ : PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+
+    // the mapping stays valid without the descriptor
+    close(fd);
+
+    if (MAP_FAILED == addr)
+    {
+        ERROR_LOG("mmap(%s) failed: %s", name, strerror(errno));
+        return NULL;
+    }
+
+    ipc_stats_shared_t* shared = (ipc_stats_shared_t*) addr;
+
+    // racing creators write the same values
+    if (!bReadOnly && 0 == atomic_load(&shared->magic))
+    {
+        shared->version    = IPC_STATS_VERSION;
+        shared->maxClients = IPC_STATS_MAX_CLIENTS;
+        atomic_store(&shared->magic, IPC_STATS_MAGIC);
+    }
+
+    if (IPC_STATS_MAGIC != atomic_load(&shared->magic)
+        || IPC_STATS_VERSION != shared->version
+        || IPC_STATS_MAX_CLIENTS != shared->maxClients)
+    {
+        ERROR_LOG("%s is not a stats segment of this version", name);
+        munmap(addr, sizeof(ipc_stats_shared_t));
+        return NULL;
+    }
+
+    ipc_stats_t* stats = (ipc_stats_t*) calloc(1, sizeof(ipc_stats_t));
+
+    if (NULL == stats)
+    {
+        munmap(addr, sizeof(ipc_stats_shared_t));
+        return NULL;
+    }
+
+    stats->shared    = shared;
+    stats->bReadOnly = bReadOnly;
+
+    return stats;
+}
+
+/*******************************************************************************
+ * @brief The mapped segment
+ * @param stats
+ * @return segment
+ */
+ipc_stats_shared_t* ipc_stats_shared(ipc_stats_t* stats)
+{
+    return stats->shared;
+}
+
+/*******************************************************************************
+ * @brief Move the counters of a slot to the retired totals
+ * @param stats
+ * @param client - slot nobody updates any more
+ */
+static void stats_retire(ipc_stats_t* stats, ipc_stats_client_t* client)
+{
+    ipc_stats_client_t* retired = &stats->shared->retired;
+
+    atomic_fetch_add(&retired->records,  atomic_exchange(&client->records, 0));
+    atomic_fetch_add(&retired->messages, atomic_exchange(&client->messages, 0));
+    atomic_fetch_add(&retired->bytes,    atomic_exchange(&client->bytes, 0));
+    atomic_fetch_add(&retired->drops,    atomic_exchange(&client->drops, 0));
+    atomic_fetch_add(&retired->spilled,  atomic_exchange(&client->spilled, 0));
+    atomic_fetch_add(&retired->filtered, atomic_exchange(&client->filtered, 0));
+}
+
+/*******************************************************************************
+ * @brief Take a free slot, or one of a process that is gone
+ * @param stats
+ * @param pid - current process
+ * @return slot, NULL if all of them are taken by live processes
+ */
+static ipc_stats_client_t* stats_claim(ipc_stats_t* stats, pid_t pid)
+{
+    ipc_stats_client_t* clients = stats->shared->clients;
+
+    for (int i = 0; i < IPC_STATS_MAX_CLIENTS; i++)
+    {
+        int32_t expected = 0;
+
+        if (0 == atomic_load_explicit(&clients[i].pid, memory_order_relaxed)
+            && atomic_compare_exchange_strong(&clients[i].pid, &expected, pid))
+        {
+            return &clients[i];
+        }
+    }
+
+    // crashed processes never release their slots
+    for (int i = 0; i < IPC_STATS_MAX_CLIENTS; i++)
+    {
+        int32_t owner = atomic_load(&clients[i].pid);
+
+        if (owner > 0 && -1 == kill(owner, 0) && ESRCH == errno
+            && atomic_compare_exchange_strong(&clients[i].pid, &owner, pid))
+        {
+            stats_retire(stats, &clients[i]);
+            return &clients[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*******************************************************************************
+ * @brief Slot of the given process, claimed on first use
+ * @param stats
+ * @param pid - current process
+ * @return slot, NULL if there is none
+ */
+ipc_stats_client_t* ipc_stats_client(ipc_stats_t* stats, pid_t pid)
+{
+    ipc_stats_client_t* slot = atomic_load_explicit(&stats->slot, memory_order_acquire);
+
+    // a fork() child inherits the handle, but not the slot
+    if (slot && pid == atomic_load_explicit(&slot->pid, memory_order_relaxed))
+    {
+        return slot;
+    }
+
+    if (stats->bReadOnly)
+    {
+        return NULL;
+    }
+
+    // with every slot taken, each append would probe all the owners again
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    unsigned long long failed = atomic_load_explicit(&stats->claimFailed, memory_order_relaxed);
+
+    if ((int32_t)(failed >> 32) == pid && (uint32_t) now.tv_sec < (uint32_t) failed)
+    {
+        return NULL;
+    }
+
+    ipc_stats_client_t* claimed = stats_claim(stats, pid);
+
+    if (NULL == claimed)
+    {
+        atomic_store_explicit(&stats->claimFailed,
+                              (unsigned long long)(uint32_t) pid << 32 | (uint32_t)(now.tv_sec + CLAIM_RETRY_S),
+                              memory_order_relaxed);
+    }
+
+    if (NULL == claimed || atomic_compare_exchange_strong(&stats->slot, &slot, claimed))
+    {
+        return claimed;
+    }
+
+    // another thread was faster
+    atomic_store(&claimed->pid, 0);
+
+    return slot;
+}
+
+/*******************************************************************************
+ * @brief Raise a high-water mark
+ * @param mark
+ * @param value
+ */
+void ipc_stats_max(atomic_ullong* mark, uint64_t value)
+{
+    unsigned long long current = atomic_load_explicit(mark, memory_order_relaxed);
+
+    while (value > current
+           && !atomic_compare_exchange_weak_explicit(mark, &current, value,
+                                                     memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+/*******************************************************************************
+ * @brief Release the slot of this process and unmap the segment
+ * @param stats
+ */
+void ipc_stats_close(ipc_stats_t* stats)
+{
+    if (NULL == stats)
+    {
+        return;
+    }
+
+    ipc_stats_client_t* slot = atomic_load(&stats->slot);
+
+    if (slot && getpid() == atomic_load(&slot->pid))
+    {
+        stats_retire(stats, slot);
+        atomic_store(&slot->pid, 0);
+    }
+
+    munmap(stats->shared, sizeof(ipc_stats_shared_t));
+    free(stats);
+}
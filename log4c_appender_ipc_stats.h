@@ -0,0 +1,158 @@
+#ifndef LOG4C_APPENDER_IPC_STATS_H
+#define LOG4C_APPENDER_IPC_STATS_H
+
+
+/**
+ * @file log4c_appender_ipc_stats.h
+ *
+ * @brief Live statistics of the IPC appender.
+ *
+ * Every appender instance maps a small POSIX shared memory object (the stats
+ * segment). Each client process claims a slot of its own and counts what it
+ * enqueues and drops; the master counts what its pump writes and how long it
+ * takes. All counters are monotonic, so readers compute rates from the
+ * difference of two samples and nobody ever resets anything.
+ *
+ * Updating a counter is a relaxed atomic add on a cache line owned by the
+ * process, i.e. no system call and no lock. Slots of exited processes are
+ * folded into the "retired" totals when they are released or reclaimed.
+ *
+ * The segment is never removed, like the control block of the lease; the
+ * ipc_stat tool reads it while the appender runs.
+ *
+*/
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#define IPC_STATS_MAX_CLIENTS   256
+#define IPC_STATS_BUCKETS       32      // power-of-two histogram buckets
+#define IPC_STATS_MAX_SINKS     8       // secondary outputs of the master
+#define IPC_STATS_SINK_NAME     56
+
+#define IPC_STATS_CACHELINE     64
+
+/**
+ * Histogram bucket of a value: 0 for 0, i for [2^(i-1), 2^i), capped.
+ */
+static inline int ipc_stats_bucket(uint64_t value)
+{
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+    return bucket < IPC_STATS_BUCKETS ? bucket : IPC_STATS_BUCKETS - 1;
+}
+
+// counters of one client process
+struct __ipc_stats_client
+{
+    _Alignas(IPC_STATS_CACHELINE) _Atomic int32_t pid;     // 0 if the slot is free
+    atomic_ullong records;          // log records enqueued
+    atomic_ullong messages;         // transport messages (records may be coalesced)
+    atomic_ullong bytes;
+    atomic_ullong drops;            // records lost to the overflow policy
+    atomic_ullong spilled;          // transport messages written to the spill journal
+    atomic_ullong filtered;         // records held back by the filter of the process
+};
+
+typedef struct __ipc_stats_client ipc_stats_client_t;
+
+// counters of the master instance, kept across master changes
+struct __ipc_stats_master
+{
+    _Alignas(IPC_STATS_CACHELINE) _Atomic int32_t pid;     // current master, 0 if none
+    atomic_ullong lines;            // lines written to the file
+    atomic_ullong bytes;
+    atomic_ullong writes;           // writev() calls
+    atomic_ullong batches;
+    atomic_ullong dropsReported;    // drops the clients told the master about
+    atomic_ullong spillMerged;      // messages merged back from spill journals
+    atomic_ullong repeated;         // duplicates held back by the filter of the master
+    atomic_ullong limited;          // records of sources over the rate limit held back
+    atomic_ullong queueDepth;       // messages in the queue at the last batch
+    atomic_ullong queueDepthMax;
+    atomic_ullong ringUsed;         // bytes in the ring at the last batch
+    atomic_ullong ringUsedMax;
+    atomic_ullong batchHist[IPC_STATS_BUCKETS];     // messages per batch
+    atomic_ullong writeHist[IPC_STATS_BUCKETS];     // writev() latency, us
+    atomic_ullong fsyncHist[IPC_STATS_BUCKETS];     // fsync() latency, us
+};
+
+typedef struct __ipc_stats_master ipc_stats_master_t;
+
+// counters of a secondary output of the master, kept across master changes
+struct __ipc_stats_sink
+{
+    _Alignas(IPC_STATS_CACHELINE) char name[IPC_STATS_SINK_NAME];  // "" if unused
+    atomic_ullong lines;            // written by the sink
+    atomic_ullong bytes;
+    atomic_ullong drops;            // lines lost because its buffer was full
+    atomic_ullong errors;           // failed writes
+    atomic_ullong queued;           // bytes waiting in its buffer at the last batch
+    atomic_ullong queuedMax;
+    atomic_ullong lagMs;            // time the last lines written had waited
+    atomic_ullong lagMsMax;
+};
+
+typedef struct __ipc_stats_sink ipc_stats_sink_t;
+
+// layout of the shared memory object
+struct __ipc_stats_shared
+{
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint32_t maxClients;
+    ipc_stats_master_t master;
+    ipc_stats_sink_t sinks[IPC_STATS_MAX_SINKS];
+    ipc_stats_client_t retired;     // sum of the released slots, pid unused
+    ipc_stats_client_t clients[IPC_STATS_MAX_CLIENTS];
+};
+
+typedef struct __ipc_stats_shared ipc_stats_shared_t;
+
+typedef struct __ipc_stats ipc_stats_t;
+
+/**
+ * Open (or create) the stats segment.
+ *
+ * @param name - name of the shared memory object, e.g. "/test_stats"
+ * @param bReadOnly - 1 to map an existing segment for reading only
+ * @return handle, NULL on failure
+ */
+ipc_stats_t* ipc_stats_open(const char* name, int bReadOnly);
+
+/**
+ * The mapped segment.
+ */
+ipc_stats_shared_t* ipc_stats_shared(ipc_stats_t* stats);
+
+/**
+ * Slot of the given process, claimed on first use (also after fork()).
+ * When there is none, the process looks for one again a second later at the
+ * earliest.
+ *
+ * @param pid - current process
+ * @return slot, NULL if all of them are taken by live processes
+ */
+ipc_stats_client_t* ipc_stats_client(ipc_stats_t* stats, pid_t pid);
+
+/**
+ * Add a sample to a histogram.
+ */
+static inline void ipc_stats_sample(atomic_ullong* hist, uint64_t value)
+{
+    atomic_fetch_add_explicit(&hist[ipc_stats_bucket(value)], 1, memory_order_relaxed);
+}
+
+/**
+ * Raise a high-water mark.
+ */
+void ipc_stats_max(atomic_ullong* mark, uint64_t value);
+
+/**
+ * Release the slot of this process and unmap the segment.
+ */
+void ipc_stats_close(ipc_stats_t* stats);
+
+
+#endif // LOG4C_APPENDER_IPC_STATS_H
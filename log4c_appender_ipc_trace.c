@@ -0,0 +1,340 @@
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+#define TRACE_TEXT_SIZE     104         // keeps an entry at 128 bytes
+#define TRACE_ERROR_SIZE    1024
+
+static const char LEVEL_NAMES[] = "-EID";
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __ipc_trace_entry
+{
+    uint64_t timeUs;            // CLOCK_REALTIME
+    const char* func;
+    uint16_t line;
+    uint8_t level;
+    uint8_t len;
+    char text[TRACE_TEXT_SIZE];
+};
+
+typedef struct __ipc_trace_entry ipc_trace_entry_t;
+
+// entries of one thread; never freed, reused once the thread is gone
+struct __ipc_trace_ring
+{
+    struct __ipc_trace_ring* _Atomic next;
+    atomic_int bFree;
+    int tid;
+    _Atomic uint64_t count;     // entries ever written
+    ipc_trace_entry_t entries[IPC_TRACE_ENTRIES];
+};
+
+typedef struct __ipc_trace_ring ipc_trace_ring_t;
+
+static ipc_trace_ring_t* _Atomic traceRings = NULL;
+static pthread_key_t traceKey;
+static pthread_once_t traceOnce = PTHREAD_ONCE_INIT;
+static __thread ipc_trace_ring_t* threadRing = NULL;
+
+/*******************************************************************************
+ * @brief Hand the ring of an exiting thread over to the next new thread
+ * @param param - ring
+ */
+static void trace_release(void* param)
+{
+    ipc_trace_ring_t* ring = (ipc_trace_ring_t*) param;
+
+    atomic_store(&ring->bFree, 1);
+}
+
+static void trace_init()
+{
+    pthread_key_create(&traceKey, trace_release);
+}
+
+/*******************************************************************************
+ * @brief Ring of the calling thread, allocated on first use
+ * @return ring, NULL if out of memory
+ */
+static ipc_trace_ring_t* trace_ring()
+{
+    if (threadRing)
+    {
+        return threadRing;
+    }
+
+    pthread_once(&traceOnce, trace_init);
+
+    ipc_trace_ring_t* ring;
+
+    // the entries of a dead thread are still worth dumping until reused
+    for (ring = atomic_load(&traceRings); ring; ring = atomic_load(&ring->next))
+    {
+        int bFree = 1;
+
+        if (atomic_compare_exchange_strong(&ring->bFree, &bFree, 0))
+        {
+            break;
+        }
+    }
+
+    if (NULL == ring)
+    {
+        if (NULL == (ring = (ipc_trace_ring_t*) calloc(1, sizeof(ipc_trace_ring_t))))
+        {
+            return NULL;
+        }
+
+        ipc_trace_ring_t* head = atomic_load(&traceRings);
+
+        do
+        {
+            atomic_store(&ring->next, head);
+        }
+        while (!atomic_compare_exchange_weak(&traceRings, &head, ring));
+    }
+
+    ring->tid = syscall(SYS_gettid);
+    pthread_setspecific(traceKey, ring);
+    threadRing = ring;
+
+    return ring;
+}
+
+/*******************************************************************************
+ * @brief Record a trace entry
+ * @param level - IPC_TRACE_*
+ * @param func - function name
+ * @param line - source line
+ * @param format - printf-style format
+ */
+void ipc_trace_record(int level, const char* func, int line, const char* format, ...)
+{
+    char text[TRACE_ERROR_SIZE];
+    va_list ap;
+
+    va_start(ap, format);
+    int len = vsnprintf(text, sizeof(text), format, ap);
+    va_end(ap);
+
+    if (len < 0)
+    {
+        return;
+    }
+
+    if ((size_t)len >= sizeof(text))
+    {
+        len = sizeof(text) - 1;
+    }
+
+    // the messages of this module end with a newline, the dump adds its own
+    while (len > 0 && '\n' == text[len - 1])
+    {
+        text[--len] = '\0';
+    }
+
+    if (level <= IPC_TRACE_ERROR)
+    {
+        fprintf(stderr, "[%d] %s (%d): %s\n", getpid(), func, line, text);
+    }
+
+    ipc_trace_ring_t* ring = (IPC_TRACE_NONE == level) ? NULL : trace_ring();
+
+    if (NULL == ring)
+    {
+        return;
+    }
+
+    uint64_t count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+    ipc_trace_entry_t* entry = &ring->entries[count % IPC_TRACE_ENTRIES];
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    entry->timeUs = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    entry->func   = func;
+    entry->line   = line;
+    entry->level  = level;
+    entry->len    = len < TRACE_TEXT_SIZE ? len : TRACE_TEXT_SIZE - 1;
+
+    memcpy(entry->text, text, entry->len);
+    entry->text[entry->len] = '\0';
+
+    atomic_store_explicit(&ring->count, count + 1, memory_order_release);
+}
+
+/*******************************************************************************
+ * @brief Append a number to a buffer, zero-padded to the given width
+ * @return position after the number
+ */
+static char* put_number(char* pos, uint64_t value, int width)
+{
+    char digits[24];
+    int n = 0;
+
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    }
+    while (value > 0);
+
+    while (n < width)
+    {
+        digits[n++] = '0';
+    }
+
+    while (n > 0)
+    {
+        *pos++ = digits[--n];
+    }
+
+    return pos;
+}
+
+static char* put_string(char* pos, const char* end, const char* str, size_t len)
+{
+    size_t room = end - pos;
+
+    if (len > room)
+    {
+        len = room;
+    }
+
+    memcpy(pos, str, len);
+
+    return pos + len;
+}
+
+/*******************************************************************************
+ * @brief Write the trace of all threads to a descriptor
+ *
+ * Only write() and hand-made formatting, so a signal handler may call it.
+ * Entries being written concurrently may come out garbled.
+ *
+ * @param fd - destination
+ */
+void ipc_trace_dump(int fd)
+{
+    char line[TRACE_TEXT_SIZE + 256];
+    const char* end = line + sizeof(line);
+    char* pos = line;
+
+    pos = put_string(pos, end, "=== appender_ipc trace of process ", 34);
+    pos = put_number(pos, getpid(), 0);
+    pos = put_string(pos, end, " ===\n", 5);
+
+    if (write(fd, line, pos - line) < 0)
+    {
+        return;
+    }
+
+    for (ipc_trace_ring_t* ring = atomic_load(&traceRings); ring; ring = atomic_load(&ring->next))
+    {
+        uint64_t count = atomic_load_explicit(&ring->count, memory_order_acquire);
+        uint64_t first = count > IPC_TRACE_ENTRIES ? count - IPC_TRACE_ENTRIES : 0;
+
+        pos = line;
+        pos = put_string(pos, end, "--- thread ", 11);
+        pos = put_number(pos, ring->tid, 0);
+        pos = put_string(pos, end, atomic_load(&ring->bFree) ? " (exited) ---\n" : " ---\n",
+                         atomic_load(&ring->bFree) ? 14 : 5);
+
+        if (write(fd, line, pos - line) < 0)
+        {
+            return;
+        }
+
+        for (uint64_t i = first; i < count; i++)
+        {
+            const ipc_trace_entry_t* entry = &ring->entries[i % IPC_TRACE_ENTRIES];
+            uint64_t seconds = entry->timeUs / 1000000 % 86400;
+
+            // HH:MM:SS.uuuuuu (UTC) L func(line): text
+            pos = line;
+            pos = put_number(pos, seconds / 3600, 2);
+            *pos++ = ':';
+            pos = put_number(pos, seconds / 60 % 60, 2);
+            *pos++ = ':';
+            pos = put_number(pos, seconds % 60, 2);
+            *pos++ = '.';
+            pos = put_number(pos, entry->timeUs % 1000000, 6);
+            *pos++ = ' ';
+            *pos++ = LEVEL_NAMES[entry->level & 3];
+            *pos++ = ' ';
+
+            if (entry->func)
+            {
+                pos = put_string(pos, end - TRACE_TEXT_SIZE - 32, entry->func, strlen(entry->func));
+            }
+
+            *pos++ = '(';
+            pos = put_number(pos, entry->line, 0);
+            pos = put_string(pos, end, "): ", 3);
+            pos = put_string(pos, end - 1, entry->text, entry->len < TRACE_TEXT_SIZE ? entry->len : 0);
+            *pos++ = '\n';
+
+            if (write(fd, line, pos - line) < 0)
+            {
+                return;
+            }
+        }
+    }
+}
+
+static void trace_on_signal(int signum)
+{
+    int savedErrno = errno;
+
+    ipc_trace_dump(STDERR_FILENO);
+
+    errno = savedErrno;
+}
+
+/*******************************************************************************
+ * @brief Dump the trace when the process receives the signal
+ * @param signum
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_trace_dump_on_signal(int signum)
+{
+    struct sigaction current;
+
+    if (-1 == sigaction(signum, NULL, &current))
+    {
+        return -1;
+    }
+
+    if (trace_on_signal == current.sa_handler)
+    {
+        return 0;
+    }
+
+    if (SIG_DFL != current.sa_handler && SIG_IGN != current.sa_handler)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = trace_on_signal;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    return sigaction(signum, &action, NULL);
+}
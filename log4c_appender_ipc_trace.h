@@ -0,0 +1,79 @@
+#ifndef LOG4C_APPENDER_IPC_TRACE_H
+#define LOG4C_APPENDER_IPC_TRACE_H
+
+
+/**
+ * @file log4c_appender_ipc_trace.h
+ *
+ * @brief Diagnostics of the IPC appender.
+ *
+ * Trace points have a level fixed at compile time: points above
+ * IPC_TRACE_LEVEL compile to nothing, arguments included. Enabled points
+ * are formatted into a small ring owned by the calling thread, so tracing
+ * takes no lock and no system call; the rings of all threads are dumped on
+ * demand, e.g. from a signal handler (see the "trace_signal" option).
+ *
+ * Errors are rare and always worth seeing, so they also go to stderr.
+ *
+ * Build with -DIPC_TRACE_LEVEL=3 to trace every message on the hot path,
+ * or with -DIPC_TRACE_LEVEL=0 to compile out everything but stderr errors.
+ *
+*/
+
+#include <stdarg.h>
+
+#define IPC_TRACE_NONE      0
+#define IPC_TRACE_ERROR     1
+#define IPC_TRACE_INFO      2       // setup, teardown, failover
+#define IPC_TRACE_DEBUG     3       // every message, i.e. the hot path
+
+#ifndef IPC_TRACE_LEVEL
+#define IPC_TRACE_LEVEL     IPC_TRACE_INFO
+#endif
+
+// entries kept per thread, the oldest ones are overwritten
+#ifndef IPC_TRACE_ENTRIES
+#define IPC_TRACE_ENTRIES   256
+#endif
+
+/**
+ * Record a trace entry; use the macros below instead.
+ */
+void ipc_trace_record(int level, const char* func, int line, const char* format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/**
+ * Write the trace of all threads to a descriptor, oldest entries first.
+ * Async-signal-safe.
+ */
+void ipc_trace_dump(int fd);
+
+/**
+ * Dump the trace when the process receives the signal. Leaves a handler
+ * installed by the application alone.
+ *
+ * @return 0 upon success, -1 otherwise
+ */
+int ipc_trace_dump_on_signal(int signum);
+
+// errors reach stderr even when tracing is compiled out
+#if IPC_TRACE_LEVEL >= IPC_TRACE_ERROR
+#define IPC_TRACE_ERROR_LOG(FMT, ...)   ipc_trace_record(IPC_TRACE_ERROR, __PRETTY_FUNCTION__, __LINE__, FMT, ##__VA_ARGS__)
+#else
+#define IPC_TRACE_ERROR_LOG(FMT, ...)   ipc_trace_record(IPC_TRACE_NONE, __PRETTY_FUNCTION__, __LINE__, FMT, ##__VA_ARGS__)
+#endif
+
+#if IPC_TRACE_LEVEL >= IPC_TRACE_INFO
+#define IPC_TRACE_INFO_LOG(FMT, ...)    ipc_trace_record(IPC_TRACE_INFO, __PRETTY_FUNCTION__, __LINE__, FMT, ##__VA_ARGS__)
+#else
+#define IPC_TRACE_INFO_LOG(FMT, ...)    do {} while(0)
+#endif
+
+#if IPC_TRACE_LEVEL >= IPC_TRACE_DEBUG
+#define IPC_TRACE_DEBUG_LOG(FMT, ...)   ipc_trace_record(IPC_TRACE_DEBUG, __PRETTY_FUNCTION__, __LINE__, FMT, ##__VA_ARGS__)
+#else
+#define IPC_TRACE_DEBUG_LOG(FMT, ...)   do {} while(0)
+#endif
+
+
+#endif // LOG4C_APPENDER_IPC_TRACE_H
@@ -0,0 +1,671 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "log4c_appender_ipc_writer.h"
+#include "log4c_appender_ipc_trace.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+enum __ipc_writer_state
+{
+    WRITER_FREE = 0,
+    WRITER_FILLING,
+    WRITER_BUSY,        // being written
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __ipc_writer_buffer
+{
+    int state;
+    size_t used;
+    size_t done;            // written so far
+    uint64_t offset;        // in the file
+    struct iovec iov;       // what is left to write, for IORING_OP_WRITEV
+    char* data;
+};
+
+typedef struct __ipc_writer_buffer ipc_writer_buffer_t;
+
+// io_uring rings mapped from the kernel
+struct __ipc_writer_uring
+{
+    int fd;
+    void* sqRing;
+    void* cqRing;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    _Atomic unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    _Atomic unsigned* cqHead;
+    _Atomic unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+};
+
+typedef struct __ipc_writer_uring ipc_writer_uring_t;
+
+struct __ipc_writer
+{
+    int fd;
+    uint64_t offset;            // end of the data handed out so far
+    size_t bufferSize;
+    int numBuffers;
+    int current;                // buffer being filled, in turn
+    atomic_int error;           // errno of a failed write, reported once
+    ipc_writer_buffer_t* buffers;
+    ipc_writer_uring_t* uring;  // NULL => the thread writes
+    pthread_t thread;
+    pthread_mutex_t lock;       // buffer states, in thread mode
+    pthread_cond_t cond;
+    int next;                   // next buffer the thread writes
+    int bStop;
+};
+
+/*******************************************************************************
+ * @brief io_uring wrappers; no liburing, the system calls are enough
+ */
+static int uring_setup(unsigned entries, struct io_uring_params* params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static void uring_close(ipc_writer_uring_t* uring)
+{
+    if (uring->sqes)
+    {
+        munmap(uring->sqes, uring->sqesSize);
+    }
+
+    if (uring->cqRing && uring->cqRing != uring->sqRing)
+    {
+        munmap(uring->cqRing, uring->cqRingSize);
+    }
+
+    if (uring->sqRing)
+    {
+        munmap(uring->sqRing, uring->sqRingSize);
+    }
+
+    close(uring->fd);
+    free(uring);
+}
+
+/*******************************************************************************
+ * @brief Set up an io_uring with a slot per buffer
+ * @param entries - max writes in flight
+ * @return rings, NULL if io_uring isn't available
+ */
+static ipc_writer_uring_t* uring_open(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = uring_setup(entries, &params);
+
+    if (-1 == fd)
+    {
+        return NULL;
+    }
+
+    ipc_writer_uring_t* uring = (ipc_writer_uring_t*) calloc(1, sizeof(ipc_writer_uring_t));
+
+    if (NULL == uring)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    uring->fd         = fd;
+    uring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    uring->sqesSize   = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // both rings in one mapping since 5.4
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (uring->cqRingSize > uring->sqRingSize)
+        {
+            uring->sqRingSize = uring->cqRingSize;
+        }
+
+        uring->cqRingSize = uring->sqRingSize;
+    }
+
+    uring->sqRing = mmap(NULL, uring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_SQ_RING);
+
+    if (MAP_FAILED == uring->sqRing)
+    {
+        uring->sqRing = NULL;
+        uring_close(uring);
+        return NULL;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        uring->cqRing = uring->sqRing;
+    }
+    else if (MAP_FAILED == (uring->cqRing = mmap(NULL, uring->cqRingSize, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING)))
+    {
+        uring->cqRing = NULL;
+        uring_close(uring);
+        return NULL;
+    }
+
+    uring->sqes = (struct io_uring_sqe*) mmap(NULL, uring->sqesSize, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (MAP_FAILED == uring->sqes)
+    {
+        uring->sqes = NULL;
+        uring_close(uring);
+        return NULL;
+    }
+
+    char* sq = (char*) uring->sqRing;
+    char* cq = (char*) uring->cqRing;
+
+    uring->sqTail  = (_Atomic unsigned*)(sq + params.sq_off.tail);
+    uring->sqMask  = (unsigned*)(sq + params.sq_off.ring_mask);
+    uring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    uring->cqHead  = (_Atomic unsigned*)(cq + params.cq_off.head);
+    uring->cqTail  = (_Atomic unsigned*)(cq + params.cq_off.tail);
+    uring->cqMask  = (unsigned*)(cq + params.cq_off.ring_mask);
+    uring->cqes    = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return uring;
+}
+
+/*******************************************************************************
+ * @brief Queue the rest of a buffer for writing
+ *
+ * On failure the entry is taken back, so it can't go out with a later
+ * submission once the buffer is reused.
+ *
+ * @param writer
+ * @param index - buffer
+ * @return 0 upon success, -1 otherwise
+ */
+static int uring_submit(ipc_writer_t* writer, int index)
+{
+    ipc_writer_uring_t* uring = writer->uring;
+    ipc_writer_buffer_t* buffer = &writer->buffers[index];
+
+    buffer->iov.iov_base = buffer->data + buffer->done;
+    buffer->iov.iov_len  = buffer->used - buffer->done;
+
+    // the pump is the only submitter and there is a slot per buffer
+    unsigned tail = atomic_load_explicit(uring->sqTail, memory_order_relaxed);
+    unsigned slot = tail & *uring->sqMask;
+    struct io_uring_sqe* sqe = &uring->sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_WRITEV;
+    sqe->fd        = writer->fd;
+    sqe->addr      = (uint64_t)(uintptr_t) &buffer->iov;
+    sqe->len       = 1;
+    sqe->off       = buffer->offset + buffer->done;
+    sqe->user_data = index;
+
+    uring->sqArray[slot] = slot;
+    atomic_store_explicit(uring->sqTail, tail + 1, memory_order_release);
+
+    while (-1 == uring_enter(uring->fd, 1, 0, 0))
+    {
+        if (EINTR != errno && EAGAIN != errno && EBUSY != errno)
+        {
+            int error = errno;
+
+            // without SQPOLL, the kernel only consumes entries in io_uring_enter(),
+            // and a failing one consumed none
+            atomic_store_explicit(uring->sqTail, tail, memory_order_release);
+
+            IPC_TRACE_ERROR_LOG("io_uring_enter() failed: %s\n", strerror(error));
+            errno = error;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Handle the completed writes, resubmitting short ones
+ * @param writer
+ * @param bWait - 1 to wait for at least one completion
+ */
+static void uring_reap(ipc_writer_t* writer, int bWait)
+{
+    ipc_writer_uring_t* uring = writer->uring;
+
+    if (bWait && -1 == uring_enter(uring->fd, 0, 1, IORING_ENTER_GETEVENTS) && EINTR != errno)
+    {
+        IPC_TRACE_ERROR_LOG("io_uring_enter() failed: %s\n", strerror(errno));
+    }
+
+    unsigned head = atomic_load_explicit(uring->cqHead, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(uring->cqTail, memory_order_acquire);
+
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe* cqe = &uring->cqes[head & *uring->cqMask];
+        ipc_writer_buffer_t* buffer = &writer->buffers[cqe->user_data];
+        int res = cqe->res;
+
+        if (res > 0)
+        {
+            buffer->done += res;
+        }
+        else if (-EINTR != res && -EAGAIN != res)
+        {
+            // nothing to do about it but to drop the buffer and tell the pump
+            IPC_TRACE_ERROR_LOG("write failed: %s\n", strerror(res ? -res : EIO));
+            writer->error = res ? -res : EIO;
+            buffer->done  = buffer->used;
+        }
+
+        if (buffer->done < buffer->used)
+        {
+            if (-1 != uring_submit(writer, cqe->user_data))
+            {
+                continue;
+            }
+
+            // the rest of the buffer is lost, the pump has to know
+            writer->error = errno;
+        }
+
+        buffer->state = WRITER_FREE;
+    }
+
+    atomic_store_explicit(uring->cqHead, head, memory_order_release);
+}
+
+/*******************************************************************************
+ * @brief Write the buffers in turn, in thread mode
+ * @param param - writer
+ * @return 0
+ */
+static void* writer_run(void* param)
+{
+    ipc_writer_t* writer = (ipc_writer_t*) param;
+
+    pthread_mutex_lock(&writer->lock);
+
+    for (;;)
+    {
+        ipc_writer_buffer_t* buffer = &writer->buffers[writer->next];
+
+        if (WRITER_BUSY != buffer->state)
+        {
+            if (writer->bStop)
+            {
+                break;
+            }
+
+            pthread_cond_wait(&writer->cond, &writer->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&writer->lock);
+
+        while (buffer->done < buffer->used)
+        {
+            ssize_t written = pwrite(writer->fd, buffer->data + buffer->done, buffer->used - buffer->done,
+                                     buffer->offset + buffer->done);
+
+            if (written > 0)
+            {
+                buffer->done += written;
+            }
+            else if (EINTR != errno)
+            {
+                IPC_TRACE_ERROR_LOG("pwrite() failed: %s\n", strerror(errno));
+                writer->error = errno;
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&writer->lock);
+
+        buffer->state = WRITER_FREE;
+        writer->next  = (writer->next + 1) % writer->numBuffers;
+        pthread_cond_broadcast(&writer->cond);
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+
+    return (void*)0;
+}
+
+/*******************************************************************************
+ * @brief Wait until a buffer is written
+ * @param writer
+ * @param index - buffer
+ */
+static void writer_wait_free(ipc_writer_t* writer, int index)
+{
+    ipc_writer_buffer_t* buffer = &writer->buffers[index];
+
+    if (writer->uring)
+    {
+        while (WRITER_BUSY == buffer->state)
+        {
+            uring_reap(writer, 1);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+
+    while (WRITER_BUSY == buffer->state)
+    {
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+}
+
+/*******************************************************************************
+ * @brief Send the current buffer on its way and move on to the next one
+ * @param writer
+ */
+static void writer_submit(ipc_writer_t* writer)
+{
+    ipc_writer_buffer_t* buffer = &writer->buffers[writer->current];
+
+    buffer->offset  = writer->offset;
+    buffer->done    = 0;
+    writer->offset += buffer->used;
+
+    if (writer->uring)
+    {
+        buffer->state = WRITER_BUSY;
+
+        if (-1 == uring_submit(writer, writer->current))
+        {
+            writer->error = errno;
+            buffer->state = WRITER_FREE;
+        }
+    }
+    else
+    {
+        pthread_mutex_lock(&writer->lock);
+        buffer->state = WRITER_BUSY;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->lock);
+    }
+
+    writer->current = (writer->current + 1) % writer->numBuffers;
+
+    writer_wait_free(writer, writer->current);
+
+    writer->buffers[writer->current].state = WRITER_FILLING;
+    writer->buffers[writer->current].used  = 0;
+}
+
+/*******************************************************************************
+ * @brief Report a failed write once
+ * @param writer
+ * @return 0 if there is none, -1 otherwise
+ */
+static int writer_status(ipc_writer_t* writer)
+{
+    int error = atomic_exchange(&writer->error, 0);
+
+    if (0 == error)
+    {
+        return 0;
+    }
+
+    errno = error;
+
+    return -1;
+}
+
+/*******************************************************************************
+ * @brief Open the file for appending and set the writer up
+ * @param path - output file
+ * @param mode
+ * @param bufferSize - bytes per buffer
+ * @param numBuffers - buffers in flight at once
+ * @return handle, NULL on failure
+ */
+ipc_writer_t* ipc_writer_create(const char* path, ipc_writer_mode_t mode, size_t bufferSize, int numBuffers)
+{
+    if (0 == bufferSize || numBuffers < 2)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ipc_writer_t* writer = (ipc_writer_t*) calloc(1, sizeof(ipc_writer_t));
+
+    if (NULL == writer)
+    {
+        return NULL;
+    }
+
+    // not O_APPEND: every buffer goes to the offset it was given
+    writer->fd         = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    writer->bufferSize = bufferSize;
+    writer->numBuffers = numBuffers;
+    writer->buffers    = (ipc_writer_buffer_t*) calloc(numBuffers, sizeof(ipc_writer_buffer_t));
+
+    off_t end = (-1 == writer->fd) ? -1 : lseek(writer->fd, 0, SEEK_END);
+
+    for (int i = 0; writer->buffers && i < numBuffers; i++)
+    {
+        if (NULL == (writer->buffers[i].data = (char*) malloc(bufferSize)))
+        {
+            end = -1;
+        }
+    }
+
+    if (-1 == end || NULL == writer->buffers)
+    {
+        IPC_TRACE_ERROR_LOG("Can't set up the writer of %s: %s\n", path, strerror(errno));
+        ipc_writer_destroy(writer);
+        return NULL;
+    }
+
+    writer->offset = end;
+    writer->buffers[0].state = WRITER_FILLING;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+
+    if (IPC_WRITER_URING == mode && NULL == (writer->uring = uring_open(numBuffers)))
+    {
+        IPC_TRACE_INFO_LOG("io_uring not available (%s), writing from a thread\n", strerror(errno));
+    }
+
+    if (NULL == writer->uring && 0 != pthread_create(&writer->thread, NULL, writer_run, writer))
+    {
+        IPC_TRACE_ERROR_LOG("Error creating thread 'writer_run'\n");
+        ipc_writer_destroy(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+/*******************************************************************************
+ * @brief Wait for all writes and close the file
+ * @param writer
+ */
+void ipc_writer_destroy(ipc_writer_t* writer)
+{
+    if (NULL == writer)
+    {
+        return;
+    }
+
+    if (writer->thread || writer->uring)
+    {
+        ipc_writer_wait(writer);
+    }
+
+    if (writer->thread)
+    {
+        pthread_mutex_lock(&writer->lock);
+        writer->bStop = 1;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->lock);
+
+        pthread_join(writer->thread, NULL);
+    }
+
+    if (writer->uring)
+    {
+        uring_close(writer->uring);
+    }
+
+    for (int i = 0; writer->buffers && i < writer->numBuffers; i++)
+    {
+        free(writer->buffers[i].data);
+    }
+
+    if (-1 != writer->fd)
+    {
+        close(writer->fd);
+    }
+
+    free(writer->buffers);
+    free(writer);
+}
+
+/*******************************************************************************
+ * @brief Copy data for writing
+ * @param writer
+ * @param iov
+ * @param count
+ * @return 0 upon success, -1 if a write has failed since the last call
+ */
+int ipc_writer_writev(ipc_writer_t* writer, const struct iovec* iov, int count)
+{
+    if (writer->uring)
+    {
+        uring_reap(writer, 0);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const char* data = (const char*) iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        while (len > 0)
+        {
+            ipc_writer_buffer_t* buffer = &writer->buffers[writer->current];
+            size_t room = writer->bufferSize - buffer->used;
+            size_t chunk = len < room ? len : room;
+
+            memcpy(buffer->data + buffer->used, data, chunk);
+            buffer->used += chunk;
+            data += chunk;
+            len  -= chunk;
+
+            if (buffer->used == writer->bufferSize)
+            {
+                writer_submit(writer);
+            }
+        }
+    }
+
+    return writer_status(writer);
+}
+
+/*******************************************************************************
+ * @brief Send the partially filled buffer on its way
+ * @param writer
+ * @return 0 upon success, -1 if a write has failed
+ */
+int ipc_writer_flush(ipc_writer_t* writer)
+{
+    if (writer->buffers[writer->current].used > 0)
+    {
+        writer_submit(writer);
+    }
+    else if (writer->uring)
+    {
+        uring_reap(writer, 0);
+    }
+
+    return writer_status(writer);
+}
+
+/*******************************************************************************
+ * @brief Flush and wait until everything is written
+ * @param writer
+ * @return 0 upon success, -1 if a write has failed
+ */
+int ipc_writer_wait(ipc_writer_t* writer)
+{
+    // reports an earlier failure only once
+    int result = ipc_writer_flush(writer);
+    int error = errno;
+
+    for (int i = 0; i < writer->numBuffers; i++)
+    {
+        if (i != writer->current)
+        {
+            writer_wait_free(writer, i);
+        }
+    }
+
+    if (-1 == writer_status(writer))
+    {
+        return -1;
+    }
+
+    errno = error;
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Wait until everything is written, then flush it to the disk
+ * @param writer
+ * @return 0 upon success, -1 if a write or fdatasync() has failed
+ */
+int ipc_writer_sync(ipc_writer_t* writer)
+{
+    int result = ipc_writer_wait(writer);
+
+    if (-1 == fdatasync(writer->fd))
+    {
+        IPC_TRACE_ERROR_LOG("fdatasync() failed: %s\n", strerror(errno));
+        result = -1;
+    }
+
+    return result;
+}
+
+/*******************************************************************************
+ * @brief Whether the writer uses io_uring
+ * @param writer
+ * @return 1 for io_uring, 0 for a thread
+ */
+int ipc_writer_uses_uring(const ipc_writer_t* writer)
+{
+    return NULL != writer->uring;
+}
@@ -0,0 +1,89 @@
+#ifndef LOG4C_APPENDER_IPC_WRITER_H
+#define LOG4C_APPENDER_IPC_WRITER_H
+
+
+/**
+ * @file log4c_appender_ipc_writer.h
+ *
+ * @brief Asynchronous writer of the output file.
+ *
+ * The pump copies its batches into a few large buffers and goes back to
+ * draining the transport while the buffers are written, instead of stalling
+ * in write(2) whenever the disk is slow. It waits only when every buffer is
+ * still being written.
+ *
+ * Buffers are written with io_uring when the kernel allows it, or by a
+ * thread of the writer otherwise. Every buffer is written at its own offset,
+ * so writes may complete in any order; the writer must be the only one
+ * writing the file.
+ *
+ * Only the pump thread uses it, there is no locking on that side.
+ *
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+typedef struct __ipc_writer ipc_writer_t;
+
+enum __ipc_writer_mode
+{
+    IPC_WRITER_URING = 0,       // io_uring, a thread if it isn't available
+    IPC_WRITER_THREAD,          // a thread of its own
+};
+
+typedef enum __ipc_writer_mode ipc_writer_mode_t;
+
+/**
+ * Open the file for appending and set the writer up.
+ *
+ * @param path - output file, created if needed
+ * @param mode
+ * @param bufferSize - bytes per buffer
+ * @param numBuffers - buffers that may be in flight at once
+ * @return handle, NULL on failure
+ */
+ipc_writer_t* ipc_writer_create(const char* path, ipc_writer_mode_t mode, size_t bufferSize, int numBuffers);
+
+/**
+ * Wait for all writes and close the file.
+ */
+void ipc_writer_destroy(ipc_writer_t* writer);
+
+/**
+ * Copy data for writing. Full buffers are sent on their way; the last one
+ * stays until ipc_writer_flush().
+ *
+ * @return 0 upon success, -1 if a write has failed since the last call
+ */
+int ipc_writer_writev(ipc_writer_t* writer, const struct iovec* iov, int count);
+
+/**
+ * Send the partially filled buffer on its way, without waiting for it.
+ *
+ * @return 0 upon success, -1 if a write has failed
+ */
+int ipc_writer_flush(ipc_writer_t* writer);
+
+/**
+ * Flush and wait until everything is written.
+ *
+ * @return 0 upon success, -1 if a write has failed
+ */
+int ipc_writer_wait(ipc_writer_t* writer);
+
+/**
+ * Wait until everything is written, then fdatasync() the file.
+ *
+ * @return 0 upon success, -1 if a write or the sync has failed
+ */
+int ipc_writer_sync(ipc_writer_t* writer);
+
+/**
+ * 1 if the writer uses io_uring, 0 if it uses a thread.
+ */
+int ipc_writer_uses_uring(const ipc_writer_t* writer);
+
+
+#endif // LOG4C_APPENDER_IPC_WRITER_H
@@ -0,0 +1,479 @@
+/**
+ * @file ipc_query.c
+ *
+ * @brief Reads binary log files written with "file_format=binary".
+ *
+ * Prints the records of a time range and a minimum severity as text, one
+ * line per record:
+ *
+ *     2024-05-02 10:15:03.120544 ERROR  4712/4712 app.db - connection lost
+ *
+ * Lines rendered by the clients (record=text) are printed as they are. The
+ * sparse index next to a file ("<file>.idx") is used to skip to the start
+ * of the range; without it, or if it doesn't match the file, the file is
+ * read from the beginning. Rolled files compressed with gzip are read as
+ * well, seeking in them means decompressing up to the offset.
+ *
+ * Usage: ipc_query [-f from] [-t to] [-p priority] [-s slack_s] [-r] <file>...
+ *
+ * Times are local, "YYYY-MM-DD HH:MM[:SS]", or seconds since the epoch
+ * prefixed with '@'. Records of different processes reach the file slightly
+ * out of order, so reading stops only at a record more than slack_s seconds
+ * (default 5) past the end of the range.
+ *
+*/
+
+#define _XOPEN_SOURCE 700   // strptime()
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "log4c_appender_ipc_binlog.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// CONSTANTS
+static const int PRIORITY_UNKNOWN     = 1000;   // LOG4C_PRIORITY_UNKNOWN
+static const double DEFAULT_SLACK_S   = 5.0;
+static const size_t MAX_RECORD        = 1U << 30;
+static const unsigned GZ_BUFFER       = 256 * 1024;
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+struct __query_priority
+{
+    const char* name;
+    int value;
+};
+
+typedef struct __query_priority query_priority_t;
+
+// what to print
+struct __query
+{
+    uint64_t from;          // microseconds since the epoch
+    uint64_t to;
+    uint64_t slack;
+    int maxPriority;        // least severe priority printed
+    int bRaw;               // messages only
+};
+
+typedef struct __query query_t;
+
+// log4c priorities, by value
+static const query_priority_t PRIORITIES[] =
+{
+    { "FATAL",  0   },
+    { "ALERT",  100 },
+    { "CRIT",   200 },
+    { "ERROR",  300 },
+    { "WARN",   400 },
+    { "NOTICE", 500 },
+    { "INFO",   600 },
+    { "DEBUG",  700 },
+    { "TRACE",  800 },
+    { "NOTSET", 900 },
+    { "UNKNOWN", 1000 },
+};
+
+#define NUM_PRIORITIES (sizeof(PRIORITIES) / sizeof(PRIORITIES[0]))
+
+static const char* priority_name(int value)
+{
+    const char* name = "UNKNOWN";
+
+    // values between two names belong to the more severe one
+    for (size_t i = 0; i < NUM_PRIORITIES && PRIORITIES[i].value <= value; i++)
+    {
+        name = PRIORITIES[i].name;
+    }
+
+    return name;
+}
+
+static int parse_priority(const char* text)
+{
+    for (size_t i = 0; i < NUM_PRIORITIES; i++)
+    {
+        if (0 == strcasecmp(text, PRIORITIES[i].name))
+        {
+            return PRIORITIES[i].value;
+        }
+    }
+
+    return -1;
+}
+
+/*******************************************************************************
+ * @brief Parse a local time or "@<seconds since the epoch>"
+ * @param text
+ * @param stamp - [out] microseconds since the epoch
+ * @return 0 upon success, -1 otherwise
+ */
+static int parse_time(const char* text, uint64_t* stamp)
+{
+    if ('@' == text[0])
+    {
+        char* end;
+        double seconds = strtod(text + 1, &end);
+
+        if (end == text + 1 || '\0' != *end || seconds < 0)
+        {
+            return -1;
+        }
+
+        *stamp = (uint64_t)(seconds * 1000000);
+        return 0;
+    }
+
+    static const char* const formats[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d" };
+
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+
+        const char* end = strptime(text, formats[i], &tm);
+
+        if (end && '\0' == *end)
+        {
+            tm.tm_isdst = -1;
+
+            time_t seconds = mktime(&tm);
+
+            if (-1 == seconds)
+            {
+                return -1;
+            }
+
+            *stamp = (uint64_t) seconds * 1000000;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*******************************************************************************
+ * @brief Load the index of a file
+ *
+ * "<file>.idx", or "<stem>.idx" for a compressed "<stem>.gz".
+ *
+ * @param path - the file
+ * @param count - [out] number of entries
+ * @return entries to free(), NULL if there are none
+ */
+static ipc_binlog_entry_t* load_index(const char* path, size_t* count)
+{
+    char indexPath[4096];
+    size_t len = strlen(path);
+
+    *count = 0;
+
+    if (len > 3 && 0 == strcmp(path + len - 3, ".gz"))
+    {
+        len -= 3;
+    }
+
+    if (snprintf(indexPath, sizeof(indexPath), "%.*s%s", (int) len, path, IPC_BINLOG_INDEX_SUFFIX)
+        >= (int) sizeof(indexPath))
+    {
+        return NULL;
+    }
+
+    FILE* fp = fopen(indexPath, "rb");
+
+    if (NULL == fp)
+    {
+        return NULL;
+    }
+
+    ipc_binlog_entry_t* entries = NULL;
+    size_t capacity = 0;
+    ipc_binlog_entry_t entry;
+
+    while (1 == fread(&entry, sizeof(entry), 1, fp))
+    {
+        if (*count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 1024;
+
+            ipc_binlog_entry_t* grown = (ipc_binlog_entry_t*) realloc(entries, capacity * sizeof(entry));
+
+            if (NULL == grown)
+            {
+                break;
+            }
+
+            entries = grown;
+        }
+
+        entries[(*count)++] = entry;
+    }
+
+    fclose(fp);
+
+    return entries;
+}
+
+/*******************************************************************************
+ * @brief Read the header of the next record
+ * @param gz
+ * @param header - [out]
+ * @return 1 if there is a record, 0 at the end of the data, -1 if it's corrupt
+ */
+static int read_header(gzFile gz, ipc_binlog_record_t* header)
+{
+    int len = gzread(gz, header, sizeof(*header));
+
+    // a mapped file may end with zeros after a crash
+    if (0 == len || ((size_t) len >= sizeof(header->len) && 0 == header->len))
+    {
+        return 0;
+    }
+
+    if ((size_t) len != sizeof(*header)
+        || header->len < sizeof(*header) + header->categoryLen + 1
+        || header->len > MAX_RECORD)
+    {
+        return -1;
+    }
+
+    return 1;
+}
+
+/*******************************************************************************
+ * @brief Move to where the records of the range may start
+ *
+ * Falls back to the first record if the index entry doesn't point to one.
+ *
+ * @param gz - right after the magic
+ * @param path
+ * @param from
+ * @param header - [out] header of the record found through the index
+ * @return 1 if the header of a record has been read (going back would mean
+ *         decompressing the file again), 0 if positioned at the first
+ *         record, -1 if the file can't be read
+ */
+static int seek_start(gzFile gz, const char* path, uint64_t from, ipc_binlog_record_t* header)
+{
+    size_t count;
+    ipc_binlog_entry_t* entries = load_index(path, &count);
+    long pos = (entries && from > 0) ? ipc_binlog_index_seek(entries, count, from) : -1;
+
+    if (pos >= 0)
+    {
+        z_off_t offset = (z_off_t) entries[pos].offset;
+
+        if (offset >= IPC_BINLOG_MAGIC_SIZE
+            && offset == gzseek(gz, offset, SEEK_SET)
+            && 1 == read_header(gz, header))
+        {
+            free(entries);
+            return 1;
+        }
+
+        fprintf(stderr, "%s: index doesn't match the file, reading all of it\n", path);
+    }
+
+    free(entries);
+
+    return IPC_BINLOG_MAGIC_SIZE == gzseek(gz, IPC_BINLOG_MAGIC_SIZE, SEEK_SET) ? 0 : -1;
+}
+
+/*******************************************************************************
+ * @brief Print one record
+ * @param query
+ * @param header
+ * @param body - category and message
+ */
+static void print_record(const query_t* query, const ipc_binlog_record_t* header, const char* body)
+{
+    const char* msg = body + header->categoryLen;
+    int msgLen = header->len - sizeof(*header) - header->categoryLen;
+
+    // rendered by the client already, it has its own decoration
+    if (query->bRaw || 0 == header->categoryLen)
+    {
+        fwrite(msg, 1, msgLen, stdout);
+        return;
+    }
+
+    char stamp[32];
+    time_t seconds = header->timestamp / 1000000;
+    struct tm tm;
+
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime_r(&seconds, &tm));
+
+    printf("%s.%06u %-6s %d/%d %.*s - %.*s", stamp, (unsigned)(header->timestamp % 1000000),
+           priority_name(header->priority), header->pid, header->tid, (int) header->categoryLen, body,
+           msgLen, msg);
+}
+
+/*******************************************************************************
+ * @brief Print the records of one file
+ * @param query
+ * @param path
+ * @return 0 upon success, -1 otherwise
+ */
+static int query_file(const query_t* query, const char* path)
+{
+    // reads uncompressed files as they are
+    gzFile gz = gzopen(path, "rb");
+
+    if (NULL == gz)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    gzbuffer(gz, GZ_BUFFER);
+
+    char magic[IPC_BINLOG_MAGIC_SIZE];
+
+    if (IPC_BINLOG_MAGIC_SIZE != gzread(gz, magic, sizeof(magic))
+        || 0 != memcmp(magic, IPC_BINLOG_MAGIC, IPC_BINLOG_MAGIC_SIZE))
+    {
+        fprintf(stderr, "%s: not a binary log\n", path);
+        gzclose(gz);
+        return -1;
+    }
+
+    ipc_binlog_record_t header;
+    int status = seek_start(gz, path, query->from, &header);
+
+    if (-1 == status)
+    {
+        fprintf(stderr, "%s: can't seek\n", path);
+        gzclose(gz);
+        return -1;
+    }
+
+    char* body = NULL;
+    size_t capacity = 0;
+    int result = 0;
+
+    // the first header may have been read already
+    while (1 == status || 1 == (status = read_header(gz, &header)))
+    {
+        status = 0;
+
+        size_t len = header.len - sizeof(header);
+
+        if (len > capacity)
+        {
+            char* grown = (char*) realloc(body, len);
+
+            if (NULL == grown)
+            {
+                result = -1;
+                break;
+            }
+
+            body = grown;
+            capacity = len;
+        }
+
+        if ((int) len != gzread(gz, body, len))
+        {
+            fprintf(stderr, "%s: truncated record\n", path);
+            result = -1;
+            break;
+        }
+
+        if (header.timestamp > query->to)
+        {
+            if (header.timestamp - query->to > query->slack)
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        if (header.timestamp >= query->from && (int) header.priority <= query->maxPriority)
+        {
+            print_record(query, &header, body);
+        }
+    }
+
+    if (-1 == status)
+    {
+        fprintf(stderr, "%s: corrupt record at %ld\n", path, (long) gztell(gz));
+        result = -1;
+    }
+
+    free(body);
+    gzclose(gz);
+
+    return result;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [-f from] [-t to] [-p priority] [-s slack_s] [-r] <file>...\n"
+                    "  times: \"YYYY-MM-DD HH:MM[:SS]\" (local) or @<seconds since the epoch>\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+    query_t query = { 0, UINT64_MAX, (uint64_t)(DEFAULT_SLACK_S * 1000000), PRIORITY_UNKNOWN, 0 };
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "f:t:p:s:rh")))
+    {
+        switch (opt)
+        {
+        case 'f':
+            if (-1 == parse_time(optarg, &query.from))
+            {
+                fprintf(stderr, "invalid time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            if (-1 == parse_time(optarg, &query.to))
+            {
+                fprintf(stderr, "invalid time: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            if (-1 == (query.maxPriority = parse_priority(optarg)))
+            {
+                fprintf(stderr, "unknown priority: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's': query.slack = (uint64_t)(atof(optarg) * 1000000); break;
+        case 'r': query.bRaw  = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc || query.from > query.to)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int result = 0;
+
+    for (int i = optind; i < argc; i++)
+    {
+        if (-1 == query_file(&query, argv[i]))
+        {
+            result = 1;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,360 @@
+/**
+ * @file ipc_stat.c
+ *
+ * @brief Live view of the statistics published by the IPC appender.
+ *
+ * Maps the stats segment of an appender read-only and prints rates computed
+ * from two consecutive samples, one block per interval:
+ *
+ *     master 4711: 250000 lines/s, 15.2 MB/s, 980 writes/s
+ *       batch:  avg 25.6 lines, p99 <= 64 messages
+ *       write:  p50 <= 8 us, p99 <= 64 us, fsync p99 -
+ *       queue:  3 messages (max 10), ring 12 KB (max 900 KB)
+ *       drops:  0/s reported, spill: 0/s merged
+ *       sink file:/archive/log.txt: 250000 lines/s, 0 drops/s, 0 errors/s, lag 2 ms (max 40), 0 KB queued (max 512 KB)
+ *           pid      rec/s      msg/s       KB/s    drops/s    spill/s
+ *          4712      62000      62000       3900          0          0
+ *
+ * Usage: ipc_stat [-i interval_s] [-n count] <appender name>
+ *
+ * The appender name is the first token of the appender configuration, i.e.
+ * "test" for "test;/tmp;log.txt;basic".
+ *
+*/
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log4c_appender_ipc_stats.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// DATA TYPES
+
+// plain copy of the counters, taken at once
+struct __stat_sample
+{
+    struct timespec at;
+    int32_t masterPid;
+    uint64_t lines;
+    uint64_t bytes;
+    uint64_t writes;
+    uint64_t batches;
+    uint64_t dropsReported;
+    uint64_t spillMerged;
+    uint64_t repeated;
+    uint64_t limited;
+    uint64_t queueDepth;
+    uint64_t queueDepthMax;
+    uint64_t ringUsed;
+    uint64_t ringUsedMax;
+    uint64_t batchHist[IPC_STATS_BUCKETS];
+    uint64_t writeHist[IPC_STATS_BUCKETS];
+    uint64_t fsyncHist[IPC_STATS_BUCKETS];
+    char sinkName[IPC_STATS_MAX_SINKS][IPC_STATS_SINK_NAME];
+    uint64_t sinkLines[IPC_STATS_MAX_SINKS];
+    uint64_t sinkDrops[IPC_STATS_MAX_SINKS];
+    uint64_t sinkErrors[IPC_STATS_MAX_SINKS];
+    uint64_t sinkQueued[IPC_STATS_MAX_SINKS];
+    uint64_t sinkQueuedMax[IPC_STATS_MAX_SINKS];
+    uint64_t sinkLagMs[IPC_STATS_MAX_SINKS];
+    uint64_t sinkLagMsMax[IPC_STATS_MAX_SINKS];
+    int32_t pid[IPC_STATS_MAX_CLIENTS];
+    uint64_t records[IPC_STATS_MAX_CLIENTS];
+    uint64_t messages[IPC_STATS_MAX_CLIENTS];
+    uint64_t clientBytes[IPC_STATS_MAX_CLIENTS];
+    uint64_t drops[IPC_STATS_MAX_CLIENTS];
+    uint64_t spilled[IPC_STATS_MAX_CLIENTS];
+    uint64_t filtered[IPC_STATS_MAX_CLIENTS];
+};
+
+typedef struct __stat_sample stat_sample_t;
+
+static volatile sig_atomic_t bStop = 0;
+
+static void on_signal(int signum)
+{
+    (void) signum;
+    bStop = 1;
+}
+
+static void copy_hist(uint64_t* to, atomic_ullong* from)
+{
+    for (int i = 0; i < IPC_STATS_BUCKETS; i++)
+    {
+        to[i] = atomic_load_explicit(&from[i], memory_order_relaxed);
+    }
+}
+
+/*******************************************************************************
+ * @brief Copy the shared counters
+ * @param shared - stats segment
+ * @param sample - [out]
+ */
+static void take_sample(ipc_stats_shared_t* shared, stat_sample_t* sample)
+{
+    ipc_stats_master_t* master = &shared->master;
+
+    clock_gettime(CLOCK_MONOTONIC, &sample->at);
+
+    sample->masterPid     = atomic_load(&master->pid);
+    sample->lines         = atomic_load(&master->lines);
+    sample->bytes         = atomic_load(&master->bytes);
+    sample->writes        = atomic_load(&master->writes);
+    sample->batches       = atomic_load(&master->batches);
+    sample->dropsReported = atomic_load(&master->dropsReported);
+    sample->spillMerged   = atomic_load(&master->spillMerged);
+    sample->repeated      = atomic_load(&master->repeated);
+    sample->limited       = atomic_load(&master->limited);
+    sample->queueDepth    = atomic_load(&master->queueDepth);
+    sample->queueDepthMax = atomic_load(&master->queueDepthMax);
+    sample->ringUsed      = atomic_load(&master->ringUsed);
+    sample->ringUsedMax   = atomic_load(&master->ringUsedMax);
+
+    copy_hist(sample->batchHist, master->batchHist);
+    copy_hist(sample->writeHist, master->writeHist);
+    copy_hist(sample->fsyncHist, master->fsyncHist);
+
+    for (int i = 0; i < IPC_STATS_MAX_SINKS; i++)
+    {
+        ipc_stats_sink_t* sink = &shared->sinks[i];
+
+        // set by a master while it starts, may be torn meanwhile
+        memcpy(sample->sinkName[i], sink->name, IPC_STATS_SINK_NAME);
+        sample->sinkName[i][IPC_STATS_SINK_NAME - 1] = '\0';
+
+        sample->sinkLines[i]     = atomic_load(&sink->lines);
+        sample->sinkDrops[i]     = atomic_load(&sink->drops);
+        sample->sinkErrors[i]    = atomic_load(&sink->errors);
+        sample->sinkQueued[i]    = atomic_load(&sink->queued);
+        sample->sinkQueuedMax[i] = atomic_load(&sink->queuedMax);
+        sample->sinkLagMs[i]     = atomic_load(&sink->lagMs);
+        sample->sinkLagMsMax[i]  = atomic_load(&sink->lagMsMax);
+    }
+
+    for (int i = 0; i < IPC_STATS_MAX_CLIENTS; i++)
+    {
+        ipc_stats_client_t* client = &shared->clients[i];
+
+        sample->pid[i]         = atomic_load(&client->pid);
+        sample->records[i]     = atomic_load(&client->records);
+        sample->messages[i]    = atomic_load(&client->messages);
+        sample->clientBytes[i] = atomic_load(&client->bytes);
+        sample->drops[i]       = atomic_load(&client->drops);
+        sample->spilled[i]     = atomic_load(&client->spilled);
+        sample->filtered[i]    = atomic_load(&client->filtered);
+    }
+}
+
+/*******************************************************************************
+ * @brief Percentile of the samples added between two snapshots of a histogram
+ * @param now - current histogram
+ * @param before - previous histogram
+ * @param fraction - e.g. 0.99
+ * @return upper bound of the bucket, 0 if there are no samples
+ */
+static uint64_t hist_percentile(const uint64_t* now, const uint64_t* before, double fraction)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < IPC_STATS_BUCKETS; i++)
+    {
+        total += now[i] - before[i];
+    }
+
+    uint64_t rank = (uint64_t)(fraction * total);
+    uint64_t seen = 0;
+
+    for (int i = 0; total > 0 && i < IPC_STATS_BUCKETS; i++)
+    {
+        seen += now[i] - before[i];
+
+        if (seen > rank)
+        {
+            return 1ULL << i;
+        }
+    }
+
+    return 0;
+}
+
+/*******************************************************************************
+ * @brief Print the rates between two samples
+ * @param now
+ * @param before
+ */
+static void print_rates(const stat_sample_t* now, const stat_sample_t* before)
+{
+    double seconds = (now->at.tv_sec - before->at.tv_sec) + (now->at.tv_nsec - before->at.tv_nsec) / 1e9;
+    uint64_t batches = now->batches - before->batches;
+    uint64_t fsyncP99 = hist_percentile(now->fsyncHist, before->fsyncHist, 0.99);
+
+    if (now->masterPid)
+    {
+        printf("master %d: ", now->masterPid);
+    }
+    else
+    {
+        printf("no master: ");
+    }
+
+    printf("%.0f lines/s, %.1f MB/s, %.0f writes/s\n",
+           (now->lines - before->lines) / seconds,
+           (now->bytes - before->bytes) / seconds / (1 << 20),
+           (now->writes - before->writes) / seconds);
+
+    printf("  batch:  avg %.1f lines, p99 <= %llu messages\n",
+           batches ? (double)(now->lines - before->lines) / batches : 0.0,
+           (unsigned long long) hist_percentile(now->batchHist, before->batchHist, 0.99));
+
+    printf("  write:  p50 <= %llu us, p99 <= %llu us, fsync p99 ",
+           (unsigned long long) hist_percentile(now->writeHist, before->writeHist, 0.50),
+           (unsigned long long) hist_percentile(now->writeHist, before->writeHist, 0.99));
+
+    if (fsyncP99)
+    {
+        printf("<= %llu us\n", (unsigned long long) fsyncP99);
+    }
+    else
+    {
+        printf("-\n");
+    }
+
+    printf("  queue:  %llu messages (max %llu), ring %llu KB (max %llu KB)\n",
+           (unsigned long long) now->queueDepth, (unsigned long long) now->queueDepthMax,
+           (unsigned long long) now->ringUsed >> 10, (unsigned long long) now->ringUsedMax >> 10);
+
+    printf("  drops:  %.0f/s reported, spill: %.0f/s merged\n", (now->dropsReported - before->dropsReported) / seconds,
+           (now->spillMerged - before->spillMerged) / seconds);
+
+    printf("  filter: %.0f/s repeated, %.0f/s over the rate limit\n", (now->repeated - before->repeated) / seconds,
+           (now->limited - before->limited) / seconds);
+
+    for (int i = 0; i < IPC_STATS_MAX_SINKS; i++)
+    {
+        if ('\0' == now->sinkName[i][0])
+        {
+            continue;
+        }
+
+        printf("  sink %s: %.0f lines/s, %.0f drops/s, %.0f errors/s, lag %llu ms (max %llu), "
+               "%llu KB queued (max %llu KB)\n", now->sinkName[i],
+               (now->sinkLines[i] - before->sinkLines[i]) / seconds,
+               (now->sinkDrops[i] - before->sinkDrops[i]) / seconds,
+               (now->sinkErrors[i] - before->sinkErrors[i]) / seconds,
+               (unsigned long long) now->sinkLagMs[i], (unsigned long long) now->sinkLagMsMax[i],
+               (unsigned long long) now->sinkQueued[i] >> 10, (unsigned long long) now->sinkQueuedMax[i] >> 10);
+    }
+
+    printf("  %8s %10s %10s %10s %10s %10s %10s\n", "pid", "rec/s", "msg/s", "KB/s", "drops/s", "spill/s",
+           "filter/s");
+
+    for (int i = 0; i < IPC_STATS_MAX_CLIENTS; i++)
+    {
+        if (0 == now->pid[i])
+        {
+            continue;
+        }
+
+        // a slot taken over by another process starts from zero
+        int bSame = (now->pid[i] == before->pid[i]);
+
+        printf("  %8d %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n", now->pid[i],
+               (now->records[i] - (bSame ? before->records[i] : 0)) / seconds,
+               (now->messages[i] - (bSame ? before->messages[i] : 0)) / seconds,
+               (now->clientBytes[i] - (bSame ? before->clientBytes[i] : 0)) / seconds / 1024,
+               (now->drops[i] - (bSame ? before->drops[i] : 0)) / seconds,
+               (now->spilled[i] - (bSame ? before->spilled[i] : 0)) / seconds,
+               (now->filtered[i] - (bSame ? before->filtered[i] : 0)) / seconds);
+    }
+
+    printf("\n");
+    fflush(stdout);
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [-i interval_s] [-n count] <appender name>\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+    double interval = 1.0;
+    long count = -1;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "i:n:h")))
+    {
+        switch (opt)
+        {
+        case 'i': interval = atof(optarg); break;
+        case 'n': count    = atol(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind + 1 != argc || interval <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char name[256];
+    snprintf(name, sizeof(name), "/%s_stats", argv[optind]);
+
+    ipc_stats_t* stats = ipc_stats_open(name, 1);
+
+    if (NULL == stats)
+    {
+        fprintf(stderr, "no statistics for appender '%s' (%s)\n", argv[optind], name);
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    ipc_stats_shared_t* shared = ipc_stats_shared(stats);
+    stat_sample_t* samples = (stat_sample_t*) calloc(2, sizeof(stat_sample_t));
+    int current = 0;
+
+    take_sample(shared, &samples[current]);
+
+    printf("totals: %llu lines, %llu bytes written, %llu drops reported; retired clients: %llu records, %llu drops\n\n",
+           (unsigned long long) samples[current].lines, (unsigned long long) samples[current].bytes,
+           (unsigned long long) samples[current].dropsReported,
+           (unsigned long long) atomic_load(&shared->retired.records),
+           (unsigned long long) atomic_load(&shared->retired.drops));
+
+    while (!bStop && 0 != count)
+    {
+        usleep((useconds_t)(interval * 1000000));
+
+        if (bStop)
+        {
+            break;
+        }
+
+        int previous = current;
+        current = 1 - current;
+
+        take_sample(shared, &samples[current]);
+        print_rates(&samples[current], &samples[previous]);
+
+        if (count > 0)
+        {
+            count--;
+        }
+    }
+
+    free(samples);
+    ipc_stats_close(stats);
+
+    return 0;
+}